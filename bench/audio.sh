@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+# Audio CPU per channel for each --audio-codec: every codec is recorded from
+# the same source, and the CPU of a --no-audio run is subtracted. Also shows
+# the audioconvert chain each codec negotiated ("passthrough" when NDI's
+# planar float goes straight into the encoder) and its cost per buffer.
+#
+#   bench/audio.sh build/ndi2srt "<ndi-name>" [seconds]
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds]}
+name=${2:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds]}
+seconds=${3:-20}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Prints "<cpu seconds>"; the log goes to $dir/<tag>.log
+run() {
+    local tag=$1; shift
+    /usr/bin/time -f "%U %S" -o "$dir/$tag.time" \
+        "$bin" --ndi-name "$name" --stdout --timeout "$seconds" "$@" >/dev/null 2>"$dir/$tag.log"
+    awk '{ print $1 + $2 }' "$dir/$tag.time"
+}
+
+base=$(run none --no-audio)
+printf "%-10s %8s %4s %18s  %s\n" codec "ms/s/ch" ch "convert us/buffer" chain
+for codec in aac mp3 ac3 smpte302m; do
+    cpu=$(run "$codec" --audio-codec "$codec")
+    # "Audio [0]: F32LE planar 2ch -> audioconvert (passthrough) -> avenc_aac, 4 us/buffer avg, ..."
+    line=$(grep -m1 '^Audio \[0\]:' "$dir/$codec.log" || true)
+    ch=$(sed -nE 's/^Audio \[0\]: [^ ]+ [^ ]+ ([0-9]+)ch .*/\1/p' <<<"$line")
+    us=$(sed -nE 's/.*, ([0-9]+) us\/buffer avg.*/\1/p' <<<"$line")
+    chain=$(sed -nE 's/^Audio \[0\]: (.*), [0-9]+ us\/buffer.*/\1/p' <<<"$line")
+    awk -v c="$codec" -v cpu="$cpu" -v b="$base" -v s="$seconds" -v ch="${ch:-0}" -v us="${us:--}" -v chain="${chain:-no log line}" 'BEGIN {
+        printf "%-10s %8.2f %4d %18s  %s\n", c, ch ? (cpu - b) * 1000 / s / ch : 0, ch, us, chain }'
+done
@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+# Network clock on one host: one instance serves its pipeline clock
+# (--serve-clock, wall-clock time), a second one is slaved to it
+# (--clock net:127.0.0.1:<port>). Both report clock_offset_ns (pipeline
+# clock minus wall clock) in their control "state"; on one host that is the
+# slave's error against the served clock. Reports the time from start until
+# the slave stays within the threshold, and its offset after that.
+#
+#   bench/clock.sh build/ndi2srt "<ndi-name>" [seconds] [port]
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds] [port]}
+name=${2:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds] [port]}
+seconds=${3:-30}
+port=${4:-8554}
+threshold_us=${THRESHOLD_US:-1000}
+dir=$(mktemp -d)
+pids=()
+trap 'kill "${pids[@]}" 2>/dev/null || true; rm -rf "$dir"' EXIT
+
+common=(--ndi-name "$name" --stdout --no-audio --timeout $((seconds + 5)))
+"$bin" "${common[@]}" --serve-clock "$port" --control-socket "$dir/server.sock" \
+    >/dev/null 2>"$dir/server.log" &
+pids+=($!)
+sleep 1
+start_ns=$(date +%s%N)
+"$bin" "${common[@]}" --clock "net:127.0.0.1:$port" --control-socket "$dir/client.sock" \
+    >/dev/null 2>"$dir/client.log" &
+pids+=($!)
+
+# Samples "<ms since the client started> <server offset us> <client offset us> <synced>"
+# every 100 ms, then summarizes
+python3 - "$dir" "$start_ns" "$seconds" "$threshold_us" <<'PY'
+import json, socket, sys, time
+d, start_ns, seconds, threshold = sys.argv[1], int(sys.argv[2]), float(sys.argv[3]), float(sys.argv[4])
+
+def state(path):
+    try:
+        s = socket.socket(socket.AF_UNIX)
+        s.settimeout(1)
+        s.connect(path)
+        s.sendall(b'{"cmd":"state"}\n')
+        buf = b""
+        while not buf.endswith(b"\n"):
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            buf += chunk
+        s.close()
+        return json.loads(buf)["state"]
+    except (OSError, ValueError, KeyError):
+        return None
+
+samples = []
+while time.time_ns() - start_ns < seconds * 1e9:
+    srv, cli = state(d + "/server.sock"), state(d + "/client.sock")
+    if srv and cli and "clock_offset_ns" in cli:
+        t = (time.time_ns() - start_ns) / 1e6
+        samples.append((t, srv["clock_offset_ns"] / 1e3, cli["clock_offset_ns"] / 1e3, cli["clock_synced"]))
+    time.sleep(0.1)
+if not samples:
+    sys.exit("no state from the slaved instance (see its log)")
+
+# Converged: from the first sample after which the slave stays within the threshold
+converged = None
+for i, (t, so, co, synced) in enumerate(samples):
+    if all(abs(c - s) <= threshold for _, s, c, _ in samples[i:]):
+        converged = i
+        break
+synced_at = next((t for t, _, _, s in samples if s), None)
+print("samples          %d over %.1f s" % (len(samples), samples[-1][0] / 1e3))
+print("first response   %.0f ms after start" % samples[0][0])
+print("clock_synced     %s" % ("%.0f ms after start" % synced_at if synced_at is not None else "never"))
+if converged is None:
+    last = samples[-1]
+    sys.exit("not converged: last offset %+.1f us (threshold %.0f us)" % (last[2] - last[1], threshold))
+after = sorted(abs(c - s) for _, s, c, _ in samples[converged:])
+mean = sum(c - s for _, s, c, _ in samples[converged:]) / len(after)
+print("converged        %.0f ms after start (within %.0f us)" % (samples[converged][0], threshold))
+print("offset after     mean %+.1f us  median |%.1f| us  max |%.1f| us" %
+      (mean, after[len(after) // 2], after[-1]))
+PY
@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+# Latency the out-of-process encoder (--encoder-process) adds: encode time
+# per frame, from the --frame-stats records, with x264enc in-process and in
+# a worker. In the worker case encode_us spans the whole handoff (frame to
+# the worker, AU back through the ring). A third run kills the worker half
+# way through and checks that it is restarted, that the stream resumes with
+# an IDR, and how long the gap in the output was.
+#
+#   bench/encproc.sh build/ndi2srt "<ndi-name>" [seconds]
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds]}
+name=${2:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds]}
+seconds=${3:-20}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Runs ndi2srt writing frame stats to $dir/<label>.bin and its log to
+# $dir/<label>.log; with kill=1 the worker is killed after seconds/2
+run() {
+    local label=$1 kill=$2
+    shift 2
+    "$bin" --ndi-name "$name" --stdout --no-audio --gop-size 50 --timeout "$seconds" \
+        --frame-stats "$dir/$label.bin" "$@" >/dev/null 2>"$dir/$label.log" &
+    local pid=$!
+    if [ "$kill" = 1 ]; then
+        sleep $((seconds / 2))
+        pkill -KILL -f -- "--encoder-worker" || echo "no worker to kill" >&2
+    fi
+    wait "$pid" || true
+}
+
+# Prints "<frames> <p50 ms> <p95 ms> <p99 ms> <max pts gap ms> <idr after gap>"
+stats() {
+    python3 - "$1" <<'PY'
+import struct, sys
+d = open(sys.argv[1], "rb").read()[16:]
+recs = [struct.unpack_from("<QIIIIcBBBI", d, o) for o in range(0, len(d) - 31, 32)]
+enc = sorted(r[4] for r in recs if r[4] != 0xffffffff)
+def pct(p):
+    return enc[min(len(enc) - 1, int(len(enc) * p))] / 1000 if enc else 0
+gap, idr = 0, 1
+for a, b in zip(recs, recs[1:]):
+    if a[0] == 2**64 - 1 or b[0] == 2**64 - 1:
+        continue
+    if (b[0] - a[0]) / 1e6 > gap:
+        gap, idr = (b[0] - a[0]) / 1e6, b[6] & 1
+print(len(recs), pct(0.5), pct(0.95), pct(0.99), gap, idr)
+PY
+}
+
+report() {
+    read -r frames p50 p95 p99 gap idr <<<"$2"
+    printf "%-16s %6d frames  encode p50 %6.2f ms  p95 %6.2f ms  p99 %6.2f ms  max gap %7.1f ms\n" \
+        "$1" "$frames" "$p50" "$p95" "$p99" "$gap"
+}
+
+run inproc 0
+run worker 0 --encoder-process
+run restart 1 --encoder-process
+inproc=$(stats "$dir/inproc.bin")
+worker=$(stats "$dir/worker.bin")
+restart=$(stats "$dir/restart.bin")
+report "in-process" "$inproc"
+report "encoder-process" "$worker"
+report "worker killed" "$restart"
+awk -v a="$inproc" -v b="$worker" 'BEGIN {
+    split(a, x); split(b, y)
+    printf "handoff adds    p50 %+.2f ms  p95 %+.2f ms  p99 %+.2f ms\n", y[2] - x[2], y[3] - x[3], y[4] - x[4] }'
+grep -q "restarting, next frame is an IDR" "$dir/restart.log" || { echo "worker was not restarted" >&2; exit 1; }
+[ "$(echo "$restart" | awk '{ print $6 }')" -eq 1 ] || { echo "no IDR after the restart" >&2; exit 1; }
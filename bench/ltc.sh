@@ -0,0 +1,128 @@
+#!/usr/bin/env bash
+# --ltc-channel against synthesized LTC: a WAV with LTC on channel 1 at 24,
+# 25 and 30 fps (each segment starts a new hour, with a second of silence
+# before the last one), plus noise, is published as an NDI source next to a
+# test pattern. ndi2srt decodes it; the control "stats" are polled every
+# 200 ms. Per segment, reports how long the decoder took to lock onto the
+# new hour and the decode rate after that, which should match the segment's
+# frame rate. Needs gst-plugins-rs' ndisink.
+#
+#   bench/ltc.sh build/ndi2srt [seconds per segment]
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> [seconds per segment]}
+segment=${2:-8}
+name="ndi2srt-ltc-bench"
+dir=$(mktemp -d)
+pids=()
+trap 'kill "${pids[@]}" 2>/dev/null || true; rm -rf "$dir"' EXIT
+
+# Segments as "<fps> <seconds of silence before it>"
+segments=("24 0" "25 0" "30 1")
+
+# Biphase-mark LTC, 48 kHz stereo S16LE, slightly rounded edges and noise
+python3 - "$dir/ltc.wav" "$segment" "${segments[@]}" <<'PY'
+import random, struct, sys, wave
+path, seconds = sys.argv[1], int(sys.argv[2])
+rate = 48000
+sync = [0, 0] + [1] * 12 + [0, 1]
+
+def frame_bits(h, m, s, f):
+    b = [0] * 64
+    for v, at, n in ((f % 10, 0, 4), (f // 10, 8, 2), (s % 10, 16, 4), (s // 10, 24, 3),
+                     (m % 10, 32, 4), (m // 10, 40, 3), (h % 10, 48, 4), (h // 10, 56, 2)):
+        for i in range(n):
+            b[at + i] = (v >> i) & 1
+    return b + sync
+
+samples, level, t = [], 1.0, 0.0
+def emit(until, value):
+    while len(samples) < until:
+        samples.append(value)
+
+for hour, seg in enumerate(sys.argv[3:], start=1):
+    fps, silence = map(int, seg.split())
+    emit(len(samples) + silence * rate, 0.0)
+    t = float(len(samples))
+    bit = rate / (fps * 80)
+    for n in range(fps * seconds):
+        for b in frame_bits(hour, 0, n // fps, n % fps):
+            level = -level
+            emit(int(t + bit / 2), level)
+            if b:
+                level = -level
+            t += bit
+            emit(int(t), level)
+
+out = []
+prev = 0.0
+for x in samples:
+    prev = prev * 0.3 + x * 0.7
+    v = 0.5 * prev + random.gauss(0, 0.02)
+    out.append(struct.pack("<hh", int(max(-1, min(1, v)) * 32767), 0))
+w = wave.open(path, "wb")
+w.setnchannels(2)
+w.setsampwidth(2)
+w.setframerate(rate)
+w.writeframes(b"".join(out))
+w.close()
+PY
+
+total=$((${#segments[@]} * segment + 1 + 2))
+gst-launch-1.0 -q ndisinkcombiner name=c ! ndisink ndi-name="$name" \
+    videotestsrc is-live=true ! video/x-raw,format=UYVY,width=640,height=360,framerate=25/1 ! c.video \
+    filesrc location="$dir/ltc.wav" ! wavparse ! identity sync=true ! audioconvert ! \
+    audio/x-raw,format=F32LE,layout=interleaved ! c.audio >/dev/null 2>"$dir/sender.log" &
+pids+=($!)
+sleep 1
+"$bin" --ndi-name "$name" --stdout --no-audio --ltc-channel 1 --timeout "$total" \
+    --control-socket "$dir/ctl.sock" >/dev/null 2>"$dir/ndi2srt.log" &
+pids+=($!)
+
+python3 - "$dir/ctl.sock" "$total" "${segments[@]}" <<'PY'
+import json, socket, sys, time
+path, total, segments = sys.argv[1], float(sys.argv[2]), sys.argv[3:]
+
+def ltc():
+    try:
+        s = socket.socket(socket.AF_UNIX)
+        s.settimeout(1)
+        s.connect(path)
+        s.sendall(b'{"cmd":"stats"}\n')
+        buf = b""
+        while not buf.endswith(b"\n"):
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            buf += chunk
+        s.close()
+        return json.loads(buf)["stats"]["ltc"]
+    except (OSError, ValueError, KeyError):
+        return None
+
+# (seconds, hour, decoded)
+samples = []
+start = time.time()
+while time.time() - start < total:
+    l = ltc()
+    if l and l["last_timecode"][0] != "-":
+        samples.append((time.time() - start, int(l["last_timecode"][:2]), l["decoded"]))
+    time.sleep(0.2)
+
+failed = False
+for hour, seg in enumerate(segments, start=1):
+    fps = int(seg.split()[0])
+    mine = [s for s in samples if s[1] == hour]
+    if len(mine) < 3:
+        print("%2d fps  never locked" % fps)
+        failed = True
+        continue
+    # Time since the last sample of the previous segment (none for the first)
+    previous = [s for s in samples if s[1] < hour]
+    locked = "%5.2f s" % (mine[0][0] - previous[-1][0]) if previous else "      -"
+    rate = (mine[-1][2] - mine[0][2]) / (mine[-1][0] - mine[0][0])
+    ok = abs(rate - fps) < fps * 0.1
+    failed |= not ok
+    print("%2d fps  locked after %s  decoding %5.1f frames/s%s" % (fps, locked, rate, "" if ok else "  WRONG RATE"))
+sys.exit(1 if failed else 0)
+PY
@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# Loopback multicast check: one ndi2srt send, several receivers on the same
+# host. Each receiver joins the group on lo and must see RTP/MP2T packets
+# (and, with FEC, the column/row FEC streams).
+#
+#   bench/multicast.sh build/ndi2srt "<ndi-name>" [receivers] [fec]
+#
+# Needs a multicast route on lo:  ip route add 239.0.0.0/8 dev lo
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> <ndi-name> [receivers] [fec]}
+name=${2:?usage: $0 <ndi2srt-binary> <ndi-name> [receivers] [fec]}
+receivers=${3:-4}
+fec=${4:-0}
+group=239.255.42.1
+port=5004
+uri="rtp://$group:$port?iface=lo&ttl=0&loop=1"
+[ "$fec" = 1 ] && uri="$uri&fec=1&fec-cols=10&fec-rows=10"
+
+"$bin" --ndi-name "$name" --output "$uri" --no-audio --timeout 12 2>/dev/null &
+sender=$!
+trap 'kill $sender 2>/dev/null || true' EXIT
+sleep 2
+
+receive() {
+    # num-buffers makes gst-launch exit 0 once enough packets arrived
+    timeout 8 gst-launch-1.0 -q udpsrc address=$group port=$1 multicast-iface=lo auto-multicast=true \
+        num-buffers=200 ! fakesink >/dev/null 2>&1
+}
+
+pids=()
+for i in $(seq "$receivers"); do
+    receive $port & pids+=($!)
+done
+if [ "$fec" = 1 ]; then
+    receive $((port + 2)) & pids+=($!)
+    receive $((port + 4)) & pids+=($!)
+fi
+
+failed=0
+for pid in "${pids[@]}"; do
+    wait "$pid" || failed=$((failed + 1))
+done
+echo "receivers: ${#pids[@]}, without data: $failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,111 @@
+#!/usr/bin/env bash
+# CPU per frame with and without h264parse after the SEI injector, and with
+# the length-prefixed internal path (--avc-internal). Checks the TS produced
+# by both modes without h264parse: the PMT must carry H.264
+# (stream type 0x1b), every IDR must start a PES with random_access_indicator
+# set and carry SPS + PPS, and no other PES may be flagged.
+#
+#   bench/noparse.sh build/ndi2srt "<ndi-name>" [seconds]
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds]}
+name=${2:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds]}
+seconds=${3:-20}
+out=$(mktemp --suffix .ts)
+trap 'rm -f "$out"' EXIT
+
+# Prints "<cpu seconds> <video frames> <idr frames> <errors>"
+run() {
+    local cpu
+    cpu=$( { /usr/bin/time -f "%U %S" "$bin" --ndi-name "$name" --stdout --no-audio --gop-size 25 \
+        --timeout "$seconds" "$@" >"$out" 2>/dev/null; } 2>&1 | tail -n 1 | awk '{ print $1 + $2 }')
+    python3 - "$out" "$cpu" <<'PY'
+import sys
+data = open(sys.argv[1], "rb").read()
+pmt_pid = video_pid = stream_type = None
+pes, pes_rai = {}, False
+frames = idrs = errors = 0
+
+def nal_types(es):
+    types, i = [], 0
+    while True:
+        i = es.find(b"\x00\x00\x01", i)
+        if i < 0 or i + 3 >= len(es):
+            return types
+        types.append(es[i + 3] & 0x1f)
+        i += 3
+
+def finish(buf, rai):
+    global frames, idrs, errors
+    if not buf:
+        return
+    frames += 1
+    header_len = 9 + buf[8] if len(buf) > 8 else len(buf)
+    types = nal_types(bytes(buf[header_len:]))
+    idr = 5 in types
+    if idr:
+        idrs += 1
+        first_idr = types.index(5)
+        if 7 not in types[:first_idr] or 8 not in types[:first_idr]:
+            errors += 1
+    if idr != rai:
+        errors += 1
+
+for off in range(0, len(data) - 187, 188):
+    p = data[off:off + 188]
+    if p[0] != 0x47:
+        continue
+    pid = ((p[1] & 0x1f) << 8) | p[2]
+    pusi = bool(p[1] & 0x40)
+    afc = (p[3] >> 4) & 3
+    payload = 4
+    rai = False
+    if afc & 2:
+        if p[4] > 0:
+            rai = bool(p[5] & 0x40)
+        payload = 5 + p[4]
+    if not afc & 1 or payload >= 188:
+        continue
+    body = p[payload:]
+    if pid == 0 and pusi and pmt_pid is None:
+        s = body[1 + body[0]:]
+        pmt_pid = ((s[10] & 0x1f) << 8) | s[11]
+    elif pid == pmt_pid and pusi and video_pid is None:
+        s = body[1 + body[0]:]
+        section_len = ((s[1] & 0x0f) << 8) | s[2]
+        i = 12 + (((s[10] & 0x0f) << 8) | s[11])
+        while i + 5 <= 3 + section_len - 4:
+            es_pid = ((s[i + 1] & 0x1f) << 8) | s[i + 2]
+            if s[i] in (0x02, 0x10, 0x1b, 0x24):  # first video stream
+                video_pid, stream_type = es_pid, s[i]
+                break
+            i += 5 + (((s[i + 3] & 0x0f) << 8) | s[i + 4])
+    elif pid == video_pid:
+        if pusi:
+            finish(pes.get(pid), pes_rai)
+            pes[pid], pes_rai = bytearray(), rai
+        if pid in pes:
+            pes[pid] += body
+if video_pid is not None:
+    finish(pes.get(video_pid), pes_rai)
+if stream_type != 0x1b:
+    errors += 1
+print(sys.argv[2], frames, idrs, errors)
+PY
+}
+
+report() {
+    read -r cpu frames idrs errors <<<"$2"
+    awk -v l="$1" -v c="$cpu" -v f="$frames" -v i="$idrs" -v e="$errors" 'BEGIN {
+        printf "%-14s %6d frames  %4d IDR  %.3f ms CPU/frame  %d TS errors\n",
+               l, f, i, f ? c * 1000 / f : 0, e }'
+}
+
+with=$(run)
+without=$(run --no-h264parse)
+avc=$(run --avc-internal)
+report "h264parse" "$with"
+report "no-h264parse" "$without"
+report "avc-internal" "$avc"
+[ "$(echo "$without" | awk '{ print $4 }')" -eq 0 ]
+[ "$(echo "$avc" | awk '{ print $4 }')" -eq 0 ]
@@ -0,0 +1,67 @@
+#!/usr/bin/env bash
+# Bonded SRT check on one host: an srtgroup:// output over two loopback
+# paths (127.0.0.1 and 127.0.0.2) into one group listener. The second path
+# loses <loss>% of its packets and is cut off completely for 3 s mid-run;
+# in broadcast mode the merged stream must come out without TS continuity
+# errors, in backup mode the switch-over must be the only disturbance.
+#
+#   sudo bench/srtgroup.sh build/ndi2srt "<ndi-name>" [broadcast|backup] [loss%]
+#
+# Needs root (iptables), srt-live-transmit and python3. libsrt on both ends
+# must be built with ENABLE_BONDING.
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> <ndi-name> [broadcast|backup] [loss%]}
+name=${2:?usage: $0 <ndi2srt-binary> <ndi-name> [broadcast|backup] [loss%]}
+mode=${3:-broadcast}
+loss=${4:-10}
+port=9000
+out=$(mktemp --suffix .ts)
+drop() {
+    iptables "$1" OUTPUT -d 127.0.0.2 -p udp --dport $port -m statistic --mode random \
+        --probability "$2" -j DROP
+}
+
+srt-live-transmit -q "srt://:$port?mode=listener&groupconnect=1" file://con >"$out" &
+receiver=$!
+drop -I "$(awk "BEGIN { print $loss / 100 }")"
+cleanup() {
+    kill $receiver 2>/dev/null || true
+    drop -D "$(awk "BEGIN { print $loss / 100 }")" 2>/dev/null || true
+    iptables -D OUTPUT -d 127.0.0.2 -p udp --dport $port -j DROP 2>/dev/null || true
+    rm -f "$out"
+}
+trap cleanup EXIT
+sleep 1
+
+"$bin" --ndi-name "$name" --no-audio --timeout 15 --verbose \
+    --output "srtgroup://127.0.0.1:$port,127.0.0.2:$port?mode=$mode&weights=2,1&latency=200" \
+    2> >(grep "SRT group" >&2) &
+sender=$!
+sleep 6
+iptables -I OUTPUT -d 127.0.0.2 -p udp --dport $port -j DROP
+sleep 3
+iptables -D OUTPUT -d 127.0.0.2 -p udp --dport $port -j DROP
+wait $sender || true
+sleep 1
+
+# Count continuity counter jumps per PID (adaptation-only packets excluded)
+python3 - "$out" <<'PY'
+import sys
+data = open(sys.argv[1], "rb").read()
+last, errors, packets = {}, 0, 0
+for off in range(0, len(data) - 187, 188):
+    p = data[off:off + 188]
+    if p[0] != 0x47:
+        continue
+    packets += 1
+    pid = ((p[1] & 0x1f) << 8) | p[2]
+    if pid == 0x1fff or not (p[3] & 0x10):
+        continue
+    cc = p[3] & 0x0f
+    if pid in last and cc != (last[pid] + 1) & 0x0f and cc != last[pid]:
+        errors += 1
+    last[pid] = cc
+print(f"packets: {packets}, continuity errors: {errors}")
+sys.exit(1 if packets == 0 or errors else 0)
+PY
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# Compare exec->PLAYING startup time of two ndi2srt builds (e.g. dynamic vs
+# NDI2SRT_STATIC_PLUGINS). Each run exports its exec time so the binary can
+# report exec->PLAYING with --startup-report.
+#
+#   bench/startup.sh build/ndi2srt build-static/ndi2srt [runs] [ndi-name]
+set -euo pipefail
+
+dyn=${1:?usage: $0 <dynamic-binary> <static-binary> [runs] [ndi-name]}
+sta=${2:?usage: $0 <dynamic-binary> <static-binary> [runs] [ndi-name]}
+runs=${3:-20}
+name=${4:-"ndi2srt startup bench"}
+
+measure() {
+    local bin=$1
+    for _ in $(seq "$runs"); do
+        NDI2SRT_EXEC_NS=$(date +%s%N) "$bin" --ndi-name "$name" --stdout --no-audio \
+            --timeout 1 --startup-report 2>&1 >/dev/null |
+            sed -n 's/.*exec->PLAYING=\([0-9.]*\) ms.*/\1/p'
+    done | sort -n | awk '{ v[NR] = $1 } END {
+        if (NR == 0) { print "no samples"; exit }
+        printf "min %.1f ms  median %.1f ms  max %.1f ms  (%d runs)\n", v[1], v[int((NR + 1) / 2)], v[NR], NR }'
+}
+
+echo "dynamic: $(measure "$dyn")"
+echo "static:  $(measure "$sta")"
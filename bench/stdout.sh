@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+# The stdout output, piped into a reader as ffmpeg would be: one write per
+# mux buffer (--stdout-batch 0, the old fdsink path), batches copied with
+# writev (--stdout-writev) and batches vmspliced from the mux buffers. Each
+# mode runs twice: under strace, counting the write/writev/vmsplice calls
+# and FIONREAD polls on fd 1, and under perf stat (no strace overhead),
+# measuring CPU time and memory traffic of the sender and its reader
+# together. Traffic is last-level cache misses times 64 bytes, so it needs
+# the LLC events (bare metal or a VM exposing them). Both runs must produce
+# a well-formed TS (a sync byte every 188 bytes, nothing torn at the end).
+#
+#   bench/stdout.sh build/ndi2srt "<ndi-name>" [seconds] [batch-KiB] [flush-ms]
+set -euo pipefail
+
+bin=${1:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds] [batch-KiB] [flush-ms]}
+name=${2:?usage: $0 <ndi2srt-binary> <ndi-name> [seconds] [batch-KiB] [flush-ms]}
+seconds=${3:-20}
+batch=${4:-64}
+flush=${5:-5}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Prints "<TS errors> <bytes>" for a capture
+check_ts() {
+    python3 - "$1" <<'PY'
+import sys
+data = open(sys.argv[1], "rb").read()
+errors = sum(1 for off in range(0, len(data), 188) if data[off] != 0x47) + (len(data) % 188 != 0) + (not data)
+print(errors, len(data))
+PY
+}
+
+# Prints "<syscalls> <bytes> <cpu seconds> <traffic bytes|n/a> <ts errors>"
+run() {
+    local tag=$1; shift
+    # The pipe matters: vmsplice is only used on pipes
+    strace -f -qq -e trace=write,writev,vmsplice,ioctl -o "$dir/$tag.strace" \
+        "$bin" --ndi-name "$name" --stdout --timeout "$seconds" "$@" 2>/dev/null | cat >"$dir/$tag.strace.ts"
+    local calls
+    calls=$(grep -cE '(write|writev|vmsplice)\(1,|ioctl\(1, FIONREAD' "$dir/$tag.strace" || true)
+    read -r errors _ <<<"$(check_ts "$dir/$tag.strace.ts")"
+
+    perf stat -x, -o "$dir/$tag.perf" -e task-clock,LLC-load-misses,LLC-store-misses -- \
+        bash -c '"$0" "$@" 2>/dev/null | cat >"'"$dir/$tag.ts"'"' \
+        "$bin" --ndi-name "$name" --stdout --timeout "$seconds" "$@"
+    local perf_errors bytes
+    read -r perf_errors bytes <<<"$(check_ts "$dir/$tag.ts")"
+    python3 - "$dir/$tag.perf" "$calls" "$bytes" "$((errors + perf_errors))" <<'PY'
+import sys
+counts = {}
+for line in open(sys.argv[1]):
+    f = line.strip().split(",")
+    if len(f) > 2 and not line.startswith("#"):
+        counts[f[2]] = f[0]
+def num(event):
+    v = counts.get(event, "")
+    return float(v) if v.replace(".", "", 1).isdigit() else None
+cpu = (num("task-clock") or 0) / 1e3
+misses = [num("LLC-load-misses"), num("LLC-store-misses")]
+traffic = "%.0f" % (sum(misses) * 64) if None not in misses else "n/a"
+print(sys.argv[2], sys.argv[3], "%.2f" % cpu, traffic, sys.argv[4])
+PY
+}
+
+report() {
+    read -r calls bytes cpu traffic errors <<<"$2"
+    awk -v l="$1" -v c="$calls" -v b="$bytes" -v u="$cpu" -v t="$traffic" -v s="$seconds" -v e="$errors" 'BEGIN {
+        mem = t == "n/a" ? "n/a" : sprintf("%.1f MB/s (%.2f B per B out)", t / s / 1e6, b ? t / b : 0)
+        printf "%-9s %8.0f syscalls/s %8.0f bytes/syscall  %6.2f s CPU  %d TS errors  memory %s\n",
+               l, c / s, c ? b / c : 0, u, e, mem }'
+}
+
+plain=$(run fdsink --stdout-batch 0)
+copied=$(run writev --stdout-batch "$batch" --stdout-flush-ms "$flush" --stdout-writev)
+spliced=$(run vmsplice --stdout-batch "$batch" --stdout-flush-ms "$flush")
+report "fdsink" "$plain"
+report "writev" "$copied"
+report "vmsplice" "$spliced"
+for r in "$plain" "$copied" "$spliced"; do
+    [ "$(echo "$r" | awk '{ print $5 }')" -eq 0 ]
+done
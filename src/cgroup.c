@@ -0,0 +1,202 @@
+// cgroup CPU and memory limits, see cgroup.h
+#define _GNU_SOURCE
+#include "cgroup.h"
+
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// cgroup v1 reports "no limit" as a huge page-rounded number
+#define CGROUP_V1_NO_LIMIT (UINT64_C(1) << 60)
+
+#ifdef __linux__
+
+// First line of dir/name, without the newline
+static int read_line(const char *dir, const char *name, char *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(buf, (int)size, f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+// Whether a comma-separated list holds token
+static int has_token(const char *list, const char *token) {
+    size_t n = strlen(token);
+    for (const char *p = list; p && *p; ) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == n && strncmp(p, token, n) == 0) return 1;
+        p = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+// Mount point and root of the hierarchy: cgroup2 when controller is NULL,
+// otherwise the v1 hierarchy carrying controller. From /proc/self/mountinfo:
+// id parent major:minor root mountpoint options [tags...] - type source superoptions
+static int find_mount(const char *controller, char *mnt, char *root) {
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f) return -1;
+    char line[4096];
+    int found = -1;
+    while (found < 0 && fgets(line, sizeof(line), f)) {
+        char r[PATH_MAX], m[PATH_MAX], type[64], source[256], super[1024] = "";
+        const char *sep = strstr(line, " - ");
+        if (!sep || sscanf(line, "%*d %*d %*s %4095s %4095s", r, m) != 2) continue;
+        if (sscanf(sep + 3, "%63s %255s %1023s", type, source, super) < 2) continue;
+        if (controller ? strcmp(type, "cgroup") != 0 || !has_token(super, controller)
+                       : strcmp(type, "cgroup2") != 0) continue;
+        strcpy(mnt, m);
+        strcpy(root, r);
+        found = 0;
+    }
+    fclose(f);
+    return found;
+}
+
+// The process's path in the hierarchy, from /proc/self/cgroup:
+// "0::<path>" on v2, "<id>:<controllers>:<path>" on v1
+static int find_path(const char *controller, char *path) {
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f) return -1;
+    char line[4096];
+    int found = -1;
+    while (found < 0 && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *c1 = strchr(line, ':');
+        char *c2 = c1 ? strchr(c1 + 1, ':') : NULL;
+        if (!c2) continue;
+        *c2 = '\0';
+        const char *controllers = c1 + 1;
+        if (controller ? !has_token(controllers, controller)
+                       : strncmp(line, "0:", 2) != 0 || *controllers != '\0') continue;
+        snprintf(path, PATH_MAX, "%s", c2 + 1);
+        found = 0;
+    }
+    fclose(f);
+    return found;
+}
+
+// Directory of the process's cgroup; *stop = length of the mount point,
+// where walking up towards the root ends
+static int cgroup_dir(const char *controller, char *dir, size_t *stop) {
+    char mnt[PATH_MAX], root[PATH_MAX], path[PATH_MAX];
+    if (find_mount(controller, mnt, root) != 0 || find_path(controller, path) != 0) return -1;
+    // Inside a cgroup namespace both are "/"; otherwise strip the mount's root
+    const char *rel = path;
+    size_t root_len = strlen(root);
+    if (strcmp(root, "/") != 0 && strncmp(path, root, root_len) == 0) rel = path + root_len;
+    if (strcmp(rel, "/") == 0) rel = "";
+    if (snprintf(dir, PATH_MAX, "%s%s", mnt, rel) >= PATH_MAX) return -1;
+    *stop = strlen(mnt);
+    return 0;
+}
+
+// Drop the last path component; 0 once dir is the mount point
+static int walk_up(char *dir, size_t stop) {
+    if (strlen(dir) <= stop) return 0;
+    char *slash = strrchr(dir, '/');
+    if (!slash || (size_t)(slash - dir) < stop) return 0;
+    *slash = '\0';
+    return 1;
+}
+
+static void keep_min_u64(uint64_t *cur, uint64_t v) {
+    if (v > 0 && (*cur == 0 || v < *cur)) *cur = v;
+}
+
+static void keep_min_double(double *cur, double v) {
+    if (v > 0 && (*cur == 0 || v < *cur)) *cur = v;
+}
+
+// "max" or a byte count
+static uint64_t parse_v2_bytes(const char *s) {
+    return strcmp(s, "max") == 0 ? 0 : strtoull(s, NULL, 10);
+}
+
+static int read_v2(CgroupLimits *l) {
+    char dir[PATH_MAX], buf[128];
+    size_t stop;
+    if (cgroup_dir(NULL, dir, &stop) != 0) return -1;
+    // Hybrid hosts mount an empty cgroup2 next to the v1 controllers
+    char mnt[PATH_MAX], controllers[256];
+    snprintf(mnt, sizeof(mnt), "%.*s", (int)stop, dir);
+    if (read_line(mnt, "cgroup.controllers", controllers, sizeof(controllers)) != 0) return -1;
+    for (char *c = controllers; *c; ++c) if (*c == ' ') *c = ',';
+    if (!has_token(controllers, "cpu") && !has_token(controllers, "memory")) return -1;
+    do {
+        if (read_line(dir, "cpu.max", buf, sizeof(buf)) == 0) {
+            char quota[32];
+            unsigned long long period = 0;
+            if (sscanf(buf, "%31s %llu", quota, &period) == 2 && strcmp(quota, "max") != 0 && period > 0) {
+                keep_min_double(&l->cpu_quota, strtod(quota, NULL) / (double)period);
+            }
+        }
+        if (read_line(dir, "memory.max", buf, sizeof(buf)) == 0) keep_min_u64(&l->memory_max, parse_v2_bytes(buf));
+        if (read_line(dir, "memory.high", buf, sizeof(buf)) == 0) keep_min_u64(&l->memory_high, parse_v2_bytes(buf));
+    } while (walk_up(dir, stop));
+    return 0;
+}
+
+static int read_v1(CgroupLimits *l) {
+    char dir[PATH_MAX], buf[128];
+    size_t stop;
+    int found = -1;
+    if (cgroup_dir("cpu", dir, &stop) == 0) {
+        found = 0;
+        do {
+            char period[128];
+            if (read_line(dir, "cpu.cfs_quota_us", buf, sizeof(buf)) == 0 &&
+                read_line(dir, "cpu.cfs_period_us", period, sizeof(period)) == 0) {
+                long long q = strtoll(buf, NULL, 10), p = strtoll(period, NULL, 10);
+                if (q > 0 && p > 0) keep_min_double(&l->cpu_quota, (double)q / (double)p);
+            }
+        } while (walk_up(dir, stop));
+    }
+    if (cgroup_dir("memory", dir, &stop) == 0) {
+        found = 0;
+        do {
+            if (read_line(dir, "memory.limit_in_bytes", buf, sizeof(buf)) == 0) {
+                uint64_t v = strtoull(buf, NULL, 10);
+                if (v < CGROUP_V1_NO_LIMIT) keep_min_u64(&l->memory_max, v);
+            }
+        } while (walk_up(dir, stop));
+    }
+    return found;
+}
+
+#endif // __linux__
+
+int cgroup_read_limits(CgroupLimits *out) {
+    memset(out, 0, sizeof(*out));
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    out->host_cpus = n > 0 ? (int)n : 1;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) out->cpuset_cpus = CPU_COUNT(&set);
+    if (read_v2(out) == 0) out->version = 2;
+    else if (read_v1(out) == 0) out->version = 1;
+#endif
+    return out->version;
+}
+
+double cgroup_cpu_budget(const CgroupLimits *l) {
+    double cpus = l->host_cpus;
+    if (l->cpuset_cpus > 0 && l->cpuset_cpus < cpus) cpus = l->cpuset_cpus;
+    if (l->cpu_quota > 0 && l->cpu_quota < cpus) cpus = l->cpu_quota;
+    return cpus;
+}
+
+uint64_t cgroup_memory_budget(const CgroupLimits *l) {
+    uint64_t m = l->memory_max;
+    if (l->memory_high > 0 && (m == 0 || l->memory_high < m)) m = l->memory_high;
+    return m;
+}
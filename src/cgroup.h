@@ -0,0 +1,39 @@
+// CPU and memory limits of the cgroup this process runs in, as a container
+// runtime (Docker, Kubernetes) sets them: the CFS quota (cpu.max, or
+// cpu.cfs_quota_us / cpu.cfs_period_us on cgroup v1), the CPUs the process
+// may run on (its affinity mask, which the cpuset controller narrows) and
+// the memory limit (memory.max / memory.high, or memory.limit_in_bytes).
+// Limits of ancestor cgroups apply too, so the tightest one along the path
+// up to the mount point is reported.
+//
+// No dependencies besides libc. On other systems only the host CPU count
+// is filled in.
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct CgroupLimits {
+    int version;            // 2 or 1; 0 when no cgroup filesystem was found
+    double cpu_quota;       // CPUs allowed by the CFS quota (quota / period), 0 = no quota
+    int cpuset_cpus;        // CPUs in the affinity mask, 0 = unknown
+    int host_cpus;          // online CPUs
+    uint64_t memory_max;    // hard limit in bytes, 0 = none
+    uint64_t memory_high;   // v2 throttling threshold in bytes, 0 = none
+} CgroupLimits;
+
+// Fills *out; returns out->version
+int cgroup_read_limits(CgroupLimits *out);
+
+// CPUs the process can keep busy: the smallest of quota, cpuset and host
+double cgroup_cpu_budget(const CgroupLimits *l);
+
+// Memory the process should stay under: the smaller of max and high, 0 = none
+uint64_t cgroup_memory_budget(const CgroupLimits *l);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,160 @@
+// Out-of-process encoder wire protocol, see encproc.h
+#define _GNU_SOURCE
+#include "encproc.h"
+
+#include <errno.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+extern char **environ;
+
+int encproc_socketpair(int sv[2]) {
+    return socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
+}
+
+pid_t encproc_spawn(const char *exe, char *const argv[], int sock) {
+    posix_spawn_file_actions_t fa;
+    if (posix_spawn_file_actions_init(&fa) != 0) return -1;
+    // dup2() clears close-on-exec on the target; if sock already is fd 3 it
+    // has to be cleared by hand, which a dup2 onto itself does not do
+    int tmp = -1;
+    if (sock == ENCPROC_WORKER_FD) {
+        tmp = fcntl(sock, F_DUPFD_CLOEXEC, ENCPROC_WORKER_FD + 1);
+        if (tmp < 0) {
+            posix_spawn_file_actions_destroy(&fa);
+            return -1;
+        }
+        sock = tmp;
+    }
+    posix_spawn_file_actions_adddup2(&fa, sock, ENCPROC_WORKER_FD);
+    // Its own process group: a Ctrl-C at the terminal is the supervisor's
+    // to handle, the worker is stopped through the socket
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+    pid_t pid;
+    int err = posix_spawn(&pid, exe, &fa, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (tmp >= 0) close(tmp);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+int encproc_send(int sock, EncProcMsg *m, const char *text, int fd, int nonblock) {
+    size_t len = text ? strlen(text) : 0;
+    if (len > ENCPROC_TEXT_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    m->text_len = (uint32_t)len;
+    struct iovec iov[2] = {
+        { .iov_base = m, .iov_len = sizeof(*m) },
+        { .iov_base = (void*)text, .iov_len = len },
+    };
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+    if (fd >= 0) {
+        memset(&ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL | (nonblock ? MSG_DONTWAIT : 0));
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -1 : 0;
+}
+
+int encproc_recv(int sock, EncProcMsg *m, char *text, size_t text_max, int *fd) {
+    char scratch[ENCPROC_TEXT_MAX];
+    struct iovec iov[2] = {
+        { .iov_base = m, .iov_len = sizeof(*m) },
+        { .iov_base = scratch, .iov_len = sizeof(scratch) },
+    };
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    if (fd) *fd = -1;
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return n == 0 ? 0 : -1;
+    int got = -1;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) memcpy(&got, CMSG_DATA(c), sizeof(int));
+    }
+    if ((size_t)n < sizeof(*m) || (msg.msg_flags & MSG_TRUNC) || m->text_len != (size_t)n - sizeof(*m)) {
+        if (got >= 0) close(got);
+        errno = EPROTO;
+        return -1;
+    }
+    if (fd) *fd = got;
+    else if (got >= 0) close(got);
+    if (text && text_max > 0) {
+        size_t len = m->text_len < text_max - 1 ? m->text_len : text_max - 1;
+        memcpy(text, scratch, len);
+        text[len] = '\0';
+    }
+    return 1;
+}
+
+uint8_t* encproc_buffer_new(size_t size, int *fd) {
+    int f = memfd_create("ndi2srt-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (f < 0) return NULL;
+    if (ftruncate(f, (off_t)size) < 0) {
+        int e = errno;
+        close(f);
+        errno = e;
+        return NULL;
+    }
+    // The worker maps the same file; nobody may resize it under the mapping
+    fcntl(f, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    if (map == MAP_FAILED) {
+        int e = errno;
+        close(f);
+        errno = e;
+        return NULL;
+    }
+    *fd = f;
+    return map;
+}
+
+const uint8_t* encproc_buffer_map(int fd, size_t size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return NULL;
+    if ((uint64_t)st.st_size < size) {
+        errno = EPROTO;
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
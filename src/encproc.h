@@ -0,0 +1,87 @@
+// Wire protocol between ndi2srt and its out-of-process encoders
+// (--encoder-process). Each stream's worker is ndi2srt itself, re-executed
+// with --encoder-worker and one end of a SOCK_SEQPACKET socket pair on fd 3.
+// Messages are a fixed header plus optional text, and at most one file
+// descriptor passed with SCM_RIGHTS:
+//
+//   supervisor -> worker                     worker -> supervisor
+//   CONFIG     encoder properties (text)     RING     AU ring memfd (fd)
+//   CAPS       raw video caps (text)         CAPS     encoded caps (text)
+//   SLOT       frame buffer memfd (fd)       RELEASE  encoder done with frame seq
+//   FRAME      slot + seq + timestamps       AU       access unit seq is in the ring
+//   BITRATE    new bitrate (value)
+//
+// Raw frames never travel over the socket: they are written by the pipeline
+// straight into memfd buffers that both processes map, and FRAME only names
+// the buffer. A buffer's fd is sent once (SLOT), then referred to by id.
+//
+// Linux only (memfd, SCM_RIGHTS). No dependencies besides libc.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ENCPROC_WORKER_FD 3         // socket fd in the worker
+#define ENCPROC_TEXT_MAX 16384      // longest text payload
+
+typedef enum {
+    ENCPROC_CONFIG = 1,
+    ENCPROC_CAPS,
+    ENCPROC_SLOT,
+    ENCPROC_FRAME,
+    ENCPROC_BITRATE,
+    ENCPROC_RING,
+    ENCPROC_RELEASE,
+    ENCPROC_AU
+} EncProcMsgType;
+
+#define ENCPROC_FLAG_FORCE_IDR (1u << 0)    // FRAME: encode this frame as an IDR
+#define ENCPROC_FLAG_DISCONT   (1u << 1)    // FRAME: first frame after a gap
+
+#define ENCPROC_TIME_NONE UINT64_MAX
+
+typedef struct EncProcMsg {
+    uint32_t type;              // EncProcMsgType
+    uint32_t slot;              // SLOT/FRAME: buffer id
+    uint64_t seq;               // FRAME/RELEASE/AU: frame or AU number
+    uint64_t pts;               // FRAME: ns, ENCPROC_TIME_NONE if unknown
+    uint64_t dts;
+    uint64_t duration;
+    uint64_t size;              // SLOT: buffer size; FRAME: bytes used
+    uint32_t flags;             // ENCPROC_FLAG_*
+    uint32_t value;             // BITRATE: kbps
+    uint32_t text_len;          // bytes of text after the header
+    uint32_t reserved;
+} EncProcMsg;
+
+// Socket pair for one worker; sv[0] stays in the supervisor, sv[1] goes to
+// the worker. Both are close-on-exec. Returns 0 or -1 with errno set.
+int encproc_socketpair(int sv[2]);
+
+// Start exe with argv, with sock on ENCPROC_WORKER_FD, in a process group of
+// its own. Returns the pid, or -1 with errno set.
+pid_t encproc_spawn(const char *exe, char *const argv[], int sock);
+
+// Send one message; text may be NULL, fd -1 for none. With nonblock set a
+// full socket fails with EAGAIN instead of waiting. Returns 0 or -1.
+int encproc_send(int sock, EncProcMsg *m, const char *text, int fd, int nonblock);
+
+// Receive one message; text (text_max bytes, NUL-terminated) and *fd (-1
+// when none came) are optional. Returns 1, 0 on EOF, -1 with errno set.
+int encproc_recv(int sock, EncProcMsg *m, char *text, size_t text_max, int *fd);
+
+// A shared frame buffer: memfd of size bytes, mapped read-write.
+// Returns the mapping and *fd, or NULL with errno set.
+uint8_t* encproc_buffer_new(size_t size, int *fd);
+
+// Map a buffer received with SLOT read-only. Returns NULL with errno set.
+const uint8_t* encproc_buffer_map(int fd, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,125 @@
+// Batched fd writer, see fdwriter.h
+#define _GNU_SOURCE
+#include "fdwriter.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#define FDWRITER_PIPE_SIZE (1 << 20)
+
+struct FdWriter {
+    int fd;
+    FdWriterMode mode;
+    int spliced;                // some bytes went out by vmsplice: drained needs FIONREAD
+    uint64_t syscalls;
+    uint64_t bytes;
+};
+
+FdWriter* fdwriter_new(int fd, int allow_vmsplice) {
+    FdWriter *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->fd = fd;
+    w->mode = FDWRITER_WRITEV;
+#ifdef __linux__
+    struct stat st;
+    if (allow_vmsplice && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        w->mode = FDWRITER_VMSPLICE;
+        // Room for whole batches: a default 64 KiB pipe (16 slots, one or two
+        // per iovec) splits them into several vmsplice calls. Best effort,
+        // capped by fs.pipe-max-size.
+        if (fcntl(fd, F_GETPIPE_SZ) < FDWRITER_PIPE_SIZE) fcntl(fd, F_SETPIPE_SZ, FDWRITER_PIPE_SIZE);
+    }
+#endif
+    return w;
+}
+
+void fdwriter_free(FdWriter *w) {
+    if (!w) return;
+    free(w);
+}
+
+FdWriterMode fdwriter_mode(const FdWriter *w) {
+    return w->mode;
+}
+
+uint64_t fdwriter_position(const FdWriter *w) {
+    return w->bytes;
+}
+
+uint64_t fdwriter_drained(FdWriter *w) {
+    if (!w->spliced) return w->bytes;
+    int unread = 0;
+    w->syscalls++;
+    // Reader gone: the pipe let go of its pages
+    if (ioctl(w->fd, FIONREAD, &unread) < 0 || unread < 0) return w->bytes;
+    return w->bytes - (uint64_t)unread;
+}
+
+void fdwriter_totals(const FdWriter *w, uint64_t *syscalls, uint64_t *bytes) {
+    if (syscalls) *syscalls = w->syscalls;
+    if (bytes) *bytes = w->bytes;
+}
+
+// writev(), or vmsplice() without SPLICE_F_GIFT: the pipe references the
+// caller's pages (see fdwriter.h)
+static int writev_all(FdWriter *w, const struct iovec *iov, int iovcnt, int splice) {
+    struct iovec local[IOV_MAX];
+    while (iovcnt > 0) {
+        int chunk = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+        int n = chunk;
+        memcpy(local, iov, (size_t)n * sizeof(*iov));
+        struct iovec *v = local;
+        while (n > 0) {
+#ifdef __linux__
+            ssize_t r = splice ? vmsplice(w->fd, v, (unsigned long)n, 0) : writev(w->fd, v, n);
+            if (splice && r > 0) w->spliced = 1;
+#else
+            (void)splice;
+            ssize_t r = writev(w->fd, v, n);
+#endif
+            w->syscalls++;
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            w->bytes += (uint64_t)r;
+            // Skip what went out, resume inside a partially written iovec
+            while (n > 0 && (size_t)r >= v->iov_len) {
+                r -= (ssize_t)v->iov_len;
+                ++v;
+                --n;
+            }
+            if (n > 0) {
+                v->iov_base = (uint8_t*)v->iov_base + r;
+                v->iov_len -= (size_t)r;
+            }
+        }
+        iov += chunk;
+        iovcnt -= chunk;
+    }
+    return 0;
+}
+
+int fdwriter_writev(FdWriter *w, const struct iovec *iov, int iovcnt) {
+#ifdef __linux__
+    if (w->mode == FDWRITER_VMSPLICE) {
+        uint64_t before = w->bytes;
+        if (writev_all(w, iov, iovcnt, 1) == 0) return 0;
+        // Not a splice-capable pipe after all: finish this batch and all
+        // later ones with writev
+        if (errno != EINVAL && errno != ENOSYS) return -1;
+        w->mode = FDWRITER_WRITEV;
+        if (w->bytes != before) {
+            errno = EIO;  // part of the batch already went out; cannot resume cleanly
+            return -1;
+        }
+    }
+#endif
+    return writev_all(w, iov, iovcnt, 0);
+}
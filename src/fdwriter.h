@@ -0,0 +1,54 @@
+// Batched, gathered writes of an output stream to a file descriptor (the
+// --stdout sink). The caller hands over whole batches as iovecs; each one
+// leaves in as few syscalls as the kernel allows.
+//
+// On a pipe (Linux) the batch is handed to vmsplice() as is: the pipe takes
+// references to the caller's pages instead of copying the bytes, so nothing
+// is copied on the way in. The price is that the memory must stay unchanged
+// until the reader has read it: fdwriter_drained() tells how far that is,
+// and the caller holds its buffers until then. (A reader that moves the
+// pages on with splice()/tee() instead of reading them can still see later
+// changes; plain readers such as ffmpeg read.) On anything else (a regular
+// file, a socket, a terminal), or when asked to, the iovecs go to writev(),
+// which copies them once and frees the caller right away.
+//
+// No dependencies besides libc.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FDWRITER_WRITEV = 1,
+    FDWRITER_VMSPLICE = 2
+} FdWriterMode;
+
+typedef struct FdWriter FdWriter;
+
+// Picks vmsplice when fd is a pipe and allow_vmsplice is set, writev
+// otherwise. The fd stays the caller's.
+FdWriter* fdwriter_new(int fd, int allow_vmsplice);
+void fdwriter_free(FdWriter *w);
+FdWriterMode fdwriter_mode(const FdWriter *w);
+// Write all of iov, retrying partial writes; blocks while the reader is slow.
+// Returns 0, or -1 with errno set (EPIPE once the reader is gone). In
+// vmsplice mode the memory is still in use afterwards: keep it until
+// fdwriter_drained() reaches fdwriter_position() as it was after this call.
+int fdwriter_writev(FdWriter *w, const struct iovec *iov, int iovcnt);
+// Bytes written so far, i.e. the stream offset just past the last batch
+uint64_t fdwriter_position(const FdWriter *w);
+// Bytes the reader has taken out of the pipe (one FIONREAD). In writev mode
+// everything written is done with: same as fdwriter_position().
+uint64_t fdwriter_drained(FdWriter *w);
+// Totals since fdwriter_new(): syscalls made (FIONREAD included) and
+// payload bytes written
+void fdwriter_totals(const FdWriter *w, uint64_t *syscalls, uint64_t *bytes);
+
+#ifdef __cplusplus
+}
+#endif
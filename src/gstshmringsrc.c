@@ -0,0 +1,212 @@
+// shmringsrc: GStreamer source reading an ndi2srt shared-memory ring
+//
+//   gst-launch-1.0 shmringsrc socket-path=/tmp/ndi2srt.ring ! tsdemux ! ...
+//
+// Records are copied out of the ring into buffers: a downstream element may
+// hold a buffer for any amount of time, while the ring only guarantees a
+// record until the producer wraps around. Consumers that want zero-copy use
+// the reader API in shmring.h directly. Overruns are logged and posted as a
+// "shmring-lost" element message carrying the number of lost records.
+#include <errno.h>
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <gst/video/video.h>
+
+#include "shmring.h"
+
+#define GST_TYPE_SHM_RING_SRC (gst_shm_ring_src_get_type())
+G_DECLARE_FINAL_TYPE(GstShmRingSrc, gst_shm_ring_src, GST, SHM_RING_SRC, GstPushSrc)
+
+struct _GstShmRingSrc {
+    GstPushSrc parent;
+    gchar *socket_path;
+    gboolean keep_timestamps;
+    ShmRingReader *reader;
+    gint flushing;
+    guint64 lost_total;
+};
+
+enum { PROP_0, PROP_SOCKET_PATH, PROP_KEEP_TIMESTAMPS, PROP_LOST };
+
+GST_DEBUG_CATEGORY_STATIC(shm_ring_src_debug);
+#define GST_CAT_DEFAULT shm_ring_src_debug
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS("video/mpegts, systemstream=(boolean)true, packetsize=(int)188; "
+                    "video/x-h264, stream-format=(string)byte-stream, alignment=(string)au"));
+
+G_DEFINE_TYPE(GstShmRingSrc, gst_shm_ring_src, GST_TYPE_PUSH_SRC)
+
+static void gst_shm_ring_src_set_property(GObject *object, guint id, const GValue *value, GParamSpec *pspec) {
+    GstShmRingSrc *self = GST_SHM_RING_SRC(object);
+    switch (id) {
+        case PROP_SOCKET_PATH:
+            g_free(self->socket_path);
+            self->socket_path = g_value_dup_string(value);
+            break;
+        case PROP_KEEP_TIMESTAMPS:
+            self->keep_timestamps = g_value_get_boolean(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, pspec);
+    }
+}
+
+static void gst_shm_ring_src_get_property(GObject *object, guint id, GValue *value, GParamSpec *pspec) {
+    GstShmRingSrc *self = GST_SHM_RING_SRC(object);
+    switch (id) {
+        case PROP_SOCKET_PATH:
+            g_value_set_string(value, self->socket_path);
+            break;
+        case PROP_KEEP_TIMESTAMPS:
+            g_value_set_boolean(value, self->keep_timestamps);
+            break;
+        case PROP_LOST:
+            g_value_set_uint64(value, self->lost_total);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, pspec);
+    }
+}
+
+static gboolean gst_shm_ring_src_start(GstBaseSrc *src) {
+    GstShmRingSrc *self = GST_SHM_RING_SRC(src);
+    if (!self->socket_path) {
+        GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND, ("No socket-path set"), (NULL));
+        return FALSE;
+    }
+    self->reader = shmring_reader_open(self->socket_path);
+    if (!self->reader) {
+        GST_ELEMENT_ERROR(self, RESOURCE, OPEN_READ, ("Could not attach to ring at %s", self->socket_path),
+                          ("%s", g_strerror(errno)));
+        return FALSE;
+    }
+    self->lost_total = 0;
+    GstCaps *caps = shmring_reader_mode(self->reader) == SHMRING_MODE_AU
+        ? gst_caps_from_string("video/x-h264,stream-format=byte-stream,alignment=au")
+        : gst_caps_from_string("video/mpegts,systemstream=true,packetsize=188");
+    gboolean ok = gst_base_src_set_caps(src, caps);
+    gst_caps_unref(caps);
+    return ok;
+}
+
+static gboolean gst_shm_ring_src_stop(GstBaseSrc *src) {
+    GstShmRingSrc *self = GST_SHM_RING_SRC(src);
+    shmring_reader_close(self->reader);
+    self->reader = NULL;
+    return TRUE;
+}
+
+static gboolean gst_shm_ring_src_unlock(GstBaseSrc *src) {
+    g_atomic_int_set(&GST_SHM_RING_SRC(src)->flushing, TRUE);
+    return TRUE;
+}
+
+static gboolean gst_shm_ring_src_unlock_stop(GstBaseSrc *src) {
+    g_atomic_int_set(&GST_SHM_RING_SRC(src)->flushing, FALSE);
+    return TRUE;
+}
+
+static void gst_shm_ring_src_report_lost(GstShmRingSrc *self, guint64 lost) {
+    self->lost_total += lost;
+    GST_WARNING_OBJECT(self, "overrun: lost %" G_GUINT64_FORMAT " records (%" G_GUINT64_FORMAT " total)",
+                       lost, self->lost_total);
+    gst_element_post_message(GST_ELEMENT(self), gst_message_new_element(GST_OBJECT(self),
+        gst_structure_new("shmring-lost", "lost", G_TYPE_UINT64, lost,
+                          "total", G_TYPE_UINT64, self->lost_total, NULL)));
+}
+
+static GstFlowReturn gst_shm_ring_src_create(GstPushSrc *psrc, GstBuffer **outbuf) {
+    GstShmRingSrc *self = GST_SHM_RING_SRC(psrc);
+    for (;;) {
+        if (g_atomic_int_get(&self->flushing)) return GST_FLOW_FLUSHING;
+        const ShmRingRecord *rec;
+        const uint8_t *data;
+        uint64_t lost = 0;
+        if (!shmring_reader_next(self->reader, &rec, &data, &lost)) {
+            // Short waits so unlock() is honoured promptly
+            shmring_reader_wait(self->reader, 100);
+            continue;
+        }
+        GstBuffer *buf = gst_buffer_new_allocate(NULL, rec->size, NULL);
+        gst_buffer_fill(buf, 0, data, rec->size);
+        if (!shmring_reader_release(self->reader)) {
+            // Overwritten while copying; the next record reports the loss
+            gst_buffer_unref(buf);
+            continue;
+        }
+        if (lost > 0) {
+            gst_shm_ring_src_report_lost(self, lost);
+            GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DISCONT);
+        }
+        if (self->keep_timestamps) {
+            if (rec->pts != SHMRING_TIME_NONE) GST_BUFFER_PTS(buf) = rec->pts;
+            if (rec->dts != SHMRING_TIME_NONE) GST_BUFFER_DTS(buf) = rec->dts;
+        }
+        if (shmring_reader_mode(self->reader) == SHMRING_MODE_AU) {
+            if (!(rec->flags & SHMRING_FLAG_KEYFRAME)) GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+            uint32_t fps_n, fps_d;
+            shmring_reader_rate(self->reader, &fps_n, &fps_d);
+            if (rec->timecode >= 0 && fps_n > 0) {
+                GstVideoTimeCode *tc = gst_video_time_code_new(fps_n, fps_d, NULL,
+                    GST_VIDEO_TIME_CODE_FLAGS_NONE, 0, 0, 0, 0, 0);
+                gst_video_time_code_add_frames(tc, rec->timecode);
+                gst_buffer_add_video_time_code_meta(buf, tc);
+                gst_video_time_code_free(tc);
+            }
+        }
+        *outbuf = buf;
+        return GST_FLOW_OK;
+    }
+}
+
+static void gst_shm_ring_src_finalize(GObject *object) {
+    GstShmRingSrc *self = GST_SHM_RING_SRC(object);
+    g_free(self->socket_path);
+    G_OBJECT_CLASS(gst_shm_ring_src_parent_class)->finalize(object);
+}
+
+static void gst_shm_ring_src_class_init(GstShmRingSrcClass *klass) {
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS(klass);
+
+    gobject_class->set_property = gst_shm_ring_src_set_property;
+    gobject_class->get_property = gst_shm_ring_src_get_property;
+    gobject_class->finalize = gst_shm_ring_src_finalize;
+    g_object_class_install_property(gobject_class, PROP_SOCKET_PATH,
+        g_param_spec_string("socket-path", "Socket path", "UNIX socket of the ndi2srt ring (--shm-ring)",
+                            NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(gobject_class, PROP_KEEP_TIMESTAMPS,
+        g_param_spec_boolean("keep-timestamps", "Keep timestamps",
+                             "Use the producer's PTS/DTS (same clock only) instead of arrival time",
+                             FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(gobject_class, PROP_LOST,
+        g_param_spec_uint64("lost", "Lost", "Records lost to overruns", 0, G_MAXUINT64, 0,
+                            G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+    gst_element_class_set_static_metadata(element_class, "ndi2srt shared-memory ring source",
+        "Source/Network", "Reads MPEG-TS or H.264 access units from an ndi2srt --shm-ring", "ndi2srt");
+
+    basesrc_class->start = gst_shm_ring_src_start;
+    basesrc_class->stop = gst_shm_ring_src_stop;
+    basesrc_class->unlock = gst_shm_ring_src_unlock;
+    basesrc_class->unlock_stop = gst_shm_ring_src_unlock_stop;
+    GST_PUSH_SRC_CLASS(klass)->create = gst_shm_ring_src_create;
+}
+
+static void gst_shm_ring_src_init(GstShmRingSrc *self) {
+    gst_base_src_set_live(GST_BASE_SRC(self), TRUE);
+    gst_base_src_set_format(GST_BASE_SRC(self), GST_FORMAT_TIME);
+    gst_base_src_set_do_timestamp(GST_BASE_SRC(self), TRUE);
+}
+
+static gboolean plugin_init(GstPlugin *plugin) {
+    GST_DEBUG_CATEGORY_INIT(shm_ring_src_debug, "shmringsrc", 0, "ndi2srt shared-memory ring source");
+    return gst_element_register(plugin, "shmringsrc", GST_RANK_NONE, GST_TYPE_SHM_RING_SRC);
+}
+
+#define PACKAGE "ndi2srt"
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, shmring, "ndi2srt shared-memory ring source",
+                  plugin_init, "0.1.0", "unknown", PACKAGE, "https://github.com/matiaspl/ndi2srt")
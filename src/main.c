@@ -1,8 +1,50 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/net/net.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <glib-unix.h>
+#include <json-glib/json-glib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#include "fdwriter.h"
+#include "vqmetrics.h"
+#include "cgroup.h"
+
+#ifdef NDI2SRT_SHM_RING
+#include <gio/gunixconnection.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "shmring.h"
+#include "encproc.h"
+#endif
+
+#ifdef NDI2SRT_SRT_GROUP
+#include <netdb.h>
+#include <sys/socket.h>
+#include <srt/srt.h>
+#endif
+
+#ifdef NDI2SRT_STATIC_PLUGINS
+// Generated by CMake: GST_PLUGIN_STATIC_DECLARE() for each linked plugin and
+// register_static_plugins()
+#include "ndi2srt_static_plugins.h"
+#endif
 
 typedef struct AppConfig {
     gchar *ndi_name;
@@ -17,11 +59,51 @@ typedef struct AppConfig {
     gboolean inject_sei;
     guint timeout_seconds; // 0 disables auto-exit
     gchar *dump_ts_path;   // optional mpegts dump path
+    GPtrArray *outputs;    // further outputs of the first source (--output)
 
     gboolean stdout_mode;  // output mpegts to stdout instead of SRT
+    gchar *ndi_cache;      // name -> url-address key file (NULL = off)
+    guint ndi_cache_timeout_ms; // give up on a cached URL after this long without a frame
     gchar *timestamp_mode; // ndisrc timestamp-mode (auto|timecode|timestamp|...)
+    gchar *ingest_format;  // auto|i420: raw formats allowed between ndisrc and the encoder
     gboolean verbose;      // enable debug stderr messages
     gboolean discover;     // discover and list NDI sources
+    gchar *control_socket; // optional UNIX socket path for the JSON-lines control API
+    gboolean startup_report; // print exec->PLAYING phase timings
+    GPtrArray *streams;    // extra sources from --stream, "<ndi-name>=<output>"
+    gboolean tc_sync;      // align all sources by timecode before encoding
+    guint tc_sync_wait_ms; // how long to wait for a late source before repeating
+    guint tc_sync_idr;     // force IDRs on timecodes that are multiples of this (frames)
+    gboolean mpts;         // mux every source into one multi-program TS
+    GArray *mpts_weights;  // guint per program: share of the --bitrate budget
+    gchar *clock_spec;     // ptp[:domain] | ntp:host[:port] | net:host:port
+    guint clock_sync_timeout; // seconds to wait for the network clock before PLAYING
+    guint serve_clock_port;   // serve the pipeline clock (GstNetTimeProvider) on this UDP port
+    gchar *shm_ring;       // UNIX socket where local readers attach to the shared-memory ring
+    gchar *shm_ring_mode;  // ts|au
+    guint shm_ring_mb;     // ring data size
+    gboolean ndi_metadata; // mux NDI metadata frames as a KLV PID
+    gint ltc_channel;      // 1-based audio channel carrying LTC (0 = use NDI timecode)
+    guint quality_probe;   // measure PSNR/SSIM on one frame in N (0 = off)
+    guint stdout_batch_kb; // stdout: write in batches of this size (0 = fdsink, one write per buffer)
+    guint stdout_flush_ms; // stdout: longest a buffer waits for its batch
+    gboolean stdout_writev; // stdout: writev even into a pipe (no vmsplice)
+    gboolean no_h264parse; // encoder straight into the mux; the injector repeats SPS/PPS
+    gboolean avc_internal; // encoder outputs length-prefixed NALs; Annex B only at the mux (implies no_h264parse)
+    gchar *trace_path;     // frame timeline trace (Chrome/Perfetto JSON), recorded on SIGUSR1
+    gchar *frame_stats_path; // per-frame encoder records (binary, rotated)
+    guint frame_stats_mb;  // rotate the --frame-stats file at this size
+    guint trace_seconds;   // length of one trace window
+    guint cpu_stats_s;     // log per-stage CPU every this many seconds (0 = off)
+    gdouble cpu_budget;    // CPUs to size the streams for (0 = from the cgroup limits)
+    // Sized by resource_budget_apply() (encoder_threads unless given); 0 = element default
+    guint encoder_threads; // x264enc threads
+    guint convert_threads; // videoconvert/videoscale n-threads
+    guint decoder_threads; // avdec_h264 max-threads (--quality-probe)
+    guint raw_queue_bytes; // max-size-bytes of the raw video queues
+    gboolean governor;     // shed load from low-priority streams when frames run late
+    GArray *priorities;    // gint per stream for --governor, higher = shed last (default 0)
+    gboolean encoder_process; // run each stream's x264enc in a worker process (Linux)
 } AppConfig;
 
 // Forward declarations
@@ -31,6 +113,8 @@ static gint find_startcode(const guint8 *data, gint size, gint from);
 static gint startcode_len_at(const guint8 *data, gint size, gint pos);
 static GByteArray* ebsp_to_rbsp(const guint8 *ebsp, gsize size);
 // SpsVuiInfo is defined below; forward declare parser signature after struct
+struct FrameStats;
+static void frame_stats_record(struct FrameStats *fs, GstBuffer *au);
 
 // VUI/SPS info used to format pic_timing properly
 typedef struct {
@@ -81,12 +165,6 @@ static void log_sps_vui_from_annexb(const guint8 *annexb, gsize size) {
     g_byte_array_unref(rbsp);
 }
 
-// Cache last seen SPS/VUI to format pic_timing on frames without in-band SPS
-static SpsVuiInfo g_last_sps_info;
-static gboolean g_last_sps_valid = FALSE;
-// Cached patched SPS (Annex B EBSP) with pic_struct_present_flag forced to 1
-static GByteArray *g_patched_sps_ebsp = NULL;
-
 
 
 typedef struct SeiConfig {
@@ -99,15 +177,234 @@ typedef struct SeiConfig {
     GstClockTime last_pts_ns;
     guint last_sec;
     guint est_fps;
+    // Per-encoder SPS state (each encoder, e.g. a rendition, has its own SPS)
+    // Cache last seen SPS/VUI to format pic_timing on frames without in-band SPS
+    SpsVuiInfo last_sps_info;
+    gboolean last_sps_valid;
+    // Cached patched SPS (Annex B EBSP) with pic_struct_present_flag forced to 1
+    GByteArray *patched_sps_ebsp;
+    // Counters for the control API "stats" command (written by the encoder
+    // streaming thread only, read racily from the main loop)
+    guint64 frames_total;
+    guint64 frames_with_sei;
+    guint64 frames_with_cc;     // AUs that got an A/53 caption SEI
+    guint64 bytes_total;
+    guint64 keyframes;
+    // --no-h264parse: keep SPS/PPS on every IDR without h264parse. Last
+    // parameter sets sent, Annex B with start codes
+    gboolean repeat_parameter_sets;
+    GByteArray *last_sps;
+    GByteArray *last_pps;
+    guint64 parameter_sets_inserted;
+    // --avc-internal: NAL size field width from avcC (0 until the caps arrive)
+    guint avc_length_size;
+    // Per-frame records (main encoder only; NULL = off)
+    struct FrameStats *frame_stats;
 } SeiConfig;
 
+static void sei_config_free(SeiConfig *scfg) {
+    if (!scfg) return;
+    if (scfg->patched_sps_ebsp) g_byte_array_unref(scfg->patched_sps_ebsp);
+    if (scfg->last_sps) g_byte_array_unref(scfg->last_sps);
+    if (scfg->last_pps) g_byte_array_unref(scfg->last_pps);
+    g_free(scfg);
+}
+
+// Typed handles to every stage of the main graph (built by graph_build())
+typedef struct PipelineGraph {
+    GstElement *pipeline;   // borrowed, shared by every stream
+    // ingest
+    GstElement *ndisrc;
+    GstElement *demux;
+    GstElement *vselect;    // input-selector: primary / backup source video
+    GstElement *aselect;    // input-selector: primary / backup source audio
+    GstPad *primary_vpad;   // selector pads fed by the primary ndisrc
+    GstPad *primary_apad;
+    // video
+    GstElement *vqueue;
+    GstElement *vconvert;
+    GstElement *vcaps;
+    GstElement *raw_tee;    // raw 4:2:0 fan-out: main encoder + renditions
+    GstElement *sync_sink;  // --tc-sync: appsink feeding the aligner (after vcaps)
+    GstElement *sync_src;   // --tc-sync: appsrc fed by the aligner (before raw_tee)
+    GstElement *meta_src;   // --ndi-metadata: appsrc of KLV-wrapped NDI metadata into the mux
+    GstElement *gov_scale;  // --governor: videoscale ! capsfilter between raw_tee and the encoder
+    GstElement *gov_caps;
+    GstElement *enc;        // x264enc, or with --encoder-process the proxy bin for its worker
+    GstElement *enc_settings; // --encoder-process: the configured x264enc the workers copy
+    struct EncProcess *enc_process;
+    GstElement *parse;      // NULL with --no-h264parse
+    GstElement *parse_caps;
+    // audio
+    GstElement *aqueue;
+    GstElement *audio_enc;  // bin from build_audio_pipeline(), or fakesink with --no-audio
+    GstElement *audio_tee;  // encoded audio fan-out: main mux + renditions (NULL with --no-audio)
+    // mux / outputs
+    GstElement *mux;
+    GstElement *out_tee;
+} PipelineGraph;
+
+// The x264enc to read and set encoder properties on
+static GstElement* graph_encoder(const PipelineGraph *g) {
+    return g->enc_settings ? g->enc_settings : g->enc;
+}
+
+typedef enum {
+    BRANCH_OUTPUT,
+    BRANCH_RECORDING,
+    BRANCH_RENDITION,
+    BRANCH_BACKUP_SOURCE,
+    BRANCH_KIND_COUNT
+} BranchKind;
+
+static const gchar *branch_kind_names[BRANCH_KIND_COUNT] = {
+    "output", "recording", "rendition", "backup_source"
+};
+
+struct App;
+struct Stream;
+struct SrtGroupOutput;
+struct StdoutOutput;
+
+// Link between a branch bin and one of the graph's tees (sink branches)
+// or input-selectors (source branches)
+typedef struct BranchLink {
+    GstElement *fanout;
+    GstPad *fanout_pad;     // requested pad on the tee/selector
+    GstPad *bin_pad;        // ghost pad on the branch bin
+} BranchLink;
+
+// A hot-swappable branch of the graph
+typedef struct Branch {
+    struct Stream *stream;
+    BranchKind kind;
+    gchar *name;            // uri for outputs/recordings, user-given name otherwise
+    GstElement *bin;
+    GstElement *sink;       // final sink of sink branches (NULL for sources)
+    BranchLink links[2];
+    guint n_links;
+    gint pending_unlinks;   // detach: links still to be unlinked by their streaming threads
+    gint eos_drained;       // detach: EOS reached the final sink
+    gint64 detach_started_us;
+    gint64 attached_us;
+    SeiConfig *sei_cfg;     // renditions run their own injector
+    struct SrtGroupOutput *srt_group; // srtgroup:// destinations, fed from the appsink
+    struct StdoutOutput *stdout_out;  // batched stdout writer, fed from the appsink
+} Branch;
+
+// Measures how a reconfiguration disturbs the main encoded video path
+typedef struct GlitchMeter {
+    GMutex lock;
+    gboolean active;
+    gint kind;              // BranchKind or GLITCH_SOURCE_SWITCH
+    gchar *what;
+    GstClockTime last_pts;
+    gint64 last_arrival_us;
+    GstClockTime frame_duration;
+    GstClockTime max_pts_gap;
+    gint64 max_arrival_gap_us;
+    guint report_id;
+    gint last_frames[BRANCH_KIND_COUNT + 1]; // last measured glitch per kind (+ source switch); -1 = none
+} GlitchMeter;
+
+#define GLITCH_SOURCE_SWITCH BRANCH_KIND_COUNT
+static const gchar *glitch_kind_names[BRANCH_KIND_COUNT + 1] = {
+    "output", "recording", "rendition", "backup_source", "source_switch"
+};
+
+struct Aligner;
+
+// --ndi-metadata: metadata events seen on the ndisrc pad wait here for the
+// next video frame, whose PTS they take
+typedef struct NdiMetaTap {
+    GMutex lock;
+    GPtrArray *pending;     // GstEvent*, owned
+    gint n_pending;         // atomic mirror of pending->len, read by the video probe
+    gboolean primed;        // an empty KLV went out with the first frame
+    guint64 frames;         // metadata frames handed to the mux
+} NdiMetaTap;
+
+// --ndi-cache: how the primary receiver got connected, and the URL it tried
+struct NdiUrlLearner;
+typedef struct NdiConnect {
+    gchar *name;
+    gchar *url;             // cached url-address in use, NULL when connecting by name
+    gboolean pending;       // no frame yet
+    gboolean fell_back;     // the cached URL failed, retried by name
+    gint64 started_us;
+    gint64 connected_us;    // set by the probe on the first buffer
+    gint64 connect_ms;      // -1 until connected
+    gulong probe_id;
+    guint timeout_id;
+    guint done_id;
+    struct NdiUrlLearner *learner;
+} NdiConnect;
+
+// One NDI source and everything encoded from it (a plain run has one)
+typedef struct Stream {
+    struct App *app;
+    guint index;
+    gchar *ndi_name;
+    gchar *output_uri;      // primary output: "stdout", srt:// or a file
+    PipelineGraph graph;
+    SeiConfig *sei_cfg;
+    gulong sei_probe_id;
+    GList *branches;        // Branch*, owned
+    GlitchMeter glitch;
+    NdiMetaTap ndi_meta;
+    NdiConnect ndi_connect;
+    struct LtcDecoder *ltc; // --ltc-channel
+    struct QualityProbe *quality; // --quality-probe
+    struct TraceStream *trace; // --trace
+    struct ConvertCost *ingest; // videoconvert cost per frame
+    struct ConvertCost *audio_convert; // audioconvert cost per buffer (NULL with --no-audio)
+    struct FrameStats *frame_stats; // --frame-stats / "frame_stats" (NULL = off)
+    struct GovStream *governor; // --governor
+} Stream;
+
+// Runtime state shared between main() and the control socket
+typedef struct App {
+    AppConfig *cfg;
+    GMainLoop *loop;
+    GstElement *pipeline;   // one pipeline (one clock) for all streams
+    GPtrArray *streams;     // Stream*, owned
+    struct Aligner *aligner; // --tc-sync only
+    GstClock *clock;        // --clock / --serve-clock: pipeline clock on a shared epoch
+    GstNetTimeProvider *clock_provider;
+    struct ShmRingOutput *shm_ring; // --shm-ring
+    struct Tracer *tracer;  // --trace
+    struct FrameStatsFile *frame_stats_file; // --frame-stats
+    guint frame_stats_timer;
+    struct CpuAccount *cpu; // --cpu-stats / --control-socket, Linux only
+    CgroupLimits limits;    // read once at startup
+    gdouble budget_cpus;    // CPUs the streams are sized for
+    guint64 budget_memory;  // bytes, 0 = no limit
+    struct Governor *governor; // --governor
+    GSocketService *control;
+    gint64 started_us;
+    // Startup phases (monotonic us) for --startup-report
+    gint64 t_main_us;
+    gint64 t_init_us;
+    gint64 t_graph_us;
+    gint64 exec_to_main_us;  // -1 when the exec time is unknown
+    gboolean reached_playing;
+} App;
+
 static void print_usage(const char *prog) {
     g_printerr("Usage: %s --ndi-name <name> [options]\n\n", prog);
     g_printerr("Required:\n");
     g_printerr("  --ndi-name <name>     NDI source name to connect to\n\n");
     g_printerr("Output Options:\n");
     g_printerr("  --srt-uri <uri>       SRT endpoint URI (srt://host:port?mode=caller)\n");
-    g_printerr("  --stdout              Output MPEG-TS to stdout instead of SRT\n\n");
+    g_printerr("  --stdout              Output MPEG-TS to stdout instead of SRT\n");
+    g_printerr("  --stdout-batch <KiB>  Write stdout in batches of up to this size (default: 64, 0 = one write\n");
+    g_printerr("                        per mux buffer)\n");
+    g_printerr("  --stdout-flush-ms <ms>\n");
+    g_printerr("                        Longest a TS packet waits for its stdout batch (default: 5)\n");
+    g_printerr("  --stdout-writev       Copy batches into a stdout pipe with writev instead of vmsplice\n");
+    g_printerr("  --output <uri>        Add an output (srt://, srtgroup://, udp://, rtp://, file, stdout); repeatable.\n");
+    g_printerr("                        udp/rtp take ?ttl=&iface=&loop=&pace=<kbps>|off and rtp ?fec=1&fec-cols=&fec-rows=\n");
+    g_printerr("                        srtgroup://h1:p1,h2:p2 bonds links: ?mode=broadcast|backup&weights=&latency=\n\n");
     g_printerr("Encoding Options:\n");
     g_printerr("  --encoder <name>      Video encoder: x264enc, vtenc_h264, openh264enc\n");
     g_printerr("  --bitrate <kbps>      Video bitrate in kbps (default: 6000)\n");
@@ -118,17 +415,64 @@ static void print_usage(const char *prog) {
     g_printerr("  --no-audio            Disable audio processing\n");
     g_printerr("  --zerolatency         Enable ultra-low latency mode (default: on)\n");
     g_printerr("  --no-sei              Disable SEI timecode injection\n");
+    g_printerr("  --ndi-metadata        Carry NDI metadata frames (XML) in a KLV PID, timed to the video\n");
+    g_printerr("  --ltc-channel <n>     Take the timecode from SMPTE LTC on NDI audio channel n (1-based)\n");
+    g_printerr("  --quality-probe <N>   Measure PSNR/SSIM of one frame in N on a background thread (0 = off)\n");
+    g_printerr("  --no-h264parse        Skip h264parse; the SEI injector keeps SPS/PPS on every IDR\n");
+    g_printerr("  --avc-internal        Encoder outputs length-prefixed NALs; converted to Annex B once, before\n");
+    g_printerr("                        the mux (implies --no-h264parse)\n");
+    g_printerr("  --trace <path>        On SIGUSR1 or the \"trace\" command, record a per-frame timeline to path\n");
+    g_printerr("                        (Chrome/Perfetto JSON)\n");
+    g_printerr("  --trace-seconds <n>   Length of a trace window (default: 5, max 60)\n");
+    g_printerr("  --frame-stats <path>  Write a 32-byte record per encoded frame (type, size, QP, encode time)\n");
+    g_printerr("  --frame-stats-mb <n>  Rotate the --frame-stats file to <path>.1 at this size (default: 64)\n");
+    g_printerr("  --cpu-stats <s>       Log the CPU used per stage and stream every s seconds (Linux)\n");
+    g_printerr("  --cpu-budget <cpus>   CPUs to size encoder/converter threads for (default: cgroup quota/cpuset)\n");
+    g_printerr("  --encoder-threads <n> x264 threads per encoder (default: from the CPU budget when limited)\n");
+    g_printerr("  --governor            Halve frame rate, then resolution, of low-priority streams while\n");
+    g_printerr("                        frames run late or the CPU budget is spent; restore when it frees up\n");
+    g_printerr("  --priority <p,..>     Governor priority per stream, higher sheds last (default: 0)\n");
+    g_printerr("  --encoder-process     Run each stream's encoder in a worker process that is restarted if it\n");
+    g_printerr("                        crashes or hangs (Linux)\n");
     g_printerr("  --timeout <seconds>   Auto-exit after specified seconds (0 = disabled)\n");
     g_printerr("  --dump-ts <path>      Save MPEG-TS to file for debugging\n");
     g_printerr("  --timestamp-mode <m>  NDI timestamp mode: auto, timecode, timestamp, etc.\n");
+    g_printerr("  --ingest-format <f>   auto: native NDI format, converted at most once to a 4:2:0 format the\n");
+    g_printerr("                        encoder takes; i420: always convert to I420 (default: auto)\n");
     g_printerr("  --verbose             Enable debug stderr messages\n");
-    g_printerr("  --discover            Discover and list available NDI sources\n");
+    g_printerr("  --discover            Discover and list available NDI sources (and cache their URLs)\n");
+    g_printerr("  --ndi-cache <path|off> NDI name -> URL cache for direct connects\n");
+    g_printerr("                        (default: $XDG_CACHE_HOME/ndi2srt/ndi-sources.ini)\n");
+    g_printerr("  --ndi-cache-timeout <ms>\n");
+    g_printerr("                        Fall back to discovery when a cached URL sends nothing this long (default: 2000)\n");
+    g_printerr("  --control-socket <p>  Serve the JSON-lines runtime control API on UNIX socket <p>\n");
+    g_printerr("  --startup-report      Print exec->PLAYING startup phase timings\n\n");
+    g_printerr("Multi-source Options:\n");
+    g_printerr("  --stream <name>=<uri> Add an NDI source with its own output (repeatable)\n");
+    g_printerr("  --tc-sync             Align all sources frame by frame on timecode\n");
+    g_printerr("  --tc-sync-wait <ms>   Wait for a late source before repeating its frame (default: 40)\n");
+    g_printerr("  --tc-sync-idr <n>     Force IDRs on timecodes that are multiples of n frames\n");
+    g_printerr("                        (default: GOP size, or 50)\n");
+    g_printerr("  --mpts                Mux all sources into one MPTS (one program each) on the\n");
+    g_printerr("                        --srt-uri/--output; --bitrate is the total video budget\n");
+    g_printerr("                        and --stream takes just <ndi-name>\n");
+    g_printerr("  --mpts-weights <w,..> Budget share per program (default: equal)\n\n");
+    g_printerr("Clock Options:\n");
+    g_printerr("  --clock <spec>        Slave the pipeline to a network clock, base time 0:\n");
+    g_printerr("                        ptp[:<domain>], ntp:<host>[:<port>], net:<host>:<port>\n");
+    g_printerr("  --clock-sync-timeout <s> Wait for the network clock before starting (default: 10)\n");
+    g_printerr("  --serve-clock <port>  Serve the pipeline clock to other hosts (GstNetTimeProvider)\n\n");
+    g_printerr("Local Consumers:\n");
+    g_printerr("  --shm-ring <path>     Publish into a shared-memory ring; readers attach on UNIX socket <path>\n");
+    g_printerr("  --shm-ring-mode <m>   ts (muxed MPEG-TS, default) or au (H.264 access units + timecode)\n");
+    g_printerr("  --shm-ring-size <MB>  Ring size in MiB (default: 32)\n");
     g_printerr("  --help, -h            Show this help message\n\n");
     g_printerr("Examples:\n");
     g_printerr("  %s --discover                                    # List available NDI sources\n", prog);
     g_printerr("  %s --ndi-name \"Camera 1\" --srt-uri \"srt://receiver:9000?mode=caller\"\n", prog);
     g_printerr("  %s --ndi-name \"Camera 1\" --stdout --gop-size 25 --bitrate 8000\n", prog);
     g_printerr("  %s --ndi-name \"Camera 1\" --stdout --audio-codec smpte302m     # SMPTE 302M audio\n", prog);
+    g_printerr("  %s --stream \"CAM1=srt://rx:9001\" --stream \"CAM2=srt://rx:9002\" --tc-sync\n", prog);
 }
 
 static gboolean parse_args(int argc, char **argv, AppConfig *cfg) {
@@ -145,14 +489,29 @@ static gboolean parse_args(int argc, char **argv, AppConfig *cfg) {
     cfg->dump_ts_path = NULL;
     cfg->stdout_mode = FALSE;
     cfg->timestamp_mode = g_strdup("timecode");
+    cfg->ingest_format = g_strdup("auto");
     cfg->verbose = FALSE;
     cfg->discover = FALSE;
+    cfg->streams = g_ptr_array_new_with_free_func(g_free);
+    cfg->outputs = g_ptr_array_new_with_free_func(g_free);
+    cfg->mpts_weights = g_array_new(FALSE, FALSE, sizeof(guint));
+    cfg->priorities = g_array_new(FALSE, FALSE, sizeof(gint));
+    cfg->tc_sync_wait_ms = 40;
+    cfg->clock_sync_timeout = 10;
+    cfg->shm_ring_mb = 32;
+    cfg->stdout_batch_kb = 64;
+    cfg->ndi_cache_timeout_ms = 2000;
+    cfg->stdout_flush_ms = 5;
+    cfg->trace_seconds = 5;
+    cfg->frame_stats_mb = 64;
 
     for (int i = 1; i < argc; ++i) {
         if (g_strcmp0(argv[i], "--ndi-name") == 0 && i + 1 < argc) {
             cfg->ndi_name = g_strdup(argv[++i]);
         } else if (g_strcmp0(argv[i], "--srt-uri") == 0 && i + 1 < argc) {
             cfg->srt_uri = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--output") == 0 && i + 1 < argc) {
+            g_ptr_array_add(cfg->outputs, g_strdup(argv[++i]));
         } else if (g_strcmp0(argv[i], "--encoder") == 0 && i + 1 < argc) {
             g_free(cfg->encoder);
             cfg->encoder = g_strdup(argv[++i]);
@@ -173,6 +532,28 @@ static gboolean parse_args(int argc, char **argv, AppConfig *cfg) {
             cfg->zerolatency = TRUE;
         } else if (g_strcmp0(argv[i], "--no-sei") == 0) {
             cfg->inject_sei = FALSE;
+        } else if (g_strcmp0(argv[i], "--ndi-metadata") == 0) {
+            cfg->ndi_metadata = TRUE;
+        } else if (g_strcmp0(argv[i], "--ltc-channel") == 0 && i + 1 < argc) {
+            cfg->ltc_channel = atoi(argv[++i]);
+            if (cfg->ltc_channel < 1) {
+                g_printerr("Invalid --ltc-channel: %s (channels count from 1)\n", argv[i]);
+                return FALSE;
+            }
+        } else if (g_strcmp0(argv[i], "--no-h264parse") == 0) {
+            cfg->no_h264parse = TRUE;
+        } else if (g_strcmp0(argv[i], "--avc-internal") == 0) {
+            cfg->avc_internal = TRUE;
+            cfg->no_h264parse = TRUE;
+        } else if (g_strcmp0(argv[i], "--trace") == 0 && i + 1 < argc) {
+            g_free(cfg->trace_path);
+            cfg->trace_path = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--trace-seconds") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            cfg->trace_seconds = n > 0 ? (guint)n : 5;
+        } else if (g_strcmp0(argv[i], "--quality-probe") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            cfg->quality_probe = n > 0 ? (guint)n : 0;
         } else if (g_strcmp0(argv[i], "--timeout") == 0 && i + 1 < argc) {
             int t = atoi(argv[++i]);
             if (t < 0) t = 0;
@@ -183,11 +564,109 @@ static gboolean parse_args(int argc, char **argv, AppConfig *cfg) {
             cfg->verbose = TRUE;
         } else if (g_strcmp0(argv[i], "--discover") == 0) {
             cfg->discover = TRUE;
+        } else if (g_strcmp0(argv[i], "--ndi-cache") == 0 && i + 1 < argc) {
+            g_free(cfg->ndi_cache);
+            cfg->ndi_cache = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--ndi-cache-timeout") == 0 && i + 1 < argc) {
+            int ms = atoi(argv[++i]);
+            cfg->ndi_cache_timeout_ms = ms > 0 ? (guint)ms : 2000;
+        } else if (g_strcmp0(argv[i], "--control-socket") == 0 && i + 1 < argc) {
+            cfg->control_socket = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--startup-report") == 0) {
+            cfg->startup_report = TRUE;
+        } else if (g_strcmp0(argv[i], "--stream") == 0 && i + 1 < argc) {
+            // Checked once all args are in: --mpts takes plain source names
+            g_ptr_array_add(cfg->streams, g_strdup(argv[++i]));
+        } else if (g_strcmp0(argv[i], "--mpts") == 0) {
+            cfg->mpts = TRUE;
+        } else if (g_strcmp0(argv[i], "--mpts-weights") == 0 && i + 1 < argc) {
+            gchar **parts = g_strsplit(argv[++i], ",", -1);
+            for (gchar **w = parts; *w; ++w) {
+                guint weight = (guint)MAX(atoi(*w), 1);
+                g_array_append_val(cfg->mpts_weights, weight);
+            }
+            g_strfreev(parts);
+        } else if (g_strcmp0(argv[i], "--tc-sync") == 0) {
+            cfg->tc_sync = TRUE;
+        } else if (g_strcmp0(argv[i], "--tc-sync-wait") == 0 && i + 1 < argc) {
+            int ms = atoi(argv[++i]);
+            if (ms < 0) ms = 0;
+            cfg->tc_sync_wait_ms = (guint)ms;
+        } else if (g_strcmp0(argv[i], "--tc-sync-idr") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            if (n < 0) n = 0;
+            cfg->tc_sync_idr = (guint)n;
+        } else if (g_strcmp0(argv[i], "--clock") == 0 && i + 1 < argc) {
+            cfg->clock_spec = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--clock-sync-timeout") == 0 && i + 1 < argc) {
+            int t = atoi(argv[++i]);
+            if (t < 0) t = 0;
+            cfg->clock_sync_timeout = (guint)t;
+        } else if (g_strcmp0(argv[i], "--serve-clock") == 0 && i + 1 < argc) {
+            int port = atoi(argv[++i]);
+            if (port <= 0 || port > 65535) {
+                g_printerr("Invalid --serve-clock port: %s\n", argv[i]);
+                return FALSE;
+            }
+            cfg->serve_clock_port = (guint)port;
+        } else if (g_strcmp0(argv[i], "--shm-ring") == 0 && i + 1 < argc) {
+            cfg->shm_ring = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--shm-ring-mode") == 0 && i + 1 < argc) {
+            g_free(cfg->shm_ring_mode);
+            cfg->shm_ring_mode = g_strdup(argv[++i]);
+            if (g_strcmp0(cfg->shm_ring_mode, "ts") != 0 && g_strcmp0(cfg->shm_ring_mode, "au") != 0) {
+                g_printerr("Invalid --shm-ring-mode '%s' (ts|au)\n", cfg->shm_ring_mode);
+                return FALSE;
+            }
+        } else if (g_strcmp0(argv[i], "--shm-ring-size") == 0 && i + 1 < argc) {
+            int mb = atoi(argv[++i]);
+            cfg->shm_ring_mb = mb > 0 ? (guint)mb : 32;
         } else if (g_strcmp0(argv[i], "--stdout") == 0) {
             cfg->stdout_mode = TRUE;
+        } else if (g_strcmp0(argv[i], "--stdout-batch") == 0 && i + 1 < argc) {
+            int kb = atoi(argv[++i]);
+            cfg->stdout_batch_kb = kb > 0 ? (guint)MIN(kb, 4096) : 0;
+        } else if (g_strcmp0(argv[i], "--stdout-flush-ms") == 0 && i + 1 < argc) {
+            int ms = atoi(argv[++i]);
+            cfg->stdout_flush_ms = ms > 0 ? (guint)ms : 1;
+        } else if (g_strcmp0(argv[i], "--stdout-writev") == 0) {
+            cfg->stdout_writev = TRUE;
         } else if (g_strcmp0(argv[i], "--timestamp-mode") == 0 && i + 1 < argc) {
             g_free(cfg->timestamp_mode);
             cfg->timestamp_mode = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--frame-stats") == 0 && i + 1 < argc) {
+            g_free(cfg->frame_stats_path);
+            cfg->frame_stats_path = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--frame-stats-mb") == 0 && i + 1 < argc) {
+            int mb = atoi(argv[++i]);
+            cfg->frame_stats_mb = mb > 0 ? (guint)mb : 64;
+        } else if (g_strcmp0(argv[i], "--cpu-stats") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            cfg->cpu_stats_s = n > 0 ? (guint)n : 0;
+        } else if (g_strcmp0(argv[i], "--cpu-budget") == 0 && i + 1 < argc) {
+            double cpus = g_ascii_strtod(argv[++i], NULL);
+            cfg->cpu_budget = cpus > 0 ? cpus : 0;
+        } else if (g_strcmp0(argv[i], "--encoder-threads") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            cfg->encoder_threads = n > 0 ? (guint)n : 0;
+        } else if (g_strcmp0(argv[i], "--governor") == 0) {
+            cfg->governor = TRUE;
+        } else if (g_strcmp0(argv[i], "--priority") == 0 && i + 1 < argc) {
+            gchar **parts = g_strsplit(argv[++i], ",", -1);
+            for (gchar **p = parts; *p; ++p) {
+                gint priority = atoi(*p);
+                g_array_append_val(cfg->priorities, priority);
+            }
+            g_strfreev(parts);
+        } else if (g_strcmp0(argv[i], "--encoder-process") == 0) {
+            cfg->encoder_process = TRUE;
+        } else if (g_strcmp0(argv[i], "--ingest-format") == 0 && i + 1 < argc) {
+            g_free(cfg->ingest_format);
+            cfg->ingest_format = g_strdup(argv[++i]);
+            if (g_strcmp0(cfg->ingest_format, "auto") != 0 && g_strcmp0(cfg->ingest_format, "i420") != 0) {
+                g_printerr("Invalid --ingest-format '%s' (auto|i420)\n", cfg->ingest_format);
+                return FALSE;
+            }
         } else if (g_strcmp0(argv[i], "--help") == 0 || g_strcmp0(argv[i], "-h") == 0) {
             return FALSE;
         } else {
@@ -196,32 +675,372 @@ static gboolean parse_args(int argc, char **argv, AppConfig *cfg) {
         }
     }
 
+    if (!cfg->ndi_cache) {
+        cfg->ndi_cache = g_build_filename(g_get_user_cache_dir(), "ndi2srt", "ndi-sources.ini", NULL);
+    } else if (g_strcmp0(cfg->ndi_cache, "off") == 0) {
+        g_clear_pointer(&cfg->ndi_cache, g_free);
+    }
+
     // If discover mode is enabled, don't require other parameters
     if (cfg->discover) {
         return TRUE;
     }
     
-    if (!cfg->ndi_name || (!cfg->srt_uri && !cfg->stdout_mode)) {
+    gboolean have_output = cfg->srt_uri || cfg->stdout_mode || cfg->outputs->len > 0;
+    if (cfg->ndi_name ? !have_output : cfg->streams->len == 0) {
+        return FALSE;
+    }
+    for (guint i = 0; i < cfg->streams->len; ++i) {
+        const gchar *spec = g_ptr_array_index(cfg->streams, i);
+        const gchar *eq = strchr(spec, '=');
+        if (cfg->mpts ? eq != NULL : (!eq || eq == spec || eq[1] == '\0')) {
+            g_printerr("Invalid --stream '%s', expected %s\n", spec, cfg->mpts ? "<ndi-name> with --mpts" : "<ndi-name>=<output-uri>");
+            return FALSE;
+        }
+    }
+    if (cfg->mpts && !have_output) {
+        g_printerr("--mpts needs --srt-uri, --stdout or --output\n");
+        return FALSE;
+    }
+    if (cfg->tc_sync && (cfg->ndi_name ? 1 : 0) + cfg->streams->len < 2) {
+        g_printerr("--tc-sync needs at least two sources\n");
         return FALSE;
     }
+    if (cfg->tc_sync_idr == 0) cfg->tc_sync_idr = cfg->gop_size > 0 ? cfg->gop_size : 50;
 
     return TRUE;
 }
 
+// --- NDI URL cache (--ndi-cache) ---
+//
+// Connecting by name waits for NDI's mDNS discovery to find the sender,
+// which takes seconds and sometimes fails on busy networks. A small key file
+// maps each NDI name to the url-address where it was last found: one group
+// per name, written by --discover and after each successful connection.
+// ndisrc is given the cached url-address, and connects to it directly. If
+// no frame arrives within --ndi-cache-timeout (or the receiver errors
+// out), the entry is dropped and ndisrc restarts with the name alone. Once a
+// name-only connection delivers frames, a device monitor learns the
+// sender's URL in the background for the next start.
+
+#define NDI_LEARN_POLL_MS 500
+#define NDI_LEARN_POLLS 20
+
+static gboolean ndi_cache_usable_name(const gchar *name) {
+    // Key file group names cannot hold brackets or control characters
+    for (const gchar *p = name; *p; ++p) {
+        if (*p == '[' || *p == ']' || (guchar)*p < 0x20) return FALSE;
+    }
+    return *name != '\0';
+}
+
+static GKeyFile* ndi_cache_load(const gchar *path) {
+    GKeyFile *kf = g_key_file_new();
+    g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, NULL);
+    return kf;
+}
+
+static void ndi_cache_save(const gchar *path, GKeyFile *kf) {
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    GError *err = NULL;
+    // g_file_set_contents underneath: readers never see a half-written file
+    if (!g_key_file_save_to_file(kf, path, &err)) {
+        g_printerr("NDI cache: cannot write %s: %s\n", path, err->message);
+        g_clear_error(&err);
+    }
+}
+
+static gchar* ndi_cache_lookup(const gchar *path, const gchar *name) {
+    if (!path || !ndi_cache_usable_name(name)) return NULL;
+    GKeyFile *kf = ndi_cache_load(path);
+    gchar *url = g_key_file_get_string(kf, name, "url-address", NULL);
+    g_key_file_free(kf);
+    if (url && *url == '\0') g_clear_pointer(&url, g_free);
+    return url;
+}
+
+// connect_ms < 0: learned from discovery, no connection timed
+static void ndi_cache_store(const gchar *path, const gchar *name, const gchar *url, gint64 connect_ms) {
+    if (!path || !url || !*url || !ndi_cache_usable_name(name)) return;
+    GKeyFile *kf = ndi_cache_load(path);
+    g_key_file_set_string(kf, name, "url-address", url);
+    GDateTime *now = g_date_time_new_now_utc();
+    gchar *stamp = g_date_time_format_iso8601(now);
+    g_key_file_set_string(kf, name, connect_ms >= 0 ? "last-connected" : "last-seen", stamp);
+    g_free(stamp);
+    g_date_time_unref(now);
+    if (connect_ms >= 0) g_key_file_set_int64(kf, name, "connect-ms", connect_ms);
+    ndi_cache_save(path, kf);
+    g_key_file_free(kf);
+}
+
+static void ndi_cache_forget(const gchar *path, const gchar *name) {
+    if (!path || !ndi_cache_usable_name(name)) return;
+    GKeyFile *kf = ndi_cache_load(path);
+    if (g_key_file_remove_group(kf, name, NULL)) ndi_cache_save(path, kf);
+    g_key_file_free(kf);
+}
+
+// Background lookup of a sender's url-address after a name-only connection
+typedef struct NdiUrlLearner {
+    gchar *cache_path;
+    gchar *name;
+    gint64 connect_ms;
+    GstDeviceMonitor *monitor;
+    guint polls;
+    guint poll_id;
+} NdiUrlLearner;
+
+static void ndi_url_learner_free(NdiUrlLearner *l) {
+    if (!l) return;
+    if (l->poll_id) g_source_remove(l->poll_id);
+    gst_device_monitor_stop(l->monitor);
+    gst_object_unref(l->monitor);
+    g_free(l->cache_path);
+    g_free(l->name);
+    g_free(l);
+}
+
+static GstDeviceMonitor* ndi_device_monitor_new(void) {
+    GstDeviceMonitor *monitor = gst_device_monitor_new();
+    GstCaps *caps = gst_caps_new_empty_simple("application/x-ndi");
+    gst_device_monitor_add_filter(monitor, "Source/Network", caps);
+    gst_caps_unref(caps);
+    return monitor;
+}
+
+static gboolean ndi_url_learn_poll_cb(gpointer user_data) {
+    NdiConnect *nc = (NdiConnect*)user_data;
+    NdiUrlLearner *l = nc->learner;
+    gchar *url = NULL;
+    GList *devices = gst_device_monitor_get_devices(l->monitor);
+    for (GList *d = devices; d && !url; d = d->next) {
+        GstStructure *props = gst_device_get_properties(GST_DEVICE(d->data));
+        if (!props) continue;
+        if (g_strcmp0(gst_structure_get_string(props, "ndi-name"), l->name) == 0) {
+            url = g_strdup(gst_structure_get_string(props, "url-address"));
+        }
+        gst_structure_free(props);
+    }
+    g_list_free_full(devices, gst_object_unref);
+    if (url) {
+        ndi_cache_store(l->cache_path, l->name, url, l->connect_ms);
+        g_printerr("NDI cache: '%s' is at %s, cached for the next start\n", l->name, url);
+        g_free(url);
+    } else if (++l->polls < NDI_LEARN_POLLS) {
+        return G_SOURCE_CONTINUE;
+    }
+    l->poll_id = 0;
+    ndi_url_learner_free(l);
+    nc->learner = NULL;
+    return G_SOURCE_REMOVE;
+}
+
+static void ndi_connect_learn_url(NdiConnect *nc, const gchar *cache_path, gint64 connect_ms) {
+    ndi_url_learner_free(nc->learner);
+    NdiUrlLearner *l = g_new0(NdiUrlLearner, 1);
+    l->cache_path = g_strdup(cache_path);
+    l->name = g_strdup(nc->name);
+    l->connect_ms = connect_ms;
+    l->monitor = ndi_device_monitor_new();
+    nc->learner = l;
+    if (!gst_device_monitor_start(l->monitor)) {
+        ndi_url_learner_free(l);
+        nc->learner = NULL;
+        return;
+    }
+    l->poll_id = g_timeout_add(NDI_LEARN_POLL_MS, ndi_url_learn_poll_cb, nc);
+}
+
+// Main loop, once the first buffer left the receiver
+static gboolean ndi_connect_done_cb(gpointer user_data) {
+    Stream *st = (Stream*)user_data;
+    NdiConnect *nc = &st->ndi_connect;
+    nc->done_id = 0;
+    if (nc->timeout_id) {
+        g_source_remove(nc->timeout_id);
+        nc->timeout_id = 0;
+    }
+    nc->pending = FALSE;
+    gint64 ms = (nc->connected_us - nc->started_us) / 1000;
+    nc->connect_ms = ms;
+    const gchar *cache = st->app->cfg->ndi_cache;
+    if (nc->url) {
+        g_printerr("NDI '%s': connected via cached URL %s in %" G_GINT64_FORMAT " ms\n", nc->name, nc->url, ms);
+        ndi_cache_store(cache, nc->name, nc->url, ms);
+    } else {
+        g_printerr("NDI '%s': connected via discovery in %" G_GINT64_FORMAT " ms%s\n", nc->name, ms,
+                   nc->fell_back ? " (cached URL failed)" : "");
+        if (cache && ndi_cache_usable_name(nc->name)) ndi_connect_learn_url(nc, cache, ms);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn ndi_connect_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Stream *st = (Stream*)user_data;
+    NdiConnect *nc = &st->ndi_connect;
+    nc->connected_us = g_get_monotonic_time();
+    nc->probe_id = 0;
+    nc->done_id = g_idle_add(ndi_connect_done_cb, st);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+// Give up on the cached URL: forget it and restart the receiver by name
+static void ndi_connect_fall_back(Stream *st, const gchar *why) {
+    NdiConnect *nc = &st->ndi_connect;
+    if (!nc->pending || !nc->url || nc->done_id || nc->connected_us) return;
+    g_printerr("NDI '%s': cached URL %s %s, falling back to discovery\n", nc->name, nc->url, why);
+    ndi_cache_forget(st->app->cfg->ndi_cache, nc->name);
+    g_clear_pointer(&nc->url, g_free);
+    nc->fell_back = TRUE;
+    if (nc->timeout_id) {
+        g_source_remove(nc->timeout_id);
+        nc->timeout_id = 0;
+    }
+    gst_element_set_state(st->graph.ndisrc, GST_STATE_NULL);
+    g_object_set(st->graph.ndisrc, "url-address", NULL, NULL);
+    gst_element_sync_state_with_parent(st->graph.ndisrc);
+}
+
+static gboolean ndi_connect_timeout_cb(gpointer user_data) {
+    Stream *st = (Stream*)user_data;
+    st->ndi_connect.timeout_id = 0;
+    gchar *why = g_strdup_printf("sent nothing in %u ms", st->app->cfg->ndi_cache_timeout_ms);
+    ndi_connect_fall_back(st, why);
+    g_free(why);
+    return G_SOURCE_REMOVE;
+}
+
+// An error from a receiver still trying its cached URL is not fatal
+static gboolean ndi_connect_handle_error(App *app, GstMessage *msg) {
+    for (guint i = 0; app->streams && i < app->streams->len; ++i) {
+        Stream *st = (Stream*)g_ptr_array_index(app->streams, i);
+        if (GST_MESSAGE_SRC(msg) != GST_OBJECT(st->graph.ndisrc) || !st->ndi_connect.pending || !st->ndi_connect.url) continue;
+        GError *err = NULL;
+        gst_message_parse_error(msg, &err, NULL);
+        gchar *why = g_strdup_printf("failed (%s)", err ? err->message : "unknown error");
+        ndi_connect_fall_back(st, why);
+        g_free(why);
+        if (err) g_error_free(err);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Point the receiver at name, through its cached URL when there is one.
+// The receiver must not be running yet (or be stopped); the caller starts it
+// and then calls stream_ndi_connect_started().
+static void stream_ndi_connect(Stream *st, const gchar *name) {
+    NdiConnect *nc = &st->ndi_connect;
+    if (nc->timeout_id) g_source_remove(nc->timeout_id);
+    if (nc->done_id) g_source_remove(nc->done_id);
+    g_free(nc->name);
+    g_free(nc->url);
+    nc->name = g_strdup(name);
+    nc->url = ndi_cache_lookup(st->app->cfg->ndi_cache, name);
+    nc->timeout_id = 0;
+    nc->done_id = 0;
+    nc->fell_back = FALSE;
+    nc->pending = TRUE;
+    nc->connected_us = 0;
+    nc->connect_ms = -1;
+    nc->started_us = g_get_monotonic_time();
+    g_object_set(st->graph.ndisrc, "ndi-name", name, "url-address", nc->url, NULL);
+    if (!nc->probe_id) {
+        GstPad *pad = gst_element_get_static_pad(st->graph.ndisrc, "src");
+        nc->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, ndi_connect_probe, st, NULL);
+        gst_object_unref(pad);
+    }
+    if (nc->url && st->app->cfg->verbose) g_printerr("NDI '%s': trying cached URL %s\n", name, nc->url);
+}
+
+// The receiver is running: time the connection from here and, on a cached
+// URL, start the fallback timer
+static void stream_ndi_connect_started(Stream *st) {
+    NdiConnect *nc = &st->ndi_connect;
+    if (!nc->pending || nc->connected_us) return;
+    nc->started_us = g_get_monotonic_time();
+    if (nc->url && !nc->timeout_id) {
+        nc->timeout_id = g_timeout_add(st->app->cfg->ndi_cache_timeout_ms, ndi_connect_timeout_cb, st);
+    }
+}
+
+static void ndi_connect_clear(NdiConnect *nc) {
+    if (nc->timeout_id) g_source_remove(nc->timeout_id);
+    if (nc->done_id) g_source_remove(nc->done_id);
+    ndi_url_learner_free(nc->learner);
+    g_free(nc->name);
+    g_free(nc->url);
+}
+
+static void ndi_connect_add_stats(JsonBuilder *b, NdiConnect *nc) {
+    json_builder_set_member_name(b, "ndi_connect");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "path");
+    json_builder_add_string_value(b, nc->pending ? "connecting" : nc->url ? "cache" : nc->fell_back ? "cache_failed_discovery" : "discovery");
+    if (nc->url) {
+        json_builder_set_member_name(b, "url_address");
+        json_builder_add_string_value(b, nc->url);
+    }
+    if (nc->connect_ms >= 0) {
+        json_builder_set_member_name(b, "connect_ms");
+        json_builder_add_int_value(b, nc->connect_ms);
+    }
+    json_builder_end_object(b);
+}
+
+static void report_startup(App *app) {
+    gint64 now = g_get_monotonic_time();
+    gint64 to_playing = now - app->t_main_us;
+    g_printerr("Startup: exec->main=");
+    if (app->exec_to_main_us >= 0) g_printerr("%.1f", app->exec_to_main_us / 1000.0);
+    else g_printerr("n/a");
+    g_printerr(" ms, gst_init=%.1f ms, graph=%.1f ms, ->PLAYING=%.1f ms, exec->PLAYING=",
+               (app->t_init_us - app->t_main_us) / 1000.0,
+               (app->t_graph_us - app->t_init_us) / 1000.0,
+               (now - app->t_graph_us) / 1000.0);
+    if (app->exec_to_main_us >= 0) g_printerr("%.1f ms", (app->exec_to_main_us + to_playing) / 1000.0);
+    else g_printerr("n/a");
+    g_printerr(" (%s plugins)\n",
+#ifdef NDI2SRT_STATIC_PLUGINS
+               "static"
+#else
+               "dynamic"
+#endif
+               );
+}
+
 static gboolean bus_msg_cb(GstBus *bus, GstMessage *msg, gpointer user_data) {
+    App *app = (App*)user_data;
     switch (GST_MESSAGE_TYPE(msg)) {
         case GST_MESSAGE_ERROR: {
+            if (ndi_connect_handle_error(app, msg)) break;
             GError *err = NULL; gchar *dbg = NULL;
             gst_message_parse_error(msg, &err, &dbg);
             g_printerr("ERROR: %s\n", err ? err->message : "(unknown)");
             if (dbg) { g_printerr("DEBUG: %s\n", dbg); g_free(dbg);} 
             if (err) g_error_free(err);
-            g_main_loop_quit((GMainLoop*)user_data);
+            g_main_loop_quit(app->loop);
             break;
         }
         case GST_MESSAGE_EOS:
-            g_main_loop_quit((GMainLoop*)user_data);
+            g_main_loop_quit(app->loop);
+            break;
+        case GST_MESSAGE_STATE_CHANGED: {
+            if (GST_MESSAGE_SRC(msg) != GST_OBJECT(app->pipeline) || app->reached_playing) break;
+            GstState newstate;
+            gst_message_parse_state_changed(msg, NULL, &newstate, NULL);
+            if (newstate == GST_STATE_PLAYING) {
+                app->reached_playing = TRUE;
+                for (guint i = 0; i < app->streams->len; ++i) {
+                    stream_ndi_connect_started((Stream*)g_ptr_array_index(app->streams, i));
+                }
+                if (app->cfg->startup_report) report_startup(app);
+            }
             break;
+        }
         default:
             break;
     }
@@ -244,48 +1063,157 @@ static gboolean element_has_property(GstElement *element, const gchar *prop_name
     return pspec != NULL;
 }
 
-static gchar* build_audio_pipeline(const gchar *audio_codec, gint audio_bitrate_kbps) {
-    if (g_strcmp0(audio_codec, "aac") == 0) {
-        if (audio_bitrate_kbps > 0) {
-            return g_strdup_printf("audioconvert ! avenc_aac bitrate=%d", audio_bitrate_kbps * 1000);
-        } else {
-            return g_strdup("audioconvert ! avenc_aac");
-        }
-    } else if (g_strcmp0(audio_codec, "mp3") == 0) {
-        if (audio_bitrate_kbps > 0) {
-            return g_strdup_printf("audioconvert ! lamemp3enc bitrate=%d", audio_bitrate_kbps);
-        } else {
-            return g_strdup("audioconvert ! lamemp3enc");
+// Remove a socket left behind by an earlier run; anything else at path
+// (a mistyped option pointing at a real file) is left alone, and the bind
+// then fails with "address in use"
+static void unlink_stale_socket(const gchar *path) {
+    GStatBuf st;
+    if (g_lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) g_unlink(path);
+}
+
+// Raw layout an audio encoder takes natively, from its sink pad template:
+// F32LE planar (what NDI delivers) whenever the encoder accepts it at all,
+// otherwise its first format/layout. NULL when the factory is missing.
+static gchar* audio_encoder_native_caps(const gchar *factory_name) {
+    GstElementFactory *factory = gst_element_factory_find(factory_name);
+    if (!factory) return NULL;
+    gchar *desc = NULL;
+    for (const GList *l = gst_element_factory_get_static_pad_templates(factory); l && !desc; l = l->next) {
+        GstStaticPadTemplate *tmpl = (GstStaticPadTemplate*)l->data;
+        if (tmpl->direction != GST_PAD_SINK) continue;
+        GstCaps *caps = gst_static_caps_get(&tmpl->static_caps);
+        if (!gst_caps_is_empty(caps) && !gst_caps_is_any(caps)) {
+            GstStructure *s = gst_structure_copy(gst_caps_get_structure(caps, 0));
+            gst_structure_fixate_field_string(s, "format", "F32LE");
+            gst_structure_fixate_field_string(s, "layout", "non-interleaved");
+            const gchar *format = gst_structure_get_string(s, "format");
+            const gchar *layout = gst_structure_get_string(s, "layout");
+            if (format) {
+                desc = layout ? g_strdup_printf("audio/x-raw,format=%s,layout=%s", format, layout)
+                              : g_strdup_printf("audio/x-raw,format=%s", format);
+            }
+            gst_structure_free(s);
         }
+        gst_caps_unref(caps);
+    }
+    gst_object_unref(factory);
+    return desc;
+}
+
+// audioconvert ! <encoder's native layout> ! encoder. NDI audio is planar
+// float: when ndisrcdemux delivers it that way, audioconvert negotiates
+// passthrough into avenc_aac/avenc_ac3 and never touches a sample. Otherwise
+// it converts once, straight into the layout the encoder works in, rather
+// than into whatever negotiation happened to fixate first. The elements are
+// named aconv/aenc for the cost probe (stream_install_convert_cost()).
+static gchar* build_audio_pipeline(const gchar *audio_codec, gint audio_bitrate_kbps) {
+    if (g_strcmp0(audio_codec, "smpte302m") == 0) {
+        // SMPTE 302M doesn't use bitrate - it's uncompressed PCM wrapped (S16LE or S32LE)
+        return g_strdup("audioconvert name=aconv ! audio/x-raw,format=S16LE,channels=2,rate=48000 ! avenc_s302m name=aenc");
+    }
+    const gchar *encoder = "avenc_aac";
+    gint bitrate = audio_bitrate_kbps * 1000;  // libav encoders take bit/s
+    if (g_strcmp0(audio_codec, "mp3") == 0) {
+        encoder = "lamemp3enc";
+        bitrate = audio_bitrate_kbps;
     } else if (g_strcmp0(audio_codec, "ac3") == 0) {
-        if (audio_bitrate_kbps > 0) {
-            return g_strdup_printf("audioconvert ! avenc_ac3 bitrate=%d", audio_bitrate_kbps * 1000);
+        encoder = "avenc_ac3";
+    } else if (g_strcmp0(audio_codec, "aac") != 0) {
+        g_printerr("Warning: Unknown audio codec '%s', falling back to AAC\n", audio_codec);
+    }
+    gchar *native = audio_encoder_native_caps(encoder);
+    gchar *params = audio_bitrate_kbps > 0 ? g_strdup_printf(" bitrate=%d", bitrate) : g_strdup("");
+    gchar *desc = g_strdup_printf("audioconvert name=aconv ! %s%s%s name=aenc%s",
+                                  native ? native : "", native ? " ! " : "", encoder, params);
+    g_free(params);
+    g_free(native);
+    return desc;
+}
+
+// --- Network clock (cross-host alignment) ---
+
+// Create the clock named by --clock:
+//   ptp[:<domain>]         IEEE 1588 (needs gst-ptp-helper), TAI epoch
+//   ntp:<host>[:<port>]    NTPv4 server, NTP epoch
+//   net:<host>:<port>      GstNetTimeProvider of another ndi2srt (--serve-clock)
+static GstClock* make_network_clock(const gchar *spec, GError **error) {
+    gchar **parts = g_strsplit(spec, ":", 3);
+    guint n = g_strv_length(parts);
+    GstClock *clock = NULL;
+    if (n >= 1 && g_strcmp0(parts[0], "ptp") == 0 && n <= 2) {
+        guint domain = n == 2 ? (guint)atoi(parts[1]) : 0;
+        if (!gst_ptp_is_initialized() && !gst_ptp_init(GST_PTP_CLOCK_ID_NONE, NULL)) {
+            g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+                        "PTP initialisation failed (is gst-ptp-helper installed with the needed privileges?)");
         } else {
-            return g_strdup("audioconvert ! avenc_ac3");
+            clock = gst_ptp_clock_new("ptp-clock", domain);
         }
-    } else if (g_strcmp0(audio_codec, "smpte302m") == 0) {
-        // SMPTE 302M doesn't use bitrate - it's uncompressed PCM wrapped (S16LE or S32LE)  
-        return g_strdup("audioconvert ! audio/x-raw,format=S16LE,channels=2,rate=48000 ! avenc_s302m");
+    } else if (n >= 2 && g_strcmp0(parts[0], "ntp") == 0 && parts[1][0] != '\0') {
+        gint port = n == 3 ? atoi(parts[2]) : 123;
+        clock = gst_ntp_clock_new("ntp-clock", parts[1], port, 0);
+    } else if (n == 3 && g_strcmp0(parts[0], "net") == 0 && parts[1][0] != '\0') {
+        clock = gst_net_client_clock_new("net-clock", parts[1], atoi(parts[2]), 0);
     } else {
-        g_printerr("Warning: Unknown audio codec '%s', falling back to AAC\n", audio_codec);
-        if (audio_bitrate_kbps > 0) {
-            return g_strdup_printf("audioconvert ! avenc_aac bitrate=%d", audio_bitrate_kbps * 1000);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "invalid --clock '%s' (ptp[:domain], ntp:host[:port], net:host:port)", spec);
+    }
+    if (!clock && error && !*error) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "could not create clock '%s'", spec);
+    }
+    g_strfreev(parts);
+    return clock;
+}
+
+// Make the pipeline clock shared across hosts: slave it to a network clock
+// (--clock) or serve it (--serve-clock), and pin base time to 0 so running
+// time, and with it every PTS, is the clock's own epoch on every host.
+static gboolean clock_setup(App *app, GError **error) {
+    AppConfig *cfg = app->cfg;
+    if (cfg->clock_spec) {
+        app->clock = make_network_clock(cfg->clock_spec, error);
+        if (!app->clock) return FALSE;
+        g_printerr("Clock: waiting up to %us for %s to sync...\n", cfg->clock_sync_timeout, cfg->clock_spec);
+        if (gst_clock_wait_for_sync(app->clock, (GstClockTime)cfg->clock_sync_timeout * GST_SECOND)) {
+            g_printerr("Clock: %s synced\n", cfg->clock_spec);
         } else {
-            return g_strdup("audioconvert ! avenc_aac");
+            g_printerr("Warning: clock %s not synced yet, starting anyway\n", cfg->clock_spec);
+        }
+    } else if (cfg->serve_clock_port) {
+        // Serve wall-clock time so every host (and the PTS timecode fallback) sees UTC
+        app->clock = GST_CLOCK(g_object_new(GST_TYPE_SYSTEM_CLOCK, "name", "realtime-clock",
+                                            "clock-type", GST_CLOCK_TYPE_REALTIME, NULL));
+        gst_object_ref_sink(app->clock);
+    } else {
+        return TRUE;
+    }
+    gst_pipeline_use_clock(GST_PIPELINE(app->pipeline), app->clock);
+    gst_element_set_start_time(app->pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(app->pipeline, 0);
+
+    if (cfg->serve_clock_port) {
+        app->clock_provider = gst_net_time_provider_new(app->clock, NULL, (gint)cfg->serve_clock_port);
+        if (!app->clock_provider) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "could not serve the clock on port %u",
+                        cfg->serve_clock_port);
+            return FALSE;
         }
+        g_printerr("Clock: serving pipeline clock on UDP port %u\n", cfg->serve_clock_port);
     }
+    return TRUE;
+}
+
+static void clock_teardown(App *app) {
+    if (app->clock_provider) gst_object_unref(app->clock_provider);
+    if (app->clock) gst_object_unref(app->clock);
+    app->clock_provider = NULL;
+    app->clock = NULL;
 }
 
-static void discover_ndi_sources(void) {
+static void discover_ndi_sources(const gchar *cache_path) {
     g_printerr("Discovering NDI sources...\n");
     
-    // Create a device monitor for NDI sources
-    GstDeviceMonitor *monitor = gst_device_monitor_new();
-    
-    // Add filter for NDI sources (Source/Network:application/x-ndi)
-    GstCaps *caps = gst_caps_new_empty_simple("application/x-ndi");
-    gst_device_monitor_add_filter(monitor, "Source/Network", caps);
-    gst_caps_unref(caps);
+    // Create a device monitor for NDI sources (Source/Network:application/x-ndi)
+    GstDeviceMonitor *monitor = ndi_device_monitor_new();
     
     g_printerr("Scanning for NDI sources (this may take a few seconds)...\n");
     
@@ -338,6 +1266,7 @@ static void discover_ndi_sources(void) {
                 if (url_address) {
                     g_printerr("      URL Address: %s\n", url_address);
                 }
+                if (ndi_name && url_address) ndi_cache_store(cache_path, ndi_name, url_address, -1);
                 gst_structure_free(props);
             }
             
@@ -402,7 +1331,91 @@ static gint startcode_len_at(const guint8 *data, gint size, gint pos) {
     return 0;
 }
 
-static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
+// Closed captions: the cc_data of every GstVideoCaptionMeta on the frame
+// (attached by the NDI source, carried through the encoder like the timecode
+// meta) goes out as an ATSC A/53 user_data_registered_itu_t_t35 SEI next to
+// pic_timing, in the same AU rewrite.
+#define A53_MAX_CC_COUNT 31         // cc_count is 5 bits
+
+static guint cc_append(guint8 *cc, guint count, guint8 b0, guint8 b1, guint8 b2) {
+    if (count >= A53_MAX_CC_COUNT) return count;
+    cc[count * 3] = b0;
+    cc[count * 3 + 1] = b1;
+    cc[count * 3 + 2] = b2;
+    return count + 1;
+}
+
+// Fill cc with cc_data triplets (marker/valid/type, data1, data2); returns the count
+static guint collect_caption_cc_data(GstBuffer *buf, guint8 cc[A53_MAX_CC_COUNT * 3]) {
+    guint count = 0;
+    gpointer state = NULL;
+    GstMeta *meta;
+    while ((meta = gst_buffer_iterate_meta_filtered(buf, &state, GST_VIDEO_CAPTION_META_API_TYPE))) {
+        const GstVideoCaptionMeta *cm = (const GstVideoCaptionMeta*)meta;
+        const guint8 *d = cm->data;
+        gsize n = cm->size, i = 0;
+        switch (cm->caption_type) {
+            case GST_VIDEO_CAPTION_TYPE_CEA708_RAW:
+                for (; i + 3 <= n; i += 3) count = cc_append(cc, count, d[i], d[i + 1], d[i + 2]);
+                break;
+            case GST_VIDEO_CAPTION_TYPE_CEA608_RAW:
+                // field 1 byte pairs
+                for (; i + 2 <= n; i += 2) count = cc_append(cc, count, 0xFC, d[i], d[i + 1]);
+                break;
+            case GST_VIDEO_CAPTION_TYPE_CEA608_S334_1A:
+                // line byte: MSB set for field 1
+                for (; i + 3 <= n; i += 3) count = cc_append(cc, count, (d[i] & 0x80) ? 0xFC : 0xFD, d[i + 1], d[i + 2]);
+                break;
+            case GST_VIDEO_CAPTION_TYPE_CEA708_CDP:
+                // cdp_header (7 bytes), optional time_code_section (5), ccdata_section (0x72)
+                if (n < 9 || d[0] != 0x96 || d[1] != 0x69) break;
+                i = 7 + ((d[4] & 0x80) ? 5 : 0);
+                if (i + 2 > n || d[i] != 0x72) break;
+                for (gsize k = 0, m = d[i + 1] & 0x1F, j = i + 2; k < m && j + 3 <= n; ++k, j += 3) {
+                    count = cc_append(cc, count, d[j], d[j + 1], d[j + 2]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return count;
+}
+
+// Annex B SEI NAL carrying one A/53 cc_data() in user_data_registered_itu_t_t35 (payload type 4)
+static GByteArray* build_a53_cc_sei_nal(const guint8 *cc, guint count) {
+    guint8 rbsp[2 + 11 + A53_MAX_CC_COUNT * 3 + 1];
+    gsize n = 0;
+    rbsp[n++] = 4;                      // payloadType
+    rbsp[n++] = (guint8)(11 + count * 3); // payloadSize
+    rbsp[n++] = 0xB5;                   // itu_t_t35_country_code: United States
+    rbsp[n++] = 0x00;                   // itu_t_t35_provider_code: ATSC
+    rbsp[n++] = 0x31;
+    memcpy(rbsp + n, "GA94", 4);        // ATSC_user_identifier
+    n += 4;
+    rbsp[n++] = 0x03;                   // user_data_type_code: cc_data
+    rbsp[n++] = 0x40 | count;           // process_cc_data_flag, cc_count
+    rbsp[n++] = 0xFF;                   // em_data
+    memcpy(rbsp + n, cc, count * 3);
+    n += count * 3;
+    rbsp[n++] = 0xFF;                   // marker_bits
+    rbsp[n++] = 0x80;                   // rbsp_trailing_bits
+    return build_annexb_from_rbsp_and_header(rbsp, n, 0x06);
+}
+
+// Timecode (pic_timing) and caption SEI NALs for one AU, Annex B with start
+// codes; either may be NULL. With scan_sps the SPS VUI is taken from the AU
+// itself when it carries one (Annex B), otherwise from the last one cached.
+// Returns FALSE when the AU gets neither.
+typedef struct AuSei {
+    GByteArray *sei;
+    GByteArray *cc_sei;
+    gboolean have_tc;
+    gboolean drop_frame;
+    guint hours, minutes, seconds, frame;
+} AuSei;
+
+static gboolean build_au_sei(SeiConfig *scfg, GstBuffer *inbuf, gboolean scan_sps, AuSei *out) {
     guint hours = 0, minutes = 0, seconds = 0, frame = 0;
     gboolean have_tc = FALSE;
     gboolean drop_frame = FALSE;
@@ -458,13 +1471,16 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
         have_tc = TRUE;
     }
     
-    if (!have_tc) {
-        return gst_buffer_ref(inbuf);
+    guint8 cc[A53_MAX_CC_COUNT * 3];
+    guint cc_count = collect_caption_cc_data(inbuf, cc);
+    if (!have_tc && cc_count == 0) {
+        return FALSE;
     }
+    GByteArray *cc_sei = cc_count > 0 ? build_a53_cc_sei_nal(cc, cc_count) : NULL;
     
     // Build Picture Timing SEI based on SPS/VUI
     GByteArray *sei = NULL;
-    {
+    if (have_tc && scan_sps) {
         GstMapInfo spsmap;
         if (gst_buffer_map(inbuf, &spsmap, GST_MAP_READ)) {
             SpsVuiInfo info; memset(&info, 0, sizeof(info));
@@ -476,7 +1492,7 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
                 info.cpb_removal_delay_length = 0;
                 info.dpb_output_delay_length = 0;
                 info.time_offset_length = 0;
-                g_last_sps_info = info; g_last_sps_valid = TRUE;
+                scfg->last_sps_info = info; scfg->last_sps_valid = TRUE;
                 // Debug: print effective SPS flags
                 if (scfg->verbose) {
                     g_printerr("SPS VUI: pic_struct_present=%d, HRD=%d, cpb_len=%u, dpb_len=%u, to_len=%u, timing_info=%d, num_units_in_tick=%u, time_scale=%u, fixed_frame_rate=%d\n",
@@ -491,14 +1507,14 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
             gst_buffer_unmap(inbuf, &spsmap);
         }
     }
-    if (!sei) {
-        if (g_last_sps_valid) {
+    if (!sei && have_tc) {
+        if (scfg->last_sps_valid) {
             // clear HRD expectations on cached info too
-            g_last_sps_info.cpb_dpb_delays_present_flag = FALSE;
-            g_last_sps_info.cpb_removal_delay_length = 0;
-            g_last_sps_info.dpb_output_delay_length = 0;
-            g_last_sps_info.time_offset_length = 0;
-            sei = build_pic_timing_sei_nal_from_sps(&g_last_sps_info, drop_frame, frame, seconds, minutes, hours);
+            scfg->last_sps_info.cpb_dpb_delays_present_flag = FALSE;
+            scfg->last_sps_info.cpb_removal_delay_length = 0;
+            scfg->last_sps_info.dpb_output_delay_length = 0;
+            scfg->last_sps_info.time_offset_length = 0;
+            sei = build_pic_timing_sei_nal_from_sps(&scfg->last_sps_info, drop_frame, frame, seconds, minutes, hours);
         } else {
             // If SPS not present in this AU, emit minimal pic_timing
             SpsVuiInfo def = { FALSE, FALSE, FALSE, 0, 0, 0 };
@@ -506,12 +1522,33 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
         }
     }
 
+    out->sei = sei;
+    out->cc_sei = cc_sei;
+    out->have_tc = have_tc;
+    out->drop_frame = drop_frame;
+    out->hours = hours;
+    out->minutes = minutes;
+    out->seconds = seconds;
+    out->frame = frame;
+    return TRUE;
+}
+
+static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
+    AuSei au_sei;
+    if (!build_au_sei(scfg, inbuf, TRUE, &au_sei)) return gst_buffer_ref(inbuf);
+    GByteArray *sei = au_sei.sei;
+    GByteArray *cc_sei = au_sei.cc_sei;
+    gboolean have_tc = au_sei.have_tc;
+    gboolean drop_frame = au_sei.drop_frame;
+    guint hours = au_sei.hours, minutes = au_sei.minutes, seconds = au_sei.seconds, frame = au_sei.frame;
+
     // Allocate output and append original buffer data
     gsize sei_len = sei ? sei->len : 0;
     gsize in_size = gst_buffer_get_size(inbuf);
     GstMapInfo inmap;
     if (!gst_buffer_map(inbuf, &inmap, GST_MAP_READ)) {
         if (sei) g_byte_array_unref(sei);
+        if (cc_sei) g_byte_array_unref(cc_sei);
         return gst_buffer_ref(inbuf);
     }
 
@@ -537,14 +1574,14 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
             } else if (nal_type == 7) {
                 sps_present = TRUE;
                 // opportunistically build patched SPS cache if not yet cached
-                if (g_patched_sps_ebsp == NULL && next > nal_start + 1) {
+                if (scfg->patched_sps_ebsp == NULL && next > nal_start + 1) {
                     guint fpsn = scfg ? (scfg->fps_n ? scfg->fps_n : (scfg->est_fps ? scfg->est_fps : 25)) : 25;
                     guint fpsd = scfg ? (scfg->fps_d ? scfg->fps_d : 1) : 1;
-                    g_patched_sps_ebsp = patch_sps_pic_struct_and_timing(inmap.data + nal_start + 1,
+                    scfg->patched_sps_ebsp = patch_sps_pic_struct_and_timing(inmap.data + nal_start + 1,
                                                                           (gsize)(next - (nal_start + 1)), nal_hdr,
                                                                           fpsn, fpsd);
-                    if (g_patched_sps_ebsp && scfg->verbose) {
-                        log_sps_vui_from_annexb(g_patched_sps_ebsp->data, g_patched_sps_ebsp->len);
+                    if (scfg->patched_sps_ebsp && scfg->verbose) {
+                        log_sps_vui_from_annexb(scfg->patched_sps_ebsp->data, scfg->patched_sps_ebsp->len);
                     }
                 }
             } else if (nal_type == 5) {
@@ -562,11 +1599,12 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
     if (pos0 < 0) {
         gst_buffer_unmap(inbuf, &inmap);
         if (sei) g_byte_array_unref(sei);
+        if (cc_sei) g_byte_array_unref(cc_sei);
         return gst_buffer_ref(inbuf);
     }
 
     // Inject patched SPS before SEI on every AU that either contains an SPS or follows an IDR
-    gboolean inject_patched_sps = (g_patched_sps_ebsp && g_patched_sps_ebsp->len > 0) && (sps_present || idr_present);
+    gboolean inject_patched_sps = (scfg->patched_sps_ebsp && scfg->patched_sps_ebsp->len > 0) && (sps_present || idr_present);
 
     // Build the new AU dynamically for exact length
     GByteArray *out_arr = g_byte_array_new();
@@ -575,9 +1613,9 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
         // copy AUD region
         g_byte_array_append(out_arr, inmap.data, aud_end);
         // If this AU contains SPS or we need to inject before IDR, ensure patched SPS comes before SEI
-        gboolean want_before_sei = (g_patched_sps_ebsp && g_patched_sps_ebsp->len > 0) && (sps_present || inject_patched_sps);
+        gboolean want_before_sei = (scfg->patched_sps_ebsp && scfg->patched_sps_ebsp->len > 0) && (sps_present || inject_patched_sps);
         if (want_before_sei) {
-            g_byte_array_append(out_arr, g_patched_sps_ebsp->data, g_patched_sps_ebsp->len);
+            g_byte_array_append(out_arr, scfg->patched_sps_ebsp->data, scfg->patched_sps_ebsp->len);
             if (scfg->verbose) {
                 g_printerr("Injected patched SPS (after AUD) tc=%02u:%02u:%02u:%02u drop=%d\n",
                            hours, minutes, seconds, frame, drop_frame ? 1 : 0);
@@ -591,9 +1629,10 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
                 g_printerr("Emitted pic_timing SEI (after AUD) tc=%02u:%02u:%02u:%02u drop=%d\n",
                            hours, minutes, seconds, frame, drop_frame ? 1 : 0);
             }
-        } else {
+        } else if (have_tc) {
             g_printerr("SEI injection disabled - using GStreamer timecode handling\n");
         }
+        if (cc_sei) g_byte_array_append(out_arr, cc_sei->data, cc_sei->len);
         // Append remaining NALs skipping SPS
         gint p = aud_end;
         while (p < (gint)inmap.size) {
@@ -607,8 +1646,8 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
             guint8 nal_hdr2 = inmap.data[nal_start2];
             guint8 nal_type2 = nal_hdr2 & 0x1F;
             if (nal_type2 == 7) {
-                if (!sps_replaced && g_patched_sps_ebsp && g_patched_sps_ebsp->len > 0) {
-                    g_byte_array_append(out_arr, g_patched_sps_ebsp->data, g_patched_sps_ebsp->len);
+                if (!sps_replaced && scfg->patched_sps_ebsp && scfg->patched_sps_ebsp->len > 0) {
+                    g_byte_array_append(out_arr, scfg->patched_sps_ebsp->data, scfg->patched_sps_ebsp->len);
                     sps_replaced = TRUE;
                 }
                 // else skip original SPS
@@ -622,9 +1661,9 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
         }
     } else {
         // Prepend patched SPS (if any) and SEI, then original AU skipping SPS
-        gboolean want_before_sei = (g_patched_sps_ebsp && g_patched_sps_ebsp->len > 0) && (sps_present || inject_patched_sps);
+        gboolean want_before_sei = (scfg->patched_sps_ebsp && scfg->patched_sps_ebsp->len > 0) && (sps_present || inject_patched_sps);
         if (want_before_sei) {
-            g_byte_array_append(out_arr, g_patched_sps_ebsp->data, g_patched_sps_ebsp->len);
+            g_byte_array_append(out_arr, scfg->patched_sps_ebsp->data, scfg->patched_sps_ebsp->len);
             if (scfg->verbose) {
                 g_printerr("Injected patched SPS (prepend) tc=%02u:%02u:%02u:%02u drop=%d\n",
                            hours, minutes, seconds, frame, drop_frame ? 1 : 0);
@@ -637,9 +1676,10 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
                 g_printerr("Emitted pic_timing SEI (prepend) tc=%02u:%02u:%02u:%02u drop=%d\n",
                            hours, minutes, seconds, frame, drop_frame ? 1 : 0);
             }
-        } else {
+        } else if (have_tc) {
             g_printerr("SEI injection disabled - using GStreamer timecode handling\n");
         }
+        if (cc_sei) g_byte_array_append(out_arr, cc_sei->data, cc_sei->len);
         gint p = 0;
         while (p < (gint)inmap.size) {
             gint sc = find_startcode(inmap.data, (gint)inmap.size, p);
@@ -652,8 +1692,8 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
             guint8 nal_hdr2 = inmap.data[nal_start2];
             guint8 nal_type2 = nal_hdr2 & 0x1F;
             if (nal_type2 == 7) {
-                if (!sps_replaced && g_patched_sps_ebsp && g_patched_sps_ebsp->len > 0) {
-                    g_byte_array_append(out_arr, g_patched_sps_ebsp->data, g_patched_sps_ebsp->len);
+                if (!sps_replaced && scfg->patched_sps_ebsp && scfg->patched_sps_ebsp->len > 0) {
+                    g_byte_array_append(out_arr, scfg->patched_sps_ebsp->data, scfg->patched_sps_ebsp->len);
                     sps_replaced = TRUE;
                 }
                 // else skip original SPS
@@ -668,27 +1708,366 @@ static GstBuffer* prepend_h264_sei_timecode(SeiConfig *scfg, GstBuffer *inbuf) {
     }
     // Allocate exact-sized buffer and copy metadata
     GstBuffer *out = gst_buffer_new_allocate(NULL, out_arr->len, NULL);
-    if (!out) { gst_buffer_unmap(inbuf, &inmap); g_byte_array_unref(sei); g_byte_array_unref(out_arr); return gst_buffer_ref(inbuf); }
+    if (!out) {
+        gst_buffer_unmap(inbuf, &inmap);
+        if (sei) g_byte_array_unref(sei);
+        if (cc_sei) g_byte_array_unref(cc_sei);
+        g_byte_array_unref(out_arr);
+        return gst_buffer_ref(inbuf);
+    }
     gst_buffer_copy_into(out, inbuf, (GstBufferCopyFlags)(GST_BUFFER_COPY_METADATA | GST_BUFFER_COPY_TIMESTAMPS), 0, -1);
     gst_buffer_fill(out, 0, out_arr->data, out_arr->len);
     g_byte_array_unref(out_arr);
     
     gst_buffer_unmap(inbuf, &inmap);
     if (sei) g_byte_array_unref(sei);
+    if (cc_sei) {
+        g_byte_array_unref(cc_sei);
+        if (scfg) scfg->frames_with_cc++;
+    }
+    return out;
+}
+
+// Stands in for h264parse config-interval=1, which puts SPS/PPS in front
+// of an IDR when a second has passed since they were last sent: here an IDR
+// access unit without SPS/PPS gets the last ones seen put back after its
+// AUD, so every IDR is a random access point (at least as often as
+// h264parse repeats them). Keyframes only; the SPS is the one that left the
+// injector (patched when SEI is on). Returns a new reference, inbuf itself
+// when nothing was missing.
+static GstBuffer* h264_repeat_parameter_sets(SeiConfig *scfg, GstBuffer *inbuf) {
+    GstMapInfo map;
+    if (!gst_buffer_map(inbuf, &map, GST_MAP_READ)) return gst_buffer_ref(inbuf);
+    gint size = (gint)map.size;
+    gboolean have_sps = FALSE, have_pps = FALSE, have_idr = FALSE;
+    gint insert_at = -1;    // start code of the first NAL that is not an AUD
+    gint p = find_startcode(map.data, size, 0);
+    while (p >= 0 && p < size) {
+        gint nal = p + startcode_len_at(map.data, size, p);
+        if (nal >= size) break;
+        gint next = find_startcode(map.data, size, nal + 1);
+        if (next < 0) next = size;
+        guint8 nal_type = map.data[nal] & 0x1F;
+        if (nal_type != 9 && insert_at < 0) insert_at = p;
+        if (nal_type == 7 || nal_type == 8) {
+            // Cache every SPS/PPS of this AU, replacing those of the previous one
+            gboolean *seen = nal_type == 7 ? &have_sps : &have_pps;
+            GByteArray **cache = nal_type == 7 ? &scfg->last_sps : &scfg->last_pps;
+            if (!*cache) *cache = g_byte_array_new();
+            if (!*seen) g_byte_array_set_size(*cache, 0);
+            g_byte_array_append(*cache, map.data + p, (guint)(next - p));
+            *seen = TRUE;
+        } else if (nal_type == 5) {
+            have_idr = TRUE;
+        }
+        p = next;
+    }
+    if (!have_idr || (have_sps && have_pps) || insert_at < 0 || !scfg->last_sps || !scfg->last_pps) {
+        gst_buffer_unmap(inbuf, &map);
+        return gst_buffer_ref(inbuf);
+    }
+
+    // AUD, SPS, PPS, then the rest of the AU without its own SPS/PPS
+    GByteArray *out_arr = g_byte_array_sized_new(map.size + scfg->last_sps->len + scfg->last_pps->len);
+    g_byte_array_append(out_arr, map.data, (guint)insert_at);
+    g_byte_array_append(out_arr, scfg->last_sps->data, scfg->last_sps->len);
+    g_byte_array_append(out_arr, scfg->last_pps->data, scfg->last_pps->len);
+    p = insert_at;
+    while (p < size) {
+        gint nal = p + startcode_len_at(map.data, size, p);
+        if (nal >= size) break;
+        gint next = find_startcode(map.data, size, nal + 1);
+        if (next < 0) next = size;
+        guint8 nal_type = map.data[nal] & 0x1F;
+        if (nal_type != 7 && nal_type != 8) g_byte_array_append(out_arr, map.data + p, (guint)(next - p));
+        p = next;
+    }
+    gst_buffer_unmap(inbuf, &map);
+
+    GstBuffer *out = gst_buffer_new_allocate(NULL, out_arr->len, NULL);
+    gst_buffer_copy_into(out, inbuf, (GstBufferCopyFlags)(GST_BUFFER_COPY_METADATA | GST_BUFFER_COPY_TIMESTAMPS), 0, -1);
+    gst_buffer_fill(out, 0, out_arr->data, out_arr->len);
+    g_byte_array_unref(out_arr);
+    scfg->parameter_sets_inserted++;
+    if (scfg->verbose) {
+        g_printerr("Inserted SPS/PPS before IDR (pts %" GST_TIME_FORMAT ")\n", GST_TIME_ARGS(GST_BUFFER_PTS(inbuf)));
+    }
     return out;
 }
 
 static GstPadProbeReturn h264_sei_inject_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
     SeiConfig *scfg = (SeiConfig*)user_data;
-    if (!scfg || !scfg->inject_sei) return GST_PAD_PROBE_OK;
+    if (!scfg) return GST_PAD_PROBE_OK;
     if ((info->type & GST_PAD_PROBE_TYPE_BUFFER) == 0) return GST_PAD_PROBE_OK;
     GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
     if (!buf) return GST_PAD_PROBE_OK;
 
-    GstBuffer *newbuf = prepend_h264_sei_timecode(scfg, buf);
-    if (newbuf != buf) {
-        GST_PAD_PROBE_INFO_DATA(info) = newbuf;
+    scfg->frames_total++;
+    gboolean keyframe = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    if (keyframe) scfg->keyframes++;
+    // SEI injection can be toggled at runtime from the control socket
+    if (g_atomic_int_get(&scfg->inject_sei)) {
+        GstBuffer *newbuf = prepend_h264_sei_timecode(scfg, buf);
+        if (newbuf != buf) {
+            // The probe owns the reference it replaces
+            gst_buffer_unref(buf);
+            buf = newbuf;
+            GST_PAD_PROBE_INFO_DATA(info) = buf;
+            scfg->frames_with_sei++;
+        } else {
+            gst_buffer_unref(newbuf);
+        }
+    }
+    if (scfg->repeat_parameter_sets && keyframe) {
+        GstBuffer *newbuf = h264_repeat_parameter_sets(scfg, buf);
+        gst_buffer_unref(buf);
+        buf = newbuf;
+        GST_PAD_PROBE_INFO_DATA(info) = buf;
+    }
+    scfg->bytes_total += gst_buffer_get_size(buf);
+    frame_stats_record(scfg->frame_stats, buf);
+    return GST_PAD_PROBE_OK;
+}
+
+// --no-h264parse: pin the encoder's caps to what h264parse handed the mux,
+// Annex B with one access unit per buffer and no codec_data
+static GstPadProbeReturn h264_bytestream_caps_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) return GST_PAD_PROBE_OK;
+    GstCaps *caps;
+    gst_event_parse_caps(event, &caps);
+    GstCaps *fixed = gst_caps_copy(caps);
+    GstStructure *s = gst_caps_get_structure(fixed, 0);
+    gst_structure_remove_field(s, "codec_data");
+    gst_structure_set(s, "stream-format", G_TYPE_STRING, "byte-stream", "alignment", G_TYPE_STRING, "au", NULL);
+    GST_PAD_PROBE_INFO_DATA(info) = gst_event_new_caps(fixed);
+    gst_caps_unref(fixed);
+    gst_event_unref(event);
+    return GST_PAD_PROBE_OK;
+}
+
+static void h264_install_bytestream_caps(GstElement *enc) {
+    GstPad *pad = gst_element_get_static_pad(enc, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, h264_bytestream_caps_probe, NULL, NULL);
+    gst_object_unref(pad);
+}
+
+// --- Length-prefixed internal path (--avc-internal) ---
+//
+// x264 knows where each of its NALs ends. In byte-stream mode the injector
+// has to find those ends again by scanning every byte for start codes. With
+// --avc-internal the encoder outputs stream-format=avc, where each NAL is
+// preceded by its size, and the injector reads only those size fields. The
+// SPS/PPS come once, in the caps' codec_data. This probe converts each AU to
+// Annex B exactly once, at the mux boundary:
+//   - each 4-byte size is overwritten with 00 00 00 01 in place (the buffer
+//     is copied only if someone else holds it);
+//   - one small header memory is prepended with AUD, SPS (patched when SEI is
+//     on) + PPS on keyframes, then the pic_timing and caption SEI.
+// The cost therefore grows with the number of NALs, not with the bitrate.
+// Size fields other than 4 bytes, or an in-band SPS/PPS, take a slower path
+// that rebuilds the AU. The caps answered upstream are avc; the caps sent
+// downstream are byte-stream/au without codec_data.
+
+static const guint8 annexb_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+static guint32 avc_nal_size(const guint8 *p, guint length_size) {
+    guint32 v = 0;
+    for (guint i = 0; i < length_size; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+// avcC (ISO/IEC 14496-15): cache SPS/PPS as Annex B and the patched SPS / VUI
+static void avc_parse_codec_data(SeiConfig *scfg, GstBuffer *codec_data) {
+    GstMapInfo map;
+    if (!gst_buffer_map(codec_data, &map, GST_MAP_READ)) return;
+    const guint8 *d = map.data;
+    gsize size = map.size, off = 6;
+    if (size < 7 || d[0] != 1) {
+        gst_buffer_unmap(codec_data, &map);
+        return;
+    }
+    scfg->avc_length_size = (d[4] & 0x03) + 1;
+    if (!scfg->last_sps) scfg->last_sps = g_byte_array_new();
+    if (!scfg->last_pps) scfg->last_pps = g_byte_array_new();
+    g_byte_array_set_size(scfg->last_sps, 0);
+    g_byte_array_set_size(scfg->last_pps, 0);
+    for (guint list = 0; list < 2; ++list) {
+        if (off >= size) break;
+        guint count = list == 0 ? (d[5] & 0x1F) : d[off++];
+        GByteArray *cache = list == 0 ? scfg->last_sps : scfg->last_pps;
+        for (guint i = 0; i < count && off + 2 <= size; ++i) {
+            guint len = ((guint)d[off] << 8) | d[off + 1];
+            off += 2;
+            if (len == 0 || off + len > size) break;
+            g_byte_array_append(cache, annexb_start_code, sizeof(annexb_start_code));
+            g_byte_array_append(cache, d + off, len);
+            if (list == 0 && i == 0) {
+                guint fpsn = scfg->fps_n ? scfg->fps_n : (scfg->est_fps ? scfg->est_fps : 25);
+                guint fpsd = scfg->fps_d ? scfg->fps_d : 1;
+                if (scfg->patched_sps_ebsp) g_byte_array_unref(scfg->patched_sps_ebsp);
+                scfg->patched_sps_ebsp = patch_sps_pic_struct_and_timing(d + off + 1, len - 1, d[off], fpsn, fpsd);
+                SpsVuiInfo info;
+                memset(&info, 0, sizeof(info));
+                if (extract_sps_vui_from_au(scfg->last_sps->data, scfg->last_sps->len, &info)) {
+                    // Same effective flags as the byte-stream path
+                    info.pic_struct_present_flag = TRUE;
+                    info.cpb_dpb_delays_present_flag = FALSE;
+                    info.cpb_removal_delay_length = 0;
+                    info.dpb_output_delay_length = 0;
+                    info.time_offset_length = 0;
+                    scfg->last_sps_info = info;
+                    scfg->last_sps_valid = TRUE;
+                }
+            }
+            off += len;
+        }
+    }
+    gst_buffer_unmap(codec_data, &map);
+    if (scfg->verbose) {
+        g_printerr("AVC codec_data: %u-byte NAL sizes, SPS %u bytes, PPS %u bytes\n",
+                   scfg->avc_length_size, scfg->last_sps->len, scfg->last_pps->len);
+    }
+}
+
+// Rebuild the whole AU in Annex B: any size-field width, in-band SPS/PPS dropped
+static GstBuffer* avc_rebuild_annexb(SeiConfig *scfg, GstBuffer *inbuf, const GByteArray *header) {
+    GstMapInfo map;
+    if (!gst_buffer_map(inbuf, &map, GST_MAP_READ)) return gst_buffer_ref(inbuf);
+    guint ls = scfg->avc_length_size;
+    GByteArray *out_arr = g_byte_array_sized_new(map.size + header->len + 64);
+    g_byte_array_append(out_arr, header->data, header->len);
+    for (gsize off = 0; off + ls < map.size;) {
+        guint32 len = avc_nal_size(map.data + off, ls);
+        if (len == 0 || off + ls + len > map.size) break;
+        guint8 nal_type = map.data[off + ls] & 0x1F;
+        if (nal_type != 7 && nal_type != 8 && nal_type != 9) {
+            g_byte_array_append(out_arr, annexb_start_code, sizeof(annexb_start_code));
+            g_byte_array_append(out_arr, map.data + off + ls, len);
+        }
+        off += ls + len;
+    }
+    gst_buffer_unmap(inbuf, &map);
+    GstBuffer *out = gst_buffer_new_allocate(NULL, out_arr->len, NULL);
+    gst_buffer_copy_into(out, inbuf, (GstBufferCopyFlags)(GST_BUFFER_COPY_METADATA | GST_BUFFER_COPY_TIMESTAMPS), 0, -1);
+    gst_buffer_fill(out, 0, out_arr->data, out_arr->len);
+    g_byte_array_unref(out_arr);
+    return out;
+}
+
+// Takes ownership of inbuf; returns the Annex B AU
+static GstBuffer* avc_au_to_annexb(SeiConfig *scfg, GstBuffer *inbuf, gboolean with_sei) {
+    guint ls = scfg->avc_length_size;
+    gboolean keyframe = !GST_BUFFER_FLAG_IS_SET(inbuf, GST_BUFFER_FLAG_DELTA_UNIT);
+    GstMapInfo map;
+    if (ls == 0 || !gst_buffer_map(inbuf, &map, GST_MAP_READ)) return inbuf;
+    // One pass over the size fields: validate, find a leading AUD and in-band parameter sets
+    gboolean valid = TRUE, in_band_ps = FALSE;
+    gsize aud_size = 0;
+    for (gsize off = 0; off < map.size;) {
+        guint32 len = off + ls <= map.size ? avc_nal_size(map.data + off, ls) : 0;
+        if (len == 0 || off + ls + len > map.size) {
+            valid = FALSE;
+            break;
+        }
+        guint8 nal_type = map.data[off + ls] & 0x1F;
+        if (nal_type == 9 && off == 0) aud_size = ls + len;
+        else if (nal_type == 7 || nal_type == 8) in_band_ps = TRUE;
+        off += ls + len;
+    }
+    gsize size = map.size;
+    gst_buffer_unmap(inbuf, &map);
+    if (!valid) {
+        if (scfg->verbose) g_printerr("AVC: malformed access unit (%" G_GSIZE_FORMAT " bytes), passed as is\n", size);
+        return inbuf;
+    }
+
+    AuSei au_sei;
+    memset(&au_sei, 0, sizeof(au_sei));
+    gboolean have_sei = with_sei && build_au_sei(scfg, inbuf, FALSE, &au_sei);
+    GByteArray *header = g_byte_array_sized_new(256);
+    static const guint8 aud[6] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+    if (aud_size > 0) g_byte_array_append(header, aud, sizeof(aud));
+    if (keyframe && scfg->last_sps && scfg->last_sps->len > 0 && scfg->last_pps && scfg->last_pps->len > 0) {
+        gboolean patched = with_sei && scfg->patched_sps_ebsp && scfg->patched_sps_ebsp->len > 0;
+        const GByteArray *sps = patched ? scfg->patched_sps_ebsp : scfg->last_sps;
+        g_byte_array_append(header, sps->data, sps->len);
+        g_byte_array_append(header, scfg->last_pps->data, scfg->last_pps->len);
+        scfg->parameter_sets_inserted++;
+    }
+    if (au_sei.sei) g_byte_array_append(header, au_sei.sei->data, au_sei.sei->len);
+    if (au_sei.cc_sei) g_byte_array_append(header, au_sei.cc_sei->data, au_sei.cc_sei->len);
+    if (have_sei) scfg->frames_with_sei++;
+    if (au_sei.cc_sei) scfg->frames_with_cc++;
+    if (au_sei.sei) g_byte_array_unref(au_sei.sei);
+    if (au_sei.cc_sei) g_byte_array_unref(au_sei.cc_sei);
+
+    GstBuffer *out;
+    if (ls != 4 || in_band_ps) {
+        out = avc_rebuild_annexb(scfg, inbuf, header);
+        gst_buffer_unref(inbuf);
+        g_byte_array_unref(header);
+        return out;
+    }
+    // Fast path: the sizes become start codes where they stand
+    out = gst_buffer_make_writable(inbuf);
+    if (gst_buffer_map(out, &map, GST_MAP_READWRITE)) {
+        for (gsize off = 0; off < map.size;) {
+            guint32 len = avc_nal_size(map.data + off, 4);
+            memcpy(map.data + off, annexb_start_code, sizeof(annexb_start_code));
+            off += 4 + len;
+        }
+        gst_buffer_unmap(out, &map);
+    }
+    if (aud_size > 0) gst_buffer_resize(out, (gssize)aud_size, -1);
+    if (header->len > 0) {
+        gsize len = header->len;
+        guint8 *data = g_byte_array_free(header, FALSE);
+        gst_buffer_prepend_memory(out, gst_memory_new_wrapped((GstMemoryFlags)0, data, len, 0, len, data, g_free));
+    } else {
+        g_byte_array_unref(header);
+    }
+    return out;
+}
+
+#define H264_AVC_PROBE_MASK (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | \
+                                              GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM)
+
+static GstPadProbeReturn h264_avc_inject_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    SeiConfig *scfg = (SeiConfig*)user_data;
+    if (info->type & GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM) {
+        // Let the encoder pick avc whatever the mux accepts; we convert
+        GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+        if (GST_QUERY_TYPE(query) != GST_QUERY_CAPS) return GST_PAD_PROBE_OK;
+        GstCaps *filter = NULL;
+        gst_query_parse_caps(query, &filter);
+        GstCaps *caps = gst_caps_from_string("video/x-h264,stream-format=avc,alignment=au");
+        if (filter) {
+            GstCaps *both = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+            gst_caps_unref(caps);
+            caps = both;
+        }
+        gst_query_set_caps_result(query, caps);
+        gst_caps_unref(caps);
+        return GST_PAD_PROBE_HANDLED;
+    }
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) return GST_PAD_PROBE_OK;
+        GstCaps *caps;
+        gst_event_parse_caps(event, &caps);
+        const GValue *cd = gst_structure_get_value(gst_caps_get_structure(caps, 0), "codec_data");
+        if (cd && GST_VALUE_HOLDS_BUFFER(cd)) avc_parse_codec_data(scfg, gst_value_get_buffer(cd));
+        return h264_bytestream_caps_probe(pad, info, NULL);
     }
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf) return GST_PAD_PROBE_OK;
+    scfg->frames_total++;
+    if (!GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) scfg->keyframes++;
+    buf = avc_au_to_annexb(scfg, buf, g_atomic_int_get(&scfg->inject_sei));
+    GST_PAD_PROBE_INFO_DATA(info) = buf;
+    scfg->bytes_total += gst_buffer_get_size(buf);
+    frame_stats_record(scfg->frame_stats, buf);
     return GST_PAD_PROBE_OK;
 }
 
@@ -924,6 +2303,24 @@ static inline guint32 br_read_ue(BitReader *br, gboolean *ok) {
 	return (1u << zeros) - 1 + suffix;
 }
 
+static inline gint32 br_read_se(BitReader *br, gboolean *ok) {
+	guint32 ue = br_read_ue(br, ok);
+	return (ue & 1) ? (gint32)((ue + 1) / 2) : -(gint32)(ue / 2);
+}
+
+// Skip the scaling_list() entries of an SPS (count lists, each behind its present flag)
+static void br_skip_scaling_lists(BitReader *br, guint count, gboolean *ok) {
+	for (guint i = 0; i < count; ++i) {
+		if (!br_read_bit(br, ok)) continue;
+		guint sizeOfScalingList = (i < 6) ? 16 : 64;
+		gint lastScale = 8, nextScale = 8;
+		for (guint j = 0; j < sizeOfScalingList; ++j) {
+			if (nextScale != 0) nextScale = (lastScale + br_read_se(br, ok) + 256) % 256;
+			lastScale = (nextScale == 0) ? lastScale : nextScale;
+		}
+	}
+}
+
 static GByteArray* ebsp_to_rbsp(const guint8 *ebsp, gsize size) {
 	GByteArray *rbsp = g_byte_array_new();
 	guint zeros = 0;
@@ -1103,27 +2500,7 @@ static gboolean parse_sps_vui_info_from_rbsp(const guint8 *rbsp, gsize size, Sps
 		br_read_ue(&br, &ok); // bit_depth_chroma_minus8
 		br_read_bits(&br, 1, &ok); // qpprime_y_zero_transform_bypass_flag
 		guint seq_scaling_matrix_present_flag = br_read_bits(&br, 1, &ok);
-		if (seq_scaling_matrix_present_flag) {
-			guint count = (chroma_format_idc != 3) ? 8 : 12;
-			for (guint i = 0; i < count; ++i) {
-				guint f = br_read_bits(&br, 1, &ok);
-				if (f) {
-					// skip scaling list; approximate skipping using exp-golomb deltas
-					guint sizeOfScalingList = (i < 6) ? 16 : 64;
-					gint lastScale = 8, nextScale = 8;
-					for (guint j = 0; j < sizeOfScalingList; ++j) {
-						if (nextScale != 0) {
-							// se(v); implement quick signed Exp-Golomb read
-							// read_ue and map to signed
-							guint ue = br_read_ue(&br, &ok);
-							gint se = (ue & 1) ? (gint)((ue + 1) / 2) : -(gint)(ue / 2);
-							nextScale = (lastScale + se + 256) % 256;
-						}
-						lastScale = (nextScale == 0) ? lastScale : nextScale;
-					}
-				}
-			}
-		}
+		if (seq_scaling_matrix_present_flag) br_skip_scaling_lists(&br, (chroma_format_idc != 3) ? 8 : 12, &ok);
 	}
 	br_read_ue(&br, &ok); // log2_max_frame_num_minus4
 	guint pic_order_cnt_type = br_read_ue(&br, &ok);
@@ -1271,151 +2648,6284 @@ GByteArray* build_pic_timing_sei_nal_from_au(const guint8 *annexb, gsize size, g
     return build_pic_timing_sei_nal_from_sps(&info, drop_frame, frame, seconds, minutes, hours);
 }
 
-int main(int argc, char **argv) {
-    gst_init(&argc, &argv);
+// --- Per-frame encoder statistics (--frame-stats, "frame_stats") ---
+//
+// The injector probe appends one 32-byte FrameStat per encoded access unit
+// to a per-stream ring. A record holds the timecode, PTS, picture type, size,
+// the QP of the first slice, and the encode latency (encoder sink to src,
+// paired by PTS). The producer is the encoder's streaming thread and never
+// blocks: it fills the slot, then publishes the new head. Readers keep their
+// own cursor and detect records overwritten under them from the head, as
+// shmring readers do. There are two readers: the --frame-stats writer, which
+// drains every ring into a rotating binary file from the main loop, and the
+// control command "frame_stats". Without a file, recording stops
+// FRAME_STATS_IDLE_US after the last poll, and the probes cost one atomic
+// read per frame.
 
-    // No in-binary element registration needed
+#define FRAME_STATS_RING 4096           // records per stream (power of two)
+#define FRAME_STATS_INFLIGHT 32         // encoder input times awaiting their output
+#define FRAME_STATS_IDLE_US (5 * G_USEC_PER_SEC)
+#define FRAME_STATS_TICK_MS 250
+#define FRAME_STATS_POLL_MAX 256        // default records per "frame_stats" reply
+#define FRAME_STATS_MAGIC "N2SFSTAT"    // file header: magic, u32 version, u32 record size
 
-    AppConfig cfg;
-    if (!parse_args(argc, argv, &cfg)) {
-        print_usage(argv[0]);
-        return 1;
+enum { FRAME_STAT_IDR = 1 << 0 };
+
+// On disk as in memory (host byte order)
+typedef struct FrameStat {
+    guint64 pts;            // ns, G_MAXUINT64 when unknown
+    guint32 seq;            // record number in its stream
+    guint32 timecode;       // hh << 24 | mm << 16 | ss << 8 | ff, G_MAXUINT32 when none
+    guint32 size;           // access unit bytes as sent to the mux
+    guint32 encode_us;      // encoder sink -> src, G_MAXUINT32 when unknown
+    guint8 type;            // 'I', 'P', 'B'; '?' when no slice header was read
+    guint8 flags;           // FRAME_STAT_*
+    guint8 qp;              // QP of the first slice, 0xFF when unknown
+    guint8 stream;
+    guint32 reserved;
+} FrameStat;
+
+G_STATIC_ASSERT(sizeof(FrameStat) == 32);
+
+// The SPS/PPS fields a slice header parse needs (x264 only uses id 0)
+typedef struct H264HeaderCtx {
+    gboolean have_sps;
+    gboolean have_pps;
+    gboolean separate_colour_plane;
+    guint chroma_array_type;
+    guint log2_max_frame_num;
+    gboolean frame_mbs_only;
+    guint poc_type;
+    guint log2_max_poc_lsb;
+    gboolean delta_pic_order_always_zero;
+    gboolean entropy_coding_mode;
+    gboolean bottom_field_pic_order_present;
+    guint num_ref_idx_default[2];
+    gboolean weighted_pred;
+    guint weighted_bipred_idc;
+    gint pic_init_qp;
+    gboolean redundant_pic_cnt_present;
+} H264HeaderCtx;
+
+typedef struct FrameStats {
+    guint index;
+    gint active;            // records are being taken (atomic)
+    guint head;             // records published (atomic); slot = head % FRAME_STATS_RING
+    FrameStat ring[FRAME_STATS_RING];
+    H264HeaderCtx hdr;      // encoder streaming thread only
+    GMutex lock;            // encoder input times
+    guint64 in_pts[FRAME_STATS_INFLIGHT];
+    gint64 in_ns[FRAME_STATS_INFLIGHT];
+    guint in_pos;
+    // main loop only
+    gint64 poll_until_us;   // last "frame_stats" + FRAME_STATS_IDLE_US
+    guint file_cursor;
+    gboolean pinned;        // --governor reads every record
+} FrameStats;
+
+typedef struct FrameStatsFile {
+    gchar *path;
+    FILE *fp;
+    guint64 bytes;
+    guint64 max_bytes;
+    guint64 lost;
+} FrameStatsFile;
+
+// RBSP of the start of a NAL payload (header byte excluded), up to max bytes
+static gsize nal_rbsp_prefix(const guint8 *ebsp, gsize size, guint8 *out, gsize max) {
+    gsize n = 0;
+    guint zeros = 0;
+    for (gsize i = 0; i < size && n < max; ++i) {
+        if (zeros >= 2 && ebsp[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        out[n++] = ebsp[i];
+        zeros = ebsp[i] == 0x00 ? zeros + 1 : 0;
     }
+    return n;
+}
 
-    // Handle discover mode
-    if (cfg.discover) {
-        discover_ndi_sources();
-        return 0;
+static void h264_hdr_parse_sps(H264HeaderCtx *h, const guint8 *rbsp, gsize size) {
+    BitReader br;
+    gboolean ok = TRUE;
+    br_init(&br, rbsp, size);
+    guint profile_idc = br_read_bits(&br, 8, &ok);
+    br_read_bits(&br, 16, &ok);         // constraint flags, level_idc
+    br_read_ue(&br, &ok);               // seq_parameter_set_id
+    guint chroma_format_idc = 1;
+    h->separate_colour_plane = FALSE;
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244 || profile_idc == 44 ||
+        profile_idc == 83 || profile_idc == 86 || profile_idc == 118 || profile_idc == 128 || profile_idc == 138 ||
+        profile_idc == 139 || profile_idc == 134 || profile_idc == 135) {
+        chroma_format_idc = br_read_ue(&br, &ok);
+        if (chroma_format_idc == 3) h->separate_colour_plane = br_read_bit(&br, &ok);
+        br_read_ue(&br, &ok);           // bit_depth_luma_minus8
+        br_read_ue(&br, &ok);           // bit_depth_chroma_minus8
+        br_read_bit(&br, &ok);          // qpprime_y_zero_transform_bypass_flag
+        if (br_read_bit(&br, &ok)) br_skip_scaling_lists(&br, chroma_format_idc != 3 ? 8 : 12, &ok);
     }
-    
-    // Build exact working pipeline via gst_parse_launch
-    gchar *output_section;
-    if (cfg.stdout_mode) {
-        output_section = g_strdup("fdsink fd=1 sync=false");
-    } else {
-        output_section = g_strdup_printf("srtsink uri=\"%s\" wait-for-connection=false sync=false", cfg.srt_uri);
+    h->chroma_array_type = h->separate_colour_plane ? 0 : chroma_format_idc;
+    h->log2_max_frame_num = br_read_ue(&br, &ok) + 4;
+    h->poc_type = br_read_ue(&br, &ok);
+    if (h->poc_type == 0) {
+        h->log2_max_poc_lsb = br_read_ue(&br, &ok) + 4;
+    } else if (h->poc_type == 1) {
+        h->delta_pic_order_always_zero = br_read_bit(&br, &ok);
+        br_read_se(&br, &ok);           // offset_for_non_ref_pic
+        br_read_se(&br, &ok);           // offset_for_top_to_bottom_field
+        guint n = br_read_ue(&br, &ok);
+        for (guint i = 0; ok && i < n; ++i) br_read_se(&br, &ok);
     }
-    
-    // Build GOP size parameter string
-    gchar *gop_param = cfg.gop_size > 0 ? g_strdup_printf("key-int-max=%u ", cfg.gop_size) : g_strdup("");
-    
-    // Build audio pipeline section based on codec choice
-    gchar *audio_section;
-    if (cfg.with_audio) {
-        gchar *audio_pipeline = build_audio_pipeline(cfg.audio_codec, cfg.audio_bitrate_kbps);
-        audio_section = g_strdup_printf("src.audio ! queue ! %s ! mux.", audio_pipeline);
-        g_free(audio_pipeline);
-    } else {
-        audio_section = g_strdup("src.audio ! queue ! fakesink sync=false");
+    br_read_ue(&br, &ok);               // max_num_ref_frames
+    br_read_bit(&br, &ok);              // gaps_in_frame_num_value_allowed_flag
+    br_read_ue(&br, &ok);               // pic_width_in_mbs_minus1
+    br_read_ue(&br, &ok);               // pic_height_in_map_units_minus1
+    h->frame_mbs_only = br_read_bit(&br, &ok);
+    h->have_sps = ok;
+}
+
+static void h264_hdr_parse_pps(H264HeaderCtx *h, const guint8 *rbsp, gsize size) {
+    BitReader br;
+    gboolean ok = TRUE;
+    br_init(&br, rbsp, size);
+    br_read_ue(&br, &ok);               // pic_parameter_set_id
+    br_read_ue(&br, &ok);               // seq_parameter_set_id
+    h->entropy_coding_mode = br_read_bit(&br, &ok);
+    h->bottom_field_pic_order_present = br_read_bit(&br, &ok);
+    if (br_read_ue(&br, &ok) != 0) ok = FALSE;  // slice groups (FMO, Baseline extension): not parsed
+    h->num_ref_idx_default[0] = br_read_ue(&br, &ok) + 1;
+    h->num_ref_idx_default[1] = br_read_ue(&br, &ok) + 1;
+    h->weighted_pred = br_read_bit(&br, &ok);
+    h->weighted_bipred_idc = br_read_bits(&br, 2, &ok);
+    h->pic_init_qp = 26 + br_read_se(&br, &ok);
+    br_read_se(&br, &ok);               // pic_init_qs_minus26
+    br_read_se(&br, &ok);               // chroma_qp_index_offset
+    br_read_bit(&br, &ok);              // deblocking_filter_control_present_flag
+    br_read_bit(&br, &ok);              // constrained_intra_pred_flag
+    h->redundant_pic_cnt_present = br_read_bit(&br, &ok);
+    h->have_pps = ok;
+}
+
+// Picture type of a slice and, once SPS and PPS were seen, its QP: the
+// slice header is read up to slice_qp_delta (7.3.3)
+static void h264_parse_slice(const H264HeaderCtx *h, guint8 nal_hdr, const guint8 *rbsp, gsize size, FrameStat *rec) {
+    BitReader br;
+    gboolean ok = TRUE;
+    br_init(&br, rbsp, size);
+    guint nal_type = nal_hdr & 0x1F, nal_ref_idc = (nal_hdr >> 5) & 3;
+    br_read_ue(&br, &ok);               // first_mb_in_slice
+    guint slice_type = br_read_ue(&br, &ok) % 5;
+    if (!ok) return;
+    gboolean is_b = slice_type == 1, is_p = slice_type == 0 || slice_type == 3;
+    rec->type = is_b ? 'B' : is_p ? 'P' : 'I';
+    if (!h->have_sps || !h->have_pps) return;
+    br_read_ue(&br, &ok);               // pic_parameter_set_id
+    if (h->separate_colour_plane) br_read_bits(&br, 2, &ok);
+    br_read_bits(&br, h->log2_max_frame_num, &ok);
+    gboolean field_pic = FALSE;
+    if (!h->frame_mbs_only) {
+        field_pic = br_read_bit(&br, &ok);
+        if (field_pic) br_read_bit(&br, &ok);   // bottom_field_flag
     }
-    
-    gchar *pipeline_desc = g_strdup_printf(
-        "ndisrc ndi-name=\"%s\" timestamp-mode=%s ! ndisrcdemux name=src "
-        "src.video ! queue ! videoconvert ! video/x-raw,format=I420 ! "
-        "x264enc name=enc tune=zerolatency speed-preset=ultrafast %sbitrate=%d aud=false byte-stream=true insert-vui=false interlaced=false nal-hrd=none ! "
-        "h264parse name=h264parse disable-passthrough=true config-interval=1 ! video/x-h264,stream-format=byte-stream,alignment=au ! mpegtsmux name=mux "
-        "%s "
-        "mux. ! queue leaky=2 max-size-time=2000000000 ! %s",
-        cfg.ndi_name, cfg.timestamp_mode, gop_param, cfg.bitrate_kbps, audio_section, output_section);
+    if (nal_type == 5) br_read_ue(&br, &ok);    // idr_pic_id
+    if (h->poc_type == 0) {
+        br_read_bits(&br, h->log2_max_poc_lsb, &ok);
+        if (h->bottom_field_pic_order_present && !field_pic) br_read_se(&br, &ok);
+    } else if (h->poc_type == 1 && !h->delta_pic_order_always_zero) {
+        br_read_se(&br, &ok);
+        if (h->bottom_field_pic_order_present && !field_pic) br_read_se(&br, &ok);
+    }
+    if (h->redundant_pic_cnt_present) br_read_ue(&br, &ok);
+    if (is_b) br_read_bit(&br, &ok);            // direct_spatial_mv_pred_flag
+    guint num_ref[2] = { h->num_ref_idx_default[0], h->num_ref_idx_default[1] };
+    if ((is_p || is_b) && br_read_bit(&br, &ok)) {
+        num_ref[0] = br_read_ue(&br, &ok) + 1;
+        if (is_b) num_ref[1] = br_read_ue(&br, &ok) + 1;
+    }
+    guint lists = is_b ? 2 : is_p ? 1 : 0;
+    // ref_pic_list_modification()
+    for (guint l = 0; ok && l < lists; ++l) {
+        if (!br_read_bit(&br, &ok)) continue;
+        for (guint n = 0; ok; ++n) {
+            guint idc = br_read_ue(&br, &ok);
+            if (idc == 3) break;
+            if (idc > 2 || n > 32) ok = FALSE;
+            br_read_ue(&br, &ok);
+        }
+    }
+    // pred_weight_table()
+    if (ok && ((h->weighted_pred && is_p) || (h->weighted_bipred_idc == 1 && is_b))) {
+        br_read_ue(&br, &ok);                   // luma_log2_weight_denom
+        if (h->chroma_array_type != 0) br_read_ue(&br, &ok);
+        for (guint l = 0; ok && l < lists; ++l) {
+            for (guint i = 0; ok && i < MIN(num_ref[l], 32u); ++i) {
+                if (br_read_bit(&br, &ok)) {
+                    br_read_se(&br, &ok);
+                    br_read_se(&br, &ok);
+                }
+                if (h->chroma_array_type != 0 && br_read_bit(&br, &ok)) {
+                    for (guint j = 0; j < 4; ++j) br_read_se(&br, &ok);
+                }
+            }
+        }
+    }
+    // dec_ref_pic_marking()
+    if (ok && nal_ref_idc != 0) {
+        if (nal_type == 5) {
+            br_read_bits(&br, 2, &ok);          // no_output_of_prior_pics, long_term_reference
+        } else if (br_read_bit(&br, &ok)) {
+            for (guint n = 0; ok; ++n) {
+                guint op = br_read_ue(&br, &ok);
+                if (op == 0) break;
+                if (op > 6 || n > 32) ok = FALSE;
+                if (op == 1 || op == 3) br_read_ue(&br, &ok);
+                if (op == 2) br_read_ue(&br, &ok);
+                if (op == 3 || op == 6) br_read_ue(&br, &ok);
+                if (op == 4) br_read_ue(&br, &ok);
+            }
+        }
+    }
+    if (h->entropy_coding_mode && (is_p || is_b)) br_read_ue(&br, &ok);  // cabac_init_idc
+    gint qp = h->pic_init_qp + br_read_se(&br, &ok);
+    if (ok && qp >= 0 && qp < 0xFF) rec->qp = (guint8)qp;
+}
+
+// Picture type and QP from the first slice of an Annex B access unit; SPS
+// and PPS met on the way update the parse context. Only the NALs in front
+// of the first slice are walked, and the slice is never searched for its
+// end. Each parser gets up to sizeof(rbsp) bytes whatever the NAL's length:
+// it stops at the fields it needs, well before the end of an SPS or PPS.
+static void frame_stats_scan_au(H264HeaderCtx *h, const guint8 *data, gint size, FrameStat *rec) {
+    guint8 rbsp[256];
+    gint p = find_startcode(data, size, 0);
+    while (p >= 0 && p < size) {
+        gint nal = p + startcode_len_at(data, size, p);
+        if (nal >= size) break;
+        guint8 nal_type = data[nal] & 0x1F;
+        if (nal_type == 7 || nal_type == 8 || nal_type == 1 || nal_type == 5) {
+            gsize avail = (gsize)(size - nal - 1);
+            gsize n = nal_rbsp_prefix(data + nal + 1, MIN(avail, sizeof(rbsp)), rbsp, sizeof(rbsp));
+            if (nal_type == 7) h264_hdr_parse_sps(h, rbsp, n);
+            else if (nal_type == 8) h264_hdr_parse_pps(h, rbsp, n);
+            else {
+                h264_parse_slice(h, data[nal], rbsp, n, rec);
+                return;
+            }
+        }
+        p = find_startcode(data, size, nal + 1);
+    }
+}
+
+static GstPadProbeReturn frame_stats_enc_in_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    FrameStats *fs = (FrameStats*)user_data;
+    if (!g_atomic_int_get(&fs->active)) return GST_PAD_PROBE_OK;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf || !GST_BUFFER_PTS_IS_VALID(buf)) return GST_PAD_PROBE_OK;
+    g_mutex_lock(&fs->lock);
+    guint i = fs->in_pos++ % FRAME_STATS_INFLIGHT;
+    fs->in_pts[i] = GST_BUFFER_PTS(buf);
+    fs->in_ns[i] = (gint64)gst_util_get_timestamp();
+    g_mutex_unlock(&fs->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+// Called by the injector probes with the access unit as it leaves them
+static void frame_stats_record(FrameStats *fs, GstBuffer *au) {
+    if (!fs || !g_atomic_int_get(&fs->active)) return;
+    FrameStat rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.pts = GST_BUFFER_PTS_IS_VALID(au) ? GST_BUFFER_PTS(au) : G_MAXUINT64;
+    rec.timecode = G_MAXUINT32;
+    rec.size = (guint32)gst_buffer_get_size(au);
+    rec.encode_us = G_MAXUINT32;
+    rec.type = '?';
+    rec.flags = GST_BUFFER_FLAG_IS_SET(au, GST_BUFFER_FLAG_DELTA_UNIT) ? 0 : FRAME_STAT_IDR;
+    rec.qp = 0xFF;
+    rec.stream = (guint8)fs->index;
+    GstVideoTimeCodeMeta *tcmeta = gst_buffer_get_video_time_code_meta(au);
+    if (tcmeta) {
+        const GstVideoTimeCode *tc = &tcmeta->tc;
+        rec.timecode = tc->hours << 24 | tc->minutes << 16 | tc->seconds << 8 | (tc->frames & 0xFF);
+    }
+    if (rec.pts != G_MAXUINT64) {
+        gint64 now = (gint64)gst_util_get_timestamp();
+        g_mutex_lock(&fs->lock);
+        for (guint i = 0; i < FRAME_STATS_INFLIGHT; ++i) {
+            if (fs->in_pts[i] != rec.pts) continue;
+            rec.encode_us = (guint32)MIN((now - fs->in_ns[i]) / 1000, (gint64)G_MAXUINT32 - 1);
+            fs->in_pts[i] = G_MAXUINT64;
+            break;
+        }
+        g_mutex_unlock(&fs->lock);
+    }
+    GstMapInfo map;
+    if (gst_buffer_map(au, &map, GST_MAP_READ)) {
+        frame_stats_scan_au(&fs->hdr, map.data, (gint)map.size, &rec);
+        gst_buffer_unmap(au, &map);
+    }
+    guint head = fs->head;              // only this thread writes it
+    rec.seq = head;
+    fs->ring[head % FRAME_STATS_RING] = rec;
+    g_atomic_int_set(&fs->head, head + 1);
+}
+
+// Copy out up to max records from *cursor on, advancing it. *lost counts
+// records the producer overwrote before they could be read.
+static guint frame_stats_read(FrameStats *fs, guint *cursor, FrameStat *out, guint max, guint *lost) {
+    guint head = (guint)g_atomic_int_get(&fs->head);
+    *lost = 0;
+    if (head - *cursor > FRAME_STATS_RING) {
+        *lost = head - *cursor - FRAME_STATS_RING;
+        *cursor = head - FRAME_STATS_RING;
+    }
+    guint n = 0;
+    while (*cursor != head && n < max) {
+        out[n] = fs->ring[*cursor % FRAME_STATS_RING];
+        // The producer writes record cursor + RING once head reaches it
+        if ((guint)g_atomic_int_get(&fs->head) - *cursor >= FRAME_STATS_RING || out[n].seq != *cursor) (*lost)++;
+        else n++;
+        (*cursor)++;
+    }
+    return n;
+}
+
+static void stream_install_frame_stats(Stream *st) {
+    FrameStats *fs = g_new0(FrameStats, 1);
+    fs->index = st->index;
+    g_mutex_init(&fs->lock);
+    for (guint i = 0; i < FRAME_STATS_INFLIGHT; ++i) fs->in_pts[i] = G_MAXUINT64;
+    fs->pinned = st->app->cfg->governor;
+    g_atomic_int_set(&fs->active, st->app->cfg->frame_stats_path != NULL || fs->pinned);
+    GstPad *in = gst_element_get_static_pad(st->graph.enc, "sink");
+    gst_pad_add_probe(in, GST_PAD_PROBE_TYPE_BUFFER, frame_stats_enc_in_probe, fs, NULL);
+    gst_object_unref(in);
+    st->frame_stats = fs;
+}
+
+static void frame_stats_free(FrameStats *fs) {
+    if (!fs) return;
+    g_mutex_clear(&fs->lock);
+    g_free(fs);
+}
+
+static gboolean frame_stats_file_open(FrameStatsFile *f, GError **error) {
+    f->fp = g_fopen(f->path, "wb");
+    if (!f->fp) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "cannot open %s: %s", f->path, g_strerror(errno));
+        return FALSE;
+    }
+    guint32 header[2] = { 1, sizeof(FrameStat) };
+    fwrite(FRAME_STATS_MAGIC, 1, 8, f->fp);
+    fwrite(header, sizeof(header), 1, f->fp);
+    f->bytes = 8 + sizeof(header);
+    return TRUE;
+}
+
+// Current file becomes <path>.1 (replacing the previous one)
+static void frame_stats_file_rotate(FrameStatsFile *f) {
+    fclose(f->fp);
+    f->fp = NULL;
+    gchar *old = g_strconcat(f->path, ".1", NULL);
+    if (g_rename(f->path, old) != 0) g_printerr("Frame stats: cannot rotate %s: %s\n", f->path, g_strerror(errno));
+    g_free(old);
     GError *err = NULL;
-    GstElement *pipeline = gst_parse_launch(pipeline_desc, &err);
-    if (!pipeline || err) {
-        g_printerr("Failed to build pipeline: %s\n", err ? err->message : "unknown error");
-        if (err) g_error_free(err);
-        g_free(pipeline_desc);
-        g_free(output_section);
-        g_free(gop_param);
-        return 1;
+    if (!frame_stats_file_open(f, &err)) {
+        g_printerr("Frame stats: %s\n", err->message);
+        g_clear_error(&err);
     }
-    g_free(pipeline_desc);
-    g_free(output_section);
-    g_free(audio_section);
-    g_free(gop_param);
+}
 
-    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
-    GstBus *bus = gst_element_get_bus(pipeline);
-    gst_bus_add_watch(bus, bus_msg_cb, loop);
+static void frame_stats_drain(App *app) {
+    FrameStatsFile *f = app->frame_stats_file;
+    FrameStat batch[256];
+    for (guint i = 0; i < app->streams->len; ++i) {
+        FrameStats *fs = ((Stream*)g_ptr_array_index(app->streams, i))->frame_stats;
+        guint n, lost;
+        while ((n = frame_stats_read(fs, &fs->file_cursor, batch, G_N_ELEMENTS(batch), &lost)) > 0 || lost > 0) {
+            f->lost += lost;
+            if (n == 0) continue;
+            if (f->fp && fwrite(batch, sizeof(FrameStat), n, f->fp) != n) {
+                g_printerr("Frame stats: write to %s failed, stopping\n", f->path);
+                fclose(f->fp);
+                f->fp = NULL;
+            }
+            f->bytes += (guint64)n * sizeof(FrameStat);
+        }
+    }
+    if (!f->fp) return;
+    fflush(f->fp);
+    if (f->bytes >= f->max_bytes) frame_stats_file_rotate(f);
+}
+
+static gboolean frame_stats_tick_cb(gpointer user_data) {
+    App *app = (App*)user_data;
+    gint64 now = g_get_monotonic_time();
+    for (guint i = 0; i < app->streams->len; ++i) {
+        FrameStats *fs = ((Stream*)g_ptr_array_index(app->streams, i))->frame_stats;
+        g_atomic_int_set(&fs->active, app->frame_stats_file != NULL || fs->pinned || now < fs->poll_until_us);
+    }
+    if (app->frame_stats_file) frame_stats_drain(app);
+    return G_SOURCE_CONTINUE;
+}
+
+// Streams carry a ring with --frame-stats, --governor or a control socket;
+// the file is opened here, before PLAYING
+static gboolean frame_stats_start(App *app, GError **error) {
+    const AppConfig *cfg = app->cfg;
+    if (!cfg->frame_stats_path && !cfg->control_socket && !cfg->governor) return TRUE;
+    if (cfg->frame_stats_path) {
+        FrameStatsFile *f = g_new0(FrameStatsFile, 1);
+        f->path = g_strdup(cfg->frame_stats_path);
+        f->max_bytes = (guint64)cfg->frame_stats_mb << 20;
+        if (!frame_stats_file_open(f, error)) {
+            g_free(f->path);
+            g_free(f);
+            return FALSE;
+        }
+        app->frame_stats_file = f;
+        g_printerr("Frame stats: %s (%zu-byte records, rotated at %u MiB)\n",
+                   f->path, sizeof(FrameStat), cfg->frame_stats_mb);
+    }
+    app->frame_stats_timer = g_timeout_add(FRAME_STATS_TICK_MS, frame_stats_tick_cb, app);
+    return TRUE;
+}
+
+// Call with the pipeline in NULL: the last records are written out
+static void frame_stats_stop(App *app) {
+    if (app->frame_stats_timer) g_source_remove(app->frame_stats_timer);
+    app->frame_stats_timer = 0;
+    FrameStatsFile *f = app->frame_stats_file;
+    if (!f) return;
+    frame_stats_drain(app);
+    if (f->lost > 0) g_printerr("Frame stats: %" G_GUINT64_FORMAT " records lost to overruns\n", f->lost);
+    if (f->fp) fclose(f->fp);
+    g_free(f->path);
+    g_free(f);
+    app->frame_stats_file = NULL;
+}
+
+// "frame_stats": up to max records of one stream from *since (default: the
+// latest max), and the cursor for the next call. Keeps recording on for
+// FRAME_STATS_IDLE_US.
+static void frame_stats_poll(FrameStats *fs, const gint64 *since, gint64 max, JsonBuilder *b) {
+    fs->poll_until_us = g_get_monotonic_time() + FRAME_STATS_IDLE_US;
+    g_atomic_int_set(&fs->active, TRUE);
+    max = CLAMP(max, 1, FRAME_STATS_RING);
+    guint head = (guint)g_atomic_int_get(&fs->head);
+    guint cursor = since ? (guint)*since : head - MIN(head, (guint)max);
+    // A cursor from the future (a restarted instance, a client bug) would
+    // count the whole distance as lost; it just has nothing new yet
+    if ((gint)(cursor - head) > 0) cursor = head;
+    FrameStat *recs = g_new(FrameStat, max);
+    guint lost;
+    guint n = frame_stats_read(fs, &cursor, recs, (guint)max, &lost);
+    json_builder_set_member_name(b, "next");
+    json_builder_add_int_value(b, cursor);
+    json_builder_set_member_name(b, "lost");
+    json_builder_add_int_value(b, lost);
+    json_builder_set_member_name(b, "frames");
+    json_builder_begin_array(b);
+    for (guint i = 0; i < n; ++i) {
+        const FrameStat *r = &recs[i];
+        gchar type[2] = { (gchar)r->type, '\0' };
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "seq");
+        json_builder_add_int_value(b, r->seq);
+        json_builder_set_member_name(b, "pts");
+        if (r->pts != G_MAXUINT64) json_builder_add_int_value(b, (gint64)r->pts);
+        else json_builder_add_null_value(b);
+        json_builder_set_member_name(b, "timecode");
+        if (r->timecode != G_MAXUINT32) {
+            gchar tc[16];
+            g_snprintf(tc, sizeof(tc), "%02u:%02u:%02u:%02u", r->timecode >> 24, (r->timecode >> 16) & 0xFF,
+                       (r->timecode >> 8) & 0xFF, r->timecode & 0xFF);
+            json_builder_add_string_value(b, tc);
+        } else {
+            json_builder_add_null_value(b);
+        }
+        json_builder_set_member_name(b, "type");
+        json_builder_add_string_value(b, type);
+        json_builder_set_member_name(b, "idr");
+        json_builder_add_boolean_value(b, (r->flags & FRAME_STAT_IDR) != 0);
+        json_builder_set_member_name(b, "size");
+        json_builder_add_int_value(b, r->size);
+        json_builder_set_member_name(b, "qp");
+        if (r->qp != 0xFF) json_builder_add_int_value(b, r->qp);
+        else json_builder_add_null_value(b);
+        json_builder_set_member_name(b, "encode_us");
+        if (r->encode_us != G_MAXUINT32) json_builder_add_int_value(b, r->encode_us);
+        else json_builder_add_null_value(b);
+        json_builder_end_object(b);
+    }
+    json_builder_end_array(b);
+    g_free(recs);
+}
+
+// --- Per-stage CPU accounting (--cpu-stats, "cpu" in stats) ---
+//
+// Each streaming thread posts a stream-status ENTER message from the thread
+// itself when its task starts. A bus sync handler records the thread's tid
+// against the element that owns the task. A main-loop timer reads every
+// thread's CPU clock and charges the time since the last sample to the stage
+// the owner serves. The thread runs every element from the owner's pad up to
+// the next queue or aggregator:
+//   receive          ndisrc ! ndisrcdemux ! selectors (also a backup source)
+//   video            videoconvert ! x264enc ! SEI injector ! h264parse
+//   encoder_threads  threads x264 starts from the video thread (same name)
+//   audio            audioconvert ! audio encoder
+//   mux              mpegtsmux ! out_tee
+//   output           an output or recording branch: queue ! sink
+//   rendition        a rendition branch: scale, encode and mux
+// Threads that serve no stream (main loop, NDI SDK, libsrt, writer threads)
+// are reported process-wide as "other". Linux only: other threads' CPU
+// clocks are read by tid, and helper threads are found in /proc/self/task.
+
+static guint64 cpu_clock_ns(clockid_t id) {
+    struct timespec ts;
+    if (clock_gettime(id, &ts) != 0) return 0;
+    return (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64)ts.tv_nsec;
+}
+
+#ifdef __linux__
+
+#define CPU_STATS_DEFAULT_S 5   // sample period with only --control-socket
+
+enum { CPU_RECEIVE, CPU_VIDEO, CPU_ENCODER_THREADS, CPU_AUDIO, CPU_MUX, CPU_OUTPUT, CPU_RENDITION, CPU_STAGE_COUNT };
+
+static const gchar *cpu_stage_names[CPU_STAGE_COUNT] = {
+    "receive", "video", "encoder_threads", "audio", "mux", "output", "rendition"
+};
+
+typedef struct CpuThread {
+    gint tid;
+    GstElement *owner;      // task owner (ref); NULL for helper threads
+    gboolean resolved;
+    gint stream;            // -1: serves no stream ("other")
+    guint stage;
+    gchar comm[16];         // thread name at the last sample
+    guint64 last_ns;        // thread CPU time at the last sample
+    guint sweep;
+} CpuThread;
+
+// CPU time of a task that ended, or of a pool thread that moved on to
+// another task, since the last sample
+typedef struct CpuRetired {
+    GstElement *owner;
+    guint64 ns;
+} CpuRetired;
+
+typedef struct CpuAccount {
+    App *app;
+    GMutex lock;            // tasks, retired: bus sync handler vs main loop
+    GHashTable *tasks;      // tid -> CpuThread*, from stream-status messages
+    GArray *retired;        // CpuRetired
+    // main loop only
+    GHashTable *helpers;    // tid -> CpuThread*, unregistered threads named like a task thread
+    guint sweep;
+    guint period_s;
+    gboolean log;
+    guint timer;
+    guint64 last_process_ns;
+    gint64 last_sample_us;
+    guint n_streams;
+    guint64 *period_ns;     // [stream * CPU_STAGE_COUNT + stage], this period
+    guint *period_threads;
+    gdouble *pct;           // last period, % of one core
+    guint *threads;
+    gdouble process_pct;
+    gdouble other_pct;
+    gboolean have_period;
+} CpuAccount;
+
+// The clock pthread_getcpuclockid() returns, built from the tid so that any
+// thread of the process can be read, including ones GStreamer did not start
+static gboolean cpu_thread_ns(gint tid, guint64 *ns) {
+    clockid_t id = (clockid_t)(((~(guint)tid) << 3) | 6u);
+    struct timespec ts;
+    if (clock_gettime(id, &ts) != 0) return FALSE;
+    *ns = (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64)ts.tv_nsec;
+    return TRUE;
+}
+
+static gboolean cpu_thread_comm(gint tid, gchar comm[16]) {
+    gchar path[48];
+    g_snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+    FILE *f = fopen(path, "r");
+    if (!f) return FALSE;
+    gboolean ok = fgets(comm, 16, f) != NULL;
+    fclose(f);
+    if (ok) comm[strcspn(comm, "\n")] = '\0';
+    return ok;
+}
+
+static void cpu_thread_free(CpuThread *t) {
+    if (t->owner) gst_object_unref(t->owner);
+    g_free(t);
+}
+
+static GstBusSyncReply cpu_bus_sync_cb(GstBus *bus, GstMessage *msg, gpointer user_data) {
+    (void)bus;
+    if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS) return GST_BUS_PASS;
+    CpuAccount *ca = (CpuAccount*)user_data;
+    GstStreamStatusType type;
+    GstElement *owner = NULL;
+    gst_message_parse_stream_status(msg, &type, &owner);
+    if (!owner || (type != GST_STREAM_STATUS_TYPE_ENTER && type != GST_STREAM_STATUS_TYPE_LEAVE)) return GST_BUS_PASS;
+    // Both are posted by the streaming thread itself
+    gint tid = (gint)syscall(SYS_gettid);
+    guint64 now = cpu_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    g_mutex_lock(&ca->lock);
+    CpuThread *t = g_hash_table_lookup(ca->tasks, GINT_TO_POINTER(tid));
+    if (t && t->owner) {
+        CpuRetired r = { t->owner, now - t->last_ns };
+        g_array_append_val(ca->retired, r);
+        t->owner = NULL;
+    }
+    if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+        if (!t) {
+            t = g_new0(CpuThread, 1);
+            t->tid = tid;
+            g_hash_table_insert(ca->tasks, GINT_TO_POINTER(tid), t);
+        }
+        t->owner = gst_object_ref(owner);
+        t->resolved = FALSE;
+        t->last_ns = now;
+    } else if (t) {
+        g_hash_table_remove(ca->tasks, GINT_TO_POINTER(tid));
+    }
+    g_mutex_unlock(&ca->lock);
+    return GST_BUS_PASS;
+}
+
+// Stream and stage whose elements a task owned by `owner` runs
+static gboolean cpu_stage_of(App *app, GstElement *owner, gint *stream, guint *stage) {
+    for (guint i = 0; i < app->streams->len; ++i) {
+        Stream *st = (Stream*)g_ptr_array_index(app->streams, i);
+        const PipelineGraph *g = &st->graph;
+        gint s = -1;
+        if (owner == g->ndisrc || owner == g->meta_src) s = CPU_RECEIVE;
+        else if (owner == g->vqueue || owner == g->sync_src) s = CPU_VIDEO;
+        else if (g->enc_process && gst_object_has_as_ancestor(GST_OBJECT(owner), GST_OBJECT(g->enc))) s = CPU_VIDEO;
+        else if (owner == g->aqueue) s = CPU_AUDIO;
+        else if (owner == g->mux) s = CPU_MUX;  // --mpts: the shared mux counts for stream 0
+        for (GList *l = st->branches; s < 0 && l; l = l->next) {
+            Branch *br = (Branch*)l->data;
+            if (!gst_object_has_as_ancestor(GST_OBJECT(owner), GST_OBJECT(br->bin))) continue;
+            s = br->kind == BRANCH_RENDITION ? CPU_RENDITION
+              : br->kind == BRANCH_BACKUP_SOURCE ? CPU_RECEIVE : CPU_OUTPUT;
+        }
+        if (s >= 0) {
+            *stream = (gint)i;
+            *stage = (guint)s;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void cpu_charge(CpuAccount *ca, gint stream, guint stage, guint64 ns, gboolean thread) {
+    if (stream < 0 || (guint)stream >= ca->n_streams) return;
+    guint i = (guint)stream * CPU_STAGE_COUNT + stage;
+    ca->period_ns[i] += ns;
+    if (thread) ca->period_threads[i]++;
+}
+
+static void cpu_account_resize(CpuAccount *ca, guint n_streams) {
+    if (n_streams <= ca->n_streams) return;
+    gsize n = (gsize)n_streams * CPU_STAGE_COUNT;
+    ca->period_ns = g_renew(guint64, ca->period_ns, n);
+    ca->period_threads = g_renew(guint, ca->period_threads, n);
+    ca->pct = g_renew(gdouble, ca->pct, n);
+    ca->threads = g_renew(guint, ca->threads, n);
+    gsize old = (gsize)ca->n_streams * CPU_STAGE_COUNT;
+    memset(ca->pct + old, 0, (n - old) * sizeof(gdouble));
+    memset(ca->threads + old, 0, (n - old) * sizeof(guint));
+    ca->n_streams = n_streams;
+}
+
+typedef struct CpuTaskName {
+    gint tid;
+    gchar comm[16];
+    gint stream;
+    guint stage;
+} CpuTaskName;
+
+// Threads not started by GStreamer inherit the name of the thread that
+// created them: x264's slice/lookahead threads are named like the video
+// thread that opened the encoder
+static void cpu_sample_helpers(CpuAccount *ca, const GArray *names) {
+    GDir *dir = g_dir_open("/proc/self/task", 0, NULL);
+    if (!dir) return;
+    const gchar *entry;
+    while ((entry = g_dir_read_name(dir))) {
+        gint tid = atoi(entry);
+        const CpuTaskName *match = NULL;
+        gboolean registered = FALSE;
+        gchar comm[16];
+        if (tid <= 0 || !cpu_thread_comm(tid, comm)) continue;
+        for (guint i = 0; i < names->len && !registered; ++i) {
+            const CpuTaskName *n = &g_array_index(names, CpuTaskName, i);
+            if (n->tid == tid) registered = TRUE;
+            else if (!match && n->stream >= 0 && strcmp(n->comm, comm) == 0) match = n;
+        }
+        guint64 ns;
+        if (registered || !match || !cpu_thread_ns(tid, &ns)) continue;
+        CpuThread *t = g_hash_table_lookup(ca->helpers, GINT_TO_POINTER(tid));
+        if (!t) {
+            // Started since the last sample (or before the first one): all of its time counts
+            t = g_new0(CpuThread, 1);
+            t->tid = tid;
+            g_hash_table_insert(ca->helpers, GINT_TO_POINTER(tid), t);
+        }
+        t->stream = match->stream;
+        t->stage = match->stage == CPU_VIDEO ? CPU_ENCODER_THREADS : match->stage;
+        cpu_charge(ca, t->stream, t->stage, ns - MIN(ns, t->last_ns), TRUE);
+        t->last_ns = ns;
+        t->sweep = ca->sweep;
+    }
+    g_dir_close(dir);
+    GHashTableIter it;
+    gpointer value;
+    g_hash_table_iter_init(&it, ca->helpers);
+    while (g_hash_table_iter_next(&it, NULL, &value)) {
+        if (((CpuThread*)value)->sweep != ca->sweep) g_hash_table_iter_remove(&it);
+    }
+}
+
+static void cpu_log(CpuAccount *ca) {
+    for (guint s = 0; s < ca->n_streams; ++s) {
+        GString *line = g_string_new(NULL);
+        for (guint k = 0; k < CPU_STAGE_COUNT; ++k) {
+            guint i = s * CPU_STAGE_COUNT + k;
+            if (ca->threads[i] == 0) continue;
+            g_string_append_printf(line, "%s%s %.1f%%", line->len ? ", " : "", cpu_stage_names[k], ca->pct[i]);
+        }
+        if (line->len) g_printerr("CPU [%u]: %s\n", s, line->str);
+        g_string_free(line, TRUE);
+    }
+    g_printerr("CPU: process %.1f%%, other %.1f%% (%% of one core over %u s)\n",
+               ca->process_pct, ca->other_pct, ca->period_s);
+}
+
+static gboolean cpu_sample_cb(gpointer user_data) {
+    CpuAccount *ca = (CpuAccount*)user_data;
+    App *app = ca->app;
+    cpu_account_resize(ca, app->streams->len);
+    gsize n = (gsize)ca->n_streams * CPU_STAGE_COUNT;
+    memset(ca->period_ns, 0, n * sizeof(guint64));
+    memset(ca->period_threads, 0, n * sizeof(guint));
+    ca->sweep++;
+
+    GArray *names = g_array_new(FALSE, FALSE, sizeof(CpuTaskName));
+    g_mutex_lock(&ca->lock);
+    for (guint i = 0; i < ca->retired->len; ++i) {
+        CpuRetired *r = &g_array_index(ca->retired, CpuRetired, i);
+        gint stream;
+        guint stage;
+        if (cpu_stage_of(app, r->owner, &stream, &stage)) cpu_charge(ca, stream, stage, r->ns, FALSE);
+        gst_object_unref(r->owner);
+    }
+    g_array_set_size(ca->retired, 0);
+    GHashTableIter it;
+    gpointer value;
+    g_hash_table_iter_init(&it, ca->tasks);
+    while (g_hash_table_iter_next(&it, NULL, &value)) {
+        CpuThread *t = (CpuThread*)value;
+        guint64 ns;
+        if (!cpu_thread_ns(t->tid, &ns)) {
+            // Exited without a LEAVE message
+            g_hash_table_iter_remove(&it);
+            continue;
+        }
+        if (!t->owner) continue;
+        if (!t->resolved) {
+            t->resolved = TRUE;
+            if (!cpu_stage_of(app, t->owner, &t->stream, &t->stage)) t->stream = -1;
+        }
+        cpu_charge(ca, t->stream, t->stage, ns - MIN(ns, t->last_ns), TRUE);
+        t->last_ns = ns;
+        CpuTaskName name = { t->tid, "", t->stream, t->stage };
+        if (cpu_thread_comm(t->tid, name.comm)) g_array_append_val(names, name);
+    }
+    g_mutex_unlock(&ca->lock);
+    cpu_sample_helpers(ca, names);
+    g_array_unref(names);
+
+    gint64 now_us = g_get_monotonic_time();
+    guint64 process_ns = cpu_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    gdouble wall_ns = (gdouble)(now_us - ca->last_sample_us) * 1000.0;
+    guint64 attributed = 0;
+    for (gsize i = 0; i < n; ++i) {
+        attributed += ca->period_ns[i];
+        ca->pct[i] = wall_ns > 0 ? 100.0 * (gdouble)ca->period_ns[i] / wall_ns : 0.0;
+        ca->threads[i] = ca->period_threads[i];
+    }
+    guint64 process = process_ns - ca->last_process_ns;
+    ca->process_pct = wall_ns > 0 ? 100.0 * (gdouble)process / wall_ns : 0.0;
+    ca->other_pct = wall_ns > 0 && process > attributed ? 100.0 * (gdouble)(process - attributed) / wall_ns : 0.0;
+    ca->last_process_ns = process_ns;
+    ca->last_sample_us = now_us;
+    ca->have_period = TRUE;
+    if (ca->log) cpu_log(ca);
+    return G_SOURCE_CONTINUE;
+}
+
+// Before PAUSED: the sync handler must see the tasks start
+static void cpu_stats_start(App *app) {
+    const AppConfig *cfg = app->cfg;
+    if (cfg->cpu_stats_s == 0 && !cfg->control_socket) return;
+    CpuAccount *ca = g_new0(CpuAccount, 1);
+    ca->app = app;
+    g_mutex_init(&ca->lock);
+    ca->tasks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)cpu_thread_free);
+    ca->helpers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)cpu_thread_free);
+    ca->retired = g_array_new(FALSE, FALSE, sizeof(CpuRetired));
+    ca->period_s = cfg->cpu_stats_s > 0 ? cfg->cpu_stats_s : CPU_STATS_DEFAULT_S;
+    ca->log = cfg->cpu_stats_s > 0;
+    ca->last_process_ns = cpu_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    ca->last_sample_us = g_get_monotonic_time();
+    cpu_account_resize(ca, app->streams->len);
+    GstBus *bus = gst_element_get_bus(app->pipeline);
+    gst_bus_set_sync_handler(bus, cpu_bus_sync_cb, ca, NULL);
     gst_object_unref(bus);
+    ca->timer = g_timeout_add_seconds(ca->period_s, cpu_sample_cb, ca);
+    app->cpu = ca;
+}
 
-    // Pause first to allow negotiation and install SEI probe
-    gst_element_set_state(pipeline, GST_STATE_PAUSED);
-    gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+// Call with the pipeline in NULL
+static void cpu_stats_stop(App *app) {
+    CpuAccount *ca = app->cpu;
+    if (!ca) return;
+    g_source_remove(ca->timer);
+    GstBus *bus = gst_element_get_bus(app->pipeline);
+    gst_bus_set_sync_handler(bus, NULL, NULL, NULL);
+    gst_object_unref(bus);
+    for (guint i = 0; i < ca->retired->len; ++i) gst_object_unref(g_array_index(ca->retired, CpuRetired, i).owner);
+    g_array_unref(ca->retired);
+    g_hash_table_unref(ca->tasks);
+    g_hash_table_unref(ca->helpers);
+    g_mutex_clear(&ca->lock);
+    g_free(ca->period_ns);
+    g_free(ca->period_threads);
+    g_free(ca->pct);
+    g_free(ca->threads);
+    g_free(ca);
+    app->cpu = NULL;
+}
 
-    // Install SEI injector on encoder src (Annex B byte-stream with AUD)
-    gulong sei_probe_id = 0;
-    SeiConfig *sei_cfg = NULL;
-    if (cfg.inject_sei) {
-        GstElement *enc_elem = gst_bin_get_by_name(GST_BIN(pipeline), "enc");
-        if (enc_elem) {
-            GstPad *enc_src = gst_element_get_static_pad(enc_elem, "src");
-            GstPad *enc_sink = gst_element_get_static_pad(enc_elem, "sink");
-            guint fps_n = 0, fps_d = 1;
-            if (enc_sink) {
-                GstPad *peer = gst_pad_get_peer(enc_sink);
-                GstCaps *pcaps = peer ? gst_pad_get_current_caps(peer) : NULL;
-                if (!pcaps && peer) pcaps = gst_pad_query_caps(peer, NULL);
-                if (pcaps) {
-                    const GstStructure *s = gst_caps_get_structure(pcaps, 0);
-                    if (s) {
-                        const GValue *fr = gst_structure_get_value(s, "framerate");
-                        if (fr && GST_VALUE_HOLDS_FRACTION(fr)) {
-                            fps_n = gst_value_get_fraction_numerator(fr);
-                            fps_d = gst_value_get_fraction_denominator(fr);
-                        }
-                    }
-                    gst_caps_unref(pcaps);
-                }
-                if (peer) gst_object_unref(peer);
-                gst_object_unref(enc_sink);
-            }
-            if (enc_src) {
-                sei_cfg = g_new0(SeiConfig, 1);
-                sei_cfg->inject_sei = TRUE;
-                sei_cfg->prefer_pts = TRUE;
-                sei_cfg->fps_n = fps_n;
-                sei_cfg->fps_d = fps_d;
-                sei_cfg->verbose = cfg.verbose;
-                sei_probe_id = gst_pad_add_probe(enc_src, GST_PAD_PROBE_TYPE_BUFFER, h264_sei_inject_probe, sei_cfg, NULL);
-                gst_object_unref(enc_src);
-            }
-            gst_object_unref(enc_elem);
+// "cpu" of one stream in stats: % of one core per stage over the last period
+static void cpu_add_stream_stats(JsonBuilder *b, const CpuAccount *ca, guint stream) {
+    if (!ca->have_period || stream >= ca->n_streams) return;
+    json_builder_set_member_name(b, "cpu");
+    json_builder_begin_object(b);
+    for (guint k = 0; k < CPU_STAGE_COUNT; ++k) {
+        guint i = stream * CPU_STAGE_COUNT + k;
+        if (ca->threads[i] == 0) continue;
+        json_builder_set_member_name(b, cpu_stage_names[k]);
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "percent");
+        json_builder_add_double_value(b, ca->pct[i]);
+        json_builder_set_member_name(b, "threads");
+        json_builder_add_int_value(b, ca->threads[i]);
+        json_builder_end_object(b);
+    }
+    json_builder_end_object(b);
+}
+
+static void cpu_add_stats(JsonBuilder *b, const CpuAccount *ca) {
+    if (!ca->have_period) return;
+    json_builder_set_member_name(b, "cpu");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "period_s");
+    json_builder_add_int_value(b, ca->period_s);
+    json_builder_set_member_name(b, "process_percent");
+    json_builder_add_double_value(b, ca->process_pct);
+    json_builder_set_member_name(b, "other_percent");
+    json_builder_add_double_value(b, ca->other_pct);
+    json_builder_end_object(b);
+}
+
+#endif // __linux__
+
+// --- Ingest format negotiation (--ingest-format) ---
+//
+// ndisrc delivers whatever the NDI SDK hands it (UYVY, UYVA with alpha, P216
+// for 16-bit sources, NV12/I420 for some HX sources), and the encoder takes a
+// handful of raw formats on its sink pad. Forcing I420 in between costs a
+// full-frame conversion even when the source is already 4:2:0. With
+// --ingest-format auto (the default) ndisrc asks the SDK for its native
+// format (color-format=fastest, so the SDK does not convert either) and vcaps
+// allows every 8-bit 4:2:0 format the encoder accepts: videoconvert then
+// passes through when the source delivers one of them, and otherwise does a
+// single orc-accelerated conversion straight to the closest one. The chain
+// and its cost per frame are logged by a ConvertCost probe (below).
+
+// 8-bit 4:2:0 raw formats: what the encoder sees stays the same picture,
+// whichever is picked. Preference order when videoconvert must convert anyway.
+static const gchar *ingest_formats[] = { "I420", "NV12", "YV12" };
+
+static gboolean element_enum_has_nick(GstElement *element, const gchar *prop_name, const gchar *nick) {
+    GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), prop_name);
+    return pspec && G_IS_PARAM_SPEC_ENUM(pspec) &&
+           g_enum_get_value_by_nick(G_PARAM_SPEC_ENUM(pspec)->enum_class, nick) != NULL;
+}
+
+// Let the SDK deliver frames in their native format; older ndisrc builds
+// without the property keep their default (UYVY/BGRA)
+static void ndisrc_set_ingest_format(GstElement *ndisrc, const AppConfig *cfg) {
+    if (g_strcmp0(cfg->ingest_format, "auto") != 0) return;
+    if (element_enum_has_nick(ndisrc, "color-format", "fastest")) {
+        gst_util_set_object_arg(G_OBJECT(ndisrc), "color-format", "fastest");
+    }
+}
+
+// vcaps: the ingest formats the encoder's sink pad accepts (I420 only with
+// --ingest-format i420, and with --quality-probe, which compares I420 planes)
+static GstCaps* ingest_caps_for_encoder(GstElement *enc, const AppConfig *cfg) {
+    gboolean i420_only = g_strcmp0(cfg->ingest_format, "auto") != 0 || cfg->quality_probe > 0;
+    GstPad *sink = gst_element_get_static_pad(enc, "sink");
+    GstCaps *accepted = gst_pad_query_caps(sink, NULL);
+    gst_object_unref(sink);
+    GValue list = G_VALUE_INIT, format = G_VALUE_INIT;
+    g_value_init(&list, GST_TYPE_LIST);
+    g_value_init(&format, G_TYPE_STRING);
+    for (guint i = 0; i < (i420_only ? 1 : G_N_ELEMENTS(ingest_formats)); ++i) {
+        GstCaps *one = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, ingest_formats[i], NULL);
+        if (gst_caps_can_intersect(one, accepted)) {
+            g_value_set_string(&format, ingest_formats[i]);
+            gst_value_list_append_value(&list, &format);
         }
+        gst_caps_unref(one);
+    }
+    gst_caps_unref(accepted);
+    GstCaps *caps = gst_caps_new_empty_simple("video/x-raw");
+    if (gst_value_list_get_size(&list) > 1) {
+        gst_caps_set_value(caps, "format", &list);
+    } else {
+        // One candidate, or none (let negotiation report the mismatch on I420)
+        gst_caps_set_simple(caps, "format", G_TYPE_STRING,
+                            gst_value_list_get_size(&list) == 1
+                                ? g_value_get_string(gst_value_list_get_value(&list, 0)) : "I420", NULL);
     }
+    g_value_unset(&format);
+    g_value_unset(&list);
+    return caps;
+}
 
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+// --- Converter cost (videoconvert / audioconvert) ---
+//
+// Time spent in a converter per buffer: its sink and src pads run on the
+// same streaming thread, so the gap between the two probes is the conversion
+// (or the passthrough bookkeeping). The negotiated chain and its cost are
+// logged once the first CONVERT_LOG_BUFFERS buffers went through, and again
+// after the input format changes (backup source, sender reconfigured).
+
+#define CONVERT_LOG_BUFFERS 100
+
+typedef struct ConvertCost {
+    const gchar *label;    // "Ingest" (video) or "Audio"
+    guint index;
+    gchar *converter;      // factory names, for the log
+    gchar *consumer;
+    GstClockTime entered;  // sink probe time of the buffer in flight
+    GMutex lock;
+    gchar in_desc[48];     // e.g. "UYVY 1920x1080", "F32LE planar 2ch"
+    gchar out_desc[48];
+    guint64 buffers;
+    guint64 total_ns;
+    guint64 max_ns;
+    gboolean logged;
+} ConvertCost;
 
-    if (cfg.stdout_mode) {
-        g_printerr("Running... NDI: %s -> stdout\n", cfg.ndi_name);
+static void convert_caps_describe(GstCaps *caps, gchar *desc, gsize size) {
+    const GstStructure *s = gst_caps_get_structure(caps, 0);
+    const gchar *format = gst_structure_get_string(s, "format");
+    gint a, b;
+    if (!format) format = gst_structure_get_name(s);
+    if (gst_structure_get_int(s, "width", &a) && gst_structure_get_int(s, "height", &b)) {
+        g_snprintf(desc, size, "%s %dx%d", format, a, b);
+    } else if (gst_structure_get_int(s, "channels", &a)) {
+        gboolean planar = g_strcmp0(gst_structure_get_string(s, "layout"), "non-interleaved") == 0;
+        g_snprintf(desc, size, "%s %s %dch", format, planar ? "planar" : "interleaved", a);
     } else {
-        g_printerr("Running... NDI: %s -> SRT: %s\n", cfg.ndi_name, cfg.srt_uri);
+        g_strlcpy(desc, format, size);
     }
-    if (cfg.timeout_seconds > 0) {
-        g_timeout_add_seconds(cfg.timeout_seconds, quit_loop_cb, loop);
+}
+
+static gboolean convert_passthrough(const ConvertCost *c) {
+    return c->out_desc[0] && strcmp(c->in_desc, c->out_desc) == 0;
+}
+
+static GstPadProbeReturn convert_sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    ConvertCost *c = (ConvertCost*)user_data;
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        c->entered = gst_util_get_timestamp();
+    } else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) {
+        GstCaps *caps;
+        gst_event_parse_caps(GST_PAD_PROBE_INFO_EVENT(info), &caps);
+        gchar desc[sizeof(c->in_desc)];
+        convert_caps_describe(caps, desc, sizeof(desc));
+        g_mutex_lock(&c->lock);
+        if (strcmp(desc, c->in_desc) != 0) {
+            // New chain: measure it afresh
+            g_strlcpy(c->in_desc, desc, sizeof(c->in_desc));
+            c->buffers = c->total_ns = c->max_ns = 0;
+            c->logged = FALSE;
+        }
+        g_mutex_unlock(&c->lock);
     }
-    g_main_loop_run(loop);
+    return GST_PAD_PROBE_OK;
+}
 
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
-    // Remove probe and free
-    if (cfg.inject_sei && sei_probe_id != 0) {
-        GstElement *enc_elem2 = gst_bin_get_by_name(GST_BIN(pipeline), "enc");
-        if (enc_elem2) {
-            GstPad *enc_src2 = gst_element_get_static_pad(enc_elem2, "src");
-            if (enc_src2) {
-                gst_pad_remove_probe(enc_src2, sei_probe_id);
-                gst_object_unref(enc_src2);
-            }
-            gst_object_unref(enc_elem2);
+static GstPadProbeReturn convert_src_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    ConvertCost *c = (ConvertCost*)user_data;
+    if (!(info->type & GST_PAD_PROBE_TYPE_BUFFER)) {
+        if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) {
+            GstCaps *caps;
+            gst_event_parse_caps(GST_PAD_PROBE_INFO_EVENT(info), &caps);
+            g_mutex_lock(&c->lock);
+            convert_caps_describe(caps, c->out_desc, sizeof(c->out_desc));
+            g_mutex_unlock(&c->lock);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    if (c->entered == GST_CLOCK_TIME_NONE) return GST_PAD_PROBE_OK;
+    guint64 ns = gst_util_get_timestamp() - c->entered;
+    c->entered = GST_CLOCK_TIME_NONE;
+    g_mutex_lock(&c->lock);
+    c->buffers++;
+    c->total_ns += ns;
+    if (ns > c->max_ns) c->max_ns = ns;
+    if (c->buffers == CONVERT_LOG_BUFFERS && !c->logged) {
+        c->logged = TRUE;
+        gchar *chain = convert_passthrough(c) ? g_strdup_printf("%s (passthrough)", c->converter)
+                                              : g_strdup_printf("%s -> %s", c->converter, c->out_desc);
+        g_printerr("%s [%u]: %s -> %s -> %s, %.0f us/buffer avg, %.0f max (%u buffers)\n",
+                   c->label, c->index, c->in_desc, chain, c->consumer,
+                   c->total_ns / 1e3 / c->buffers, c->max_ns / 1e3, CONVERT_LOG_BUFFERS);
+        g_free(chain);
+    }
+    g_mutex_unlock(&c->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static ConvertCost* convert_cost_install(const gchar *label, guint index, GstElement *converter, GstElement *consumer) {
+    ConvertCost *c = g_new0(ConvertCost, 1);
+    c->label = label;
+    c->index = index;
+    c->converter = g_strdup(GST_OBJECT_NAME(gst_element_get_factory(converter)));
+    c->consumer = g_strdup(GST_OBJECT_NAME(gst_element_get_factory(consumer)));
+    c->entered = GST_CLOCK_TIME_NONE;
+    g_mutex_init(&c->lock);
+    GstPad *in = gst_element_get_static_pad(converter, "sink");
+    gst_pad_add_probe(in, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, convert_sink_probe, c, NULL);
+    gst_object_unref(in);
+    GstPad *out = gst_element_get_static_pad(converter, "src");
+    gst_pad_add_probe(out, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, convert_src_probe, c, NULL);
+    gst_object_unref(out);
+    return c;
+}
+
+// Probes on the stream's videoconvert and, with audio, its audioconvert
+static void stream_install_convert_cost(Stream *st) {
+    st->ingest = convert_cost_install("Ingest", st->index, st->graph.vconvert, graph_encoder(&st->graph));
+    if (!st->graph.audio_tee) return;
+    GstElement *aconv = gst_bin_get_by_name(GST_BIN(st->graph.audio_enc), "aconv");
+    GstElement *aenc = gst_bin_get_by_name(GST_BIN(st->graph.audio_enc), "aenc");
+    if (aconv && aenc) st->audio_convert = convert_cost_install("Audio", st->index, aconv, aenc);
+    if (aconv) gst_object_unref(aconv);
+    if (aenc) gst_object_unref(aenc);
+}
+
+static void convert_cost_free(ConvertCost *c) {
+    if (!c) return;
+    g_mutex_clear(&c->lock);
+    g_free(c->converter);
+    g_free(c->consumer);
+    g_free(c);
+}
+
+static void convert_cost_add_stats(JsonBuilder *b, const gchar *member, ConvertCost *c) {
+    g_mutex_lock(&c->lock);
+    json_builder_set_member_name(b, member);
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "input");
+    json_builder_add_string_value(b, c->in_desc);
+    json_builder_set_member_name(b, "output");
+    json_builder_add_string_value(b, c->out_desc);
+    json_builder_set_member_name(b, "passthrough");
+    json_builder_add_boolean_value(b, convert_passthrough(c));
+    json_builder_set_member_name(b, "buffers");
+    json_builder_add_int_value(b, (gint64)c->buffers);
+    json_builder_set_member_name(b, "convert_us_avg");
+    json_builder_add_double_value(b, c->buffers ? c->total_ns / 1e3 / c->buffers : 0.0);
+    json_builder_set_member_name(b, "convert_us_max");
+    json_builder_add_double_value(b, c->max_ns / 1e3);
+    json_builder_end_object(b);
+    g_mutex_unlock(&c->lock);
+}
+
+static void init_gstreamer(int *argc, char ***argv) {
+#ifdef NDI2SRT_STATIC_PLUGINS
+    // Everything we need is linked in: skip loading and scanning the registry
+    g_setenv("GST_REGISTRY_DISABLE", "yes", FALSE);
+    g_setenv("GST_REGISTRY_UPDATE", "no", FALSE);
+    g_setenv("GST_PLUGIN_SYSTEM_PATH_1_0", "", FALSE);
+    g_setenv("GST_PLUGIN_PATH_1_0", "", FALSE);
+#endif
+    gst_init(argc, argv);
+#ifdef NDI2SRT_STATIC_PLUGINS
+    register_static_plugins();
+#endif
+}
+
+#ifdef NDI2SRT_SHM_RING
+
+// --- Out-of-process encoder (--encoder-process) ---
+//
+// A crash in x264, or a frame it never returns, takes down or stalls the
+// whole process, and with it every stream. With --encoder-process each
+// stream's encoder runs in a worker: ndi2srt re-executed with
+// --encoder-worker, running appsrc ! x264enc ! appsink (protocol in
+// encproc.h). graph.enc becomes a bin with the same two pads:
+//   sink  an appsink. It answers the allocation query with a pool of memfd
+//         buffers, so videoconvert writes each frame straight into memory
+//         the worker maps and only the buffer's id crosses the socket.
+//         Frames from another pool (the --tc-sync aligner, a tee shared with
+//         renditions, videoconvert in passthrough) are copied into one
+//         first. A frame is held until the worker's encoder releases it.
+//   src   an appsrc. The worker writes access units into an AU-mode shmring
+//         and they are copied out of it, tens of KB each. The input frame's
+//         metas (timecode, captions) go back on its AU, matched by PTS, as
+//         x264enc would have carried them.
+// The SEI injector, frame stats and trace probes stay on the bin's pads, in
+// this process. The x264enc graph_build() configured is never linked: a new
+// worker gets its non-default properties, and bitrate changes on it are
+// forwarded. A worker that exits, holds a frame ENCPROC_HANG_MS or lets its
+// socket fill up is killed and started again, and encodes its first frame
+// as an IDR. Frames that arrive while no worker is up are dropped.
+
+#define ENCPROC_HANG_MS 2000                    // a frame held this long: the worker hung
+#define ENCPROC_POLL_MS 200
+#define ENCPROC_RESTART_US (1 * G_USEC_PER_SEC) // at most one worker start per second
+#define ENCPROC_POOL_MIN 4
+#define ENCPROC_POOL_MAX 12                     // frames in flight before videoconvert waits
+#define ENCPROC_RING_BYTES (8u << 20)           // AU ring; a 1080p IDR is well under half
+#define ENCPROC_META_RING 32                    // input frames whose metas wait for their AU
+
+// A frame buffer both processes map
+typedef struct EncProcSlot {
+    guint id;
+    gint fd;
+    guint8 *data;
+    gsize size;
+} EncProcSlot;
+
+static GQuark encproc_slot_quark(void) {
+    return g_quark_from_static_string("ndi2srt-encproc-slot");
+}
+
+static void encproc_slot_free(gpointer data) {
+    EncProcSlot *slot = (EncProcSlot*)data;
+    munmap(slot->data, slot->size);
+    close(slot->fd);
+    g_free(slot);
+}
+
+// Slot behind buf, or NULL if it is not (all of) one of ours
+static EncProcSlot* encproc_buffer_slot(GstBuffer *buf) {
+    if (gst_buffer_n_memory(buf) != 1) return NULL;
+    GstMemory *mem = gst_buffer_peek_memory(buf, 0);
+    EncProcSlot *slot = (EncProcSlot*)gst_mini_object_get_qdata(GST_MINI_OBJECT(mem), encproc_slot_quark());
+    return slot && mem->offset == 0 ? slot : NULL;
+}
+
+// Buffer pool whose buffers are EncProcSlots
+typedef struct EncProcPool {
+    GstBufferPool parent;
+    gsize size;
+} EncProcPool;
+typedef GstBufferPoolClass EncProcPoolClass;
+
+G_DEFINE_TYPE(EncProcPool, encproc_pool, GST_TYPE_BUFFER_POOL)
+
+static gboolean encproc_pool_set_config(GstBufferPool *pool, GstStructure *config) {
+    guint size = 0;
+    if (!gst_buffer_pool_config_get_params(config, NULL, &size, NULL, NULL) || size == 0) return FALSE;
+    ((EncProcPool*)pool)->size = size;
+    return GST_BUFFER_POOL_CLASS(encproc_pool_parent_class)->set_config(pool, config);
+}
+
+static GstFlowReturn encproc_pool_alloc_buffer(GstBufferPool *pool, GstBuffer **buffer,
+                                               GstBufferPoolAcquireParams *params) {
+    (void)params;
+    static gint next_id;
+    EncProcSlot *slot = g_new0(EncProcSlot, 1);
+    slot->size = ((EncProcPool*)pool)->size;
+    slot->data = encproc_buffer_new(slot->size, &slot->fd);
+    if (!slot->data) {
+        g_printerr("Encoder process: cannot allocate a %" G_GSIZE_FORMAT "-byte frame buffer: %s\n",
+                   slot->size, g_strerror(errno));
+        g_free(slot);
+        return GST_FLOW_ERROR;
+    }
+    slot->id = (guint)g_atomic_int_add(&next_id, 1);
+    *buffer = gst_buffer_new_wrapped_full(0, slot->data, slot->size, 0, slot->size, slot, encproc_slot_free);
+    gst_mini_object_set_qdata(GST_MINI_OBJECT(gst_buffer_peek_memory(*buffer, 0)), encproc_slot_quark(), slot, NULL);
+    return GST_FLOW_OK;
+}
+
+static void encproc_pool_class_init(EncProcPoolClass *klass) {
+    klass->set_config = encproc_pool_set_config;
+    klass->alloc_buffer = encproc_pool_alloc_buffer;
+}
+
+static void encproc_pool_init(EncProcPool *pool) {
+    (void)pool;
+}
+
+typedef struct EncProcFrame {
+    GstBuffer *buf;         // held until the worker releases it
+    gint64 sent_us;
+} EncProcFrame;
+
+static void encproc_frame_free(gpointer data) {
+    EncProcFrame *f = (EncProcFrame*)data;
+    gst_buffer_unref(f->buf);
+    g_free(f);
+}
+
+typedef struct EncProcess {
+    guint index;
+    GstElement *bin;        // graph.enc
+    GstElement *sink;       // appsink: raw frames to the worker
+    GstElement *src;        // appsrc: access units from the worker
+    GstElement *settings;   // graph.enc_settings
+    GThread *thread;        // starts the worker, reads its messages, restarts it
+    gint stopping;
+    GstBufferPool *copy_pool; // streaming thread only: frames from other pools
+    gint copied;            // frames copied into a slot
+    GMutex lock;
+    GCond returned;         // pending went down
+    // under lock
+    gint pending;           // frames sent whose AU has not come back
+    gint sock;              // -1 while no worker is up
+    pid_t pid;
+    gboolean killed;        // stopped reading its socket, killed; the thread restarts it
+    guint generation;       // worker starts so far
+    GHashTable *slots_sent; // slot id -> generation it was sent to
+    GHashTable *inflight;   // frame seq -> EncProcFrame
+    gchar *caps;            // raw caps the worker was given
+    gboolean force_idr;
+    guint64 seq;
+    GstBuffer *metas[ENCPROC_META_RING]; // metas of recent input frames, by seq
+    guint64 frames, dropped, lost_aus;
+    guint restarts;
+} EncProcess;
+
+// "name=value" lines of the writable properties of the configured x264enc
+// that differ from their defaults
+static gchar* encproc_settings_string(GstElement *settings) {
+    guint n = 0;
+    GParamSpec **props = g_object_class_list_properties(G_OBJECT_GET_CLASS(settings), &n);
+    GString *s = g_string_new(NULL);
+    for (guint i = 0; i < n; ++i) {
+        GParamSpec *p = props[i];
+        if ((p->flags & (G_PARAM_READABLE | G_PARAM_WRITABLE)) != (G_PARAM_READABLE | G_PARAM_WRITABLE) ||
+            (p->flags & G_PARAM_CONSTRUCT_ONLY) ||
+            g_strcmp0(p->name, "name") == 0 || g_strcmp0(p->name, "parent") == 0) continue;
+        GValue v = G_VALUE_INIT;
+        g_value_init(&v, p->value_type);
+        g_object_get_property(G_OBJECT(settings), p->name, &v);
+        if (!g_param_value_defaults(p, &v)) {
+            gchar *str = gst_value_serialize(&v);
+            if (str) g_string_append_printf(s, "%s=%s\n", p->name, str);
+            g_free(str);
         }
+        g_value_unset(&v);
     }
-    if (sei_cfg) g_free(sei_cfg);
+    g_free(props);
+    return g_string_free(s, FALSE);
+}
+
+// Sends to the worker happen under ep->lock, so none of them may wait: a
+// full socket means the worker stopped reading. It is killed, and the thread
+// sees the socket close and starts a new one. Call with ep->lock held.
+static gboolean encproc_send_locked(EncProcess *ep, EncProcMsg *m, const gchar *text, gint fd) {
+    if (ep->sock < 0 || ep->killed) return FALSE;
+    if (encproc_send(ep->sock, m, text, fd, TRUE) == 0) return TRUE;
+    g_printerr("Encoder process [%u]: worker pid %d is not reading its socket (%s), killing it\n",
+               ep->index, (int)ep->pid, g_strerror(errno));
+    kill(ep->pid, SIGKILL); // not reaped before encproc_worker_lost(), so the pid is still the worker's
+    ep->killed = TRUE;
+    return FALSE;
+}
+
+static void encproc_bitrate_cb(GObject *settings, GParamSpec *pspec, gpointer user_data) {
+    (void)pspec;
+    EncProcess *ep = (EncProcess*)user_data;
+    guint kbps = 0;
+    g_object_get(settings, "bitrate", &kbps, NULL);
+    EncProcMsg m = { .type = ENCPROC_BITRATE, .value = kbps };
+    g_mutex_lock(&ep->lock);
+    encproc_send_locked(ep, &m, NULL, -1);
+    g_mutex_unlock(&ep->lock);
+}
+
+// The metas GstVideoEncoder carries from a frame to its output: untagged
+// ones and those tagged only "video" (timecode, captions)
+static gboolean encproc_copy_meta(GstBuffer *buf, GstMeta **meta, gpointer user_data) {
+    const GstMetaInfo *info = (*meta)->info;
+    const gchar *const *tags = gst_meta_api_type_get_tags(info->api);
+    gboolean copy = !tags || !tags[0] ||
+                    (!tags[1] && gst_meta_api_type_has_tag(info->api, g_quark_from_string(GST_META_TAG_VIDEO_STR)));
+    if (copy && info->transform_func) {
+        GstMetaTransformCopy region = { FALSE, 0, (gsize)-1 };
+        info->transform_func((GstBuffer*)user_data, *meta, buf, _gst_meta_transform_copy, &region);
+    }
+    return TRUE;
+}
+
+// buf itself if it is a slot, otherwise a copy in one; NULL if none is free
+static GstBuffer* encproc_own_frame(EncProcess *ep, GstBuffer *buf, GstCaps *caps) {
+    if (encproc_buffer_slot(buf)) return gst_buffer_ref(buf);
+    gsize size = gst_buffer_get_size(buf);
+    if (ep->copy_pool && ((EncProcPool*)ep->copy_pool)->size != size) {
+        gst_buffer_pool_set_active(ep->copy_pool, FALSE);
+        gst_clear_object(&ep->copy_pool);
+    }
+    if (!ep->copy_pool) {
+        ep->copy_pool = gst_object_ref_sink(g_object_new(encproc_pool_get_type(), NULL));
+        GstStructure *config = gst_buffer_pool_get_config(ep->copy_pool);
+        gst_buffer_pool_config_set_params(config, caps, (guint)size, ENCPROC_POOL_MIN, ENCPROC_POOL_MAX);
+        if (!gst_buffer_pool_set_config(ep->copy_pool, config) || !gst_buffer_pool_set_active(ep->copy_pool, TRUE)) {
+            gst_clear_object(&ep->copy_pool);
+            return NULL;
+        }
+    }
+    // Never wait here: with every slot in flight the worker is behind, and a
+    // dropped frame is what a slow in-process encoder would cost as well
+    GstBufferPoolAcquireParams params = { .flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT };
+    GstBuffer *copy = NULL;
+    if (gst_buffer_pool_acquire_buffer(ep->copy_pool, &copy, &params) != GST_FLOW_OK) return NULL;
+    GstMapInfo map;
+    if (!gst_buffer_map(buf, &map, GST_MAP_READ)) {
+        gst_buffer_unref(copy);
+        return NULL;
+    }
+    gst_buffer_fill(copy, 0, map.data, map.size);
+    gst_buffer_unmap(buf, &map);
+    gst_buffer_copy_into(copy, buf, GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+    g_atomic_int_inc(&ep->copied);
+    return copy;
+}
+
+static GstFlowReturn encproc_new_sample(GstAppSink *sink, gpointer user_data) {
+    EncProcess *ep = (EncProcess*)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) return GST_FLOW_EOS;
+    GstBuffer *buf = gst_sample_get_buffer(sample);
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *frame = buf && caps ? encproc_own_frame(ep, buf, caps) : NULL;
+    gchar *capstr = caps ? gst_caps_to_string(caps) : NULL;
+
+    g_mutex_lock(&ep->lock);
+    gboolean sent = FALSE;
+    if (frame && ep->sock >= 0 && !ep->killed) {
+        EncProcSlot *slot = encproc_buffer_slot(frame);
+        gboolean ok = TRUE;
+        if (g_strcmp0(capstr, ep->caps) != 0) {
+            // New caps: the worker forgets the slots it has mapped
+            EncProcMsg m = { .type = ENCPROC_CAPS };
+            ok = encproc_send_locked(ep, &m, capstr, -1);
+            g_free(ep->caps);
+            ep->caps = g_strdup(capstr);
+            g_hash_table_remove_all(ep->slots_sent);
+        }
+        gpointer id = GUINT_TO_POINTER(slot->id);
+        if (ok && GPOINTER_TO_UINT(g_hash_table_lookup(ep->slots_sent, id)) != ep->generation) {
+            EncProcMsg m = { .type = ENCPROC_SLOT, .slot = slot->id, .size = slot->size };
+            ok = encproc_send_locked(ep, &m, NULL, slot->fd);
+            if (ok) g_hash_table_insert(ep->slots_sent, id, GUINT_TO_POINTER(ep->generation));
+        }
+        EncProcMsg m = {
+            .type = ENCPROC_FRAME, .slot = slot->id, .seq = ep->seq,
+            .pts = GST_BUFFER_PTS(frame), .dts = GST_BUFFER_DTS(frame), .duration = GST_BUFFER_DURATION(frame),
+            .size = gst_buffer_get_size(frame),
+            .flags = (ep->force_idr ? ENCPROC_FLAG_FORCE_IDR : 0) |
+                     (GST_BUFFER_FLAG_IS_SET(frame, GST_BUFFER_FLAG_DISCONT) ? ENCPROC_FLAG_DISCONT : 0),
+        };
+        // A full socket means the worker stopped reading; drop rather than wait
+        if (ok && encproc_send(ep->sock, &m, NULL, -1, TRUE) == 0) {
+            EncProcFrame *f = g_new0(EncProcFrame, 1);
+            f->buf = frame;
+            f->sent_us = g_get_monotonic_time();
+            g_hash_table_insert(ep->inflight, GUINT_TO_POINTER((guint)ep->seq), f);
+            GstBuffer *carrier = gst_buffer_new();
+            GST_BUFFER_PTS(carrier) = GST_BUFFER_PTS(buf);
+            gst_buffer_foreach_meta(buf, encproc_copy_meta, carrier);
+            guint i = (guint)(ep->seq % ENCPROC_META_RING);
+            if (ep->metas[i]) gst_buffer_unref(ep->metas[i]);
+            ep->metas[i] = carrier;
+            ep->force_idr = FALSE;
+            ep->seq++;
+            ep->frames++;
+            ep->pending++;
+            sent = TRUE;
+        }
+    }
+    if (!sent) {
+        ep->dropped++;
+        ep->force_idr = TRUE;   // the AU stream resumes decodable
+    }
+    g_mutex_unlock(&ep->lock);
+
+    if (!sent && frame) gst_buffer_unref(frame);
+    g_free(capstr);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static void encproc_eos(GstAppSink *sink, gpointer user_data) {
+    (void)sink;
+    EncProcess *ep = (EncProcess*)user_data;
+    // Let the worker return what it has, then end the AU stream as well
+    gint64 deadline = g_get_monotonic_time() + ENCPROC_HANG_MS * G_TIME_SPAN_MILLISECOND;
+    g_mutex_lock(&ep->lock);
+    while (ep->pending > 0 && g_cond_wait_until(&ep->returned, &ep->lock, deadline)) {}
+    g_mutex_unlock(&ep->lock);
+    gst_app_src_end_of_stream(GST_APP_SRC(ep->src));
+}
+
+// On the appsink's pad: hand videoconvert our pool, and catch the aligner's
+// force-key-unit events (the appsink would just swallow them)
+static GstPadProbeReturn encproc_sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    EncProcess *ep = (EncProcess*)user_data;
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        if (gst_video_event_is_force_key_unit(GST_PAD_PROBE_INFO_EVENT(info))) {
+            g_mutex_lock(&ep->lock);
+            ep->force_idr = TRUE;
+            g_mutex_unlock(&ep->lock);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    GstQuery *q = GST_PAD_PROBE_INFO_QUERY(info);
+    if (GST_QUERY_TYPE(q) != GST_QUERY_ALLOCATION) return GST_PAD_PROBE_OK;
+    GstCaps *caps = NULL;
+    gboolean need_pool = FALSE;
+    GstVideoInfo vi;
+    gst_query_parse_allocation(q, &caps, &need_pool);
+    if (!caps || !gst_video_info_from_caps(&vi, caps)) return GST_PAD_PROBE_OK;
+    GstBufferPool *pool = gst_object_ref_sink(g_object_new(encproc_pool_get_type(), NULL));
+    gst_query_add_allocation_pool(q, pool, (guint)vi.size, ENCPROC_POOL_MIN, ENCPROC_POOL_MAX);
+    gst_object_unref(pool);
+    return GST_PAD_PROBE_HANDLED;
+}
+
+// On the appsrc's pad: force_keyframe from the control API becomes a flag
+// on the next frame, and latency is what lies upstream, as with x264enc in
+// place (tune=zerolatency adds none)
+static GstPadProbeReturn encproc_src_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    EncProcess *ep = (EncProcess*)user_data;
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_UPSTREAM) {
+        GstEvent *ev = GST_PAD_PROBE_INFO_EVENT(info);
+        if (!gst_video_event_is_force_key_unit(ev)) return GST_PAD_PROBE_OK;
+        g_mutex_lock(&ep->lock);
+        ep->force_idr = TRUE;
+        g_mutex_unlock(&ep->lock);
+        gst_event_unref(ev);
+        return GST_PAD_PROBE_HANDLED;
+    }
+    GstQuery *q = GST_PAD_PROBE_INFO_QUERY(info);
+    if (GST_QUERY_TYPE(q) != GST_QUERY_LATENCY) return GST_PAD_PROBE_OK;
+    GstPad *in = gst_element_get_static_pad(ep->sink, "sink");
+    gboolean ok = gst_pad_peer_query(in, q);
+    gst_object_unref(in);
+    return ok ? GST_PAD_PROBE_HANDLED : GST_PAD_PROBE_OK;
+}
+
+// Copy the access units the worker announced out of the ring
+static void encproc_push_aus(EncProcess *ep, ShmRingReader *ring) {
+    const ShmRingRecord *rec;
+    const guint8 *data;
+    uint64_t lost = 0;
+    while (ring && shmring_reader_next(ring, &rec, &data, &lost)) {
+        GstBuffer *au = gst_buffer_new_allocate(NULL, rec->size, NULL);
+        gst_buffer_fill(au, 0, data, rec->size);
+        GstClockTime pts = rec->pts;
+        GstClockTime dts = rec->dts;
+        gboolean keyframe = (rec->flags & SHMRING_FLAG_KEYFRAME) != 0;
+        if (!shmring_reader_release(ring)) {
+            gst_buffer_unref(au);
+            lost++;
+        } else {
+            GST_BUFFER_PTS(au) = pts;
+            GST_BUFFER_DTS(au) = dts;
+            if (!keyframe) GST_BUFFER_FLAG_SET(au, GST_BUFFER_FLAG_DELTA_UNIT);
+            g_mutex_lock(&ep->lock);
+            for (guint i = 0; i < ENCPROC_META_RING; ++i) {
+                GstBuffer *carrier = ep->metas[i];
+                if (!carrier || GST_BUFFER_PTS(carrier) != pts) continue;
+                gst_buffer_copy_into(au, carrier, GST_BUFFER_COPY_META, 0, -1);
+                gst_buffer_unref(carrier);
+                ep->metas[i] = NULL;
+                break;
+            }
+            if (ep->pending > 0) {
+                ep->pending--;
+                g_cond_broadcast(&ep->returned);
+            }
+            g_mutex_unlock(&ep->lock);
+            gst_app_src_push_buffer(GST_APP_SRC(ep->src), au);
+        }
+        if (lost > 0) {
+            g_mutex_lock(&ep->lock);
+            ep->lost_aus += lost;
+            g_mutex_unlock(&ep->lock);
+            lost = 0;
+        }
+    }
+}
+
+static gboolean encproc_start_worker(EncProcess *ep) {
+    int sv[2];
+    if (encproc_socketpair(sv) != 0) {
+        g_printerr("Encoder process [%u]: socketpair: %s\n", ep->index, g_strerror(errno));
+        return FALSE;
+    }
+    gchar *argv[] = { (gchar*)"ndi2srt-encoder", (gchar*)"--encoder-worker", NULL };
+    pid_t pid = encproc_spawn("/proc/self/exe", argv, sv[1]);
+    int err = errno;
+    close(sv[1]);
+    if (pid < 0) {
+        close(sv[0]);
+        g_printerr("Encoder process [%u]: cannot start the worker: %s\n", ep->index, g_strerror(err));
+        return FALSE;
+    }
+    gchar *config = encproc_settings_string(ep->settings);
+    EncProcMsg m = { .type = ENCPROC_CONFIG };
+    g_mutex_lock(&ep->lock);
+    ep->sock = sv[0];
+    ep->pid = pid;
+    ep->killed = FALSE;
+    ep->generation++;
+    ep->force_idr = TRUE;
+    g_hash_table_remove_all(ep->slots_sent);
+    if (encproc_send_locked(ep, &m, config, -1) && ep->caps) {
+        EncProcMsg c = { .type = ENCPROC_CAPS };
+        encproc_send_locked(ep, &c, ep->caps, -1);
+    }
+    g_mutex_unlock(&ep->lock);
+    g_free(config);
+    g_printerr("Encoder process [%u]: worker pid %d started\n", ep->index, (int)pid);
+    return TRUE;
+}
+
+// The worker is gone or has to go: reap it and forget what it held
+static void encproc_worker_lost(EncProcess *ep, ShmRingReader **ring, const gchar *why) {
+    g_mutex_lock(&ep->lock);
+    gint sock = ep->sock;
+    pid_t pid = ep->pid;
+    ep->sock = -1;
+    ep->pid = 0;
+    g_hash_table_remove_all(ep->inflight);
+    ep->pending = 0;
+    g_cond_broadcast(&ep->returned);
+    g_mutex_unlock(&ep->lock);
+    close(sock);
+    int status = 0;
+    if (pid > 0) {
+        kill(pid, SIGKILL); // no-op if it already exited; it is not reaped yet
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    }
+    shmring_reader_close(*ring);
+    *ring = NULL;
+    if (g_atomic_int_get(&ep->stopping)) return;
+    gchar how[48];
+    if (WIFSIGNALED(status)) g_snprintf(how, sizeof(how), "killed by signal %d", WTERMSIG(status));
+    else g_snprintf(how, sizeof(how), "exit status %d", WEXITSTATUS(status));
+    g_mutex_lock(&ep->lock);
+    ep->restarts++;
+    g_mutex_unlock(&ep->lock);
+    g_printerr("Encoder process [%u]: worker pid %d %s (%s); restarting, next frame is an IDR\n",
+               ep->index, (int)pid, why, how);
+}
+
+static gpointer encproc_thread(gpointer data) {
+    EncProcess *ep = (EncProcess*)data;
+    ShmRingReader *ring = NULL;
+    gchar *text = g_malloc(ENCPROC_TEXT_MAX + 1);
+    gint64 started_us = 0;
+    while (!g_atomic_int_get(&ep->stopping)) {
+        g_mutex_lock(&ep->lock);
+        gint sock = ep->sock;
+        g_mutex_unlock(&ep->lock);
+        if (sock < 0) {
+            gint64 wait = started_us + ENCPROC_RESTART_US - g_get_monotonic_time();
+            if (wait > 0) {
+                g_usleep(MIN(wait, (gint64)ENCPROC_POLL_MS * G_TIME_SPAN_MILLISECOND));
+                continue;
+            }
+            started_us = g_get_monotonic_time();
+            encproc_start_worker(ep);
+            continue;
+        }
+
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        int ready = poll(&pfd, 1, ENCPROC_POLL_MS);
+        // Checked on every pass: a worker that keeps answering for other
+        // frames can still sit on one forever
+        gint64 oldest = G_MAXINT64;
+        GHashTableIter it;
+        gpointer value;
+        g_mutex_lock(&ep->lock);
+        g_hash_table_iter_init(&it, ep->inflight);
+        while (g_hash_table_iter_next(&it, NULL, &value)) oldest = MIN(oldest, ((EncProcFrame*)value)->sent_us);
+        g_mutex_unlock(&ep->lock);
+        if (oldest != G_MAXINT64 && g_get_monotonic_time() - oldest > ENCPROC_HANG_MS * G_TIME_SPAN_MILLISECOND) {
+            encproc_worker_lost(ep, &ring, "hung");
+            continue;
+        }
+        if (ready <= 0) continue;   // timeout, or a signal (EINTR)
+        EncProcMsg m;
+        int fd = -1;
+        int r = encproc_recv(sock, &m, text, ENCPROC_TEXT_MAX + 1, &fd);
+        if (r <= 0) {
+            encproc_worker_lost(ep, &ring, r == 0 ? "exited" : g_strerror(errno));
+            continue;
+        }
+        switch (m.type) {
+        case ENCPROC_RING:
+            shmring_reader_close(ring);
+            ring = fd >= 0 ? shmring_reader_open_fd(fd) : NULL;
+            fd = -1;
+            if (!ring) encproc_worker_lost(ep, &ring, "sent no usable ring");
+            break;
+        case ENCPROC_CAPS: {
+            GstCaps *caps = gst_caps_from_string(text);
+            if (caps) {
+                gst_app_src_set_caps(GST_APP_SRC(ep->src), caps);
+                gst_caps_unref(caps);
+            }
+            break;
+        }
+        case ENCPROC_RELEASE:
+            g_mutex_lock(&ep->lock);
+            g_hash_table_remove(ep->inflight, GUINT_TO_POINTER((guint)m.seq));
+            g_mutex_unlock(&ep->lock);
+            break;
+        case ENCPROC_AU:
+            encproc_push_aus(ep, ring);
+            break;
+        default:
+            break;
+        }
+        if (fd >= 0) close(fd);
+    }
+    g_mutex_lock(&ep->lock);
+    gboolean running = ep->sock >= 0;
+    g_mutex_unlock(&ep->lock);
+    if (running) encproc_worker_lost(ep, &ring, "stopped");
+    g_free(text);
+    return NULL;
+}
+
+// graph.enc for --encoder-process; g->enc_settings holds the configured x264enc
+static GstElement* enc_process_new(PipelineGraph *g, guint index, GError **error) {
+    EncProcess *ep = g_new0(EncProcess, 1);
+    ep->index = index;
+    ep->settings = g->enc_settings;
+    ep->sock = -1;
+    g_mutex_init(&ep->lock);
+    g_cond_init(&ep->returned);
+    ep->slots_sent = g_hash_table_new(g_direct_hash, g_direct_equal);
+    ep->inflight = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, encproc_frame_free);
+    g->enc_process = ep;
+
+    gchar *name = g_strdup_printf("enc%u", index);
+    ep->bin = gst_bin_new(name);
+    g_free(name);
+    if (!(ep->sink = make_element("appsink", "encsink", error))) return NULL;
+    if (!(ep->src = make_element("appsrc", "encsrc", error))) return NULL;
+    // What x264enc itself would take, so ingest negotiates the same format
+    GstPad *tsink = gst_element_get_static_pad(g->enc_settings, "sink");
+    GstCaps *caps = gst_pad_query_caps(tsink, NULL);
+    gst_object_unref(tsink);
+    g_object_set(ep->sink, "caps", caps, "sync", FALSE, "async", FALSE, "enable-last-sample", FALSE, NULL);
+    gst_caps_unref(caps);
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = encproc_new_sample;
+    callbacks.eos = encproc_eos;
+    gst_app_sink_set_callbacks(GST_APP_SINK(ep->sink), &callbacks, ep, NULL);
+    g_object_set(ep->src, "is-live", TRUE, "block", FALSE, "max-bytes", (guint64)0, NULL);
+    gst_util_set_object_arg(G_OBJECT(ep->src), "format", "time");
+    gst_bin_add_many(GST_BIN(ep->bin), ep->sink, ep->src, NULL);
+
+    GstPad *in = ghost_child_pad(ep->bin, "encsink", "sink", "sink");
+    GstPad *out = ghost_child_pad(ep->bin, "encsrc", "src", "src");
+    if (!in || !out) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_PAD, "cannot ghost the encoder process pads");
+        return NULL;
+    }
+    GstPad *pad = gst_element_get_static_pad(ep->sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      encproc_sink_probe, ep, NULL);
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(ep->src, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_UPSTREAM | GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+                      encproc_src_probe, ep, NULL);
+    gst_object_unref(pad);
+
+    g_signal_connect(g->enc_settings, "notify::bitrate", G_CALLBACK(encproc_bitrate_cb), ep);
+    ep->thread = g_thread_new("encoder-process", encproc_thread, ep);
+    return ep->bin;
+}
+
+// After the pipeline is down: stop the worker and free what it held
+static void enc_process_free(EncProcess *ep) {
+    if (!ep) return;
+    g_atomic_int_set(&ep->stopping, TRUE);
+    if (ep->settings) g_signal_handlers_disconnect_by_data(ep->settings, ep);
+    if (ep->thread) {
+        g_mutex_lock(&ep->lock);
+        if (ep->sock >= 0) shutdown(ep->sock, SHUT_RDWR);   // wakes the thread's poll
+        g_mutex_unlock(&ep->lock);
+        g_thread_join(ep->thread);
+    }
+    if (ep->copy_pool) {
+        gst_buffer_pool_set_active(ep->copy_pool, FALSE);
+        gst_object_unref(ep->copy_pool);
+    }
+    for (guint i = 0; i < ENCPROC_META_RING; ++i) {
+        if (ep->metas[i]) gst_buffer_unref(ep->metas[i]);
+    }
+    g_hash_table_destroy(ep->inflight);
+    g_hash_table_destroy(ep->slots_sent);
+    g_free(ep->caps);
+    g_mutex_clear(&ep->lock);
+    g_cond_clear(&ep->returned);
+    g_free(ep);
+}
+
+static void enc_process_add_stats(JsonBuilder *b, EncProcess *ep) {
+    g_mutex_lock(&ep->lock);
+    json_builder_set_member_name(b, "encoder_process");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "pid");
+    json_builder_add_int_value(b, ep->pid);
+    json_builder_set_member_name(b, "restarts");
+    json_builder_add_int_value(b, ep->restarts);
+    json_builder_set_member_name(b, "frames");
+    json_builder_add_int_value(b, (gint64)ep->frames);
+    json_builder_set_member_name(b, "copied_frames");
+    json_builder_add_int_value(b, (gint64)g_atomic_int_get(&ep->copied));
+    json_builder_set_member_name(b, "dropped_frames");
+    json_builder_add_int_value(b, (gint64)ep->dropped);
+    json_builder_set_member_name(b, "in_flight");
+    json_builder_add_int_value(b, g_hash_table_size(ep->inflight));
+    json_builder_set_member_name(b, "lost_aus");
+    json_builder_add_int_value(b, (gint64)ep->lost_aus);
+    json_builder_end_object(b);
+    g_mutex_unlock(&ep->lock);
+}
+
+// Worker side: ndi2srt --encoder-worker, with the socket on ENCPROC_WORKER_FD
+
+typedef struct EncWorkerSlot {
+    gint refs;              // the slot table's, plus one per frame in the encoder
+    const guint8 *data;
+    gsize size;
+} EncWorkerSlot;
+
+static void enc_worker_slot_unref(gpointer data) {
+    EncWorkerSlot *slot = (EncWorkerSlot*)data;
+    if (!g_atomic_int_dec_and_test(&slot->refs)) return;
+    munmap((void*)slot->data, slot->size);
+    g_free(slot);
+}
+
+typedef struct EncWorkerFrame {
+    gint sock;
+    guint64 seq;
+    EncWorkerSlot *slot;
+} EncWorkerFrame;
+
+// x264enc is done with the frame: the supervisor may reuse the buffer
+static void enc_worker_frame_done(gpointer data) {
+    EncWorkerFrame *f = (EncWorkerFrame*)data;
+    EncProcMsg m = { .type = ENCPROC_RELEASE, .seq = f->seq };
+    encproc_send(f->sock, &m, NULL, -1, FALSE);
+    enc_worker_slot_unref(f->slot);
+    g_free(f);
+}
+
+typedef struct EncWorker {
+    gint sock;
+    GstElement *pipeline;
+    GstElement *src;
+    GstElement *enc;
+    ShmRingProducer *ring;
+    gchar *caps;            // encoded caps last sent
+    guint64 aus;
+} EncWorker;
+
+static GstFlowReturn enc_worker_new_sample(GstAppSink *sink, gpointer user_data) {
+    EncWorker *w = (EncWorker*)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) return GST_FLOW_EOS;
+    GstCaps *caps = gst_sample_get_caps(sample);
+    gchar *capstr = caps ? gst_caps_to_string(caps) : NULL;
+    if (capstr && g_strcmp0(capstr, w->caps) != 0) {
+        EncProcMsg m = { .type = ENCPROC_CAPS };
+        encproc_send(w->sock, &m, capstr, -1, FALSE);
+        g_free(w->caps);
+        w->caps = capstr;
+    } else {
+        g_free(capstr);
+    }
+    GstBuffer *buf = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (buf && gst_buffer_map(buf, &map, GST_MAP_READ)) {
+        ShmRingRecord rec = { 0 };
+        rec.pts = GST_BUFFER_PTS(buf);
+        rec.dts = GST_BUFFER_DTS(buf);
+        rec.timecode = -1;
+        if (!GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) rec.flags |= SHMRING_FLAG_KEYFRAME;
+        if (shmring_producer_write(w->ring, &rec, map.data, map.size) == 0) {
+            EncProcMsg m = { .type = ENCPROC_AU, .seq = w->aus++ };
+            encproc_send(w->sock, &m, NULL, -1, FALSE);
+        } else {
+            g_printerr("Encoder worker: %" G_GSIZE_FORMAT "-byte access unit does not fit the ring\n", map.size);
+        }
+        gst_buffer_unmap(buf, &map);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static gboolean enc_worker_build(EncWorker *w, gchar *config, GError **error) {
+    GstElement *sink = NULL;
+    if (!(w->src = make_element("appsrc", "in", error)) ||
+        !(w->enc = make_element("x264enc", "enc", error)) ||
+        !(sink = make_element("appsink", "out", error))) return FALSE;
+    for (gchar *line = strtok(config, "\n"); line; line = strtok(NULL, "\n")) {
+        gchar *eq = strchr(line, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        gst_util_set_object_arg(G_OBJECT(w->enc), line, eq + 1);
+    }
+    g_object_set(w->src, "is-live", TRUE, "block", FALSE, "max-bytes", (guint64)0, NULL);
+    gst_util_set_object_arg(G_OBJECT(w->src), "format", "time");
+    g_object_set(sink, "sync", FALSE, "async", FALSE, "enable-last-sample", FALSE, NULL);
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = enc_worker_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, w, NULL);
+    w->pipeline = gst_pipeline_new("encoder-worker");
+    gst_bin_add_many(GST_BIN(w->pipeline), w->src, w->enc, sink, NULL);
+    if (!gst_element_link_many(w->src, w->enc, sink, NULL)) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION, "cannot link appsrc ! x264enc ! appsink");
+        return FALSE;
+    }
+    if (!(w->ring = shmring_producer_new(ENCPROC_RING_BYTES, SHMRING_MODE_AU))) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno), "AU ring: %s", g_strerror(errno));
+        return FALSE;
+    }
+    EncProcMsg m = { .type = ENCPROC_RING };
+    if (encproc_send(w->sock, &m, NULL, shmring_producer_fd(w->ring), FALSE) != 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno), "send ring: %s", g_strerror(errno));
+        return FALSE;
+    }
+    if (gst_element_set_state(w->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE, "encoder pipeline failed to start");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void enc_worker_push_frame(EncWorker *w, GHashTable *slots, const EncProcMsg *m) {
+    EncWorkerSlot *slot = (EncWorkerSlot*)g_hash_table_lookup(slots, GUINT_TO_POINTER(m->slot));
+    if (!w->pipeline || !slot || m->size > slot->size) {
+        // Nothing to encode it with: give the buffer straight back
+        EncProcMsg r = { .type = ENCPROC_RELEASE, .seq = m->seq };
+        encproc_send(w->sock, &r, NULL, -1, FALSE);
+        return;
+    }
+    if (m->flags & ENCPROC_FLAG_FORCE_IDR) {
+        GstPad *pad = gst_element_get_static_pad(w->enc, "src");
+        gst_pad_send_event(pad, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        gst_object_unref(pad);
+    }
+    EncWorkerFrame *f = g_new0(EncWorkerFrame, 1);
+    f->sock = w->sock;
+    f->seq = m->seq;
+    f->slot = slot;
+    g_atomic_int_inc(&slot->refs);
+    GstBuffer *buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, (gpointer)slot->data, slot->size,
+                                                 0, m->size, f, enc_worker_frame_done);
+    GST_BUFFER_PTS(buf) = m->pts;
+    GST_BUFFER_DTS(buf) = m->dts;
+    GST_BUFFER_DURATION(buf) = m->duration;
+    if (m->flags & ENCPROC_FLAG_DISCONT) GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DISCONT);
+    gst_app_src_push_buffer(GST_APP_SRC(w->src), buf);
+}
+
+// Runs until the supervisor closes the socket (or dies: PR_SET_PDEATHSIG)
+static int encoder_worker_main(void) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    // The supervisor loaded (and updated) the registry just before: use it
+    // as is rather than checking every plugin file again. No gst options.
+    g_setenv("GST_REGISTRY_UPDATE", "no", FALSE);
+    init_gstreamer(NULL, NULL);
+    EncWorker w = { .sock = ENCPROC_WORKER_FD };
+    GHashTable *slots = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, enc_worker_slot_unref);
+    gchar *text = g_malloc(ENCPROC_TEXT_MAX + 1);
+    int ret = 0;
+    for (;;) {
+        EncProcMsg m;
+        int fd = -1;
+        if (encproc_recv(w.sock, &m, text, ENCPROC_TEXT_MAX + 1, &fd) <= 0) break;
+        if (m.type == ENCPROC_CONFIG && !w.pipeline) {
+            GError *err = NULL;
+            if (!enc_worker_build(&w, text, &err)) {
+                g_printerr("Encoder worker: %s\n", err ? err->message : "unknown error");
+                g_clear_error(&err);
+                ret = 1;
+                break;
+            }
+        } else if (m.type == ENCPROC_CAPS && w.src) {
+            // Buffers of the old format are not sent again; drop their mappings
+            g_hash_table_remove_all(slots);
+            GstCaps *caps = gst_caps_from_string(text);
+            if (caps) {
+                gst_app_src_set_caps(GST_APP_SRC(w.src), caps);
+                gst_caps_unref(caps);
+            }
+        } else if (m.type == ENCPROC_SLOT && fd >= 0) {
+            const guint8 *data = encproc_buffer_map(fd, m.size);
+            if (data) {
+                EncWorkerSlot *slot = g_new0(EncWorkerSlot, 1);
+                slot->refs = 1;
+                slot->data = data;
+                slot->size = m.size;
+                g_hash_table_replace(slots, GUINT_TO_POINTER(m.slot), slot);
+            } else {
+                g_printerr("Encoder worker: cannot map frame buffer %u: %s\n", m.slot, g_strerror(errno));
+            }
+        } else if (m.type == ENCPROC_FRAME) {
+            enc_worker_push_frame(&w, slots, &m);
+        } else if (m.type == ENCPROC_BITRATE && w.enc) {
+            g_object_set(w.enc, "bitrate", m.value, NULL);
+        }
+        if (fd >= 0) close(fd);
+    }
+    if (w.pipeline) {
+        gst_element_set_state(w.pipeline, GST_STATE_NULL);
+        gst_object_unref(w.pipeline);
+    }
+    g_hash_table_destroy(slots);
+    shmring_producer_free(w.ring);
+    g_free(w.caps);
+    g_free(text);
+    return ret;
+}
+
+#endif // NDI2SRT_SHM_RING
+
+// --- Pipeline graph builder ---
+
+static GstElement* make_element(const gchar *factory, const gchar *name, GError **error) {
+    GstElement *e = gst_element_factory_make(factory, name);
+    if (!e) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+                    "element '%s' not available", factory);
+    }
+    return e;
+}
+
+// Ghost the named pad of a child element onto its bin
+static GstPad* ghost_child_pad(GstElement *bin, const gchar *child, const gchar *padname, const gchar *ghostname) {
+    GstElement *e = gst_bin_get_by_name(GST_BIN(bin), child);
+    if (!e) return NULL;
+    GstPad *target = gst_element_get_static_pad(e, padname);
+    gst_object_unref(e);
+    if (!target) return NULL;
+    GstPad *ghost = gst_ghost_pad_new(ghostname, target);
+    gst_object_unref(target);
+    gst_pad_set_active(ghost, TRUE);
+    gst_element_add_pad(bin, ghost);
+    return ghost;
+}
+
+static void demux_pad_added_cb(GstElement *demux, GstPad *pad, gpointer user_data) {
+    PipelineGraph *g = (PipelineGraph*)user_data;
+    gchar *name = gst_pad_get_name(pad);
+    GstPad *target = NULL;
+    if (g_str_has_prefix(name, "video")) target = g->primary_vpad;
+    else if (g_str_has_prefix(name, "audio")) target = g->primary_apad;
+    if (target && !gst_pad_is_linked(target)) {
+        GstPadLinkReturn r = gst_pad_link(pad, target);
+        if (r != GST_PAD_LINK_OK) {
+            g_printerr("Failed to link ndisrcdemux pad %s: %s\n", name, gst_pad_link_get_name(r));
+        }
+    }
+    g_free(name);
+}
+
+// Element names carry the stream index so several graphs share one pipeline
+static GstElement* make_stream_element(const gchar *factory, const gchar *base, guint index, GError **error) {
+    gchar *name = g_strdup_printf("%s%u", base, index);
+    GstElement *e = make_element(factory, name, error);
+    g_free(name);
+    return e;
+}
+
+// --mpts: program i+1 carries stream i on video PID 0x100 + 0x20*i and
+// audio PID one above
+#define MPTS_VIDEO_PID(i) (0x100u + 0x20u * (i))
+#define MPTS_AUDIO_PID(i) (MPTS_VIDEO_PID(i) + 1u)
+#define NDI_META_PID(i)   (MPTS_VIDEO_PID(i) + 2u)  // --ndi-metadata, also without --mpts
+
+static guint mpts_source_count(const AppConfig *cfg) {
+    return (cfg->ndi_name ? 1 : 0) + cfg->streams->len;
+}
+
+static guint mpts_weight(const AppConfig *cfg, guint index) {
+    return index < cfg->mpts_weights->len ? g_array_index(cfg->mpts_weights, guint, index) : 1;
+}
+
+// Video bitrate of one stream: with --mpts the --bitrate budget is shared
+// by all programs in proportion to their weights
+static gint mpts_program_kbps(const AppConfig *cfg, guint index) {
+    if (!cfg->mpts) return cfg->bitrate_kbps;
+    guint total = 0;
+    for (guint i = 0; i < mpts_source_count(cfg); ++i) total += mpts_weight(cfg, i);
+    return (gint)((gint64)cfg->bitrate_kbps * mpts_weight(cfg, index) / MAX(total, 1));
+}
+
+static void mpts_set_program_map(GstElement *mux, const AppConfig *cfg) {
+    GstStructure *map = gst_structure_new_empty("program_map");
+    for (guint i = 0; i < mpts_source_count(cfg); ++i) {
+        gchar *vpad = g_strdup_printf("sink_%u", MPTS_VIDEO_PID(i));
+        gchar *apad = g_strdup_printf("sink_%u", MPTS_AUDIO_PID(i));
+        gchar *mpad = g_strdup_printf("sink_%u", NDI_META_PID(i));
+        gst_structure_set(map, vpad, G_TYPE_INT, (gint)(i + 1), apad, G_TYPE_INT, (gint)(i + 1), NULL);
+        if (cfg->ndi_metadata) gst_structure_set(map, mpad, G_TYPE_INT, (gint)(i + 1), NULL);
+        g_free(vpad);
+        g_free(apad);
+        g_free(mpad);
+    }
+    g_object_set(mux, "prog-map", map, NULL);
+    gst_structure_free(map);
+}
+
+// Build the graph of one stream into the shared pipeline:
+//   ndisrc ! ndisrcdemux
+//     video -> vselect ! queue ! videoconvert ! 4:2:0 ! raw_tee ! x264enc ! h264parse ! caps ! mux
+//              (x264enc ! caps ! mux with --no-h264parse;
+//               raw_tee ! videoscale ! caps ! x264enc with --governor)
+//     audio -> aselect ! queue ! <audio encoder> ! audio_tee ! mux
+//   mux ! out_tee (outputs attach here)
+// With --tc-sync the raw video leaves through an appsink into the aligner
+// and comes back through an appsrc: ... ! 4:2:0 ! appsink | appsrc ! raw_tee ! ...
+// (4:2:0 = the formats picked by ingest_caps_for_encoder())
+static gboolean graph_build(PipelineGraph *g, GstElement *pipeline, AppConfig *cfg,
+                            const gchar *ndi_name, guint index, const PipelineGraph *shared, GError **error) {
+    memset(g, 0, sizeof(*g));
+    g->pipeline = pipeline;
+
+    if (!(g->ndisrc = make_stream_element("ndisrc", "ndisrc", index, error))) return FALSE;
+    if (!(g->demux = make_stream_element("ndisrcdemux", "src", index, error))) return FALSE;
+    if (!(g->vselect = make_stream_element("input-selector", "vselect", index, error))) return FALSE;
+    if (!(g->aselect = make_stream_element("input-selector", "aselect", index, error))) return FALSE;
+    if (!(g->vqueue = make_stream_element("queue", "vqueue", index, error))) return FALSE;
+    if (!(g->vconvert = make_stream_element("videoconvert", "vconvert", index, error))) return FALSE;
+    if (!(g->vcaps = make_stream_element("capsfilter", "vcaps", index, error))) return FALSE;
+    if (!(g->raw_tee = make_stream_element("tee", "rawtee", index, error))) return FALSE;
+    if (cfg->governor) {
+        if (!(g->gov_scale = make_stream_element("videoscale", "govscale", index, error))) return FALSE;
+        if (!(g->gov_caps = make_stream_element("capsfilter", "govcaps", index, error))) return FALSE;
+        if (cfg->convert_threads > 0 && element_has_property(g->gov_scale, "n-threads")) {
+            g_object_set(g->gov_scale, "n-threads", cfg->convert_threads, NULL);
+        }
+    }
+    if (!(g->enc = make_stream_element("x264enc", "enc", index, error))) return FALSE;
+    if (!cfg->no_h264parse && !(g->parse = make_stream_element("h264parse", "h264parse", index, error))) return FALSE;
+    if (!(g->parse_caps = make_stream_element("capsfilter", "h264caps", index, error))) return FALSE;
+    if (!(g->aqueue = make_stream_element("queue", "aqueue", index, error))) return FALSE;
+    if (shared) {
+        // --mpts: one program of the first stream's mux
+        g->mux = shared->mux;
+        g->out_tee = shared->out_tee;
+    } else {
+        if (!(g->mux = make_stream_element("mpegtsmux", "mux", index, error))) return FALSE;
+        if (!(g->out_tee = make_stream_element("tee", "outtee", index, error))) return FALSE;
+    }
+    if (cfg->tc_sync) {
+        if (!(g->sync_sink = make_stream_element("appsink", "syncsink", index, error))) return FALSE;
+        if (!(g->sync_src = make_stream_element("appsrc", "syncsrc", index, error))) return FALSE;
+        g_object_set(g->sync_sink, "sync", FALSE, NULL);
+        // The aligner bounds what is queued; appsrc must never block it
+        g_object_set(g->sync_src, "is-live", TRUE, "block", FALSE, "max-bytes", (guint64)0, NULL);
+        gst_util_set_object_arg(G_OBJECT(g->sync_src), "format", "time");
+    }
+    if (cfg->ndi_metadata) {
+        if (!(g->meta_src = make_stream_element("appsrc", "ndimeta", index, error))) return FALSE;
+        GstCaps *klv = gst_caps_from_string("meta/x-klv,parsed=true");
+        g_object_set(g->meta_src, "caps", klv, "is-live", TRUE, "block", FALSE, NULL);
+        gst_caps_unref(klv);
+        gst_util_set_object_arg(G_OBJECT(g->meta_src), "format", "time");
+    }
+
+    g_object_set(g->ndisrc, "ndi-name", ndi_name, NULL);
+    gst_util_set_object_arg(G_OBJECT(g->ndisrc), "timestamp-mode", cfg->timestamp_mode);
+    // Drop (rather than wait on) buffers of the inactive source
+    g_object_set(g->vselect, "sync-streams", FALSE, NULL);
+    g_object_set(g->aselect, "sync-streams", FALSE, NULL);
+
+    ndisrc_set_ingest_format(g->ndisrc, cfg);
+    if (cfg->raw_queue_bytes > 0) g_object_set(g->vqueue, "max-size-bytes", cfg->raw_queue_bytes, NULL);
+    if (cfg->convert_threads > 0 && element_has_property(g->vconvert, "n-threads")) {
+        g_object_set(g->vconvert, "n-threads", cfg->convert_threads, NULL);
+    }
+    GstCaps *caps = ingest_caps_for_encoder(g->enc, cfg);
+    g_object_set(g->vcaps, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    g_object_set(g->raw_tee, "allow-not-linked", TRUE, NULL);
+
+    gst_util_set_object_arg(G_OBJECT(g->enc), "tune", "zerolatency");
+    gst_util_set_object_arg(G_OBJECT(g->enc), "speed-preset", "ultrafast");
+    gst_util_set_object_arg(G_OBJECT(g->enc), "nal-hrd", "none");
+    if (cfg->tc_sync) {
+        // IDRs only where the aligner forces them, so all streams cut on the same timecode
+        g_object_set(g->enc, "key-int-max", cfg->tc_sync_idr, "option-string", "scenecut=0", NULL);
+    } else if (cfg->gop_size > 0) {
+        g_object_set(g->enc, "key-int-max", cfg->gop_size, NULL);
+    }
+    g_object_set(g->enc, "bitrate", (guint)mpts_program_kbps(cfg, index), "aud", FALSE, "byte-stream", !cfg->avc_internal,
+                 "insert-vui", FALSE, "interlaced", FALSE, NULL);
+    if (cfg->encoder_threads > 0) g_object_set(g->enc, "threads", cfg->encoder_threads, NULL);
+#ifdef NDI2SRT_SHM_RING
+    if (cfg->encoder_process) {
+        // g->enc becomes the worker's proxy; the x264enc set up above only
+        // holds the properties each worker starts with
+        g->enc_settings = gst_object_ref_sink(g->enc);
+        if (!(g->enc = enc_process_new(g, index, error))) return FALSE;
+    }
+#endif
+    if (g->parse) g_object_set(g->parse, "disable-passthrough", TRUE, "config-interval", 1, NULL);
+    else if (!cfg->avc_internal) h264_install_bytestream_caps(g->enc);  // --avc-internal: the injector does it
+    caps = gst_caps_from_string("video/x-h264,stream-format=byte-stream,alignment=au");
+    g_object_set(g->parse_caps, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    if (!shared) {
+        g_object_set(g->out_tee, "allow-not-linked", TRUE, NULL);
+        // 7 TS packets (1316 bytes) per buffer: one UDP/RTP datagram, one SRT payload
+        g_object_set(g->mux, "alignment", 7, NULL);
+        if (cfg->mpts) mpts_set_program_map(g->mux, cfg);
+    }
+
+    if (cfg->with_audio) {
+        gchar *audio_pipeline = build_audio_pipeline(cfg->audio_codec, cfg->audio_bitrate_kbps);
+        g->audio_enc = gst_parse_bin_from_description(audio_pipeline, TRUE, error);
+        g_free(audio_pipeline);
+        if (!g->audio_enc) return FALSE;
+        if (!(g->audio_tee = make_stream_element("tee", "audiotee", index, error))) return FALSE;
+        g_object_set(g->audio_tee, "allow-not-linked", TRUE, NULL);
+    } else {
+        if (!(g->audio_enc = make_stream_element("fakesink", "audiosink", index, error))) return FALSE;
+        g_object_set(g->audio_enc, "sync", FALSE, NULL);
+    }
+
+    gst_bin_add_many(GST_BIN(g->pipeline), g->ndisrc, g->demux, g->vselect, g->aselect,
+                     g->vqueue, g->vconvert, g->vcaps, g->raw_tee, g->enc, g->parse_caps,
+                     g->aqueue, g->audio_enc, NULL);
+    if (g->parse) gst_bin_add(GST_BIN(g->pipeline), g->parse);
+    if (!shared) gst_bin_add_many(GST_BIN(g->pipeline), g->mux, g->out_tee, NULL);
+    if (g->audio_tee) gst_bin_add(GST_BIN(g->pipeline), g->audio_tee);
+    if (g->sync_sink) gst_bin_add_many(GST_BIN(g->pipeline), g->sync_sink, g->sync_src, NULL);
+    if (g->meta_src) gst_bin_add(GST_BIN(g->pipeline), g->meta_src);
+    if (g->gov_scale) gst_bin_add_many(GST_BIN(g->pipeline), g->gov_scale, g->gov_caps, NULL);
+
+    gboolean linked =
+        gst_element_link(g->ndisrc, g->demux) &&
+        gst_element_link_many(g->vselect, g->vqueue, g->vconvert, g->vcaps, NULL) &&
+        (g->sync_sink ? gst_element_link(g->vcaps, g->sync_sink) && gst_element_link(g->sync_src, g->raw_tee)
+                      : gst_element_link(g->vcaps, g->raw_tee)) &&
+        (g->gov_scale ? gst_element_link_many(g->raw_tee, g->gov_scale, g->gov_caps, g->enc, NULL)
+                      : gst_element_link(g->raw_tee, g->enc)) &&
+        (g->parse ? gst_element_link_many(g->enc, g->parse, g->parse_caps, NULL)
+                  : gst_element_link(g->enc, g->parse_caps)) &&
+        gst_element_link_many(g->aselect, g->aqueue, g->audio_enc, NULL) &&
+        (!g->audio_tee || gst_element_link(g->audio_enc, g->audio_tee));
+    if (cfg->mpts) {
+        // Request the mux pads by PID so prog-map puts them in this stream's program
+        gchar *vpad = g_strdup_printf("sink_%u", MPTS_VIDEO_PID(index));
+        gchar *apad = g_strdup_printf("sink_%u", MPTS_AUDIO_PID(index));
+        linked = linked &&
+            gst_element_link_pads(g->parse_caps, "src", g->mux, vpad) &&
+            (!g->audio_tee || gst_element_link_pads(g->audio_tee, NULL, g->mux, apad));
+        g_free(vpad);
+        g_free(apad);
+    } else {
+        linked = linked &&
+            gst_element_link(g->parse_caps, g->mux) &&
+            (!g->audio_tee || gst_element_link(g->audio_tee, g->mux));
+    }
+    if (g->meta_src) {
+        // Own PID per stream, so it stays put whether or not --mpts maps programs
+        gchar *mpad = g_strdup_printf("sink_%u", NDI_META_PID(index));
+        linked = linked && gst_element_link_pads(g->meta_src, "src", g->mux, mpad);
+        g_free(mpad);
+    }
+    linked = linked && (shared || gst_element_link(g->mux, g->out_tee));
+    if (!linked) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION, "failed to link pipeline graph");
+        return FALSE;
+    }
+
+    // ndisrcdemux pads appear once the receiver knows what the sender carries
+    g->primary_vpad = gst_element_request_pad_simple(g->vselect, "sink_%u");
+    g->primary_apad = gst_element_request_pad_simple(g->aselect, "sink_%u");
+    g_signal_connect(g->demux, "pad-added", G_CALLBACK(demux_pad_added_cb), g);
+    return TRUE;
+}
+
+static void graph_clear(PipelineGraph *g) {
+#ifdef NDI2SRT_SHM_RING
+    enc_process_free(g->enc_process);
+#endif
+    if (g->enc_settings) gst_object_unref(g->enc_settings);
+    if (g->primary_vpad) gst_object_unref(g->primary_vpad);
+    if (g->primary_apad) gst_object_unref(g->primary_apad);
+    memset(g, 0, sizeof(*g));
+}
+
+// --- Reconfiguration glitch measurement ---
+
+static GstPadProbeReturn glitch_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    GlitchMeter *m = (GlitchMeter*)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf || !GST_BUFFER_PTS_IS_VALID(buf)) return GST_PAD_PROBE_OK;
+    GstClockTime pts = GST_BUFFER_PTS(buf);
+    gint64 now = g_get_monotonic_time();
+    g_mutex_lock(&m->lock);
+    if (GST_CLOCK_TIME_IS_VALID(m->last_pts) && pts > m->last_pts) {
+        GstClockTime gap = pts - m->last_pts;
+        gint64 arrival_gap = now - m->last_arrival_us;
+        if (m->active) {
+            if (gap > m->max_pts_gap) m->max_pts_gap = gap;
+            if (arrival_gap > m->max_arrival_gap_us) m->max_arrival_gap_us = arrival_gap;
+        } else if (m->frame_duration == GST_CLOCK_TIME_NONE || gap < m->frame_duration) {
+            // Track the nominal frame duration while nothing is being reconfigured
+            m->frame_duration = gap;
+        }
+    }
+    m->last_pts = pts;
+    m->last_arrival_us = now;
+    g_mutex_unlock(&m->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static gint glitch_frames(GstClockTime gap, GstClockTime frame_duration) {
+    if (!GST_CLOCK_TIME_IS_VALID(frame_duration) || frame_duration == 0) return 0;
+    gint frames = (gint)((gap + frame_duration / 2) / frame_duration) - 1;
+    return frames > 0 ? frames : 0;
+}
+
+static gboolean glitch_report_cb(gpointer user_data) {
+    Stream *st = (Stream*)user_data;
+    GlitchMeter *m = &st->glitch;
+    g_mutex_lock(&m->lock);
+    gint dropped = glitch_frames(m->max_pts_gap, m->frame_duration);
+    gint stalled = glitch_frames((GstClockTime)m->max_arrival_gap_us * GST_USECOND, m->frame_duration);
+    gint frames = MAX(dropped, stalled);
+    m->last_frames[m->kind] = frames;
+    g_printerr("Reconfiguration '%s': glitch=%d frames (missing=%d, stall=%d, max arrival gap %.1f ms)\n",
+               m->what, frames, dropped, stalled, m->max_arrival_gap_us / 1000.0);
+    m->active = FALSE;
+    g_clear_pointer(&m->what, g_free);
+    m->report_id = 0;
+    g_mutex_unlock(&m->lock);
+    return G_SOURCE_REMOVE;
+}
+
+// Start a one-second measurement window for a reconfiguration of the given
+// kind, once it has been applied; the first frame after it still measures
+// the gap from the last frame before it
+static void glitch_begin(Stream *st, gint kind, const gchar *what) {
+    GlitchMeter *m = &st->glitch;
+    if (m->report_id) {
+        g_source_remove(m->report_id);
+        glitch_report_cb(st);
+    }
+    g_mutex_lock(&m->lock);
+    m->active = TRUE;
+    m->kind = kind;
+    m->what = g_strdup(what);
+    m->max_pts_gap = 0;
+    m->max_arrival_gap_us = 0;
+    g_mutex_unlock(&m->lock);
+    m->report_id = g_timeout_add(1000, glitch_report_cb, st);
+}
+
+static void glitch_init(Stream *st) {
+    GlitchMeter *m = &st->glitch;
+    m->last_pts = GST_CLOCK_TIME_NONE;
+    m->frame_duration = GST_CLOCK_TIME_NONE;
+    for (guint i = 0; i <= BRANCH_KIND_COUNT; ++i) m->last_frames[i] = -1;
+    GstPad *pad = gst_element_get_static_pad(st->graph.parse_caps, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, glitch_probe, m, NULL);
+    gst_object_unref(pad);
+}
+
+// --- Frame timeline trace (--trace) ---
+//
+// On SIGUSR1 or the control command "trace", every video frame is followed
+// through the graph for a bounded window. Pad probes record which thread
+// touched it in each stage, and for how long. The window is then written
+// out as Chrome/Perfetto JSON (open it in ui.perfetto.dev or
+// chrome://tracing). A probe costs one atomic read while nothing is being
+// recorded. While recording, each event goes into a per-thread buffer that
+// was allocated and faulted in at startup. No locks or allocations are taken
+// on the way, except the per-stream mutex that pairs the two ends of a span.
+//
+// Stages, keyed by PTS (stream index in args):
+//   queue_wait  vqueue sink -> vqueue src (on the dequeuing thread)
+//   convert     vqueue src  -> vcaps src
+//   encode      enc sink    -> enc src
+//   sei_inject  enc src, around the injector probe
+//   parse       after the injector -> h264parse output (not with --no-h264parse)
+//   mux_wait    mux sink pad -> first mux output at or past the frame's PTS
+//   sink        instant when the first TS chunk of a frame reaches an output
+//               sink. srtgroup:// outputs record the send itself as a span
+// mux_wait assumes PTS and running time line up, as they do for ndisrc.
+
+#define TRACE_MAX_THREADS 64
+#define TRACE_EVENTS_PER_THREAD 8192
+#define TRACE_MARKS 16              // frames in flight per stage
+#define TRACE_MAX_SECONDS 60
+
+typedef enum {
+    TRACE_RECEIVE,
+    TRACE_QUEUE_WAIT,
+    TRACE_CONVERT,
+    TRACE_ENCODE,
+    TRACE_SEI_INJECT,
+    TRACE_PARSE,
+    TRACE_MUX_WAIT,
+    TRACE_SINK,
+    TRACE_STAGE_COUNT,
+    TRACE_NONE = 0xFF
+} TraceStage;
+
+static const gchar *trace_stage_names[TRACE_STAGE_COUNT] = {
+    "receive", "queue_wait", "convert", "encode", "sei_inject", "parse", "mux_wait", "sink"
+};
+
+typedef struct TraceEvent {
+    gint64 start_ns;
+    gint64 dur_ns;                  // -1: instant
+    guint64 pts;
+    guint16 stage;
+    guint16 stream;
+} TraceEvent;
+
+typedef struct TraceThread {
+    gint session;                   // set last when claimed (atomic)
+    GThread *owner;                 // thread that claimed the slot this session
+    gint tid;
+    gchar name[16];
+    gint count;                     // published events (atomic)
+    TraceEvent *events;             // TRACE_EVENTS_PER_THREAD, in Tracer.pool
+} TraceThread;
+
+enum { TRACE_IDLE, TRACE_RECORDING, TRACE_EXPORTING };
+
+typedef struct Tracer {
+    gchar *default_path;
+    guint default_seconds;
+    gint state;                     // TRACE_* (atomic)
+    gint session;
+    gint n_threads;                 // slots claimed this session (atomic)
+    gint dropped;                   // events lost to full buffers (atomic)
+    TraceThread threads[TRACE_MAX_THREADS];
+    TraceEvent *pool;
+    gint64 started_ns;
+    gchar *path;                    // of the current session
+    GThread *exporter;
+    GPtrArray *streams;             // TraceStream*, filled before PLAYING
+} Tracer;
+
+// Begin timestamps of spans whose two ends are different probes
+typedef struct TraceStream {
+    Tracer *tracer;
+    guint index;
+    GstElement *out_tee;
+    GMutex lock;
+    guint64 mark_pts[TRACE_STAGE_COUNT][TRACE_MARKS];
+    gint64 mark_ns[TRACE_STAGE_COUNT][TRACE_MARKS];
+    guint mark_pos[TRACE_STAGE_COUNT];
+} TraceStream;
+
+// What one probe does with a buffer: end a span, record an instant, begin a span
+typedef struct TraceProbe {
+    TraceStream *ts;
+    guint8 end;
+    guint8 instant;
+    guint8 begin;
+    guint64 last_pts;               // sink probes: one instant per frame, not per chunk
+} TraceProbe;
+
+static GPrivate trace_thread_slot;  // TraceThread* of the calling thread
+
+static Tracer* tracer_new(const gchar *path, guint seconds) {
+    Tracer *tr = g_new0(Tracer, 1);
+    tr->default_path = g_strdup(path);
+    tr->default_seconds = CLAMP(seconds, 1, TRACE_MAX_SECONDS);
+    gsize bytes = (gsize)TRACE_MAX_THREADS * TRACE_EVENTS_PER_THREAD * sizeof(TraceEvent);
+    tr->pool = g_malloc(bytes);
+    // Fault every page in now rather than on the first write while recording
+    memset(tr->pool, 0xFF, bytes);
+    for (guint i = 0; i < TRACE_MAX_THREADS; ++i) tr->threads[i].events = tr->pool + (gsize)i * TRACE_EVENTS_PER_THREAD;
+    tr->streams = g_ptr_array_new();
+    return tr;
+}
+
+static TraceThread* trace_thread(Tracer *tr) {
+    TraceThread *t = g_private_get(&trace_thread_slot);
+    gint session = g_atomic_int_get(&tr->session);
+    // Slots are handed out again every session: the one this thread had
+    // last time may now belong to another thread
+    if (t && g_atomic_int_get(&t->session) == session && t->owner == g_thread_self()) return t;
+    // Claim the next slot, without touching the counter once all are taken:
+    // threads without a slot come through here for every event
+    gint i;
+    do {
+        i = g_atomic_int_get(&tr->n_threads);
+        if (i >= TRACE_MAX_THREADS) return NULL;
+    } while (!g_atomic_int_compare_and_exchange(&tr->n_threads, i, i + 1));
+    t = &tr->threads[i];
+#ifdef __linux__
+    t->tid = (gint)syscall(SYS_gettid);
+    prctl(PR_GET_NAME, t->name);
+    // Written into the JSON as is
+    for (gchar *c = t->name; *c; ++c) {
+        if (*c == '"' || *c == '\\' || (guchar)*c < 0x20) *c = '_';
+    }
+#else
+    t->tid = i + 1;
+    g_strlcpy(t->name, "thread", sizeof(t->name));
+#endif
+    t->owner = g_thread_self();
+    g_atomic_int_set(&t->count, 0);
+    g_atomic_int_set(&t->session, session);
+    g_private_set(&trace_thread_slot, t);
+    return t;
+}
+
+static void trace_record(Tracer *tr, guint stage, guint stream, guint64 pts, gint64 start_ns, gint64 dur_ns) {
+    TraceThread *t = trace_thread(tr);
+    gint n = t ? g_atomic_int_get(&t->count) : TRACE_EVENTS_PER_THREAD;
+    if (n >= TRACE_EVENTS_PER_THREAD) {
+        g_atomic_int_inc(&tr->dropped);
+        return;
+    }
+    TraceEvent *ev = &t->events[n];
+    ev->start_ns = start_ns;
+    ev->dur_ns = dur_ns;
+    ev->pts = pts;
+    ev->stage = (guint16)stage;
+    ev->stream = (guint16)stream;
+    g_atomic_int_set(&t->count, n + 1);
+}
+
+static inline gboolean trace_recording(Tracer *tr) {
+    return g_atomic_int_get(&tr->state) == TRACE_RECORDING;
+}
+
+static void trace_mark(TraceStream *ts, guint stage, guint64 pts, gint64 now) {
+    g_mutex_lock(&ts->lock);
+    guint i = ts->mark_pos[stage]++ % TRACE_MARKS;
+    ts->mark_pts[stage][i] = pts;
+    ts->mark_ns[stage][i] = now;
+    g_mutex_unlock(&ts->lock);
+}
+
+// End the span of `stage` begun for pts (every frame up to pts for mux_wait)
+static void trace_span_end(TraceStream *ts, guint stage, guint64 pts, gint64 now, gboolean up_to) {
+    gint64 begin[TRACE_MARKS];
+    guint64 begin_pts[TRACE_MARKS];
+    guint n = 0;
+    g_mutex_lock(&ts->lock);
+    for (guint i = 0; i < TRACE_MARKS; ++i) {
+        guint64 p = ts->mark_pts[stage][i];
+        if (p == GST_CLOCK_TIME_NONE || (up_to ? p > pts : p != pts)) continue;
+        begin_pts[n] = p;
+        begin[n++] = ts->mark_ns[stage][i];
+        ts->mark_pts[stage][i] = GST_CLOCK_TIME_NONE;
+    }
+    g_mutex_unlock(&ts->lock);
+    for (guint i = 0; i < n; ++i) trace_record(ts->tracer, stage, ts->index, begin_pts[i], begin[i], now - begin[i]);
+}
+
+static GstPadProbeReturn trace_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    TraceProbe *p = (TraceProbe*)user_data;
+    TraceStream *ts = p->ts;
+    if (!trace_recording(ts->tracer)) return GST_PAD_PROBE_OK;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf || !GST_BUFFER_PTS_IS_VALID(buf)) return GST_PAD_PROBE_OK;
+    guint64 pts = GST_BUFFER_PTS(buf);
+    gint64 now = (gint64)gst_util_get_timestamp();
+    if (p->end != TRACE_NONE) trace_span_end(ts, p->end, pts, now, p->end == TRACE_MUX_WAIT);
+    if (p->instant != TRACE_NONE && pts != p->last_pts) {
+        p->last_pts = pts;
+        trace_record(ts->tracer, p->instant, ts->index, pts, now, -1);
+    }
+    if (p->begin != TRACE_NONE) trace_mark(ts, p->begin, pts, now);
+    return GST_PAD_PROBE_OK;
+}
+
+// Mux output: ends mux_wait for every program of this mux (--mpts)
+static GstPadProbeReturn trace_mux_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    TraceStream *owner = (TraceStream*)user_data;
+    Tracer *tr = owner->tracer;
+    if (!trace_recording(tr)) return GST_PAD_PROBE_OK;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf || !GST_BUFFER_PTS_IS_VALID(buf)) return GST_PAD_PROBE_OK;
+    gint64 now = (gint64)gst_util_get_timestamp();
+    for (guint i = 0; i < tr->streams->len; ++i) {
+        TraceStream *ts = g_ptr_array_index(tr->streams, i);
+        if (ts->out_tee == owner->out_tee) trace_span_end(ts, TRACE_MUX_WAIT, GST_BUFFER_PTS(buf), now, TRUE);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void trace_add_probe(TraceStream *ts, GstElement *element, const gchar *pad_name,
+                            guint end, guint instant, guint begin) {
+    if (!element) return;
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    if (!pad) return;
+    TraceProbe *p = g_new0(TraceProbe, 1);
+    p->ts = ts;
+    p->end = (guint8)end;
+    p->instant = (guint8)instant;
+    p->begin = (guint8)begin;
+    p->last_pts = GST_CLOCK_TIME_NONE;
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, trace_probe, p, g_free);
+    gst_object_unref(pad);
+}
+
+static void stream_install_trace(Stream *st) {
+    TraceStream *ts = g_new0(TraceStream, 1);
+    ts->tracer = st->app->tracer;
+    ts->index = st->index;
+    ts->out_tee = st->graph.out_tee;
+    g_mutex_init(&ts->lock);
+    for (guint s = 0; s < TRACE_STAGE_COUNT; ++s) {
+        for (guint i = 0; i < TRACE_MARKS; ++i) ts->mark_pts[s][i] = GST_CLOCK_TIME_NONE;
+    }
+    st->trace = ts;
+    PipelineGraph *g = &st->graph;
+    trace_add_probe(ts, g->vqueue, "sink", TRACE_NONE, TRACE_RECEIVE, TRACE_QUEUE_WAIT);
+    trace_add_probe(ts, g->vqueue, "src", TRACE_QUEUE_WAIT, TRACE_NONE, TRACE_CONVERT);
+    trace_add_probe(ts, g->vcaps, "src", TRACE_CONVERT, TRACE_NONE, TRACE_NONE);
+    trace_add_probe(ts, g->enc, "sink", TRACE_NONE, TRACE_NONE, TRACE_ENCODE);
+    // Added before the injector's probe, so it runs first
+    trace_add_probe(ts, g->enc, "src", TRACE_ENCODE, TRACE_NONE, TRACE_SEI_INJECT);
+    trace_add_probe(ts, g->parse, "src", TRACE_PARSE, TRACE_NONE, TRACE_NONE);
+    trace_add_probe(ts, g->parse_caps, "src", TRACE_NONE, TRACE_NONE, TRACE_MUX_WAIT);
+    // The mux output is traced once, by the stream that owns the mux
+    if (!st->app->cfg->mpts || st->index == 0) {
+        GstPad *pad = gst_element_get_static_pad(g->out_tee, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, trace_mux_probe, ts, NULL);
+        gst_object_unref(pad);
+    }
+    g_ptr_array_add(ts->tracer->streams, ts);
+}
+
+// After the injector's probe on the encoder src (see stream_install_sei)
+static void stream_install_trace_sei_end(Stream *st) {
+    TraceStream *ts = st->trace;
+    trace_add_probe(ts, st->graph.enc, "src", TRACE_SEI_INJECT, TRACE_NONE, st->graph.parse ? TRACE_PARSE : TRACE_NONE);
+}
+
+static void branch_install_trace(Stream *st, GstElement *sink) {
+    // Appsinks (srtgroup://, batched stdout) record the sink stage themselves
+    if (GST_IS_APP_SINK(sink)) return;
+    trace_add_probe(st->trace, sink, "sink", TRACE_NONE, TRACE_SINK, TRACE_NONE);
+}
+
+static void trace_stream_free(TraceStream *ts) {
+    if (!ts) return;
+    g_mutex_clear(&ts->lock);
+    g_free(ts);
+}
+
+static gpointer trace_export_thread(gpointer user_data) {
+    Tracer *tr = (Tracer*)user_data;
+    FILE *f = fopen(tr->path, "w");
+    if (!f) {
+        g_printerr("Trace: cannot write %s: %s\n", tr->path, g_strerror(errno));
+        g_atomic_int_set(&tr->state, TRACE_IDLE);
+        return NULL;
+    }
+    gint pid = (gint)getpid();
+    guint64 total = 0;
+    gint n_threads = MIN(g_atomic_int_get(&tr->n_threads), TRACE_MAX_THREADS);
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"ndi2srt\"}}", pid);
+    for (gint i = 0; i < n_threads; ++i) {
+        TraceThread *t = &tr->threads[i];
+        gint count = g_atomic_int_get(&t->count);
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, t->tid, t->name);
+        for (gint j = 0; j < count; ++j) {
+            const TraceEvent *ev = &t->events[j];
+            gdouble ts_us = (ev->start_ns - tr->started_ns) / 1000.0;
+            if (ts_us < 0) continue;
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"stream%u\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,",
+                    trace_stage_names[ev->stage], ev->stream, pid, t->tid, ts_us);
+            if (ev->dur_ns >= 0) fprintf(f, "\"ph\":\"X\",\"dur\":%.3f,", ev->dur_ns / 1000.0);
+            else fprintf(f, "\"ph\":\"i\",\"s\":\"t\",");
+            fprintf(f, "\"args\":{\"stream\":%u,\"pts_ms\":%.3f}}", ev->stream, ev->pts / 1e6);
+            total++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    gboolean ok = fclose(f) == 0;
+    g_printerr("Trace: %s %s (%" G_GUINT64_FORMAT " events from %d threads, %d dropped)\n",
+               ok ? "wrote" : "failed to write", tr->path, total, n_threads, g_atomic_int_get(&tr->dropped));
+    g_atomic_int_set(&tr->state, TRACE_IDLE);
+    return NULL;
+}
+
+static gboolean trace_stop_cb(gpointer user_data) {
+    Tracer *tr = (Tracer*)user_data;
+    g_atomic_int_set(&tr->state, TRACE_EXPORTING);
+    // Formatting a few hundred thousand events takes a while: not on the main loop
+    if (tr->exporter) g_thread_join(tr->exporter);
+    tr->exporter = g_thread_new("trace-export", trace_export_thread, tr);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean trace_start(Tracer *tr, const gchar *path, guint seconds, GError **error) {
+    if (g_atomic_int_get(&tr->state) != TRACE_IDLE) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_BUSY, "a trace is already being recorded or written");
+        return FALSE;
+    }
+    seconds = seconds > 0 ? MIN(seconds, TRACE_MAX_SECONDS) : tr->default_seconds;
+    g_free(tr->path);
+    tr->path = g_strdup(path ? path : tr->default_path);
+    g_atomic_int_set(&tr->n_threads, 0);
+    g_atomic_int_set(&tr->dropped, 0);
+    g_atomic_int_inc(&tr->session);
+    tr->started_ns = (gint64)gst_util_get_timestamp();
+    g_atomic_int_set(&tr->state, TRACE_RECORDING);
+    g_timeout_add_seconds(seconds, trace_stop_cb, tr);
+    g_printerr("Trace: recording %u s to %s\n", seconds, tr->path);
+    return TRUE;
+}
+
+static gboolean trace_signal_cb(gpointer user_data) {
+    GError *err = NULL;
+    if (!trace_start((Tracer*)user_data, NULL, 0, &err)) {
+        g_printerr("Trace: %s\n", err->message);
+        g_clear_error(&err);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Call with the pipeline in NULL
+static void tracer_free(Tracer *tr) {
+    if (!tr) return;
+    if (tr->exporter) g_thread_join(tr->exporter);
+    g_free(tr->pool);
+    g_ptr_array_unref(tr->streams);
+    g_free(tr->path);
+    g_free(tr->default_path);
+    g_free(tr);
+}
+
+#ifdef NDI2SRT_SRT_GROUP
+// --- SRT socket-group output (srtgroup://) ---
+//
+// srtgroup://<host>:<port>,<host>:<port>[,...][?opts] sends the encoded TS
+// over several links of one libsrt socket group. The branch ends in an
+// appsink and every 1316-byte chunk is handed to the group once; libsrt does
+// the fan-out, so nothing is encoded or muxed twice.
+//   mode=broadcast   same packets on every link, the receiver merges them
+//                    hitlessly (default)
+//   mode=backup      one active link; the others take over when it stalls
+//   weights=<w,...>  backup: link priority, higher is preferred (default 1)
+//   stable=<ms>      backup: silence after which a link counts as unstable
+//   latency=<ms>, streamid=<id>, passphrase=<secret>, pbkeylen=<16|24|32>
+// Needs libsrt built with ENABLE_BONDING and a listener with groupconnect=1.
+// Links that break are reconnected every second from the main loop.
+
+#define SRT_GROUP_CHUNK 1316        // 7 TS packets, SRT's live payload size
+#define SRT_GROUP_REPORT_INTERVAL_US (5 * G_USEC_PER_SEC)
+
+typedef struct SrtGroupLink {
+    gchar *name;                    // host:port as given
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    gint weight;
+    SRTSOCKET id;                   // current member socket, SRT_INVALID_SOCK when down
+    SRT_MEMBERSTATUS state;
+    gboolean was_running;
+    guint reconnects;
+} SrtGroupLink;
+
+typedef struct SrtGroupOutput {
+    gchar *uri;
+    SRT_GROUP_TYPE type;
+    SRTSOCKET group;
+    GArray *links;                  // SrtGroupLink
+    guint check_id;
+    gint64 last_report_us;
+    gboolean verbose;
+    guint64 chunks_sent;
+    guint64 chunks_dropped;         // send buffer full or no link up
+    TraceStream *trace;             // --trace: the send is the "sink" span
+    guint64 trace_last_pts;
+} SrtGroupOutput;
+
+static const gchar* srt_group_member_state_name(SRT_MEMBERSTATUS s) {
+    switch (s) {
+        case SRT_GST_PENDING: return "pending";
+        case SRT_GST_IDLE: return "idle";
+        case SRT_GST_RUNNING: return "running";
+        case SRT_GST_BROKEN: return "broken";
+        default: return "down";
+    }
+}
+
+static gboolean srt_group_resolve(SrtGroupLink *link, GError **error) {
+    const gchar *colon = strrchr(link->name, ':');
+    if (!colon || colon == link->name || atoi(colon + 1) <= 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "srtgroup link '%s' needs host:port", link->name);
+        return FALSE;
+    }
+    gchar *host = g_strndup(link->name, colon - link->name);
+    struct addrinfo hints = { 0 }, *res = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int rc = getaddrinfo(host, colon + 1, &hints, &res);
+    g_free(host);
+    if (rc != 0 || !res) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_HOST_NOT_FOUND, "srtgroup link '%s': %s", link->name, gai_strerror(rc));
+        return FALSE;
+    }
+    memcpy(&link->addr, res->ai_addr, res->ai_addrlen);
+    link->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return TRUE;
+}
+
+// Start (or restart) the member connection of one link; non-blocking
+static void srt_group_connect_link(SrtGroupOutput *out, SrtGroupLink *link) {
+    SRT_SOCKGROUPCONFIG cfg = srt_prepare_endpoint(NULL, (struct sockaddr*)&link->addr, link->addr_len);
+    cfg.weight = link->weight;
+    if (srt_connect_group(out->group, &cfg, 1) == SRT_ERROR) {
+        link->id = SRT_INVALID_SOCK;
+        if (out->verbose) g_printerr("SRT group: connect %s failed: %s\n", link->name, srt_getlasterror_str());
+        return;
+    }
+    link->id = cfg.id;
+    link->state = SRT_GST_PENDING;
+}
+
+// Main loop, every second: refresh member states, log transitions,
+// reconnect links whose member is gone and report link stats when verbose
+static gboolean srt_group_check_cb(gpointer user_data) {
+    SrtGroupOutput *out = (SrtGroupOutput*)user_data;
+    SRT_SOCKGROUPDATA data[16];
+    size_t n = G_N_ELEMENTS(data);
+    if (srt_group_data(out->group, data, &n) == SRT_ERROR) n = 0;
+    gint64 now = g_get_monotonic_time();
+    gboolean report = out->verbose && now - out->last_report_us >= SRT_GROUP_REPORT_INTERVAL_US;
+    if (report) out->last_report_us = now;
+
+    for (guint i = 0; i < out->links->len; ++i) {
+        SrtGroupLink *link = &g_array_index(out->links, SrtGroupLink, i);
+        gboolean member = FALSE;
+        for (size_t j = 0; j < n && link->id != SRT_INVALID_SOCK; ++j) {
+            if (data[j].id != link->id) continue;
+            member = TRUE;
+            link->state = data[j].memberstate;
+        }
+        gboolean running = member && (link->state == SRT_GST_RUNNING || link->state == SRT_GST_IDLE);
+        if (running != link->was_running) {
+            g_printerr("SRT group: link %s %s\n", link->name, running ? "up" : "down");
+            link->was_running = running;
+        }
+        if (!member || link->state == SRT_GST_BROKEN) {
+            if (link->id != SRT_INVALID_SOCK) link->reconnects++;
+            link->state = SRT_GST_BROKEN;
+            srt_group_connect_link(out, link);
+        } else if (report) {
+            SRT_TRACEBSTATS perf;
+            if (srt_bstats(link->id, &perf, 0) == 0) {
+                g_printerr("SRT group: %s %s rtt=%.1fms rate=%.2fMbps sent=%" G_GINT64_FORMAT
+                           " lost=%d retrans=%d dropped=%d\n", link->name, srt_group_member_state_name(link->state),
+                           perf.msRTT, perf.mbpsSendRate, perf.pktSentTotal, perf.pktSndLossTotal,
+                           perf.pktRetransTotal, perf.pktSndDropTotal);
+            }
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static GstFlowReturn srt_group_new_sample_cb(GstAppSink *sink, gpointer user_data) {
+    SrtGroupOutput *out = (SrtGroupOutput*)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) return GST_FLOW_EOS;
+    GstBuffer *buf = gst_sample_get_buffer(sample);
+    // Traced once per frame, on its first chunk
+    gboolean traced = out->trace && buf && trace_recording(out->trace->tracer) &&
+                      GST_BUFFER_PTS_IS_VALID(buf) && GST_BUFFER_PTS(buf) != out->trace_last_pts;
+    gint64 t0 = traced ? (gint64)gst_util_get_timestamp() : 0;
+    GstMapInfo map;
+    if (buf && gst_buffer_map(buf, &map, GST_MAP_READ)) {
+        for (gsize off = 0; off < map.size; off += SRT_GROUP_CHUNK) {
+            SRT_MSGCTRL mc;
+            srt_msgctrl_init(&mc);
+            int len = (int)MIN((gsize)SRT_GROUP_CHUNK, map.size - off);
+            // Never block the branch: a full send buffer or no live link drops the chunk
+            if (srt_sendmsg2(out->group, (const char*)map.data + off, len, &mc) == SRT_ERROR) out->chunks_dropped++;
+            else out->chunks_sent++;
+        }
+        gst_buffer_unmap(buf, &map);
+    }
+    if (traced) {
+        out->trace_last_pts = GST_BUFFER_PTS(buf);
+        trace_record(out->trace->tracer, TRACE_SINK, out->trace->index, out->trace_last_pts, t0,
+                     (gint64)gst_util_get_timestamp() - t0);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static void srt_group_free(SrtGroupOutput *out) {
+    if (!out) return;
+    if (out->check_id) g_source_remove(out->check_id);
+    srt_close(out->group);
+    for (guint i = 0; i < out->links->len; ++i) g_free(g_array_index(out->links, SrtGroupLink, i).name);
+    g_array_unref(out->links);
+    g_free(out->uri);
+    g_free(out);
+    srt_cleanup();
+}
+
+static gboolean srt_group_set_flag(SrtGroupOutput *out, SRT_SOCKOPT opt, const void *val, int len,
+                                   const gchar *what, GError **error) {
+    if (srt_setsockflag(out->group, opt, val, len) == SRT_ERROR) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "srtgroup: %s: %s", what, srt_getlasterror_str());
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static SrtGroupOutput* srt_group_new(const gchar *uri, gboolean verbose, GError **error) {
+    const gchar *spec = uri + strlen("srtgroup://");
+    const gchar *query = strchr(spec, '?');
+    GHashTable *params = NULL;
+    if (query) {
+        // A query that does not parse, or names an option that does not
+        // exist, is a typo: refuse it rather than run with the defaults
+        static const gchar *const known[] = {
+            "mode", "weights", "stable", "latency", "streamid", "passphrase", "pbkeylen", NULL
+        };
+        GError *perr = NULL;
+        params = g_uri_parse_params(query + 1, -1, "&", G_URI_PARAMS_NONE, &perr);
+        if (!params) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "srtgroup: bad query '%s': %s",
+                        query + 1, perr->message);
+            g_error_free(perr);
+            return NULL;
+        }
+        GHashTableIter it;
+        gpointer key;
+        g_hash_table_iter_init(&it, params);
+        while (g_hash_table_iter_next(&it, &key, NULL)) {
+            if (!g_strv_contains(known, (const gchar*)key)) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "srtgroup: unknown option '%s'",
+                            (const gchar*)key);
+                g_hash_table_unref(params);
+                return NULL;
+            }
+        }
+    }
+    gchar *hosts = query ? g_strndup(spec, query - spec) : g_strdup(spec);
+    const gchar *mode = params ? g_hash_table_lookup(params, "mode") : NULL;
+    const gchar *weights = params ? g_hash_table_lookup(params, "weights") : NULL;
+    const gchar *stable = params ? g_hash_table_lookup(params, "stable") : NULL;
+    const gchar *latency = params ? g_hash_table_lookup(params, "latency") : NULL;
+    const gchar *streamid = params ? g_hash_table_lookup(params, "streamid") : NULL;
+    const gchar *passphrase = params ? g_hash_table_lookup(params, "passphrase") : NULL;
+    const gchar *pbkeylen = params ? g_hash_table_lookup(params, "pbkeylen") : NULL;
+
+    SrtGroupOutput *out = g_new0(SrtGroupOutput, 1);
+    out->uri = g_strdup(uri);
+    out->verbose = verbose;
+    out->group = SRT_INVALID_SOCK;
+    out->links = g_array_new(FALSE, TRUE, sizeof(SrtGroupLink));
+    srt_startup();
+
+    gboolean ok = TRUE;
+    if (mode && !g_str_equal(mode, "broadcast") && !g_str_equal(mode, "backup")) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "srtgroup: mode must be broadcast or backup");
+        ok = FALSE;
+    }
+    out->type = g_strcmp0(mode, "backup") == 0 ? SRT_GTYPE_BACKUP : SRT_GTYPE_BROADCAST;
+    gchar **names = g_strsplit(hosts, ",", -1);
+    gchar **w = weights ? g_strsplit(weights, ",", -1) : NULL;
+    for (guint i = 0; ok && names[i]; ++i) {
+        SrtGroupLink link = { 0 };
+        link.name = g_strdup(names[i]);
+        link.weight = (w && i < g_strv_length(w)) ? atoi(w[i]) : 1;
+        link.id = SRT_INVALID_SOCK;
+        link.state = SRT_GST_BROKEN;
+        g_array_append_val(out->links, link);
+        ok = srt_group_resolve(&g_array_index(out->links, SrtGroupLink, i), error);
+    }
+    g_strfreev(w);
+    g_strfreev(names);
+    if (ok && out->links->len < 2) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "srtgroup needs at least two links");
+        ok = FALSE;
+    }
+    if (ok) {
+        out->group = srt_create_group(out->type);
+        if (out->group == SRT_INVALID_SOCK) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        "srtgroup: %s (libsrt built without ENABLE_BONDING?)", srt_getlasterror_str());
+            ok = FALSE;
+        }
+    }
+    if (ok) {
+        // Non-blocking: connects run in the background, sends never wait
+        gint no = 0;
+        gint lat = latency ? atoi(latency) : 120;
+        ok = srt_group_set_flag(out, SRTO_RCVSYN, &no, sizeof(no), "rcvsyn", error) &&
+             srt_group_set_flag(out, SRTO_SNDSYN, &no, sizeof(no), "sndsyn", error) &&
+             srt_group_set_flag(out, SRTO_LATENCY, &lat, sizeof(lat), "latency", error);
+        if (ok && stable) {
+            gint ms = atoi(stable);
+            ok = srt_group_set_flag(out, SRTO_GROUPMINSTABLETIMEO, &ms, sizeof(ms), "stable", error);
+        }
+        if (ok && streamid) ok = srt_group_set_flag(out, SRTO_STREAMID, streamid, strlen(streamid), "streamid", error);
+        if (ok && pbkeylen) {
+            gint len = atoi(pbkeylen);
+            ok = srt_group_set_flag(out, SRTO_PBKEYLEN, &len, sizeof(len), "pbkeylen", error);
+        }
+        if (ok && passphrase) {
+            ok = srt_group_set_flag(out, SRTO_PASSPHRASE, passphrase, strlen(passphrase), "passphrase", error);
+        }
+    }
+    if (params) g_hash_table_unref(params);
+    g_free(hosts);
+    if (!ok) {
+        srt_group_free(out);
+        return NULL;
+    }
+    for (guint i = 0; i < out->links->len; ++i) {
+        srt_group_connect_link(out, &g_array_index(out->links, SrtGroupLink, i));
+    }
+    out->last_report_us = g_get_monotonic_time();
+    out->check_id = g_timeout_add_seconds(1, srt_group_check_cb, out);
+    g_printerr("SRT group: %s over %u links\n", out->type == SRT_GTYPE_BACKUP ? "main/backup" : "broadcast",
+               out->links->len);
+    return out;
+}
+
+// Feed the group from the branch's appsink (named outsink)
+static void srt_group_attach(SrtGroupOutput *out, GstElement *bin) {
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), "outsink");
+    GstAppSinkCallbacks callbacks = { .new_sample = srt_group_new_sample_cb };
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, out, NULL);
+    gst_object_unref(sink);
+}
+
+static void srt_group_add_stats(JsonBuilder *b, SrtGroupOutput *out) {
+    json_builder_set_member_name(b, "srt_group");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "mode");
+    json_builder_add_string_value(b, out->type == SRT_GTYPE_BACKUP ? "backup" : "broadcast");
+    json_builder_set_member_name(b, "chunks_sent");
+    json_builder_add_int_value(b, (gint64)out->chunks_sent);
+    json_builder_set_member_name(b, "chunks_dropped");
+    json_builder_add_int_value(b, (gint64)out->chunks_dropped);
+    json_builder_set_member_name(b, "links");
+    json_builder_begin_array(b);
+    for (guint i = 0; i < out->links->len; ++i) {
+        SrtGroupLink *link = &g_array_index(out->links, SrtGroupLink, i);
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "link");
+        json_builder_add_string_value(b, link->name);
+        json_builder_set_member_name(b, "state");
+        json_builder_add_string_value(b, srt_group_member_state_name(link->state));
+        json_builder_set_member_name(b, "weight");
+        json_builder_add_int_value(b, link->weight);
+        json_builder_set_member_name(b, "reconnects");
+        json_builder_add_int_value(b, link->reconnects);
+        SRT_TRACEBSTATS perf;
+        if (link->id != SRT_INVALID_SOCK && srt_bstats(link->id, &perf, 0) == 0) {
+            json_builder_set_member_name(b, "rtt_ms");
+            json_builder_add_double_value(b, perf.msRTT);
+            json_builder_set_member_name(b, "send_rate_mbps");
+            json_builder_add_double_value(b, perf.mbpsSendRate);
+            json_builder_set_member_name(b, "bandwidth_mbps");
+            json_builder_add_double_value(b, perf.mbpsBandwidth);
+            json_builder_set_member_name(b, "packets_sent");
+            json_builder_add_int_value(b, perf.pktSentTotal);
+            json_builder_set_member_name(b, "packets_lost");
+            json_builder_add_int_value(b, perf.pktSndLossTotal);
+            json_builder_set_member_name(b, "packets_retransmitted");
+            json_builder_add_int_value(b, perf.pktRetransTotal);
+            json_builder_set_member_name(b, "packets_dropped");
+            json_builder_add_int_value(b, perf.pktSndDropTotal);
+        }
+        json_builder_end_object(b);
+    }
+    json_builder_end_array(b);
+    json_builder_end_object(b);
+}
+#endif
+
+// --- Batched stdout output ---
+//
+// fdsink makes one write() per mux buffer, i.e. per 7 TS packets, which is
+// a few thousand small syscalls per second per stream when piped into
+// ffmpeg. Instead, "stdout" outputs end in an appsink whose callback only
+// queues the buffer. A writer thread sends the queue in one fdwriter batch
+// as soon as it holds --stdout-batch KiB, or when its oldest buffer has
+// waited --stdout-flush-ms: that bounds the added latency. fdwriter uses
+// vmsplice into a pipe and writev otherwise. vmsplice leaves the buffer's
+// own pages in the pipe, so the thread keeps the buffers mapped until the
+// reader has drained them (at most a pipe's worth). When the reader falls
+// behind by four batches, the callback blocks like fdsink did, and the
+// leaky queue in front of the sink drops. --stdout-batch 0 restores fdsink.
+
+#define STDOUT_REPORT_INTERVAL_US (5 * G_USEC_PER_SEC)
+#define STDOUT_DRAIN_TIMEOUT_US (2 * G_USEC_PER_SEC)
+
+// A vmspliced buffer the pipe may still reference
+typedef struct {
+    GstBuffer *buf;
+    GstMapInfo map;
+    guint64 end;                    // stream offset just past its batch
+} StdoutHeld;
+
+typedef struct StdoutOutput {
+    FdWriter *writer;
+    GstElement *sink;               // for error messages
+    gsize batch_bytes;
+    gint64 flush_us;
+    gboolean verbose;
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    GQueue queue;                   // GstBuffer, oldest first
+    gsize queued_bytes;
+    gint64 oldest_us;               // arrival of the queue head
+    gboolean flush_now;             // EOS: send what is queued without waiting
+    gboolean stopping;
+    gboolean failed;
+    GQueue held;                    // StdoutHeld, writer thread only
+    // written by the writer thread, read racily for stats
+    guint64 batches;
+    gint64 started_us;
+    gint64 last_report_us;
+    guint64 last_report_syscalls, last_report_bytes;
+    TraceStream *trace;             // --trace: arrival at the sink is the "sink" instant
+    guint64 trace_last_pts;
+} StdoutOutput;
+
+// Unmaps and drops the held buffers the reader is done with
+static void stdout_output_release(StdoutOutput *out) {
+    if (g_queue_is_empty(&out->held)) return;
+    guint64 drained = fdwriter_drained(out->writer);
+    while (!g_queue_is_empty(&out->held)) {
+        StdoutHeld *h = (StdoutHeld*)g_queue_peek_head(&out->held);
+        if (h->end > drained) break;
+        g_queue_pop_head(&out->held);
+        gst_buffer_unmap(h->buf, &h->map);
+        gst_buffer_unref(h->buf);
+        g_free(h);
+    }
+}
+
+static void stdout_output_write(StdoutOutput *out, GQueue *batch) {
+    struct iovec iov[64];
+    GstMapInfo maps[G_N_ELEMENTS(iov)];
+    GstBuffer *bufs[G_N_ELEMENTS(iov)];
+    stdout_output_release(out);
+    while (!g_queue_is_empty(batch)) {
+        guint n = 0;
+        while (n < G_N_ELEMENTS(iov) && !g_queue_is_empty(batch)) {
+            bufs[n] = (GstBuffer*)g_queue_pop_head(batch);
+            if (!gst_buffer_map(bufs[n], &maps[n], GST_MAP_READ)) {
+                gst_buffer_unref(bufs[n]);
+                continue;
+            }
+            iov[n].iov_base = maps[n].data;
+            iov[n].iov_len = maps[n].size;
+            ++n;
+        }
+        // Even a failed vmsplice may have queued part of the batch
+        gboolean spliced = !out->failed && fdwriter_mode(out->writer) == FDWRITER_VMSPLICE;
+        int rc = out->failed ? 0 : fdwriter_writev(out->writer, iov, (int)n);
+        int err = errno;
+        guint64 end = fdwriter_position(out->writer);
+        for (guint i = 0; i < n; ++i) {
+            if (spliced) {
+                StdoutHeld *h = g_new(StdoutHeld, 1);
+                h->buf = bufs[i];
+                h->map = maps[i];
+                h->end = end;
+                g_queue_push_tail(&out->held, h);
+                continue;
+            }
+            gst_buffer_unmap(bufs[i], &maps[i]);
+            gst_buffer_unref(bufs[i]);
+        }
+        if (rc < 0 && !out->failed) {
+            // Same outcome as an fdsink write error: the pipeline stops
+            g_atomic_int_set(&out->failed, TRUE);
+            GError *gerr = g_error_new(GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_WRITE,
+                                       "Error while writing to stdout: %s", g_strerror(err));
+            gst_element_post_message(out->sink, gst_message_new_error(GST_OBJECT(out->sink), gerr, NULL));
+            g_error_free(gerr);
+        }
+    }
+    out->batches++;
+}
+
+static void stdout_output_report(StdoutOutput *out) {
+    gint64 now = g_get_monotonic_time();
+    if (now - out->last_report_us < STDOUT_REPORT_INTERVAL_US) return;
+    guint64 syscalls, bytes;
+    fdwriter_totals(out->writer, &syscalls, &bytes);
+    guint64 d_sys = syscalls - out->last_report_syscalls, d_bytes = bytes - out->last_report_bytes;
+    g_printerr("stdout: %.0f syscalls/s, %.0f bytes/syscall (%s)\n",
+               d_sys * (gdouble)G_USEC_PER_SEC / (now - out->last_report_us), d_sys ? (gdouble)d_bytes / d_sys : 0.0,
+               fdwriter_mode(out->writer) == FDWRITER_VMSPLICE ? "vmsplice" : "writev");
+    out->last_report_us = now;
+    out->last_report_syscalls = syscalls;
+    out->last_report_bytes = bytes;
+}
+
+static gpointer stdout_output_thread(gpointer user_data) {
+    StdoutOutput *out = (StdoutOutput*)user_data;
+    GQueue batch = G_QUEUE_INIT;
+    g_mutex_lock(&out->lock);
+    for (;;) {
+        while (g_queue_is_empty(&out->queue) && !out->stopping) g_cond_wait(&out->cond, &out->lock);
+        if (g_queue_is_empty(&out->queue)) break;
+        // Wait for a full batch, but never past the oldest buffer's deadline
+        gint64 deadline = out->oldest_us + out->flush_us;
+        while (out->queued_bytes < out->batch_bytes && !out->flush_now && !out->stopping &&
+               g_get_monotonic_time() < deadline) {
+            g_cond_wait_until(&out->cond, &out->lock, deadline);
+        }
+        batch = out->queue;
+        g_queue_init(&out->queue);
+        out->queued_bytes = 0;
+        out->flush_now = FALSE;
+        g_cond_broadcast(&out->cond);
+        g_mutex_unlock(&out->lock);
+        stdout_output_write(out, &batch);
+        if (out->verbose) stdout_output_report(out);
+        g_mutex_lock(&out->lock);
+    }
+    g_mutex_unlock(&out->lock);
+    // Give the reader a moment to take the last batches. Pages it never
+    // reads stay in the pipe, so their buffers are leaked rather than freed.
+    gint64 give_up = g_get_monotonic_time() + STDOUT_DRAIN_TIMEOUT_US;
+    for (stdout_output_release(out); !g_queue_is_empty(&out->held) && g_get_monotonic_time() < give_up;
+         stdout_output_release(out)) {
+        g_usleep(2000);
+    }
+    if (!g_queue_is_empty(&out->held)) {
+        g_printerr("stdout: reader left %u buffers in the pipe, not freeing them\n", g_queue_get_length(&out->held));
+        g_queue_clear_full(&out->held, g_free);
+    }
+    return NULL;
+}
+
+static void stdout_output_push(StdoutOutput *out, GstBuffer *buf) {
+    gsize size = gst_buffer_get_size(buf);
+    g_mutex_lock(&out->lock);
+    while (out->queued_bytes >= 4 * out->batch_bytes && !out->stopping) g_cond_wait(&out->cond, &out->lock);
+    if (out->stopping) {
+        g_mutex_unlock(&out->lock);
+        return;
+    }
+    if (g_queue_is_empty(&out->queue)) out->oldest_us = g_get_monotonic_time();
+    g_queue_push_tail(&out->queue, gst_buffer_ref(buf));
+    out->queued_bytes += size;
+    if (out->queued_bytes >= out->batch_bytes || g_queue_get_length(&out->queue) == 1) g_cond_broadcast(&out->cond);
+    g_mutex_unlock(&out->lock);
+}
+
+static gboolean stdout_output_push_list_item(GstBuffer **buf, guint idx, gpointer user_data) {
+    stdout_output_push((StdoutOutput*)user_data, *buf);
+    return TRUE;
+}
+
+static GstFlowReturn stdout_output_new_sample_cb(GstAppSink *sink, gpointer user_data) {
+    StdoutOutput *out = (StdoutOutput*)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) return GST_FLOW_EOS;
+    GstBufferList *list = gst_sample_get_buffer_list(sample);
+    GstBuffer *buf = list ? (gst_buffer_list_length(list) > 0 ? gst_buffer_list_get(list, 0) : NULL)
+                          : gst_sample_get_buffer(sample);
+    if (out->trace && buf && trace_recording(out->trace->tracer) && GST_BUFFER_PTS_IS_VALID(buf) &&
+        GST_BUFFER_PTS(buf) != out->trace_last_pts) {
+        out->trace_last_pts = GST_BUFFER_PTS(buf);
+        trace_record(out->trace->tracer, TRACE_SINK, out->trace->index, out->trace_last_pts,
+                     (gint64)gst_util_get_timestamp(), -1);
+    }
+    // Whole mux output lists at once (buffer-list=true), one callback each
+    if (list) gst_buffer_list_foreach(list, stdout_output_push_list_item, out);
+    else if (buf) stdout_output_push(out, buf);
+    gst_sample_unref(sample);
+    return g_atomic_int_get(&out->failed) ? GST_FLOW_ERROR : GST_FLOW_OK;
+}
+
+static void stdout_output_eos_cb(GstAppSink *sink, gpointer user_data) {
+    StdoutOutput *out = (StdoutOutput*)user_data;
+    g_mutex_lock(&out->lock);
+    out->flush_now = TRUE;
+    g_cond_broadcast(&out->cond);
+    g_mutex_unlock(&out->lock);
+}
+
+// Sends whatever is still queued, then stops the writer
+static void stdout_output_free(StdoutOutput *out) {
+    if (!out) return;
+    g_mutex_lock(&out->lock);
+    out->stopping = TRUE;
+    g_cond_broadcast(&out->cond);
+    g_mutex_unlock(&out->lock);
+    g_thread_join(out->thread);
+    fdwriter_free(out->writer);
+    gst_object_unref(out->sink);
+    g_mutex_clear(&out->lock);
+    g_cond_clear(&out->cond);
+    g_free(out);
+}
+
+// Feed a new writer from the branch's appsink (named outsink)
+static StdoutOutput* stdout_output_new(GstElement *bin, const AppConfig *cfg, TraceStream *trace, GError **error) {
+    FdWriter *writer = fdwriter_new(STDOUT_FILENO, !cfg->stdout_writev);
+    if (!writer) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "stdout: %s", g_strerror(errno));
+        return NULL;
+    }
+    StdoutOutput *out = g_new0(StdoutOutput, 1);
+    out->writer = writer;
+    out->sink = gst_bin_get_by_name(GST_BIN(bin), "outsink");
+    out->batch_bytes = (gsize)cfg->stdout_batch_kb << 10;
+    out->flush_us = (gint64)cfg->stdout_flush_ms * 1000;
+    out->verbose = cfg->verbose;
+    out->trace = trace;
+    out->trace_last_pts = GST_CLOCK_TIME_NONE;
+    out->started_us = out->last_report_us = g_get_monotonic_time();
+    g_mutex_init(&out->lock);
+    g_cond_init(&out->cond);
+    g_queue_init(&out->queue);
+    g_queue_init(&out->held);
+    out->thread = g_thread_new("stdout-writer", stdout_output_thread, out);
+    GstAppSinkCallbacks callbacks = { .eos = stdout_output_eos_cb, .new_sample = stdout_output_new_sample_cb };
+    gst_app_sink_set_callbacks(GST_APP_SINK(out->sink), &callbacks, out, NULL);
+    g_printerr("stdout: %s, batches of %u KiB or %u ms\n",
+               fdwriter_mode(writer) == FDWRITER_VMSPLICE ? "pipe (vmsplice)" : "writev",
+               cfg->stdout_batch_kb, cfg->stdout_flush_ms);
+    return out;
+}
+
+static void stdout_output_add_stats(JsonBuilder *b, StdoutOutput *out) {
+    guint64 syscalls, bytes;
+    fdwriter_totals(out->writer, &syscalls, &bytes);
+    gdouble elapsed_s = (g_get_monotonic_time() - out->started_us) / 1e6;
+    json_builder_set_member_name(b, "stdout");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "mode");
+    json_builder_add_string_value(b, fdwriter_mode(out->writer) == FDWRITER_VMSPLICE ? "vmsplice" : "writev");
+    json_builder_set_member_name(b, "batches");
+    json_builder_add_int_value(b, (gint64)out->batches);
+    json_builder_set_member_name(b, "syscalls");
+    json_builder_add_int_value(b, (gint64)syscalls);
+    json_builder_set_member_name(b, "bytes");
+    json_builder_add_int_value(b, (gint64)bytes);
+    json_builder_set_member_name(b, "syscalls_per_s");
+    json_builder_add_double_value(b, elapsed_s > 0 ? syscalls / elapsed_s : 0.0);
+    json_builder_set_member_name(b, "bytes_per_syscall");
+    json_builder_add_double_value(b, syscalls ? (gdouble)bytes / syscalls : 0.0);
+    json_builder_end_object(b);
+}
+
+// --- Hot-swappable branches ---
+
+// udp://<host>:<port>[?opts] sends the TS as 7-packet datagrams,
+// rtp://<host>:<port>[?opts] as RTP/MP2T (RFC 2250), optionally with
+// SMPTE 2022-1 FEC on port+2 (columns) and port+4 (rows). Options:
+//   ttl=<n>          multicast TTL (default 1)
+//   iface=<name>     multicast interface
+//   loop=0|1         multicast loopback (default 1)
+//   pace=<kbps>|off  cap the send rate (default: 1.25 x the stream bitrate)
+//   fec=1, fec-cols=<n>, fec-rows=<n>   (rtp only)
+// One send serves every receiver that joined the group.
+static gchar* build_udp_sink_desc(const gchar *uri, gint stream_kbps, GError **error) {
+    GUri *guri = g_uri_parse(uri, G_URI_FLAGS_NONE, error);
+    if (!guri) return NULL;
+    const gchar *host = g_uri_get_host(guri);
+    gint port = g_uri_get_port(guri);
+    if (!host || port <= 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "'%s' needs a host and a port", uri);
+        g_uri_unref(guri);
+        return NULL;
+    }
+    gboolean rtp = g_str_equal(g_uri_get_scheme(guri), "rtp");
+    GHashTable *params = g_uri_get_query(guri)
+        ? g_uri_parse_params(g_uri_get_query(guri), -1, "&", G_URI_PARAMS_NONE, NULL) : NULL;
+    const gchar *ttl = params ? g_hash_table_lookup(params, "ttl") : NULL;
+    const gchar *iface = params ? g_hash_table_lookup(params, "iface") : NULL;
+    const gchar *loop = params ? g_hash_table_lookup(params, "loop") : NULL;
+    const gchar *pace = params ? g_hash_table_lookup(params, "pace") : NULL;
+    const gchar *fec = params ? g_hash_table_lookup(params, "fec") : NULL;
+    const gchar *fec_cols = params ? g_hash_table_lookup(params, "fec-cols") : NULL;
+    const gchar *fec_rows = params ? g_hash_table_lookup(params, "fec-rows") : NULL;
+
+    guint64 max_bitrate = 0;
+    if (g_strcmp0(pace, "off") != 0) {
+        gint64 kbps = pace ? g_ascii_strtoll(pace, NULL, 10) : (gint64)(stream_kbps + 256) * 5 / 4;
+        if (kbps > 0) max_bitrate = (guint64)kbps * 1000;
+    }
+    GString *common = g_string_new(NULL);
+    g_string_append_printf(common, "host=%s auto-multicast=true ttl-mc=%d loop=%s sync=false",
+                           host, ttl ? atoi(ttl) : 1, g_strcmp0(loop, "0") == 0 ? "false" : "true");
+    if (iface) g_string_append_printf(common, " multicast-iface=\"%s\"", iface);
+
+    gchar *desc;
+    if (rtp && g_strcmp0(fec, "1") == 0) {
+        // The FEC streams are small; only the media stream is paced
+        desc = g_strdup_printf(
+            "rtpmp2tpay pt=33 ! rtpst2022-1-fecenc name=fec columns=%d rows=%d ! "
+            "udpsink name=outsink port=%d max-bitrate=%" G_GUINT64_FORMAT " %s "
+            "fec.fec_0 ! udpsink port=%d %s "
+            "fec.fec_1 ! udpsink port=%d %s",
+            fec_cols ? atoi(fec_cols) : 10, fec_rows ? atoi(fec_rows) : 10,
+            port, max_bitrate, common->str, port + 2, common->str, port + 4, common->str);
+    } else {
+        desc = g_strdup_printf("%sudpsink name=outsink port=%d max-bitrate=%" G_GUINT64_FORMAT " %s",
+                               rtp ? "rtpmp2tpay pt=33 ! " : "", port, max_bitrate, common->str);
+    }
+    g_string_free(common, TRUE);
+    if (params) g_hash_table_unref(params);
+    g_uri_unref(guri);
+    return desc;
+}
+
+static gchar* build_output_sink_desc(const AppConfig *cfg, const gchar *uri, gint stream_kbps, GError **error) {
+    if (g_strcmp0(uri, "stdout") == 0 || g_strcmp0(uri, "-") == 0) {
+        if (cfg->stdout_batch_kb == 0) return g_strdup("fdsink name=outsink fd=1 sync=false");
+        return g_strdup("appsink name=outsink sync=false async=false buffer-list=true");
+    } else if (g_str_has_prefix(uri, "srt://")) {
+        return g_strdup_printf("srtsink name=outsink uri=\"%s\" wait-for-connection=false sync=false", uri);
+    } else if (g_str_has_prefix(uri, "udp://") || g_str_has_prefix(uri, "rtp://")) {
+        return build_udp_sink_desc(uri, stream_kbps, error);
+    } else if (g_str_has_prefix(uri, "srtgroup://")) {
+#ifdef NDI2SRT_SRT_GROUP
+        return g_strdup("appsink name=outsink sync=false async=false max-buffers=64 drop=true");
+#else
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "srtgroup:// needs a build with libsrt");
+        return NULL;
+#endif
+    } else {
+        const gchar *path = g_str_has_prefix(uri, "file://") ? uri + strlen("file://") : uri;
+        return g_strdup_printf("filesink name=outsink location=\"%s\" sync=false", path);
+    }
+}
+
+static Branch* stream_find_branch(Stream *st, BranchKind kind, const gchar *name) {
+    for (GList *l = st->branches; l != NULL; l = l->next) {
+        Branch *br = (Branch*)l->data;
+        if (br->kind == kind && (name == NULL || g_strcmp0(br->name, name) == 0)) return br;
+    }
+    return NULL;
+}
+
+static void branch_free(Branch *br) {
+    for (guint i = 0; i < br->n_links; ++i) {
+        gst_object_unref(br->links[i].fanout_pad);
+        gst_object_unref(br->links[i].bin_pad);
+    }
+    if (br->sink) gst_object_unref(br->sink);
+    sei_config_free(br->sei_cfg);
+#ifdef NDI2SRT_SRT_GROUP
+    srt_group_free(br->srt_group);
+#endif
+    stdout_output_free(br->stdout_out);
+    g_free(br->name);
+    g_free(br);
+}
+
+static gboolean branch_add_link(Branch *br, GstElement *fanout, const gchar *bin_pad_name, GError **error) {
+    GstPad *bin_pad = gst_element_get_static_pad(br->bin, bin_pad_name);
+    // Source branches feed a selector sink pad, sink branches take a tee src pad
+    gboolean is_source = bin_pad && GST_PAD_IS_SRC(bin_pad);
+    GstPad *fanout_pad = bin_pad ? gst_element_request_pad_simple(fanout, is_source ? "sink_%u" : "src_%u") : NULL;
+    GstPadLinkReturn r = GST_PAD_LINK_REFUSED;
+    if (bin_pad && fanout_pad) {
+        r = is_source ? gst_pad_link(bin_pad, fanout_pad) : gst_pad_link(fanout_pad, bin_pad);
+    }
+    if (r != GST_PAD_LINK_OK) {
+        g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION, "failed to link %s '%s' (%s)",
+                    branch_kind_names[br->kind], br->name, gst_pad_link_get_name(r));
+        if (fanout_pad) {
+            gst_element_release_request_pad(fanout, fanout_pad);
+            gst_object_unref(fanout_pad);
+        }
+        if (bin_pad) gst_object_unref(bin_pad);
+        return FALSE;
+    }
+    BranchLink *link = &br->links[br->n_links++];
+    link->fanout = fanout;
+    link->fanout_pad = fanout_pad;
+    link->bin_pad = bin_pad;
+    return TRUE;
+}
+
+// Add a fully built bin to the running pipeline. Sink branches are brought
+// up before they are linked, so the tee never pushes into a non-running
+// branch; the tee replays sticky events (caps, segment) on the new pad.
+static Branch* stream_attach_branch(Stream *st, BranchKind kind, const gchar *name, GstElement *bin, GError **error) {
+    Branch *br = g_new0(Branch, 1);
+    br->stream = st;
+    br->kind = kind;
+    br->name = g_strdup(name);
+    br->bin = bin;
+    br->sink = gst_bin_get_by_name(GST_BIN(bin), "outsink");
+    gst_bin_add(GST_BIN(st->app->pipeline), bin);
+
+    gboolean ok = TRUE;
+    if (kind == BRANCH_BACKUP_SOURCE) {
+        ok = branch_add_link(br, st->graph.vselect, "video", error) &&
+             (branch_add_link(br, st->graph.aselect, "audio", error));
+        if (ok) gst_element_sync_state_with_parent(bin);
+    } else {
+        gst_element_sync_state_with_parent(bin);
+        if (kind == BRANCH_RENDITION) {
+            ok = branch_add_link(br, st->graph.raw_tee, "video_sink", error) &&
+                 (!st->graph.audio_tee || branch_add_link(br, st->graph.audio_tee, "audio_sink", error));
+        } else {
+            ok = branch_add_link(br, st->graph.out_tee, "sink", error);
+        }
+    }
+    if (!ok) {
+        for (guint i = 0; i < br->n_links; ++i) {
+            BranchLink *link = &br->links[i];
+            if (GST_PAD_IS_SRC(link->bin_pad)) gst_pad_unlink(link->bin_pad, link->fanout_pad);
+            else gst_pad_unlink(link->fanout_pad, link->bin_pad);
+            gst_element_release_request_pad(link->fanout, link->fanout_pad);
+        }
+        gst_element_set_state(bin, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(st->app->pipeline), bin);
+        branch_free(br);
+        return NULL;
+    }
+    if (st->trace && br->sink) branch_install_trace(st, br->sink);
+    br->attached_us = g_get_monotonic_time();
+    st->branches = g_list_append(st->branches, br);
+    g_printerr("Attached %s: %s\n", branch_kind_names[kind], name);
+    return br;
+}
+
+// Detach (main thread side): tear the bin down once every link has been
+// unlinked and the branch drained its EOS, or after a 2s drain timeout.
+static gboolean branch_finish_detach_cb(gpointer user_data) {
+    Branch *br = (Branch*)user_data;
+    gboolean drained = g_atomic_int_get(&br->eos_drained);
+    gboolean timed_out = g_get_monotonic_time() - br->detach_started_us > 2 * G_USEC_PER_SEC;
+    if (g_atomic_int_get(&br->pending_unlinks) > 0 && !timed_out) return G_SOURCE_CONTINUE;
+    if (!drained && !timed_out) return G_SOURCE_CONTINUE;
+    Stream *st = br->stream;
+    gst_element_set_state(br->bin, GST_STATE_NULL);
+    for (guint i = 0; i < br->n_links; ++i) {
+        BranchLink *link = &br->links[i];
+        if (gst_pad_is_linked(link->fanout_pad)) {
+            if (GST_PAD_IS_SRC(link->bin_pad)) gst_pad_unlink(link->bin_pad, link->fanout_pad);
+            else gst_pad_unlink(link->fanout_pad, link->bin_pad);
+        }
+        gst_element_release_request_pad(link->fanout, link->fanout_pad);
+    }
+    gst_bin_remove(GST_BIN(st->app->pipeline), br->bin);
+    g_printerr("Detached %s: %s (%s, %.1f ms)\n", branch_kind_names[br->kind], br->name,
+               drained ? "drained" : "drain timeout",
+               (g_get_monotonic_time() - br->detach_started_us) / 1000.0);
+    branch_free(br);
+    return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn branch_eos_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Branch *br = (Branch*)user_data;
+    GstEvent *ev = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(ev) != GST_EVENT_EOS) return GST_PAD_PROBE_OK;
+    g_atomic_int_set(&br->eos_drained, TRUE);
+    // Keep the EOS away from the sink so the pipeline does not count it
+    return GST_PAD_PROBE_DROP;
+}
+
+// Runs in the tee's streaming thread with the tee pad blocked: unlink the
+// branch and push EOS into it so queued data drains through its own sink.
+// The tee carries on as soon as we return, the main path never waits.
+static GstPadProbeReturn branch_unlink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Branch *br = (Branch*)user_data;
+    for (guint i = 0; i < br->n_links; ++i) {
+        BranchLink *link = &br->links[i];
+        if (link->fanout_pad != pad) continue;
+        gst_pad_unlink(link->fanout_pad, link->bin_pad);
+        gst_pad_send_event(link->bin_pad, gst_event_new_eos());
+    }
+    g_atomic_int_add(&br->pending_unlinks, -1);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void stream_detach_branch(Stream *st, Branch *br) {
+    st->branches = g_list_remove(st->branches, br);
+    br->detach_started_us = g_get_monotonic_time();
+    if (br->kind == BRANCH_BACKUP_SOURCE) {
+        // Never leave the selectors pointing at a source that is going away
+        for (guint i = 0; i < br->n_links; ++i) {
+            BranchLink *link = &br->links[i];
+            GstPad *active = NULL;
+            g_object_get(link->fanout, "active-pad", &active, NULL);
+            if (active == link->fanout_pad) {
+                g_object_set(link->fanout, "active-pad",
+                             link->fanout == st->graph.vselect ? st->graph.primary_vpad : st->graph.primary_apad, NULL);
+            }
+            if (active) gst_object_unref(active);
+        }
+        // A source has nothing to drain, stop it in place
+        g_atomic_int_set(&br->eos_drained, TRUE);
+        g_timeout_add(10, branch_finish_detach_cb, br);
+        return;
+    }
+    if (br->sink) {
+        GstPad *sinkpad = gst_element_get_static_pad(br->sink, "sink");
+        gst_pad_add_probe(sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, branch_eos_probe, br, NULL);
+        gst_object_unref(sinkpad);
+    } else {
+        g_atomic_int_set(&br->eos_drained, TRUE);
+    }
+    g_atomic_int_set(&br->pending_unlinks, (gint)br->n_links);
+    // The idle probe fires at once if the tee pad is idle, otherwise right
+    // after the buffer currently being pushed, blocking the pad meanwhile
+    for (guint i = 0; i < br->n_links; ++i) {
+        gst_pad_add_probe(br->links[i].fanout_pad, GST_PAD_PROBE_TYPE_IDLE, branch_unlink_probe, br, NULL);
+    }
+    g_timeout_add(10, branch_finish_detach_cb, br);
+}
+
+// srtgroup:// branches end in an appsink; connect the group before the
+// branch goes live so its first buffers already have somewhere to go
+static gboolean output_bind_srt_group(Stream *st, const gchar *uri, GstElement *bin,
+                                      struct SrtGroupOutput **group, GError **error) {
+    *group = NULL;
+#ifdef NDI2SRT_SRT_GROUP
+    if (g_str_has_prefix(uri, "srtgroup://")) {
+        *group = srt_group_new(uri, st->app->cfg->verbose, error);
+        if (!*group) return FALSE;
+        (*group)->trace = st->trace;
+        (*group)->trace_last_pts = GST_CLOCK_TIME_NONE;
+        srt_group_attach(*group, bin);
+    }
+#endif
+    return TRUE;
+}
+
+// Batched stdout outputs end in an appsink too; start the writer first
+static gboolean output_bind_stdout(Stream *st, const gchar *uri, GstElement *bin,
+                                   struct StdoutOutput **out, GError **error) {
+    *out = NULL;
+    if ((g_strcmp0(uri, "stdout") == 0 || g_strcmp0(uri, "-") == 0) && st->app->cfg->stdout_batch_kb > 0) {
+        *out = stdout_output_new(bin, st->app->cfg, st->trace, error);
+        if (!*out) return FALSE;
+    }
+    return TRUE;
+}
+
+static Branch* stream_attach_output(Stream *st, const gchar *uri, gboolean recording, GError **error) {
+    BranchKind kind = recording ? BRANCH_RECORDING : BRANCH_OUTPUT;
+    if (stream_find_branch(st, BRANCH_OUTPUT, uri) || stream_find_branch(st, BRANCH_RECORDING, uri)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "output '%s' already attached", uri);
+        return NULL;
+    }
+    gchar *sink_desc = build_output_sink_desc(st->app->cfg, uri, st->app->cfg->bitrate_kbps + st->app->cfg->audio_bitrate_kbps, error);
+    if (!sink_desc) return NULL;
+    gchar *desc = g_strdup_printf("queue leaky=2 max-size-time=2000000000 ! %s", sink_desc);
+    g_free(sink_desc);
+    GstElement *bin = gst_parse_bin_from_description(desc, TRUE, error);
+    g_free(desc);
+    if (!bin) return NULL;
+    struct SrtGroupOutput *group = NULL;
+    struct StdoutOutput *out = NULL;
+    if (!output_bind_srt_group(st, uri, bin, &group, error) || !output_bind_stdout(st, uri, bin, &out, error)) {
+        gst_object_unref(gst_object_ref_sink(bin));
+        return NULL;
+    }
+    Branch *br = stream_attach_branch(st, kind, uri, bin, error);
+    if (br) {
+        br->srt_group = group;
+        br->stdout_out = out;
+    } else {
+#ifdef NDI2SRT_SRT_GROUP
+        srt_group_free(group);
+#endif
+        stdout_output_free(out);
+    }
+    return br;
+}
+
+// Extra encode of the raw video (scaled) with its own mux and destination;
+// shares the already-encoded audio through the audio tee
+static Branch* stream_attach_rendition(Stream *st, const gchar *name, gint width, gint height,
+                                    gint bitrate_kbps, const gchar *uri, GError **error) {
+    if (stream_find_branch(st, BRANCH_RENDITION, name)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "rendition '%s' already attached", name);
+        return NULL;
+    }
+    gchar *sink_desc = build_output_sink_desc(st->app->cfg, uri, bitrate_kbps + st->app->cfg->audio_bitrate_kbps, error);
+    if (!sink_desc) return NULL;
+    const AppConfig *cfg = st->app->cfg;
+    gchar *gop_param = cfg->gop_size > 0 ? g_strdup_printf("key-int-max=%u ", cfg->gop_size) : g_strdup("");
+    gchar *scale_param = cfg->convert_threads > 0 ? g_strdup_printf(" n-threads=%u", cfg->convert_threads) : g_strdup("");
+    gchar *thread_param = cfg->encoder_threads > 0 ? g_strdup_printf("threads=%u ", cfg->encoder_threads) : g_strdup("");
+    gchar *desc = g_strdup_printf(
+        "queue name=vin leaky=2 max-size-buffers=2 ! videoscale%s ! video/x-raw,width=%d,height=%d ! "
+        "x264enc name=renc tune=zerolatency speed-preset=ultrafast %s%sbitrate=%d aud=false byte-stream=%s insert-vui=false interlaced=false nal-hrd=none ! "
+        "%svideo/x-h264,stream-format=byte-stream,alignment=au ! mpegtsmux name=rmux alignment=7 ! "
+        "queue leaky=2 max-size-time=2000000000 ! %s "
+        "%s",
+        scale_param, width, height, gop_param, thread_param, bitrate_kbps, cfg->avc_internal ? "false" : "true",
+        cfg->no_h264parse ? "" : "h264parse disable-passthrough=true config-interval=1 ! ", sink_desc,
+        st->graph.audio_tee ? "queue name=ain ! rmux." : "");
+    g_free(gop_param);
+    g_free(scale_param);
+    g_free(thread_param);
+    g_free(sink_desc);
+    GstElement *bin = gst_parse_bin_from_description(desc, FALSE, error);
+    g_free(desc);
+    if (!bin) return NULL;
+    ghost_child_pad(bin, "vin", "sink", "video_sink");
+    if (st->graph.audio_tee) ghost_child_pad(bin, "ain", "sink", "audio_sink");
+
+    // Same timecode injection as the main encoder, with its own SPS cache
+    SeiConfig *scfg = g_new0(SeiConfig, 1);
+    if (st->sei_cfg) {
+        scfg->inject_sei = g_atomic_int_get(&st->sei_cfg->inject_sei);
+        scfg->fps_n = st->sei_cfg->fps_n;
+        scfg->fps_d = st->sei_cfg->fps_d;
+    }
+    scfg->prefer_pts = TRUE;
+    scfg->verbose = st->app->cfg->verbose;
+    scfg->repeat_parameter_sets = st->app->cfg->no_h264parse;
+    GstElement *renc = gst_bin_get_by_name(GST_BIN(bin), "renc");
+    GstPad *renc_src = gst_element_get_static_pad(renc, "src");
+    if (st->app->cfg->avc_internal) {
+        gst_pad_add_probe(renc_src, H264_AVC_PROBE_MASK, h264_avc_inject_probe, scfg, NULL);
+    } else {
+        if (scfg->repeat_parameter_sets) h264_install_bytestream_caps(renc);
+        gst_pad_add_probe(renc_src, GST_PAD_PROBE_TYPE_BUFFER, h264_sei_inject_probe, scfg, NULL);
+    }
+    gst_object_unref(renc_src);
+    gst_object_unref(renc);
+    struct SrtGroupOutput *group = NULL;
+    struct StdoutOutput *out = NULL;
+    if (!output_bind_srt_group(st, uri, bin, &group, error) || !output_bind_stdout(st, uri, bin, &out, error)) {
+        sei_config_free(scfg);
+        gst_object_unref(gst_object_ref_sink(bin));
+        return NULL;
+    }
+
+    Branch *br = stream_attach_branch(st, BRANCH_RENDITION, name, bin, error);
+    if (!br) {
+        sei_config_free(scfg);
+#ifdef NDI2SRT_SRT_GROUP
+        srt_group_free(group);
+#endif
+        stdout_output_free(out);
+        return NULL;
+    }
+    br->sei_cfg = scfg;
+    br->srt_group = group;
+    br->stdout_out = out;
+    return br;
+}
+
+static void backup_demux_pad_added_cb(GstElement *demux, GstPad *pad, gpointer user_data) {
+    GstElement *bin = GST_ELEMENT(user_data);
+    gchar *name = gst_pad_get_name(pad);
+    const gchar *queue_name = g_str_has_prefix(name, "video") ? "bvq" : g_str_has_prefix(name, "audio") ? "baq" : NULL;
+    GstElement *q = queue_name ? gst_bin_get_by_name(GST_BIN(bin), queue_name) : NULL;
+    if (q) {
+        GstPad *sinkpad = gst_element_get_static_pad(q, "sink");
+        if (!gst_pad_is_linked(sinkpad)) gst_pad_link(pad, sinkpad);
+        gst_object_unref(sinkpad);
+        gst_object_unref(q);
+    }
+    g_free(name);
+}
+
+// Standby NDI receiver feeding the input-selectors; select_source switches to it
+static Branch* stream_attach_backup_source(Stream *st, const gchar *ndi_name, GError **error) {
+    if (stream_find_branch(st, BRANCH_BACKUP_SOURCE, NULL)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "a backup source is already attached");
+        return NULL;
+    }
+    static const gchar *parts[][2] = {
+        { "ndisrc", "bsrc" }, { "ndisrcdemux", "bdemux" }, { "queue", "bvq" }, { "queue", "baq" }
+    };
+    GstElement *bin = gst_bin_new(NULL);
+    GstElement *elems[G_N_ELEMENTS(parts)];
+    for (guint i = 0; i < G_N_ELEMENTS(parts); ++i) {
+        elems[i] = make_element(parts[i][0], parts[i][1], error);
+        if (!elems[i]) {
+            gst_object_unref(bin);
+            return NULL;
+        }
+        gst_bin_add(GST_BIN(bin), elems[i]);
+    }
+    GstElement *src = elems[0], *demux = elems[1];
+    g_object_set(src, "ndi-name", ndi_name, NULL);
+    gst_util_set_object_arg(G_OBJECT(src), "timestamp-mode", st->app->cfg->timestamp_mode);
+    ndisrc_set_ingest_format(src, st->app->cfg);
+    if (st->app->cfg->raw_queue_bytes > 0) g_object_set(elems[2], "max-size-bytes", st->app->cfg->raw_queue_bytes, NULL);
+    gst_element_link(src, demux);
+    g_signal_connect(demux, "pad-added", G_CALLBACK(backup_demux_pad_added_cb), bin);
+    ghost_child_pad(bin, "bvq", "src", "video");
+    ghost_child_pad(bin, "baq", "src", "audio");
+    return stream_attach_branch(st, BRANCH_BACKUP_SOURCE, ndi_name, bin, error);
+}
+
+static gboolean stream_select_source(Stream *st, gboolean backup, GError **error) {
+    Branch *br = stream_find_branch(st, BRANCH_BACKUP_SOURCE, NULL);
+    if (backup && !br) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no backup source attached");
+        return FALSE;
+    }
+    glitch_begin(st, GLITCH_SOURCE_SWITCH, backup ? "select backup source" : "select primary source");
+    g_object_set(st->graph.vselect, "active-pad", backup ? br->links[0].fanout_pad : st->graph.primary_vpad, NULL);
+    g_object_set(st->graph.aselect, "active-pad", backup ? br->links[1].fanout_pad : st->graph.primary_apad, NULL);
+    return TRUE;
+}
+
+// Install the SEI injector on the stream's encoder src (Annex B byte-stream,
+// or the length-prefixed converter with --avc-internal).
+// Always installed so injection can be toggled at runtime; --no-sei only
+// sets the initial state.
+static void stream_install_sei(Stream *st) {
+    GstElement *enc_elem = st->graph.enc;
+    GstPad *enc_src = gst_element_get_static_pad(enc_elem, "src");
+    GstPad *enc_sink = gst_element_get_static_pad(enc_elem, "sink");
+    guint fps_n = 0, fps_d = 1;
+    if (enc_sink) {
+        GstPad *peer = gst_pad_get_peer(enc_sink);
+        GstCaps *pcaps = peer ? gst_pad_get_current_caps(peer) : NULL;
+        if (!pcaps && peer) pcaps = gst_pad_query_caps(peer, NULL);
+        if (pcaps) {
+            const GstStructure *s = gst_caps_get_structure(pcaps, 0);
+            if (s) {
+                const GValue *fr = gst_structure_get_value(s, "framerate");
+                if (fr && GST_VALUE_HOLDS_FRACTION(fr)) {
+                    fps_n = gst_value_get_fraction_numerator(fr);
+                    fps_d = gst_value_get_fraction_denominator(fr);
+                }
+            }
+            gst_caps_unref(pcaps);
+        }
+        if (peer) gst_object_unref(peer);
+        gst_object_unref(enc_sink);
+    }
+    if (enc_src) {
+        SeiConfig *sei_cfg = g_new0(SeiConfig, 1);
+        sei_cfg->inject_sei = st->app->cfg->inject_sei;
+        sei_cfg->prefer_pts = TRUE;
+        sei_cfg->fps_n = fps_n;
+        sei_cfg->fps_d = fps_d;
+        sei_cfg->verbose = st->app->cfg->verbose;
+        sei_cfg->repeat_parameter_sets = st->app->cfg->no_h264parse;
+        if (st->app->cfg->avc_internal) {
+            st->sei_probe_id = gst_pad_add_probe(enc_src, H264_AVC_PROBE_MASK, h264_avc_inject_probe, sei_cfg, NULL);
+        } else {
+            st->sei_probe_id = gst_pad_add_probe(enc_src, GST_PAD_PROBE_TYPE_BUFFER, h264_sei_inject_probe, sei_cfg, NULL);
+        }
+        sei_cfg->frame_stats = st->frame_stats;
+        st->sei_cfg = sei_cfg;
+        if (st->trace) stream_install_trace_sei_end(st);
+        gst_object_unref(enc_src);
+    }
+}
+
+// --- NDI metadata as a timed KLV PID (--ndi-metadata) ---
+//
+// The NDI source forwards metadata frames (tally, PTZ, production XML) as
+// custom downstream events. Each one is wrapped in a KLV triplet and muxed
+// on NDI_META_PID with the PTS of the next video frame. The XML is never
+// copied: the buffer holds a 16-byte key + BER length header and then
+// wraps the event's own string, keeping the event alive. The video path
+// only pays an atomic read per frame while no metadata is pending.
+
+// SMPTE UL prefix, experimental node (0x0F), then "NDIMETA"
+static const guint8 ndi_meta_klv_key[16] = {
+    0x06, 0x0E, 0x2B, 0x34, 0x01, 0x01, 0x01, 0x01, 0x0F, 'N', 'D', 'I', 'M', 'E', 'T', 'A'
+};
+
+static GstBuffer* ndi_meta_klv_buffer(const guint8 *header, gsize n, GstClockTime pts) {
+    GstBuffer *buf = gst_buffer_new_memdup(header, n);
+    GST_BUFFER_PTS(buf) = pts;
+    GST_BUFFER_DTS(buf) = pts;
+    return buf;
+}
+
+static const gchar* ndi_meta_event_xml(GstEvent *event) {
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CUSTOM_DOWNSTREAM) return NULL;
+    const GstStructure *s = gst_event_get_structure(event);
+    if (!s || !(gst_structure_has_name(s, "GstNdiMetadata") || gst_structure_has_name(s, "ndi-metadata"))) return NULL;
+    return gst_structure_get_string(s, "data");
+}
+
+static GstBuffer* ndi_meta_wrap_klv(GstEvent *event, GstClockTime pts) {
+    const gchar *xml = ndi_meta_event_xml(event);
+    gsize len = strlen(xml);
+    guint8 header[16 + 9];
+    gsize n = 16;
+    memcpy(header, ndi_meta_klv_key, 16);
+    if (len < 0x80) {
+        header[n++] = (guint8)len;
+    } else {
+        // BER long form
+        guint bytes = 0;
+        for (gsize v = len; v > 0; v >>= 8) bytes++;
+        header[n++] = 0x80 | bytes;
+        for (gint i = bytes - 1; i >= 0; --i) header[n++] = (guint8)(len >> (8 * i));
+    }
+    GstBuffer *buf = ndi_meta_klv_buffer(header, n, pts);
+    gst_buffer_append_memory(buf, gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, (gpointer)xml, len, 0, len,
+                                                         gst_event_ref(event), (GDestroyNotify)gst_event_unref));
+    return buf;
+}
+
+static GstPadProbeReturn ndi_meta_event_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Stream *st = (Stream*)user_data;
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (!ndi_meta_event_xml(event)) return GST_PAD_PROBE_OK;
+    NdiMetaTap *tap = &st->ndi_meta;
+    g_mutex_lock(&tap->lock);
+    g_ptr_array_add(tap->pending, gst_event_ref(event));
+    g_atomic_int_set(&tap->n_pending, tap->pending->len);
+    g_mutex_unlock(&tap->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn ndi_meta_video_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Stream *st = (Stream*)user_data;
+    NdiMetaTap *tap = &st->ndi_meta;
+    if (tap->primed && g_atomic_int_get(&tap->n_pending) == 0) return GST_PAD_PROBE_OK;
+    GstBuffer *frame = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!frame || !GST_BUFFER_PTS_IS_VALID(frame)) return GST_PAD_PROBE_OK;
+    if (!tap->primed) {
+        // The mux needs caps on the KLV pad before it writes the PMT; an
+        // empty-valued triplet gets them there while the frame is encoded
+        guint8 empty[17];
+        memcpy(empty, ndi_meta_klv_key, 16);
+        empty[16] = 0;
+        gst_app_src_push_buffer(GST_APP_SRC(st->graph.meta_src), ndi_meta_klv_buffer(empty, 17, GST_BUFFER_PTS(frame)));
+        tap->primed = TRUE;
+    }
+    g_mutex_lock(&tap->lock);
+    GPtrArray *events = tap->pending;
+    tap->pending = g_ptr_array_new_with_free_func((GDestroyNotify)gst_event_unref);
+    g_atomic_int_set(&tap->n_pending, 0);
+    g_mutex_unlock(&tap->lock);
+    for (guint i = 0; i < events->len; ++i) {
+        GstBuffer *buf = ndi_meta_wrap_klv((GstEvent*)g_ptr_array_index(events, i), GST_BUFFER_PTS(frame));
+        if (gst_app_src_push_buffer(GST_APP_SRC(st->graph.meta_src), buf) == GST_FLOW_OK) tap->frames++;
+    }
+    g_ptr_array_unref(events);
+    return GST_PAD_PROBE_OK;
+}
+
+// Events are taken before the demuxer and timed after the source selector,
+// where the primary source's frames pass in order on the same thread
+static void stream_install_ndi_meta(Stream *st) {
+    NdiMetaTap *tap = &st->ndi_meta;
+    g_mutex_init(&tap->lock);
+    tap->pending = g_ptr_array_new_with_free_func((GDestroyNotify)gst_event_unref);
+    GstPad *src = gst_element_get_static_pad(st->graph.ndisrc, "src");
+    gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, ndi_meta_event_probe, st, NULL);
+    gst_object_unref(src);
+    GstPad *vin = gst_element_get_static_pad(st->graph.vqueue, "sink");
+    gst_pad_add_probe(vin, GST_PAD_PROBE_TYPE_BUFFER, ndi_meta_video_probe, st, NULL);
+    gst_object_unref(vin);
+}
+
+// --- LTC timecode from an audio channel (--ltc-channel) ---
+//
+// SMPTE 12M LTC is biphase-mark coded: a transition at every bit boundary
+// plus one mid-bit for a 1. The selected channel is copied into a float
+// scratch buffer, zero crossings are located with branch-free loops the
+// compiler vectorizes, and only the crossings (a few per bit) go through
+// the scalar bit decoder. Crossing times are interpolated between samples,
+// so the start of each 80-bit frame is known to a fraction of a sample.
+// Fixed cost per sample, no allocation after the first buffer.
+//
+// A frame decodes only once it has ended, i.e. after the video frame it
+// labels has already passed. Video frames are therefore stamped from the
+// most recent decode: timecode + round((video PTS - LTC frame start) * fps).
+// The fractional part of that product is the sub-frame phase between the
+// LTC and the video, reported in stats.
+
+#define LTC_SYNC_WORD 0xBFFCu               // bits 64..79, bit 64 in the LSB
+#define LTC_STALE_NS (2 * GST_SECOND)      // stop stamping when LTC went missing
+// Bit period bounds: 30 fps - 10% .. 24 fps + 10%. Noise or a long gap can
+// never walk the estimate somewhere no LTC rate is.
+#define LTC_BIT_NS_MIN (1e9 / (30.0 * 80.0) * 0.9)
+#define LTC_BIT_NS_MAX (1e9 / (24.0 * 80.0) * 1.1)
+#define LTC_BIT_NS_NOMINAL (1e9 / (25.0 * 80.0))
+
+typedef struct LtcDecoder {
+    // audio thread only
+    gint channel;           // 0-based
+    gint channels;
+    gint rate;
+    gboolean planar;
+    gint sample_format;     // 0 = F32LE, 1 = S16LE, 2 = S32LE
+    gfloat *scratch;
+    gsize scratch_len;
+    gfloat prev_sample;
+    gdouble prev_time;      // ns of prev_sample
+    gdouble last_edge;      // ns of the last accepted transition
+    gdouble bit_ns;         // running estimate of one bit period
+    gboolean half_pending;  // first half of a 1 seen
+    gdouble half_start;     // ns of the edge that started that 1
+    gdouble bit_start[80];  // start time of the last 80 bits, ring
+    guint bit_index;
+    guint64 reg_lo, reg_hi; // last 80 bits, oldest in bit 0 of reg_lo
+    // shared with the video probe
+    GMutex lock;
+    gboolean have_tc;
+    GstVideoTimeCode tc;    // last decoded frame
+    gdouble tc_start_ns;    // its first bit edge (PTS domain)
+    guint64 decoded;
+    guint64 stamped;
+    gdouble phase_frames;   // last sub-frame phase, -0.5..0.5
+} LtcDecoder;
+
+static guint ltc_bits(const LtcDecoder *d, guint first, guint count) {
+    guint v = 0;
+    for (guint i = 0; i < count; ++i) {
+        guint bit = first + i;
+        guint64 word = bit < 64 ? d->reg_lo : d->reg_hi;
+        v |= (guint)((word >> (bit & 63)) & 1u) << i;
+    }
+    return v;
+}
+
+static void ltc_frame_complete(LtcDecoder *d, gdouble end_ns) {
+    guint frames = ltc_bits(d, 0, 4) + 10 * ltc_bits(d, 8, 2);
+    gboolean drop = ltc_bits(d, 10, 1);
+    guint seconds = ltc_bits(d, 16, 4) + 10 * ltc_bits(d, 24, 3);
+    guint minutes = ltc_bits(d, 32, 4) + 10 * ltc_bits(d, 40, 3);
+    guint hours = ltc_bits(d, 48, 4) + 10 * ltc_bits(d, 56, 2);
+    if (frames > 29 || seconds > 59 || minutes > 59 || hours > 23) return;
+    gdouble start_ns = d->bit_start[d->bit_index % 80]; // oldest of the last 80 bits = bit 0
+    gdouble fps = 1e9 / (end_ns - start_ns);
+    // Nominal rates only; drop frame implies 30000/1001
+    guint fps_n = drop ? 30000 : (fps < 24.5 ? 24 : (fps < 27.5 ? 25 : 30));
+    guint fps_d = drop ? 1001 : 1;
+    g_mutex_lock(&d->lock);
+    gst_video_time_code_clear(&d->tc);
+    gst_video_time_code_init(&d->tc, fps_n, fps_d, NULL,
+                             drop ? GST_VIDEO_TIME_CODE_FLAGS_DROP_FRAME : GST_VIDEO_TIME_CODE_FLAGS_NONE,
+                             hours, minutes, seconds, frames, 0);
+    d->tc_start_ns = start_ns;
+    d->have_tc = gst_video_time_code_is_valid(&d->tc);
+    d->decoded++;
+    g_mutex_unlock(&d->lock);
+}
+
+static void ltc_push_bit(LtcDecoder *d, guint bit, gdouble start_ns, gdouble end_ns) {
+    d->bit_start[d->bit_index++ % 80] = start_ns;
+    d->reg_lo = (d->reg_lo >> 1) | ((d->reg_hi & 1u) << 63);
+    d->reg_hi = (d->reg_hi >> 1) | ((guint64)bit << 15);
+    if ((d->reg_hi & 0xFFFFu) == LTC_SYNC_WORD) ltc_frame_complete(d, end_ns);
+}
+
+// One transition at time t (ns)
+static void ltc_edge(LtcDecoder *d, gdouble t) {
+    gdouble dt = t - d->last_edge;
+    if (dt < d->bit_ns * 0.25) return;      // glitch, keep the earlier edge
+    if (dt > d->bit_ns * 1.6) {
+        // Signal gap or a slower rate: resynchronize on this edge. A gap
+        // longer than any bit says nothing about the rate, start over from
+        // nominal
+        d->bit_ns = dt > LTC_BIT_NS_MAX * 1.6 ? LTC_BIT_NS_NOMINAL
+                                              : CLAMP(MIN(dt, d->bit_ns * 1.3), LTC_BIT_NS_MIN, LTC_BIT_NS_MAX);
+        d->half_pending = FALSE;
+        d->last_edge = t;
+        return;
+    }
+    if (dt > d->bit_ns * 0.75) {
+        if (!d->half_pending) ltc_push_bit(d, 0, d->last_edge, t);
+        d->half_pending = FALSE;
+        d->bit_ns = CLAMP(d->bit_ns * 0.75 + dt * 0.25, LTC_BIT_NS_MIN, LTC_BIT_NS_MAX);
+    } else if (d->half_pending) {
+        ltc_push_bit(d, 1, d->half_start, t);
+        d->half_pending = FALSE;
+        d->bit_ns = CLAMP(d->bit_ns * 0.75 + 2.0 * dt * 0.25, LTC_BIT_NS_MIN, LTC_BIT_NS_MAX);
+    } else {
+        d->half_pending = TRUE;
+        d->half_start = d->last_edge;
+    }
+    d->last_edge = t;
+}
+
+// Copy the LTC channel out as floats
+static gsize ltc_extract(LtcDecoder *d, const guint8 *data, gsize size) {
+    gsize bps = d->sample_format == 1 ? 2 : 4;
+    gsize n = size / (bps * d->channels);
+    if (n > d->scratch_len) {
+        g_free(d->scratch);
+        d->scratch = g_new(gfloat, n);
+        d->scratch_len = n;
+    }
+    gfloat *out = d->scratch;
+    gsize stride = d->planar ? 1 : (gsize)d->channels;
+    gsize first = d->planar ? (gsize)d->channel * n : (gsize)d->channel;
+    if (d->sample_format == 0) {
+        const gfloat *in = (const gfloat*)data + first;
+        for (gsize i = 0; i < n; ++i) out[i] = in[i * stride];
+    } else if (d->sample_format == 1) {
+        const gint16 *in = (const gint16*)data + first;
+        for (gsize i = 0; i < n; ++i) out[i] = in[i * stride] * (1.0f / 32768.0f);
+    } else {
+        const gint32 *in = (const gint32*)data + first;
+        for (gsize i = 0; i < n; ++i) out[i] = in[i * stride] * (1.0f / 2147483648.0f);
+    }
+    return n;
+}
+
+static void ltc_decode_buffer(LtcDecoder *d, GstBuffer *buf) {
+    if (d->rate <= 0 || d->channel >= d->channels || !GST_BUFFER_PTS_IS_VALID(buf)) return;
+    GstMapInfo map;
+    if (!gst_buffer_map(buf, &map, GST_MAP_READ)) return;
+    gsize n = ltc_extract(d, map.data, map.size);
+    gst_buffer_unmap(buf, &map);
+    const gfloat *x = d->scratch;
+    gdouble t0 = (gdouble)GST_BUFFER_PTS(buf);
+    gdouble ns_per_sample = 1e9 / d->rate;
+    // Continue across buffers from the last sample of the previous one
+    // unless there is a gap (discont or more than a bit missing)
+    gdouble jump = t0 - (d->prev_time + ns_per_sample);
+    gboolean contiguous = jump < d->bit_ns * 0.5 && jump > -d->bit_ns * 0.5;
+    if (contiguous && n > 0 && (d->prev_sample >= 0.0f) != (x[0] >= 0.0f)) {
+        gdouble frac = d->prev_sample / (d->prev_sample - x[0]);
+        ltc_edge(d, d->prev_time + frac * ns_per_sample);
+    } else if (!contiguous) {
+        d->half_pending = FALSE;
+        d->last_edge = t0;
+    }
+    // Crossings are rare (about two per bit); scan in blocks, mark sign
+    // changes without branches, then visit only the marked samples
+    for (gsize base = 0; base + 1 < n; base += 256) {
+        gsize len = MIN((gsize)256, n - 1 - base);
+        guint8 change[256];
+        guint any = 0;
+        for (gsize i = 0; i < len; ++i) {
+            change[i] = (x[base + i] >= 0.0f) ^ (x[base + i + 1] >= 0.0f);
+            any |= change[i];
+        }
+        if (!any) continue;
+        for (gsize i = 0; i < len; ++i) {
+            if (!change[i]) continue;
+            gfloat a = x[base + i], b = x[base + i + 1];
+            gdouble frac = a / (a - b);
+            ltc_edge(d, t0 + ((gdouble)(base + i) + frac) * ns_per_sample);
+        }
+    }
+    if (n > 0) {
+        d->prev_sample = x[n - 1];
+        d->prev_time = t0 + (n - 1) * ns_per_sample;
+    }
+}
+
+static void ltc_set_caps(LtcDecoder *d, GstCaps *caps) {
+    const GstStructure *s = gst_caps_get_structure(caps, 0);
+    const gchar *format = gst_structure_get_string(s, "format");
+    const gchar *layout = gst_structure_get_string(s, "layout");
+    d->rate = 0;
+    if (!gst_structure_get_int(s, "rate", &d->rate) || !gst_structure_get_int(s, "channels", &d->channels)) return;
+    if (g_strcmp0(format, "F32LE") == 0) d->sample_format = 0;
+    else if (g_strcmp0(format, "S16LE") == 0) d->sample_format = 1;
+    else if (g_strcmp0(format, "S32LE") == 0) d->sample_format = 2;
+    else {
+        g_printerr("LTC: unsupported audio format %s\n", format ? format : "(none)");
+        d->rate = 0;
+        return;
+    }
+    d->planar = g_strcmp0(layout, "non-interleaved") == 0;
+    if (d->channel >= d->channels) {
+        g_printerr("LTC: channel %d requested, source has %d\n", d->channel + 1, d->channels);
+    }
+    // Start from 25 fps; the estimate follows the signal within a few bits
+    d->bit_ns = LTC_BIT_NS_NOMINAL;
+}
+
+static GstPadProbeReturn ltc_audio_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    LtcDecoder *d = (LtcDecoder*)user_data;
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps;
+            gst_event_parse_caps(event, &caps);
+            ltc_set_caps(d, caps);
+        }
+    } else if (GST_PAD_PROBE_INFO_BUFFER(info)) {
+        ltc_decode_buffer(d, GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Replace the frame's timecode with the one LTC gives for its PTS
+static GstPadProbeReturn ltc_video_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    LtcDecoder *d = (LtcDecoder*)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf || !GST_BUFFER_PTS_IS_VALID(buf)) return GST_PAD_PROBE_OK;
+    g_mutex_lock(&d->lock);
+    gdouble since = (gdouble)GST_BUFFER_PTS(buf) - d->tc_start_ns;
+    if (!d->have_tc || since < -(gdouble)LTC_STALE_NS || since > (gdouble)LTC_STALE_NS) {
+        g_mutex_unlock(&d->lock);
+        return GST_PAD_PROBE_OK;
+    }
+    gdouble frames = since * d->tc.config.fps_n / (d->tc.config.fps_d * 1e9);
+    gint64 whole = (gint64)(frames >= 0 ? frames + 0.5 : frames - 0.5);
+    d->phase_frames = frames - whole;
+    GstVideoTimeCode *tc = gst_video_time_code_copy(&d->tc);
+    d->stamped++;
+    g_mutex_unlock(&d->lock);
+    gst_video_time_code_add_frames(tc, whole);
+
+    buf = gst_buffer_make_writable(buf);
+    GST_PAD_PROBE_INFO_DATA(info) = buf;
+    GstVideoTimeCodeMeta *old = gst_buffer_get_video_time_code_meta(buf);
+    if (old) gst_buffer_remove_meta(buf, (GstMeta*)old);
+    gst_buffer_add_video_time_code_meta(buf, tc);
+    gst_video_time_code_free(tc);
+    return GST_PAD_PROBE_OK;
+}
+
+// Audio is tapped after the source selector; video before videoconvert, so
+// the timecode meta rides through the encoder to the SEI injector (and the
+// --tc-sync aligner keys on it)
+static void stream_install_ltc(Stream *st, gint channel) {
+    LtcDecoder *d = g_new0(LtcDecoder, 1);
+    d->channel = channel;
+    d->bit_ns = LTC_BIT_NS_NOMINAL;
+    g_mutex_init(&d->lock);
+    GstPad *ain = gst_element_get_static_pad(st->graph.aqueue, "sink");
+    gst_pad_add_probe(ain, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, ltc_audio_probe, d, NULL);
+    gst_object_unref(ain);
+    GstPad *vin = gst_element_get_static_pad(st->graph.vconvert, "sink");
+    gst_pad_add_probe(vin, GST_PAD_PROBE_TYPE_BUFFER, ltc_video_probe, d, NULL);
+    gst_object_unref(vin);
+    st->ltc = d;
+}
+
+static void ltc_decoder_free(LtcDecoder *d) {
+    if (!d) return;
+    gst_video_time_code_clear(&d->tc);
+    g_mutex_clear(&d->lock);
+    g_free(d->scratch);
+    g_free(d);
+}
+
+// --- Sampled objective quality probe (--quality-probe N) ---
+//
+// One frame in N is measured against what the encoder made of it. The
+// encoder's input frame is kept by reference (no copy). So are the encoded
+// access units since the last IDR, because a P frame decodes only with its
+// references. When the sampled frame's AU leaves the encoder, that IDR..AU
+// run goes to a low-priority worker. The worker decodes it with avdec_h264
+// and compares the last picture with the kept input (PSNR per plane, SSIM
+// on luma; kernels in vqmetrics.c). A sample is dropped, never waited for,
+// while the worker is still busy with the previous one.
+
+#define QUALITY_WINDOW 32           // samples in the rolling averages
+#define QUALITY_MAX_GOP 300         // AUs kept since the last IDR before giving up on the GOP
+
+typedef struct QualityJob {
+    GstBuffer *raw;
+    GstVideoInfo raw_info;
+    GPtrArray *aus;                 // GstBuffer*, IDR first, sampled AU last
+    GstCaps *caps;                  // encoded caps
+} QualityJob;
+
+typedef struct QualityProbe {
+    guint interval;
+    gboolean verbose;
+    guint decoder_threads;          // avdec_h264 max-threads, 0 = libav's choice
+    // encoder threads
+    guint64 frames;
+    GstBuffer *pending_raw;         // sampled input waiting for its AU
+    GstVideoInfo pending_info;
+    GPtrArray *gop;                 // AUs since the last IDR (NULL until one is seen)
+    GMutex pending_lock;            // pending_raw: encoder sink vs. src thread
+    // worker
+    gint busy;                      // atomic: a job is queued or running
+    GAsyncQueue *jobs;
+    GThread *thread;
+    GstElement *decoder;
+    GstClockTime dec_ts;            // synthetic timestamps for the decoder
+    // results
+    GMutex lock;
+    guint64 sampled, dropped, measured, failed;
+    gdouble last_psnr_y, last_psnr, last_ssim;
+    gdouble psnr_y[QUALITY_WINDOW], ssim[QUALITY_WINDOW];
+    guint window_len, window_pos;
+} QualityProbe;
+
+static QualityJob quality_stop_job;  // sentinel
+
+static void quality_job_free(QualityJob *job) {
+    gst_buffer_unref(job->raw);
+    g_ptr_array_unref(job->aus);
+    gst_caps_unref(job->caps);
+    g_free(job);
+}
+
+// Decode job->aus and return the last picture (NULL on failure)
+static GstSample* quality_decode(QualityProbe *q, QualityJob *job) {
+    if (!q->decoder) {
+        GError *err = NULL;
+        gchar *desc = g_strdup_printf("appsrc name=src format=time ! avdec_h264 thread-type=slice max-threads=%u ! "
+                                      "video/x-raw,format=I420 ! appsink name=sink sync=false", q->decoder_threads);
+        q->decoder = gst_parse_launch(desc, &err);
+        g_free(desc);
+        if (!q->decoder) {
+            g_printerr("Quality probe: cannot build decoder: %s\n", err ? err->message : "unknown error");
+            g_clear_error(&err);
+            return NULL;
+        }
+    }
+    GstElement *src = gst_bin_get_by_name(GST_BIN(q->decoder), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(q->decoder), "sink");
+    g_object_set(src, "caps", job->caps, NULL);
+    gst_element_set_state(q->decoder, GST_STATE_PLAYING);
+    for (guint i = 0; i < job->aus->len; ++i) {
+        // Shallow copy: same memory, our own timestamps
+        GstBuffer *au = gst_buffer_copy((GstBuffer*)g_ptr_array_index(job->aus, i));
+        GST_BUFFER_PTS(au) = GST_BUFFER_DTS(au) = q->dec_ts;
+        q->dec_ts += GST_MSECOND;
+        gst_app_src_push_buffer(GST_APP_SRC(src), au);
+    }
+    // EOS drains the decoder, so the sampled picture comes out whatever its delay
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+    GstSample *last = NULL, *sample;
+    while ((sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink), 2 * GST_SECOND))) {
+        if (last) gst_sample_unref(last);
+        last = sample;
+    }
+    gst_element_set_state(q->decoder, GST_STATE_READY);
+    gst_object_unref(src);
+    gst_object_unref(sink);
+    return last;
+}
+
+static void quality_measure(QualityProbe *q, QualityJob *job) {
+    GstSample *sample = quality_decode(q, job);
+    GstVideoInfo dec_info;
+    GstVideoFrame ref, dec;
+    gboolean ref_mapped = FALSE;
+    // Every sample that ends up unmeasured counts as failed, so measured +
+    // failed is what was sampled
+    gboolean usable = sample && gst_video_info_from_caps(&dec_info, gst_sample_get_caps(sample)) &&
+        dec_info.width == job->raw_info.width && dec_info.height == job->raw_info.height &&
+        GST_VIDEO_INFO_FORMAT(&job->raw_info) == GST_VIDEO_FORMAT_I420 &&
+        (ref_mapped = gst_video_frame_map(&ref, &job->raw_info, job->raw, GST_MAP_READ)) &&
+        gst_video_frame_map(&dec, &dec_info, gst_sample_get_buffer(sample), GST_MAP_READ);
+    if (!usable) {
+        if (ref_mapped) gst_video_frame_unmap(&ref);
+        g_mutex_lock(&q->lock);
+        q->failed++;
+        g_mutex_unlock(&q->lock);
+        if (sample) gst_sample_unref(sample);
+        return;
+    }
+    guint64 sse_y = 0, sse = 0, samples = 0;
+    for (guint p = 0; p < 3; ++p) {
+        gint w = GST_VIDEO_FRAME_COMP_WIDTH(&ref, p), h = GST_VIDEO_FRAME_COMP_HEIGHT(&ref, p);
+        guint64 plane = vq_plane_sse(GST_VIDEO_FRAME_PLANE_DATA(&ref, p), GST_VIDEO_FRAME_PLANE_STRIDE(&ref, p),
+                                     GST_VIDEO_FRAME_PLANE_DATA(&dec, p), GST_VIDEO_FRAME_PLANE_STRIDE(&dec, p), w, h);
+        if (p == 0) sse_y = plane;
+        sse += plane;
+        samples += (guint64)w * h;
+    }
+    gint w = GST_VIDEO_FRAME_WIDTH(&ref), h = GST_VIDEO_FRAME_HEIGHT(&ref);
+    gdouble ssim = vq_plane_ssim(GST_VIDEO_FRAME_PLANE_DATA(&ref, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&ref, 0),
+                                 GST_VIDEO_FRAME_PLANE_DATA(&dec, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&dec, 0), w, h);
+    gst_video_frame_unmap(&dec);
+    gst_video_frame_unmap(&ref);
+    gst_sample_unref(sample);
+
+    g_mutex_lock(&q->lock);
+    q->measured++;
+    q->last_psnr_y = vq_psnr(sse_y, (guint64)w * h);
+    q->last_psnr = vq_psnr(sse, samples);
+    q->last_ssim = ssim;
+    q->psnr_y[q->window_pos] = q->last_psnr_y;
+    q->ssim[q->window_pos] = ssim;
+    q->window_pos = (q->window_pos + 1) % QUALITY_WINDOW;
+    if (q->window_len < QUALITY_WINDOW) q->window_len++;
+    g_mutex_unlock(&q->lock);
+    if (q->verbose) {
+        g_printerr("Quality: PSNR Y %.2f dB, YUV %.2f dB, SSIM Y %.4f (%u AUs decoded)\n",
+                   q->last_psnr_y, q->last_psnr, ssim, job->aus->len);
+    }
+}
+
+static gpointer quality_thread(gpointer user_data) {
+    QualityProbe *q = (QualityProbe*)user_data;
+#ifdef __linux__
+    // Per-thread on Linux: yield to the encoders whenever they need the CPU
+    setpriority(PRIO_PROCESS, 0, 15);
+#endif
+    for (;;) {
+        QualityJob *job = (QualityJob*)g_async_queue_pop(q->jobs);
+        if (job == &quality_stop_job) break;
+        quality_measure(q, job);
+        quality_job_free(job);
+        g_atomic_int_set(&q->busy, 0);
+    }
+    return NULL;
+}
+
+// Encoder input: pick every interval-th frame while the worker is idle
+static GstPadProbeReturn quality_raw_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    QualityProbe *q = (QualityProbe*)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf || q->frames++ % q->interval != 0 || !GST_BUFFER_PTS_IS_VALID(buf)) return GST_PAD_PROBE_OK;
+    g_mutex_lock(&q->lock);
+    q->sampled++;
+    g_mutex_unlock(&q->lock);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstVideoInfo vinfo;
+    gboolean ok = caps && gst_video_info_from_caps(&vinfo, caps);
+    if (caps) gst_caps_unref(caps);
+    g_mutex_lock(&q->pending_lock);
+    if (!ok || g_atomic_int_get(&q->busy) || q->pending_raw) {
+        ok = FALSE;
+    } else {
+        q->pending_raw = gst_buffer_ref(buf);
+        q->pending_info = vinfo;
+    }
+    g_mutex_unlock(&q->pending_lock);
+    if (!ok) {
+        g_mutex_lock(&q->lock);
+        q->dropped++;
+        g_mutex_unlock(&q->lock);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Encoder output: keep the GOP so far; hand it over when the sampled AU shows up
+static GstPadProbeReturn quality_au_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    QualityProbe *q = (QualityProbe*)user_data;
+    GstBuffer *au = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!au) return GST_PAD_PROBE_OK;
+    if (!GST_BUFFER_FLAG_IS_SET(au, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        if (q->gop) g_ptr_array_set_size(q->gop, 0);
+        else q->gop = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+    }
+    if (q->gop) {
+        g_ptr_array_add(q->gop, gst_buffer_ref(au));
+        if (q->gop->len > QUALITY_MAX_GOP) g_clear_pointer(&q->gop, g_ptr_array_unref);
+    }
+
+    g_mutex_lock(&q->pending_lock);
+    GstBuffer *raw = q->pending_raw;
+    if (!raw || !GST_BUFFER_PTS_IS_VALID(au) || GST_BUFFER_PTS(au) < GST_BUFFER_PTS(raw)) {
+        g_mutex_unlock(&q->pending_lock);
+        return GST_PAD_PROBE_OK;
+    }
+    q->pending_raw = NULL;
+    GstVideoInfo raw_info = q->pending_info;
+    g_mutex_unlock(&q->pending_lock);
+
+    // A later PTS means the encoder dropped the sampled frame
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (GST_BUFFER_PTS(au) != GST_BUFFER_PTS(raw) || !q->gop || !caps) {
+        gst_buffer_unref(raw);
+        if (caps) gst_caps_unref(caps);
+        g_mutex_lock(&q->lock);
+        q->dropped++;
+        g_mutex_unlock(&q->lock);
+        return GST_PAD_PROBE_OK;
+    }
+    QualityJob *job = g_new0(QualityJob, 1);
+    job->raw = raw;
+    job->raw_info = raw_info;
+    job->caps = caps;
+    job->aus = g_ptr_array_new_full(q->gop->len, (GDestroyNotify)gst_buffer_unref);
+    for (guint i = 0; i < q->gop->len; ++i) g_ptr_array_add(job->aus, gst_buffer_ref(g_ptr_array_index(q->gop, i)));
+    g_atomic_int_set(&q->busy, 1);
+    g_async_queue_push(q->jobs, job);
+    return GST_PAD_PROBE_OK;
+}
+
+static void stream_install_quality_probe(Stream *st, guint interval) {
+    QualityProbe *q = g_new0(QualityProbe, 1);
+    q->interval = interval;
+    q->verbose = st->app->cfg->verbose;
+    q->decoder_threads = st->app->cfg->decoder_threads;
+    g_mutex_init(&q->lock);
+    g_mutex_init(&q->pending_lock);
+    q->jobs = g_async_queue_new();
+    q->thread = g_thread_new("quality-probe", quality_thread, q);
+    GstPad *in = gst_element_get_static_pad(st->graph.enc, "sink");
+    gst_pad_add_probe(in, GST_PAD_PROBE_TYPE_BUFFER, quality_raw_probe, q, NULL);
+    gst_object_unref(in);
+    GstPad *out = gst_element_get_static_pad(st->graph.enc, "src");
+    gst_pad_add_probe(out, GST_PAD_PROBE_TYPE_BUFFER, quality_au_probe, q, NULL);
+    gst_object_unref(out);
+    st->quality = q;
+}
+
+// Call with the pipeline in NULL
+static void quality_probe_free(QualityProbe *q) {
+    if (!q) return;
+    g_async_queue_push(q->jobs, &quality_stop_job);
+    g_thread_join(q->thread);
+    QualityJob *job;
+    while ((job = (QualityJob*)g_async_queue_try_pop(q->jobs))) quality_job_free(job);
+    g_async_queue_unref(q->jobs);
+    if (q->decoder) {
+        gst_element_set_state(q->decoder, GST_STATE_NULL);
+        gst_object_unref(q->decoder);
+    }
+    if (q->pending_raw) gst_buffer_unref(q->pending_raw);
+    if (q->gop) g_ptr_array_unref(q->gop);
+    g_mutex_clear(&q->pending_lock);
+    g_mutex_clear(&q->lock);
+    g_free(q);
+}
+
+static void quality_add_stats(JsonBuilder *b, QualityProbe *q) {
+    g_mutex_lock(&q->lock);
+    gdouble psnr_sum = 0.0, ssim_sum = 0.0, psnr_min = 0.0;
+    for (guint i = 0; i < q->window_len; ++i) {
+        psnr_sum += q->psnr_y[i];
+        ssim_sum += q->ssim[i];
+        if (i == 0 || q->psnr_y[i] < psnr_min) psnr_min = q->psnr_y[i];
+    }
+    json_builder_set_member_name(b, "quality");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "interval");
+    json_builder_add_int_value(b, q->interval);
+    json_builder_set_member_name(b, "sampled");
+    json_builder_add_int_value(b, (gint64)q->sampled);
+    json_builder_set_member_name(b, "measured");
+    json_builder_add_int_value(b, (gint64)q->measured);
+    json_builder_set_member_name(b, "dropped");
+    json_builder_add_int_value(b, (gint64)q->dropped);
+    json_builder_set_member_name(b, "failed");
+    json_builder_add_int_value(b, (gint64)q->failed);
+    if (q->window_len > 0) {
+        json_builder_set_member_name(b, "psnr_y");
+        json_builder_add_double_value(b, q->last_psnr_y);
+        json_builder_set_member_name(b, "psnr_yuv");
+        json_builder_add_double_value(b, q->last_psnr);
+        json_builder_set_member_name(b, "ssim_y");
+        json_builder_add_double_value(b, q->last_ssim);
+        json_builder_set_member_name(b, "psnr_y_avg");
+        json_builder_add_double_value(b, psnr_sum / q->window_len);
+        json_builder_set_member_name(b, "psnr_y_min");
+        json_builder_add_double_value(b, psnr_min);
+        json_builder_set_member_name(b, "ssim_y_avg");
+        json_builder_add_double_value(b, ssim_sum / q->window_len);
+    }
+    json_builder_end_object(b);
+    g_mutex_unlock(&q->lock);
+}
+
+// Call with the pipeline in NULL
+static void stream_free(Stream *st) {
+    if (st->sei_probe_id != 0) {
+        GstPad *enc_src = gst_element_get_static_pad(st->graph.enc, "src");
+        if (enc_src) {
+            gst_pad_remove_probe(enc_src, st->sei_probe_id);
+            gst_object_unref(enc_src);
+        }
+    }
+    sei_config_free(st->sei_cfg);
+    if (st->ndi_meta.pending) {
+        g_ptr_array_unref(st->ndi_meta.pending);
+        g_mutex_clear(&st->ndi_meta.lock);
+    }
+    ltc_decoder_free(st->ltc);
+    ndi_connect_clear(&st->ndi_connect);
+    quality_probe_free(st->quality);
+    convert_cost_free(st->ingest);
+    convert_cost_free(st->audio_convert);
+    frame_stats_free(st->frame_stats);
+    trace_stream_free(st->trace);
+    g_list_free_full(st->branches, (GDestroyNotify)branch_free);
+    graph_clear(&st->graph);
+    if (st->glitch.report_id) g_source_remove(st->glitch.report_id);
+    g_mutex_clear(&st->glitch.lock);
+    g_free(st->glitch.what);
+    g_free(st->ndi_name);
+    g_free(st->output_uri);
+    g_free(st);
+}
+
+// Build one source's graph into the shared pipeline and attach its primary
+// output (none for the later programs of an MPTS)
+static Stream* app_add_stream(App *app, const gchar *ndi_name, const gchar *output_uri, GError **error) {
+    Stream *st = g_new0(Stream, 1);
+    st->app = app;
+    st->index = app->streams->len;
+    st->ndi_name = g_strdup(ndi_name);
+    st->output_uri = g_strdup(output_uri);
+    g_mutex_init(&st->glitch.lock);
+    g_ptr_array_add(app->streams, st);
+    const PipelineGraph *shared = app->cfg->mpts && st->index > 0
+        ? &((Stream*)g_ptr_array_index(app->streams, 0))->graph : NULL;
+    if (!graph_build(&st->graph, app->pipeline, app->cfg, ndi_name, st->index, shared, error)) return NULL;
+    stream_ndi_connect(st, ndi_name);
+    stream_install_convert_cost(st);
+    if (app->cfg->frame_stats_path || app->cfg->control_socket || app->cfg->governor) stream_install_frame_stats(st);
+    if (app->tracer) stream_install_trace(st);
+    if (output_uri && !stream_attach_output(st, output_uri, FALSE, error)) return NULL;
+    if (st->graph.meta_src) stream_install_ndi_meta(st);
+    if (app->cfg->ltc_channel > 0) stream_install_ltc(st, app->cfg->ltc_channel - 1);
+    if (app->cfg->quality_probe > 0) stream_install_quality_probe(st, app->cfg->quality_probe);
+    glitch_init(st);
+    return st;
+}
+
+// --- Timecode-aligned multi-source synchronizer (--tc-sync) ---
+//
+// Every stream's raw video goes through one shared buffer keyed on the frame
+// count since the daily jam of its GstVideoTimeCodeMeta (PTS * fps when a
+// source carries no timecode). A worker thread releases one frame per stream
+// for each timecode in lockstep: it waits at most tc_sync_wait_ms after the
+// first source delivered a timecode for the others, then repeats the last
+// frame of a source that is still late. Frames older than the current
+// timecode are dropped. Released frames keep their own PTS and go to each
+// stream's encoder independently; on every tc_sync_idr-th timecode all
+// encoders are asked for an IDR.
+
+#define ALIGN_MAX_QUEUE 16          // frames held per source before the oldest is dropped
+#define ALIGN_REPORT_INTERVAL_US (5 * G_USEC_PER_SEC)
+
+typedef struct AlignFrame {
+    GstBuffer *buf;
+    gint64 key;                 // frames since daily jam
+    gint64 arrival_us;
+} AlignFrame;
+
+typedef struct AlignSource {
+    Stream *stream;
+    GQueue frames;              // AlignFrame*, oldest first
+    GstCaps *caps;              // caps of the last frame pushed to the appsrc
+    GstCaps *in_caps;           // caps of the last frame received
+    gint fps_n, fps_d;
+    GstBuffer *last;            // last released frame, repeated when late
+    gint64 last_key;
+    GstClockTime last_pts;
+    // totals
+    guint64 released, dropped, repeated;
+    // report window
+    guint64 w_released, w_dropped, w_repeated;
+    gint64 w_max_error;         // frames between the released content and the target timecode
+    gint64 w_latency_sum_us, w_latency_max_us;
+    gint64 w_skew_max_us;       // arrival of this source vs. the earliest source, same timecode
+} AlignSource;
+
+typedef struct Aligner {
+    App *app;
+    GMutex lock;
+    GCond cond;
+    GThread *thread;
+    gboolean running;
+    guint n_sources;
+    AlignSource *sources;
+    gint64 next_key;            // timecode to release next, -1 until locked
+    gint64 key_first_us;        // when the first source delivered next_key
+    gint64 wait_us;
+    guint idr_interval;
+    gint64 last_report_us;
+} Aligner;
+
+// Marks a released frame the encoder has to make an IDR; qdata rather than
+// a buffer flag, so nothing downstream can mistake it for its own meaning,
+// and copies (repeats) do not inherit it
+static GQuark align_idr_quark(void) {
+    return g_quark_from_static_string("ndi2srt-align-idr");
+}
+
+static void align_frame_free(AlignFrame *f) {
+    gst_buffer_unref(f->buf);
+    g_free(f);
+}
+
+static gint64 align_frame_key(AlignSource *src, GstBuffer *buf) {
+    GstVideoTimeCodeMeta *tcmeta = gst_buffer_get_video_time_code_meta(buf);
+    if (tcmeta) return (gint64)gst_video_time_code_frames_since_daily_jam(&tcmeta->tc);
+    if (!GST_BUFFER_PTS_IS_VALID(buf) || src->fps_n <= 0 || src->fps_d <= 0) return -1;
+    return (gint64)gst_util_uint64_scale_round(GST_BUFFER_PTS(buf), src->fps_n, (guint64)src->fps_d * GST_SECOND);
+}
+
+// appsink streaming thread: queue the frame and wake the worker
+static GstFlowReturn align_new_sample_cb(GstAppSink *sink, gpointer user_data) {
+    AlignSource *src = (AlignSource*)user_data;
+    Aligner *al = (Aligner*)src->stream->app->aligner;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample) return GST_FLOW_EOS;
+    GstBuffer *buf = gst_sample_get_buffer(sample);
+    GstCaps *caps = gst_sample_get_caps(sample);
+
+    g_mutex_lock(&al->lock);
+    if (caps && (!src->in_caps || !gst_caps_is_equal(caps, src->in_caps))) {
+        gst_caps_replace(&src->in_caps, caps);
+        const GstStructure *s = gst_caps_get_structure(caps, 0);
+        if (!gst_structure_get_fraction(s, "framerate", &src->fps_n, &src->fps_d)) src->fps_n = 0;
+    }
+    gint64 key = buf ? align_frame_key(src, buf) : -1;
+    if (key >= 0) {
+        AlignFrame *f = g_new0(AlignFrame, 1);
+        f->buf = gst_buffer_ref(buf);
+        f->key = key;
+        f->arrival_us = g_get_monotonic_time();
+        g_queue_push_tail(&src->frames, f);
+        while (g_queue_get_length(&src->frames) > ALIGN_MAX_QUEUE) {
+            align_frame_free((AlignFrame*)g_queue_pop_head(&src->frames));
+            src->dropped++;
+            src->w_dropped++;
+        }
+        if (al->key_first_us == 0 && key >= al->next_key) al->key_first_us = f->arrival_us;
+        g_cond_signal(&al->cond);
+    }
+    g_mutex_unlock(&al->lock);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// Repeat the last frame of a late source as the frame for `key`: a shallow
+// copy with PTS and timecode moved forward by the missing frames
+static GstBuffer* align_repeat_frame(AlignSource *src, gint64 key) {
+    GstBuffer *buf = gst_buffer_copy(src->last);
+    gint64 delta = key - src->last_key;
+    GstVideoTimeCodeMeta *tcmeta = gst_buffer_get_video_time_code_meta(buf);
+    if (tcmeta) {
+        GstVideoTimeCode *tc = gst_video_time_code_copy(&tcmeta->tc);
+        gst_video_time_code_add_frames(tc, delta);
+        gst_buffer_remove_meta(buf, (GstMeta*)tcmeta);
+        gst_buffer_add_video_time_code_meta(buf, tc);
+        gst_video_time_code_free(tc);
+    }
+    // Captions belong to the original frame only; a repeat would show them twice
+    GstMeta *cc;
+    gpointer state = NULL;
+    while ((cc = gst_buffer_iterate_meta_filtered(buf, &state, GST_VIDEO_CAPTION_META_API_TYPE))) {
+        gst_buffer_remove_meta(buf, cc);
+        state = NULL;
+    }
+    if (GST_BUFFER_PTS_IS_VALID(buf) && src->fps_n > 0) {
+        GST_BUFFER_PTS(buf) += gst_util_uint64_scale(delta, (guint64)src->fps_d * GST_SECOND, src->fps_n);
+    }
+    GST_BUFFER_DTS(buf) = GST_CLOCK_TIME_NONE;
+    return buf;
+}
+
+static void align_report(Aligner *al, gint64 now) {
+    for (guint i = 0; i < al->n_sources; ++i) {
+        AlignSource *src = &al->sources[i];
+        g_printerr("TC sync [%u] %s: released=%" G_GUINT64_FORMAT " dropped=%" G_GUINT64_FORMAT
+                   " repeated=%" G_GUINT64_FORMAT " max_error=%" G_GINT64_FORMAT " frames"
+                   " latency avg=%.1f max=%.1f ms skew max=%.1f ms\n",
+                   src->stream->index, src->stream->ndi_name, src->w_released, src->w_dropped,
+                   src->w_repeated, src->w_max_error,
+                   src->w_released ? src->w_latency_sum_us / 1000.0 / src->w_released : 0.0,
+                   src->w_latency_max_us / 1000.0, src->w_skew_max_us / 1000.0);
+        src->w_released = src->w_dropped = src->w_repeated = 0;
+        src->w_max_error = src->w_latency_sum_us = src->w_latency_max_us = src->w_skew_max_us = 0;
+    }
+    al->last_report_us = now;
+}
+
+// Called with the lock held once next_key is due: pick one frame per source
+static void align_release(Aligner *al, GstBuffer **out, gint64 now) {
+    gboolean idr = al->idr_interval > 0 && al->next_key % al->idr_interval == 0;
+    gint64 first_arrival = G_MAXINT64;
+    for (guint i = 0; i < al->n_sources; ++i) {
+        AlignFrame *f = (AlignFrame*)g_queue_peek_head(&al->sources[i].frames);
+        if (f && f->key == al->next_key && f->arrival_us < first_arrival) first_arrival = f->arrival_us;
+    }
+    for (guint i = 0; i < al->n_sources; ++i) {
+        AlignSource *src = &al->sources[i];
+        AlignFrame *f = (AlignFrame*)g_queue_peek_head(&src->frames);
+        out[i] = NULL;
+        if (f && f->key == al->next_key) {
+            g_queue_pop_head(&src->frames);
+            gint64 latency = now - f->arrival_us;
+            src->w_latency_sum_us += latency;
+            if (latency > src->w_latency_max_us) src->w_latency_max_us = latency;
+            if (f->arrival_us - first_arrival > src->w_skew_max_us) src->w_skew_max_us = f->arrival_us - first_arrival;
+            gst_buffer_replace(&src->last, f->buf);
+            src->last_key = f->key;
+            out[i] = gst_buffer_ref(f->buf);
+            src->released++;
+            src->w_released++;
+            align_frame_free(f);
+        } else if (src->last) {
+            // Late, or skipped this timecode: show the previous picture again
+            gint64 error = al->next_key - src->last_key;
+            if (error > src->w_max_error) src->w_max_error = error;
+            out[i] = align_repeat_frame(src, al->next_key);
+            src->repeated++;
+            src->w_repeated++;
+        }
+        if (!out[i]) continue;
+        if (GST_BUFFER_PTS_IS_VALID(out[i]) && GST_CLOCK_TIME_IS_VALID(src->last_pts) &&
+            GST_BUFFER_PTS(out[i]) <= src->last_pts) {
+            // A repeat ran ahead of the source's own clock: keep PTS increasing
+            out[i] = gst_buffer_make_writable(out[i]);
+            GST_BUFFER_PTS(out[i]) = src->last_pts + 1;
+        }
+        if (GST_BUFFER_PTS_IS_VALID(out[i])) src->last_pts = GST_BUFFER_PTS(out[i]);
+        if (idr) {
+            out[i] = gst_buffer_make_writable(out[i]);
+            gst_mini_object_set_qdata(GST_MINI_OBJECT_CAST(out[i]), align_idr_quark(), GINT_TO_POINTER(TRUE), NULL);
+        }
+    }
+    al->next_key++;
+    al->key_first_us = 0;
+}
+
+// Drop what is older than next_key; returns how many sources hold next_key or later
+static guint align_prune(Aligner *al, gint64 *min_key) {
+    guint ready = 0;
+    *min_key = G_MAXINT64;
+    for (guint i = 0; i < al->n_sources; ++i) {
+        AlignSource *src = &al->sources[i];
+        AlignFrame *f;
+        while ((f = (AlignFrame*)g_queue_peek_head(&src->frames)) && f->key < al->next_key) {
+            g_queue_pop_head(&src->frames);
+            align_frame_free(f);
+            src->dropped++;
+            src->w_dropped++;
+        }
+        if (f) {
+            ready++;
+            if (f->key < *min_key) *min_key = f->key;
+        }
+    }
+    return ready;
+}
+
+static gpointer align_thread(gpointer user_data) {
+    Aligner *al = (Aligner*)user_data;
+    GstBuffer **out = g_new0(GstBuffer*, al->n_sources);
+    GstCaps **out_caps = g_new0(GstCaps*, al->n_sources);
+    g_mutex_lock(&al->lock);
+    while (al->running) {
+        gint64 now = g_get_monotonic_time();
+        if (now - al->last_report_us >= ALIGN_REPORT_INTERVAL_US) align_report(al, now);
+        if (al->next_key < 0) {
+            // Lock on the newest head once every source delivered something
+            gint64 newest = -1;
+            guint have = 0;
+            for (guint i = 0; i < al->n_sources; ++i) {
+                AlignFrame *f = (AlignFrame*)g_queue_peek_head(&al->sources[i].frames);
+                if (!f) continue;
+                have++;
+                if (f->key > newest) newest = f->key;
+            }
+            if (have < al->n_sources) {
+                g_cond_wait_until(&al->cond, &al->lock, now + 100 * G_TIME_SPAN_MILLISECOND);
+                continue;
+            }
+            al->next_key = newest;
+            al->key_first_us = now;
+            g_printerr("TC sync: locked at frame %" G_GINT64_FORMAT " since daily jam\n", newest);
+        }
+        gint64 min_key;
+        guint ready = align_prune(al, &min_key);
+        if (ready == 0) {
+            g_cond_wait_until(&al->cond, &al->lock, now + 100 * G_TIME_SPAN_MILLISECOND);
+            continue;
+        }
+        if (min_key > al->next_key) {
+            // Nobody has this timecode; continue from the earliest one anyone has
+            // (or start over after a jump of more than the queue depth)
+            if (min_key - al->next_key > ALIGN_MAX_QUEUE) {
+                g_printerr("TC sync: timecode jumped by %" G_GINT64_FORMAT " frames, relocking\n",
+                           min_key - al->next_key);
+                al->next_key = -1;
+                continue;
+            }
+            al->next_key = min_key;
+        }
+        if (al->key_first_us == 0) al->key_first_us = now;
+        guint exact = 0;
+        for (guint i = 0; i < al->n_sources; ++i) {
+            AlignFrame *f = (AlignFrame*)g_queue_peek_head(&al->sources[i].frames);
+            if (f && f->key == al->next_key) exact++;
+        }
+        gint64 deadline = al->key_first_us + al->wait_us;
+        if (exact < al->n_sources && now < deadline) {
+            g_cond_wait_until(&al->cond, &al->lock, deadline);
+            continue;
+        }
+        align_release(al, out, now);
+        for (guint i = 0; i < al->n_sources; ++i) {
+            AlignSource *src = &al->sources[i];
+            if (out[i] && src->in_caps && src->caps != src->in_caps) {
+                gst_caps_replace(&src->caps, src->in_caps);
+                out_caps[i] = gst_caps_ref(src->caps);
+            }
+        }
+        // Push without the lock: appsrc never blocks, but the appsinks must not wait on us
+        g_mutex_unlock(&al->lock);
+        for (guint i = 0; i < al->n_sources; ++i) {
+            GstAppSrc *appsrc = GST_APP_SRC(al->sources[i].stream->graph.sync_src);
+            if (out_caps[i]) {
+                gst_app_src_set_caps(appsrc, out_caps[i]);
+                gst_caps_unref(out_caps[i]);
+                out_caps[i] = NULL;
+            }
+            if (out[i]) gst_app_src_push_buffer(appsrc, out[i]);
+            out[i] = NULL;
+        }
+        g_mutex_lock(&al->lock);
+    }
+    g_mutex_unlock(&al->lock);
+    g_free(out_caps);
+    g_free(out);
+    return NULL;
+}
+
+// appsrc src pad: turn the aligner's IDR mark into a force-key-unit event
+// that reaches the encoder right before the frame. The mark is taken off
+// here, so the frame goes on as the aligner received it.
+static GstPadProbeReturn align_idr_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buf && gst_mini_object_steal_qdata(GST_MINI_OBJECT_CAST(buf), align_idr_quark())) {
+        gst_pad_push_event(pad, gst_video_event_new_downstream_force_key_unit(
+            GST_BUFFER_PTS(buf), GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void aligner_start(App *app) {
+    Aligner *al = g_new0(Aligner, 1);
+    al->app = app;
+    g_mutex_init(&al->lock);
+    g_cond_init(&al->cond);
+    al->n_sources = app->streams->len;
+    al->sources = g_new0(AlignSource, al->n_sources);
+    al->next_key = -1;
+    al->wait_us = (gint64)app->cfg->tc_sync_wait_ms * G_TIME_SPAN_MILLISECOND;
+    al->idr_interval = app->cfg->tc_sync_idr;
+    al->last_report_us = g_get_monotonic_time();
+    al->running = TRUE;
+    app->aligner = al;
+    for (guint i = 0; i < al->n_sources; ++i) {
+        AlignSource *src = &al->sources[i];
+        src->stream = (Stream*)g_ptr_array_index(app->streams, i);
+        src->last_pts = GST_CLOCK_TIME_NONE;
+        g_queue_init(&src->frames);
+        GstAppSinkCallbacks cbs = { 0 };
+        cbs.new_sample = align_new_sample_cb;
+        gst_app_sink_set_callbacks(GST_APP_SINK(src->stream->graph.sync_sink), &cbs, src, NULL);
+        GstPad *pad = gst_element_get_static_pad(src->stream->graph.sync_src, "src");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, align_idr_probe, NULL, NULL);
+        gst_object_unref(pad);
+    }
+    al->thread = g_thread_new("tc-sync", align_thread, al);
+    g_printerr("TC sync: %u sources, wait %u ms, IDR every %u frames\n",
+               al->n_sources, app->cfg->tc_sync_wait_ms, al->idr_interval);
+}
+
+// Call with the pipeline in NULL so no appsink callback is running
+static void aligner_stop(App *app) {
+    Aligner *al = app->aligner;
+    if (!al) return;
+    g_mutex_lock(&al->lock);
+    al->running = FALSE;
+    g_cond_signal(&al->cond);
+    g_mutex_unlock(&al->lock);
+    g_thread_join(al->thread);
+    for (guint i = 0; i < al->n_sources; ++i) {
+        AlignSource *src = &al->sources[i];
+        g_queue_clear_full(&src->frames, (GDestroyNotify)align_frame_free);
+        if (src->last) gst_buffer_unref(src->last);
+        if (src->in_caps) gst_caps_unref(src->in_caps);
+        if (src->caps) gst_caps_unref(src->caps);
+    }
+    g_free(al->sources);
+    g_cond_clear(&al->cond);
+    g_mutex_clear(&al->lock);
+    g_free(al);
+    app->aligner = NULL;
+}
+
+#ifdef NDI2SRT_SHM_RING
+// --- Shared-memory output ring (--shm-ring) ---
+//
+// Stream 0's muxed TS (or its H.264 access units, after SEI injection) is
+// copied once into a memfd ring that any number of local readers map; see
+// shmring.h. Readers fetch the memfd over a UNIX socket and are never waited
+// for: the streaming thread only pays one memcpy per buffer.
+
+typedef struct ShmRingOutput {
+    ShmRingProducer *ring;
+    ShmRingMode mode;
+    GSocketService *service;
+    GstPad *pad;
+    gulong probe_id;
+    guint64 records;
+    guint64 oversize;           // buffers too large for the ring, not published
+    guint readers;              // handshakes served
+} ShmRingOutput;
+
+static void shm_ring_publish(ShmRingOutput *out, GstBuffer *buf) {
+    GstMapInfo map;
+    if (!gst_buffer_map(buf, &map, GST_MAP_READ)) return;
+    ShmRingRecord rec = { 0 };
+    rec.pts = GST_BUFFER_PTS_IS_VALID(buf) ? GST_BUFFER_PTS(buf) : SHMRING_TIME_NONE;
+    rec.dts = GST_BUFFER_DTS_IS_VALID(buf) ? GST_BUFFER_DTS(buf) : SHMRING_TIME_NONE;
+    rec.timecode = -1;
+    if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DISCONT)) rec.flags |= SHMRING_FLAG_DISCONT;
+    if (out->mode == SHMRING_MODE_AU) {
+        if (!GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) rec.flags |= SHMRING_FLAG_KEYFRAME;
+        GstVideoTimeCodeMeta *tcmeta = gst_buffer_get_video_time_code_meta(buf);
+        if (tcmeta) {
+            rec.timecode = (gint64)gst_video_time_code_frames_since_daily_jam(&tcmeta->tc);
+            shmring_producer_set_rate(out->ring, tcmeta->tc.config.fps_n, tcmeta->tc.config.fps_d);
+        }
+    }
+    if (shmring_producer_write(out->ring, &rec, map.data, map.size) == 0) out->records++;
+    else out->oversize++;
+    gst_buffer_unmap(buf, &map);
+}
+
+static gboolean shm_ring_publish_list_item(GstBuffer **buf, guint idx, gpointer user_data) {
+    shm_ring_publish((ShmRingOutput*)user_data, *buf);
+    return TRUE;
+}
+
+static GstPadProbeReturn shm_ring_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ShmRingOutput *out = (ShmRingOutput*)user_data;
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info), shm_ring_publish_list_item, out);
+    } else if (GST_PAD_PROBE_INFO_BUFFER(info)) {
+        shm_ring_publish(out, GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Handshake: send the memfd (SCM_RIGHTS) and hang up
+static gboolean shm_ring_incoming_cb(GSocketService *service, GSocketConnection *conn,
+                                     GObject *source_object, gpointer user_data) {
+    ShmRingOutput *out = (ShmRingOutput*)user_data;
+    GError *err = NULL;
+    if (!g_unix_connection_send_fd(G_UNIX_CONNECTION(conn), shmring_producer_fd(out->ring), NULL, &err)) {
+        g_printerr("SHM ring: handshake failed: %s\n", err ? err->message : "unknown error");
+        g_clear_error(&err);
+    } else {
+        out->readers++;
+    }
+    g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+    return TRUE;
+}
+
+static gboolean shm_ring_start(App *app, GError **error) {
+    AppConfig *cfg = app->cfg;
+    Stream *st = (Stream*)g_ptr_array_index(app->streams, 0);
+    ShmRingMode mode = g_strcmp0(cfg->shm_ring_mode, "au") == 0 ? SHMRING_MODE_AU : SHMRING_MODE_TS;
+    ShmRingProducer *ring = shmring_producer_new((guint64)cfg->shm_ring_mb << 20, mode);
+    if (!ring) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno), "could not create ring: %s", g_strerror(errno));
+        return FALSE;
+    }
+    unlink_stale_socket(cfg->shm_ring);
+    GSocketService *svc = g_socket_service_new();
+    GSocketAddress *addr = g_unix_socket_address_new(cfg->shm_ring);
+    gboolean ok = g_socket_listener_add_address(G_SOCKET_LISTENER(svc), addr, G_SOCKET_TYPE_STREAM,
+                                                G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, error);
+    g_object_unref(addr);
+    if (!ok) {
+        g_object_unref(svc);
+        shmring_producer_free(ring);
+        return FALSE;
+    }
+    ShmRingOutput *out = g_new0(ShmRingOutput, 1);
+    out->ring = ring;
+    out->mode = mode;
+    out->service = svc;
+    out->pad = gst_element_get_static_pad(mode == SHMRING_MODE_AU ? st->graph.parse_caps : st->graph.mux, "src");
+    out->probe_id = gst_pad_add_probe(out->pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                                      shm_ring_probe, out, NULL);
+    g_signal_connect(svc, "incoming", G_CALLBACK(shm_ring_incoming_cb), out);
+    g_socket_service_start(svc);
+    app->shm_ring = out;
+    g_printerr("SHM ring: %s, %u MiB, readers attach on %s\n",
+               mode == SHMRING_MODE_AU ? "H.264 access units" : "MPEG-TS", cfg->shm_ring_mb, cfg->shm_ring);
+    return TRUE;
+}
+
+// Call with the pipeline in NULL
+static void shm_ring_stop(App *app) {
+    ShmRingOutput *out = app->shm_ring;
+    if (!out) return;
+    g_socket_service_stop(out->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(out->service));
+    g_object_unref(out->service);
+    unlink_stale_socket(app->cfg->shm_ring);
+    gst_pad_remove_probe(out->pad, out->probe_id);
+    gst_object_unref(out->pad);
+    shmring_producer_free(out->ring);
+    g_free(out);
+    app->shm_ring = NULL;
+}
+#endif
+
+// --- Resource budget (cgroup CPU quota, cpuset, memory limit) ---
+//
+// x264 sizes its thread pool from the cores it can see, and so do libav
+// decoders. Neither knows about a CFS quota. In a pod limited to 2 CPUs on
+// a 64-core host, x264 starts dozens of slice threads. They use up the quota
+// early in every 100 ms period and are then throttled for the rest of it,
+// which shows up as latency spikes. The limits are read once at startup:
+//   CPU     the budget (quota, cpuset or --cpu-budget) is split evenly
+//           between the streams. Each encoder gets one thread per whole
+//           CPU of its share, videoconvert/videoscale one thread per 4,
+//           and the quality probe's decoder a single thread.
+//   memory  the raw video queues shrink from their 10 MiB default to a
+//           32nd of the limit per stream (never below one 1080p frame).
+// Without a limit below the host, elements keep their defaults. Estimates
+// assume 1080p: the source resolution is only known once NDI connects.
+
+#define BUDGET_FRAME_BYTES (1920u * 1080u * 3u / 2u)    // 1080p 4:2:0
+#define BUDGET_NDI_FRAME_BYTES (1920u * 1080u * 2u)     // 1080p UYVY as NDI delivers it
+#define BUDGET_NDI_FRAMES 5                             // ndisrc max-queue-length default
+#define BUDGET_QUEUE_BYTES (10u << 20)                  // queue max-size-bytes default
+#define BUDGET_BASE_BYTES ((guint64)96 << 20)           // GStreamer, NDI SDK, libraries
+#define BUDGET_MIN_CPUS_PER_STREAM 1.0                  // 1080p ultrafast encode + convert + mux, roughly
+
+// Rough resident size of one stream: x264 keeps a frame per thread plus
+// references, each about twice the raw picture (padding, lowres planes)
+static guint64 budget_stream_bytes(const AppConfig *cfg) {
+    guint threads = cfg->encoder_threads > 0 ? cfg->encoder_threads : 4;
+    guint64 encoder = (guint64)(threads + 4) * 2 * BUDGET_FRAME_BYTES;
+    guint64 receive = (guint64)BUDGET_NDI_FRAMES * BUDGET_NDI_FRAME_BYTES;
+    guint64 queue = cfg->raw_queue_bytes > 0 ? cfg->raw_queue_bytes : BUDGET_QUEUE_BYTES;
+    return encoder + receive + queue + (guint64)FRAME_STATS_RING * sizeof(FrameStat);
+}
+
+// Before the streams are built: fills in the thread counts and queue sizes
+// the user did not give
+static void resource_budget_apply(App *app) {
+    AppConfig *cfg = app->cfg;
+    const CgroupLimits *l = &app->limits;
+    cgroup_read_limits(&app->limits);
+    guint streams = MAX(1u, (cfg->ndi_name ? 1u : 0u) + cfg->streams->len);
+    gdouble cpus = cfg->cpu_budget > 0 ? cfg->cpu_budget : cgroup_cpu_budget(l);
+    gboolean cpu_limited = cfg->cpu_budget > 0 || cpus < l->host_cpus;
+    guint64 memory = cgroup_memory_budget(l);
+    gdouble share = cpus / streams;
+    app->budget_cpus = cpus;
+    app->budget_memory = memory;
+
+    if (cpu_limited) {
+        if (cfg->encoder_threads == 0) cfg->encoder_threads = MAX(1u, (guint)share);
+        cfg->convert_threads = CLAMP((guint)(share / 4), 1u, 4u);
+        cfg->decoder_threads = 1;
+    }
+    if (memory > 0) {
+        cfg->raw_queue_bytes = (guint)CLAMP(memory / (32u * streams), (guint64)BUDGET_FRAME_BYTES,
+                                            (guint64)BUDGET_QUEUE_BYTES);
+    }
+
+    const gchar *source = cfg->cpu_budget > 0 ? "--cpu-budget"
+                        : l->cpu_quota > 0 && l->cpu_quota <= cpus ? "CFS quota"
+                        : l->cpuset_cpus > 0 && l->cpuset_cpus < l->host_cpus ? "cpuset" : "host";
+    gchar threads[16], memstr[32];
+    if (cfg->encoder_threads > 0) g_snprintf(threads, sizeof(threads), "%u", cfg->encoder_threads);
+    else g_strlcpy(threads, "auto", sizeof(threads));
+    if (memory > 0) g_snprintf(memstr, sizeof(memstr), "%" G_GUINT64_FORMAT " MiB", memory >> 20);
+    else g_strlcpy(memstr, "no limit", sizeof(memstr));
+    g_printerr("Resource budget: %.2f CPUs (%s; cgroup v%d, %d in cpuset, %d on host), %u stream%s -> %.2f each; "
+               "x264 threads %s, videoconvert threads %u; memory %s, raw queue %u KiB\n",
+               cpus, source, l->version, l->cpuset_cpus, l->host_cpus, streams, streams == 1 ? "" : "s", share,
+               threads, MAX(cfg->convert_threads, 1u), memstr,
+               (cfg->raw_queue_bytes > 0 ? cfg->raw_queue_bytes : BUDGET_QUEUE_BYTES) >> 10);
+
+    if (share < BUDGET_MIN_CPUS_PER_STREAM) {
+        g_printerr("Warning: %.2f CPUs for %u stream%s is under %.1f per stream; expect throttling and late frames "
+                   "at 1080p (fewer streams, a lower resolution or a larger quota)\n",
+                   cpus, streams, streams == 1 ? "" : "s", BUDGET_MIN_CPUS_PER_STREAM);
+    }
+    if (cfg->encoder_threads > 0 && (gdouble)cfg->encoder_threads > share + 0.5) {
+        g_printerr("Warning: %u x264 threads per stream against %.2f CPUs each; the quota will throttle them\n",
+                   cfg->encoder_threads, share);
+    }
+    if (memory > 0) {
+        guint64 need = BUDGET_BASE_BYTES + streams * budget_stream_bytes(cfg);
+        if (cfg->shm_ring) need += (guint64)cfg->shm_ring_mb << 20;
+        if (cfg->trace_path) need += (gsize)TRACE_MAX_THREADS * TRACE_EVENTS_PER_THREAD * sizeof(TraceEvent);
+        if (need > memory) {
+            g_printerr("Warning: the configured workload needs about %" G_GUINT64_FORMAT " MiB at 1080p, "
+                       "the memory limit is %" G_GUINT64_FORMAT " MiB\n", need >> 20, memory >> 20);
+        }
+    }
+}
+
+static void resource_budget_add_stats(JsonBuilder *b, App *app) {
+    json_builder_set_member_name(b, "resources");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "cgroup_version");
+    json_builder_add_int_value(b, app->limits.version);
+    json_builder_set_member_name(b, "cpu_budget");
+    json_builder_add_double_value(b, app->budget_cpus);
+    json_builder_set_member_name(b, "cpu_quota");
+    json_builder_add_double_value(b, app->limits.cpu_quota);
+    json_builder_set_member_name(b, "cpuset_cpus");
+    json_builder_add_int_value(b, app->limits.cpuset_cpus);
+    json_builder_set_member_name(b, "host_cpus");
+    json_builder_add_int_value(b, app->limits.host_cpus);
+    json_builder_set_member_name(b, "memory_limit_mb");
+    json_builder_add_int_value(b, (gint64)(app->budget_memory >> 20));
+    json_builder_set_member_name(b, "encoder_threads");
+    json_builder_add_int_value(b, app->cfg->encoder_threads);
+    json_builder_set_member_name(b, "convert_threads");
+    json_builder_add_int_value(b, app->cfg->convert_threads);
+    json_builder_end_object(b);
+}
+
+// --- Priority governor (--governor, --priority) ---
+//
+// All streams of the process share one CPU budget; when it runs short every
+// encoder falls behind at once. The governor sheds load from the least
+// important streams first so the others keep their deadlines. Every
+// GOVERNOR_TICK_S it counts, per stream, frames that took longer than a frame
+// interval to encode (the frame_stats records) and overruns of the raw video
+// queue, and measures the headroom: the CPU budget (resource_budget_apply())
+// minus what the process used, capped on Linux by the host's idle CPUs.
+//
+// Under pressure (late frames above GOVERNOR_MISS_RATIO, an overrun, or less
+// than GOVERNOR_MIN_HEADROOM CPUs left) the lowest-priority stream that still
+// has something to give goes down one level, then the governor waits
+// GOVERNOR_SETTLE_S for the effect:
+//   full -> half_rate       every other frame is dropped before the encoder
+//   half_rate -> half_size  the frames left are also scaled to half width
+//                           and height
+// After GOVERNOR_RESTORE_S without pressure and with
+// GOVERNOR_RESTORE_HEADROOM CPUs free (a quarter of the budget when that is
+// less, so small containers can get levels back too), the most important
+// degraded stream gets one level back. The preset is not a level: x264enc
+// already runs ultrafast and cannot change it while PLAYING.
+
+#define GOVERNOR_TICK_S 1
+#define GOVERNOR_MISS_RATIO 0.02        // late frames per encoded frame
+#define GOVERNOR_MIN_FRAMES 10          // frames in a tick before its miss ratio counts
+#define GOVERNOR_MIN_HEADROOM 0.1       // CPUs
+#define GOVERNOR_RESTORE_HEADROOM 1.0   // CPUs free before a level is given back
+#define GOVERNOR_SETTLE_S 3             // after a step, before the next one
+#define GOVERNOR_RESTORE_S 10           // without pressure, before a level is given back
+
+enum { GOV_FULL, GOV_HALF_RATE, GOV_HALF_SIZE, GOV_LEVEL_COUNT };
+
+static const gchar *gov_level_names[GOV_LEVEL_COUNT] = { "full", "half_rate", "half_size" };
+
+typedef struct GovStream {
+    Stream *st;
+    gint priority;
+    gint level;             // GOV_* (atomic: read by the drop probe)
+    guint frame;            // video streaming thread only
+    gint overruns;          // vqueue "overrun" signals (atomic)
+    gulong probe_id;
+    gulong overrun_id;
+    // main loop only
+    guint cursor;           // next frame_stats record
+    guint64 frames;
+    guint64 late;
+    guint overruns_seen;
+} GovStream;
+
+typedef struct Governor {
+    App *app;
+    guint timer;
+    gint64 last_us;
+    guint64 last_process_ns;
+    guint64 last_idle;      // /proc/stat jiffies, 0 = unknown
+    guint64 last_total;
+    gdouble headroom;       // CPUs, last tick
+    gint64 hold_until_us;   // no step before this
+    gint64 calm_since_us;   // last tick under pressure
+    gboolean saturated;     // every stream shed, logged once
+    guint64 actions;
+} Governor;
+
+static GstPadProbeReturn governor_drop_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    (void)info;
+    GovStream *gs = (GovStream*)user_data;
+    if (g_atomic_int_get(&gs->level) < GOV_HALF_RATE) return GST_PAD_PROBE_OK;
+    return (gs->frame++ & 1) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+static void governor_overrun_cb(GstElement *queue, gpointer user_data) {
+    (void)queue;
+    g_atomic_int_inc(&((GovStream*)user_data)->overruns);
+}
+
+// Source frame interval; the injector's rate, else its estimate, else 25 fps
+static guint64 governor_frame_interval_us(const Stream *st) {
+    const SeiConfig *s = st->sei_cfg;
+    guint fps_n = s && s->fps_n ? s->fps_n : s && s->est_fps ? s->est_fps : 25;
+    guint fps_d = s && s->fps_n && s->fps_d ? s->fps_d : 1;
+    return (guint64)G_USEC_PER_SEC * fps_d / fps_n;
+}
+
+// Idle and total jiffies of all CPUs (first line of /proc/stat)
+static gboolean governor_read_host(guint64 *idle, guint64 *total) {
+#ifdef __linux__
+    FILE *f = fopen("/proc/stat", "r");
+    if (!f) return FALSE;
+    unsigned long long v[8] = { 0 };
+    int n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+    fclose(f);
+    if (n < 4) return FALSE;
+    *idle = v[3] + v[4];    // idle + iowait
+    *total = 0;
+    for (guint i = 0; i < G_N_ELEMENTS(v); ++i) *total += v[i];
+    return TRUE;
+#else
+    (void)idle;
+    (void)total;
+    return FALSE;
+#endif
+}
+
+// Half the size of the frames coming in, or back to the source size
+static gboolean governor_set_size(GovStream *gs, gboolean half) {
+    const PipelineGraph *g = &gs->st->graph;
+    GstCaps *caps = NULL;
+    if (half) {
+        GstPad *pad = gst_element_get_static_pad(g->gov_scale, "sink");
+        GstCaps *in = gst_pad_get_current_caps(pad);
+        gst_object_unref(pad);
+        GstVideoInfo info;
+        if (in && gst_video_info_from_caps(&info, in)) {
+            caps = gst_caps_new_simple("video/x-raw",
+                "width", G_TYPE_INT, MAX((GST_VIDEO_INFO_WIDTH(&info) / 2) & ~1, 2),
+                "height", G_TYPE_INT, MAX((GST_VIDEO_INFO_HEIGHT(&info) / 2) & ~1, 2), NULL);
+        }
+        if (in) gst_caps_unref(in);
+        if (!caps) return FALSE;
+    } else {
+        caps = gst_caps_new_any();
+    }
+    // The capsfilter renegotiates; x264enc restarts with an IDR at the new size
+    g_object_set(g->gov_caps, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    return TRUE;
+}
+
+static gboolean governor_set_level(Governor *gov, GovStream *gs, gint level, const gchar *why) {
+    gint old = g_atomic_int_get(&gs->level);
+    if ((old >= GOV_HALF_SIZE) != (level >= GOV_HALF_SIZE) && !governor_set_size(gs, level >= GOV_HALF_SIZE)) {
+        g_printerr("Governor: stream %u has no video caps yet, cannot scale it\n", gs->st->index);
+        return FALSE;
+    }
+    g_atomic_int_set(&gs->level, level);
+    gov->actions++;
+    g_printerr("Governor: stream %u (priority %d) %s -> %s: %s\n", gs->st->index, gs->priority,
+               gov_level_names[old], gov_level_names[level], why);
+    return TRUE;
+}
+
+// Next stream to shed (lowest priority, later streams first) or to restore
+// (highest priority, earlier streams first); NULL when there is none
+static GovStream* governor_pick(App *app, gboolean shed) {
+    GovStream *best = NULL;
+    for (guint i = 0; i < app->streams->len; ++i) {
+        GovStream *gs = ((Stream*)g_ptr_array_index(app->streams, i))->governor;
+        gint level = g_atomic_int_get(&gs->level);
+        if (shed ? level == GOV_LEVEL_COUNT - 1 : level == GOV_FULL) continue;
+        if (!best || (shed ? gs->priority <= best->priority : gs->priority > best->priority)) best = gs;
+    }
+    return best;
+}
+
+// GOVERNOR_RESTORE_HEADROOM, or a quarter of the budget when that is less;
+// at least twice the shedding threshold, so a level given back is not shed
+// again on the next tick
+static gdouble governor_restore_headroom(const App *app) {
+    return MAX(GOVERNOR_MIN_HEADROOM * 2, MIN(GOVERNOR_RESTORE_HEADROOM, app->budget_cpus * 0.25));
+}
+
+static gboolean governor_tick_cb(gpointer user_data) {
+    Governor *gov = (Governor*)user_data;
+    App *app = gov->app;
+    gint64 now = g_get_monotonic_time();
+    guint64 process_ns = cpu_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    gdouble elapsed_s = (now - gov->last_us) / 1e6;
+    gdouble used = elapsed_s > 0 ? (process_ns - gov->last_process_ns) / 1e9 / elapsed_s : 0;
+    gov->headroom = app->budget_cpus - used;
+    guint64 idle, total;
+    if (governor_read_host(&idle, &total)) {
+        if (gov->last_total > 0 && total > gov->last_total) {
+            gdouble host_idle = (gdouble)(idle - gov->last_idle) / (gdouble)(total - gov->last_total)
+                              * app->limits.host_cpus;
+            gov->headroom = MIN(gov->headroom, host_idle);
+        }
+        gov->last_idle = idle;
+        gov->last_total = total;
+    }
+    gov->last_us = now;
+    gov->last_process_ns = process_ns;
+
+    gchar why[128] = "";
+    FrameStat batch[256];
+    for (guint i = 0; i < app->streams->len; ++i) {
+        Stream *st = (Stream*)g_ptr_array_index(app->streams, i);
+        GovStream *gs = st->governor;
+        // At half rate a frame has two source intervals to get through
+        guint64 deadline_us = governor_frame_interval_us(st) *
+                              (g_atomic_int_get(&gs->level) >= GOV_HALF_RATE ? 2 : 1);
+        guint frames = 0, late = 0, n, lost;
+        while ((n = frame_stats_read(st->frame_stats, &gs->cursor, batch, G_N_ELEMENTS(batch), &lost)) > 0 || lost > 0) {
+            for (guint j = 0; j < n; ++j) {
+                if (batch[j].encode_us == G_MAXUINT32) continue;
+                frames++;
+                if (batch[j].encode_us > deadline_us) late++;
+            }
+        }
+        gs->frames += frames;
+        gs->late += late;
+        guint overruns = (guint)g_atomic_int_get(&gs->overruns);
+        guint new_overruns = overruns - gs->overruns_seen;
+        gs->overruns_seen = overruns;
+        if (why[0]) continue;
+        if (new_overruns > 0) {
+            g_snprintf(why, sizeof(why), "stream %u raw queue overran %u times", st->index, new_overruns);
+        } else if (frames >= GOVERNOR_MIN_FRAMES && late > frames * GOVERNOR_MISS_RATIO) {
+            g_snprintf(why, sizeof(why), "stream %u had %u of %u frames late (> %.1f ms)",
+                       st->index, late, frames, deadline_us / 1000.0);
+        }
+    }
+    if (!why[0] && gov->headroom < GOVERNOR_MIN_HEADROOM) {
+        g_snprintf(why, sizeof(why), "%.2f CPUs of headroom", MAX(gov->headroom, 0.0));
+    }
+
+    if (why[0]) {
+        gov->calm_since_us = now;
+        if (now < gov->hold_until_us) return G_SOURCE_CONTINUE;
+        GovStream *victim = governor_pick(app, TRUE);
+        if (!victim) {
+            if (!gov->saturated) g_printerr("Governor: every stream is at %s, nothing left to shed (%s)\n",
+                                            gov_level_names[GOV_LEVEL_COUNT - 1], why);
+            gov->saturated = TRUE;
+        } else if (governor_set_level(gov, victim, g_atomic_int_get(&victim->level) + 1, why)) {
+            gov->hold_until_us = now + GOVERNOR_SETTLE_S * G_USEC_PER_SEC;
+        }
+        return G_SOURCE_CONTINUE;
+    }
+    gov->saturated = FALSE;
+    if (now < gov->hold_until_us || now - gov->calm_since_us < GOVERNOR_RESTORE_S * G_USEC_PER_SEC ||
+        gov->headroom < governor_restore_headroom(app)) return G_SOURCE_CONTINUE;
+    GovStream *gs = governor_pick(app, FALSE);
+    if (!gs) return G_SOURCE_CONTINUE;
+    g_snprintf(why, sizeof(why), "%.2f CPUs free, no late frames for %" G_GINT64_FORMAT " s",
+               gov->headroom, (now - gov->calm_since_us) / G_USEC_PER_SEC);
+    if (governor_set_level(gov, gs, g_atomic_int_get(&gs->level) - 1, why)) {
+        gov->hold_until_us = now + GOVERNOR_SETTLE_S * G_USEC_PER_SEC;
+        gov->calm_since_us = now;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// After frame_stats_start(): reads the streams' frame_stats rings
+static void governor_start(App *app) {
+    const AppConfig *cfg = app->cfg;
+    if (!cfg->governor) return;
+    Governor *gov = g_new0(Governor, 1);
+    gov->app = app;
+    GString *list = g_string_new(NULL);
+    for (guint i = 0; i < app->streams->len; ++i) {
+        Stream *st = (Stream*)g_ptr_array_index(app->streams, i);
+        GovStream *gs = g_new0(GovStream, 1);
+        gs->st = st;
+        gs->priority = i < cfg->priorities->len ? g_array_index(cfg->priorities, gint, i) : 0;
+        GstPad *pad = gst_element_get_static_pad(st->graph.gov_scale, "sink");
+        gs->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, governor_drop_probe, gs, NULL);
+        gst_object_unref(pad);
+        gs->overrun_id = g_signal_connect(st->graph.vqueue, "overrun", G_CALLBACK(governor_overrun_cb), gs);
+        st->governor = gs;
+        g_string_append_printf(list, "%s%d", i > 0 ? "," : "", gs->priority);
+    }
+    if (cfg->priorities->len > app->streams->len) {
+        g_printerr("Warning: --priority lists %u values for %u streams, ignoring the rest\n",
+                   cfg->priorities->len, app->streams->len);
+    }
+    gov->last_us = g_get_monotonic_time();
+    gov->calm_since_us = gov->last_us;
+    gov->last_process_ns = cpu_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    governor_read_host(&gov->last_idle, &gov->last_total);
+    gov->headroom = app->budget_cpus;
+    gov->timer = g_timeout_add_seconds(GOVERNOR_TICK_S, governor_tick_cb, gov);
+    app->governor = gov;
+    g_printerr("Governor: %u stream%s on %.2f CPUs, priorities %s\n", app->streams->len,
+               app->streams->len == 1 ? "" : "s", app->budget_cpus, list->str);
+    g_string_free(list, TRUE);
+}
+
+// Call with the pipeline in NULL, before the streams are freed
+static void governor_stop(App *app) {
+    Governor *gov = app->governor;
+    if (!gov) return;
+    g_source_remove(gov->timer);
+    for (guint i = 0; i < app->streams->len; ++i) {
+        Stream *st = (Stream*)g_ptr_array_index(app->streams, i);
+        GovStream *gs = st->governor;
+        GstPad *pad = gst_element_get_static_pad(st->graph.gov_scale, "sink");
+        gst_pad_remove_probe(pad, gs->probe_id);
+        gst_object_unref(pad);
+        g_signal_handler_disconnect(st->graph.vqueue, gs->overrun_id);
+        g_free(gs);
+        st->governor = NULL;
+    }
+    if (gov->actions > 0) g_printerr("Governor: %" G_GUINT64_FORMAT " level changes\n", gov->actions);
+    g_free(gov);
+    app->governor = NULL;
+}
+
+static void governor_set_priority(GovStream *gs, gint priority) {
+    if (priority == gs->priority) return;
+    g_printerr("Governor: stream %u priority %d -> %d\n", gs->st->index, gs->priority, priority);
+    gs->priority = priority;
+}
+
+static void governor_add_stream_stats(JsonBuilder *b, const GovStream *gs) {
+    json_builder_set_member_name(b, "governor");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "priority");
+    json_builder_add_int_value(b, gs->priority);
+    json_builder_set_member_name(b, "level");
+    json_builder_add_string_value(b, gov_level_names[g_atomic_int_get(&gs->level)]);
+    json_builder_set_member_name(b, "frames");
+    json_builder_add_int_value(b, (gint64)gs->frames);
+    json_builder_set_member_name(b, "late_frames");
+    json_builder_add_int_value(b, (gint64)gs->late);
+    json_builder_set_member_name(b, "queue_overruns");
+    json_builder_add_int_value(b, gs->overruns_seen);
+    json_builder_end_object(b);
+}
+
+static void governor_add_stats(JsonBuilder *b, const Governor *gov) {
+    json_builder_set_member_name(b, "governor");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "headroom_cpus");
+    json_builder_add_double_value(b, gov->headroom);
+    json_builder_set_member_name(b, "level_changes");
+    json_builder_add_int_value(b, (gint64)gov->actions);
+    json_builder_end_object(b);
+}
+
+// --- Runtime control API (JSON lines over a UNIX socket) ---
+
+#define CONTROL_LINE_MAX (64 * 1024)   // longer requests are refused and the client dropped
+
+typedef struct ControlClient {
+    App *app;
+    GSocketConnection *conn;
+    GString *in;           // bytes received, not yet a complete line
+    gchar chunk[4096];
+    gchar *pending;        // response being written
+    gboolean closing;      // drop the client once pending is written
+} ControlClient;
+
+static void control_read_next(ControlClient *client);
+
+static void control_add_stream_state(JsonBuilder *b, Stream *st) {
+    gchar *ndi_name = NULL;
+    if (st->graph.ndisrc) g_object_get(st->graph.ndisrc, "ndi-name", &ndi_name, NULL);
+    json_builder_set_member_name(b, "source");
+    json_builder_add_string_value(b, ndi_name ? ndi_name : st->ndi_name);
+    g_free(ndi_name);
+    GstElement *enc = graph_encoder(&st->graph);
+    if (enc && element_has_property(enc, "bitrate")) {
+        guint bitrate = 0;
+        g_object_get(enc, "bitrate", &bitrate, NULL);
+        json_builder_set_member_name(b, "bitrate_kbps");
+        json_builder_add_int_value(b, bitrate);
+    }
+    json_builder_set_member_name(b, "sei");
+    json_builder_add_boolean_value(b, st->sei_cfg && g_atomic_int_get(&st->sei_cfg->inject_sei));
+    json_builder_set_member_name(b, "branches");
+    json_builder_begin_array(b);
+    for (GList *l = st->branches; l != NULL; l = l->next) {
+        Branch *br = (Branch*)l->data;
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "kind");
+        json_builder_add_string_value(b, branch_kind_names[br->kind]);
+        json_builder_set_member_name(b, "name");
+        json_builder_add_string_value(b, br->name);
+        json_builder_end_object(b);
+    }
+    json_builder_end_array(b);
+    GstPad *active = NULL;
+    g_object_get(st->graph.vselect, "active-pad", &active, NULL);
+    json_builder_set_member_name(b, "active_source");
+    json_builder_add_string_value(b, (active && active != st->graph.primary_vpad) ? "backup" : "primary");
+    if (active) gst_object_unref(active);
+}
+
+static void control_add_stream_stats(JsonBuilder *b, Stream *st) {
+    if (st->sei_cfg) {
+        json_builder_set_member_name(b, "frames");
+        json_builder_add_int_value(b, (gint64)st->sei_cfg->frames_total);
+        json_builder_set_member_name(b, "frames_with_sei");
+        json_builder_add_int_value(b, (gint64)st->sei_cfg->frames_with_sei);
+        json_builder_set_member_name(b, "frames_with_captions");
+        json_builder_add_int_value(b, (gint64)st->sei_cfg->frames_with_cc);
+        json_builder_set_member_name(b, "keyframes");
+        json_builder_add_int_value(b, (gint64)st->sei_cfg->keyframes);
+        json_builder_set_member_name(b, "video_bytes");
+        json_builder_add_int_value(b, (gint64)st->sei_cfg->bytes_total);
+        if (st->sei_cfg->repeat_parameter_sets) {
+            json_builder_set_member_name(b, "parameter_sets_inserted");
+            json_builder_add_int_value(b, (gint64)st->sei_cfg->parameter_sets_inserted);
+        }
+    }
+    if (st->ndi_connect.name) ndi_connect_add_stats(b, &st->ndi_connect);
+    if (st->graph.meta_src) {
+        json_builder_set_member_name(b, "ndi_metadata_frames");
+        json_builder_add_int_value(b, (gint64)st->ndi_meta.frames);
+    }
+    if (st->ltc) {
+        LtcDecoder *d = st->ltc;
+        gchar tcstr[16];
+        g_mutex_lock(&d->lock);
+        format_tc(d->have_tc ? &d->tc : NULL, tcstr);
+        json_builder_set_member_name(b, "ltc");
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "decoded");
+        json_builder_add_int_value(b, (gint64)d->decoded);
+        json_builder_set_member_name(b, "frames_stamped");
+        json_builder_add_int_value(b, (gint64)d->stamped);
+        json_builder_set_member_name(b, "last_timecode");
+        json_builder_add_string_value(b, tcstr);
+        json_builder_set_member_name(b, "phase_frames");
+        json_builder_add_double_value(b, d->phase_frames);
+        json_builder_end_object(b);
+        g_mutex_unlock(&d->lock);
+    }
+    if (st->ingest) convert_cost_add_stats(b, "ingest", st->ingest);
+    if (st->audio_convert) convert_cost_add_stats(b, "audio_convert", st->audio_convert);
+    if (st->quality) quality_add_stats(b, st->quality);
+#ifdef __linux__
+    if (st->app->cpu) cpu_add_stream_stats(b, st->app->cpu, st->index);
+#endif
+    if (st->governor) governor_add_stream_stats(b, st->governor);
+#ifdef NDI2SRT_SHM_RING
+    if (st->graph.enc_process) enc_process_add_stats(b, st->graph.enc_process);
+#endif
+    json_builder_set_member_name(b, "glitch_frames");
+    json_builder_begin_object(b);
+    for (guint i = 0; i <= BRANCH_KIND_COUNT; ++i) {
+        if (st->glitch.last_frames[i] < 0) continue;
+        json_builder_set_member_name(b, glitch_kind_names[i]);
+        json_builder_add_int_value(b, st->glitch.last_frames[i]);
+    }
+    json_builder_end_object(b);
+    Aligner *al = st->app->aligner;
+    if (al) {
+        AlignSource *src = &al->sources[st->index];
+        g_mutex_lock(&al->lock);
+        json_builder_set_member_name(b, "tc_sync");
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "released");
+        json_builder_add_int_value(b, (gint64)src->released);
+        json_builder_set_member_name(b, "dropped");
+        json_builder_add_int_value(b, (gint64)src->dropped);
+        json_builder_set_member_name(b, "repeated");
+        json_builder_add_int_value(b, (gint64)src->repeated);
+        json_builder_set_member_name(b, "queued");
+        json_builder_add_int_value(b, g_queue_get_length(&src->frames));
+        json_builder_end_object(b);
+        g_mutex_unlock(&al->lock);
+    }
+    json_builder_set_member_name(b, "branches");
+    json_builder_begin_array(b);
+    for (GList *l = st->branches; l != NULL; l = l->next) {
+        Branch *br = (Branch*)l->data;
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "name");
+        json_builder_add_string_value(b, br->name);
+        json_builder_set_member_name(b, "attached_s");
+        json_builder_add_double_value(b, (g_get_monotonic_time() - br->attached_us) / 1e6);
+        // srtsink exposes link statistics as a GstStructure
+        if (br->sink && element_has_property(br->sink, "stats")) {
+            GstStructure *stats = NULL;
+            g_object_get(br->sink, "stats", &stats, NULL);
+            if (stats) {
+                gchar *str = gst_structure_to_string(stats);
+                json_builder_set_member_name(b, "srt");
+                json_builder_add_string_value(b, str);
+                g_free(str);
+                gst_structure_free(stats);
+            }
+        }
+#ifdef NDI2SRT_SRT_GROUP
+        if (br->srt_group) srt_group_add_stats(b, br->srt_group);
+#endif
+        if (br->stdout_out) stdout_output_add_stats(b, br->stdout_out);
+        json_builder_end_object(b);
+    }
+    json_builder_end_array(b);
+}
+
+// Stream 0 is reported at the top level (single-source clients see the same
+// shape as before); with several sources every stream is listed under "streams"
+static void control_add_streams(JsonBuilder *b, App *app, void (*add)(JsonBuilder*, Stream*)) {
+    add(b, (Stream*)g_ptr_array_index(app->streams, 0));
+    if (app->streams->len < 2) return;
+    json_builder_set_member_name(b, "streams");
+    json_builder_begin_array(b);
+    for (guint i = 0; i < app->streams->len; ++i) {
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "stream");
+        json_builder_add_int_value(b, i);
+        add(b, (Stream*)g_ptr_array_index(app->streams, i));
+        json_builder_end_object(b);
+    }
+    json_builder_end_array(b);
+}
+
+static void control_add_state(JsonBuilder *b, App *app) {
+    json_builder_set_member_name(b, "state");
+    json_builder_begin_object(b);
+    control_add_streams(b, app, control_add_stream_state);
+    if (app->clock) {
+        json_builder_set_member_name(b, "clock");
+        json_builder_add_string_value(b, app->cfg->clock_spec ? app->cfg->clock_spec : "realtime");
+        json_builder_set_member_name(b, "clock_synced");
+        json_builder_add_boolean_value(b, gst_clock_is_synced(app->clock));
+        // Pipeline clock minus this host's wall clock: ~0 for --serve-clock
+        // and a synced net: client on the same host, the epoch difference
+        // for PTP (TAI) and NTP
+        json_builder_set_member_name(b, "clock_offset_ns");
+        json_builder_add_int_value(b, (gint64)gst_clock_get_time(app->clock) - g_get_real_time() * 1000);
+    }
+    json_builder_end_object(b);
+}
+
+static void control_add_stats(JsonBuilder *b, App *app) {
+    json_builder_set_member_name(b, "stats");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "uptime_s");
+    json_builder_add_double_value(b, (g_get_monotonic_time() - app->started_us) / 1e6);
+    control_add_streams(b, app, control_add_stream_stats);
+    resource_budget_add_stats(b, app);
+#ifdef __linux__
+    if (app->cpu) cpu_add_stats(b, app->cpu);
+#endif
+    if (app->governor) governor_add_stats(b, app->governor);
+#ifdef NDI2SRT_SHM_RING
+    if (app->shm_ring) {
+        json_builder_set_member_name(b, "shm_ring");
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "records");
+        json_builder_add_int_value(b, (gint64)app->shm_ring->records);
+        json_builder_set_member_name(b, "oversize");
+        json_builder_add_int_value(b, (gint64)app->shm_ring->oversize);
+        json_builder_set_member_name(b, "readers_attached");
+        json_builder_add_int_value(b, app->shm_ring->readers);
+        json_builder_end_object(b);
+    }
+#endif
+    json_builder_end_object(b);
+}
+
+static const gchar* control_get_string(JsonObject *o, const gchar *name) {
+    JsonNode *n = json_object_get_member(o, name);
+    if (!n || !JSON_NODE_HOLDS_VALUE(n) || json_node_get_value_type(n) != G_TYPE_STRING) return NULL;
+    return json_node_get_string(n);
+}
+
+static gboolean control_get_int(JsonObject *o, const gchar *name, gint64 *out) {
+    JsonNode *n = json_object_get_member(o, name);
+    if (!n || !JSON_NODE_HOLDS_VALUE(n)) return FALSE;
+    GType t = json_node_get_value_type(n);
+    if (t == G_TYPE_INT64) { *out = json_node_get_int(n); return TRUE; }
+    if (t == G_TYPE_DOUBLE) { *out = (gint64)json_node_get_double(n); return TRUE; }
+    return FALSE;
+}
+
+// Apply one command; returns FALSE with *error set on failure.
+// Called on the main loop; nothing here blocks the streaming threads.
+static gboolean control_apply(App *app, const gchar *cmd, JsonObject *o, JsonBuilder *b, GError **error) {
+    // Commands address stream 0 unless they carry "stream": <index>
+    gint64 index = 0;
+    if (json_object_has_member(o, "stream") && !control_get_int(o, "stream", &index)) index = -1;
+    if (index < 0 || index >= (gint64)app->streams->len) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "no stream %" G_GINT64_FORMAT, index);
+        return FALSE;
+    }
+    Stream *st = (Stream*)g_ptr_array_index(app->streams, index);
+    if (g_strcmp0(cmd, "set_bitrate") == 0) {
+        gint64 kbps = 0;
+        if (!control_get_int(o, "kbps", &kbps) || kbps <= 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "set_bitrate needs a positive \"kbps\"");
+            return FALSE;
+        }
+        GstElement *enc = graph_encoder(&st->graph);
+        if (!enc || !element_has_property(enc, "bitrate")) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "encoder has no bitrate property");
+            return FALSE;
+        }
+        if (app->cfg->mpts && !json_object_has_member(o, "stream")) {
+            // The whole multiplex: split the new budget over the programs again
+            app->cfg->bitrate_kbps = (gint)kbps;
+            for (guint i = 0; i < app->streams->len; ++i) {
+                Stream *prog = (Stream*)g_ptr_array_index(app->streams, i);
+                g_object_set(graph_encoder(&prog->graph), "bitrate", (guint)mpts_program_kbps(app->cfg, i), NULL);
+            }
+        } else {
+            g_object_set(enc, "bitrate", (guint)kbps, NULL);
+            if (!app->cfg->mpts) app->cfg->bitrate_kbps = (gint)kbps;
+        }
+    } else if (g_strcmp0(cmd, "force_keyframe") == 0) {
+        GstPad *srcpad = gst_element_get_static_pad(st->graph.enc, "src");
+        gboolean sent = srcpad && gst_pad_send_event(srcpad,
+            gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        if (srcpad) gst_object_unref(srcpad);
+        if (!sent) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "encoder did not accept force-key-unit");
+            return FALSE;
+        }
+    } else if (g_strcmp0(cmd, "add_output") == 0) {
+        const gchar *uri = control_get_string(o, "uri");
+        if (!uri) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "add_output needs \"uri\"");
+            return FALSE;
+        }
+        if (!stream_attach_output(st, uri, FALSE, error)) return FALSE;
+        glitch_begin(st, BRANCH_OUTPUT, "attach output");
+    } else if (g_strcmp0(cmd, "remove_output") == 0) {
+        const gchar *uri = control_get_string(o, "uri");
+        Branch *br = uri ? stream_find_branch(st, BRANCH_OUTPUT, uri) : NULL;
+        if (!br) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no output '%s'", uri ? uri : "");
+            return FALSE;
+        }
+        glitch_begin(st, BRANCH_OUTPUT, "detach output");
+        stream_detach_branch(st, br);
+    } else if (g_strcmp0(cmd, "add_rendition") == 0) {
+        const gchar *name = control_get_string(o, "name");
+        const gchar *uri = control_get_string(o, "uri");
+        gint64 width = 0, height = 0, kbps = 0;
+        if (!name || !uri || !control_get_int(o, "width", &width) || !control_get_int(o, "height", &height) ||
+            width <= 0 || height <= 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                        "add_rendition needs \"name\", \"uri\", \"width\" and \"height\"");
+            return FALSE;
+        }
+        if (!control_get_int(o, "kbps", &kbps) || kbps <= 0) kbps = app->cfg->bitrate_kbps / 2;
+        if (!stream_attach_rendition(st, name, (gint)width, (gint)height, (gint)kbps, uri, error)) return FALSE;
+        glitch_begin(st, BRANCH_RENDITION, "attach rendition");
+    } else if (g_strcmp0(cmd, "remove_rendition") == 0) {
+        const gchar *name = control_get_string(o, "name");
+        Branch *br = name ? stream_find_branch(st, BRANCH_RENDITION, name) : NULL;
+        if (!br) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no rendition '%s'", name ? name : "");
+            return FALSE;
+        }
+        glitch_begin(st, BRANCH_RENDITION, "detach rendition");
+        stream_detach_branch(st, br);
+    } else if (g_strcmp0(cmd, "add_backup_source") == 0) {
+        const gchar *name = control_get_string(o, "ndi_name");
+        if (!name) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "add_backup_source needs \"ndi_name\"");
+            return FALSE;
+        }
+        if (!stream_attach_backup_source(st, name, error)) return FALSE;
+        glitch_begin(st, BRANCH_BACKUP_SOURCE, "attach backup source");
+    } else if (g_strcmp0(cmd, "remove_backup_source") == 0) {
+        Branch *br = stream_find_branch(st, BRANCH_BACKUP_SOURCE, NULL);
+        if (!br) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no backup source attached");
+            return FALSE;
+        }
+        glitch_begin(st, BRANCH_BACKUP_SOURCE, "detach backup source");
+        stream_detach_branch(st, br);
+    } else if (g_strcmp0(cmd, "select_source") == 0) {
+        const gchar *which = control_get_string(o, "source");
+        if (g_strcmp0(which, "primary") != 0 && g_strcmp0(which, "backup") != 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "select_source needs \"source\": primary|backup");
+            return FALSE;
+        }
+        if (!stream_select_source(st, g_strcmp0(which, "backup") == 0, error)) return FALSE;
+    } else if (g_strcmp0(cmd, "switch_source") == 0) {
+        const gchar *name = control_get_string(o, "ndi_name");
+        if (!name) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "switch_source needs \"ndi_name\"");
+            return FALSE;
+        }
+        // Only the receiver restarts; demux, encoder and outputs stay in PLAYING
+        gst_element_set_state(st->graph.ndisrc, GST_STATE_NULL);
+        stream_ndi_connect(st, name);
+        if (!gst_element_sync_state_with_parent(st->graph.ndisrc)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "failed to restart ndisrc");
+            return FALSE;
+        }
+        stream_ndi_connect_started(st);
+        glitch_begin(st, GLITCH_SOURCE_SWITCH, "switch primary source");
+        g_free(st->ndi_name);
+        st->ndi_name = g_strdup(name);
+    } else if (g_strcmp0(cmd, "set_sei") == 0) {
+        JsonNode *n = json_object_get_member(o, "enabled");
+        if (!n || !JSON_NODE_HOLDS_VALUE(n) || json_node_get_value_type(n) != G_TYPE_BOOLEAN) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "set_sei needs boolean \"enabled\"");
+            return FALSE;
+        }
+        if (!st->sei_cfg) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "SEI injector not installed");
+            return FALSE;
+        }
+        g_atomic_int_set(&st->sei_cfg->inject_sei, json_node_get_boolean(n) ? TRUE : FALSE);
+    } else if (g_strcmp0(cmd, "set_priority") == 0) {
+        gint64 priority = 0;
+        if (!control_get_int(o, "priority", &priority)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "set_priority needs \"priority\"");
+            return FALSE;
+        }
+        if (!st->governor) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "priorities need --governor");
+            return FALSE;
+        }
+        governor_set_priority(st->governor, (gint)CLAMP(priority, G_MININT, G_MAXINT));
+    } else if (g_strcmp0(cmd, "stats") == 0) {
+        control_add_stats(b, app);
+    } else if (g_strcmp0(cmd, "trace") == 0) {
+        gint64 seconds = 0;
+        if (!app->tracer) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "tracing needs --trace");
+            return FALSE;
+        }
+        control_get_int(o, "seconds", &seconds);
+        if (!trace_start(app->tracer, control_get_string(o, "path"), (guint)CLAMP(seconds, 0, TRACE_MAX_SECONDS), error)) {
+            return FALSE;
+        }
+        json_builder_set_member_name(b, "path");
+        json_builder_add_string_value(b, app->tracer->path);
+    } else if (g_strcmp0(cmd, "frame_stats") == 0) {
+        gint64 since = 0, max = FRAME_STATS_POLL_MAX;
+        gboolean have_since = control_get_int(o, "since", &since);
+        control_get_int(o, "max", &max);
+        frame_stats_poll(st->frame_stats, have_since ? &since : NULL, max, b);
+    } else if (g_strcmp0(cmd, "start_recording") == 0) {
+        const gchar *path = control_get_string(o, "path");
+        if (!path) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "start_recording needs \"path\"");
+            return FALSE;
+        }
+        if (stream_find_branch(st, BRANCH_RECORDING, NULL)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_BUSY, "a recording is already running");
+            return FALSE;
+        }
+        if (!stream_attach_output(st, path, TRUE, error)) return FALSE;
+        glitch_begin(st, BRANCH_RECORDING, "start recording");
+    } else if (g_strcmp0(cmd, "stop_recording") == 0) {
+        Branch *br = stream_find_branch(st, BRANCH_RECORDING, NULL);
+        if (!br) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no recording running");
+            return FALSE;
+        }
+        glitch_begin(st, BRANCH_RECORDING, "stop recording");
+        stream_detach_branch(st, br);
+    } else if (g_strcmp0(cmd, "state") != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "unknown command '%s'", cmd ? cmd : "");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Parse one request line and build the response line (without newline)
+static gchar* control_handle_line(App *app, const gchar *line) {
+    JsonBuilder *b = json_builder_new();
+    json_builder_begin_object(b);
+    JsonParser *parser = json_parser_new();
+    GError *err = NULL;
+    JsonObject *o = NULL;
+    if (json_parser_load_from_data(parser, line, -1, &err)) {
+        JsonNode *root = json_parser_get_root(parser);
+        if (root && JSON_NODE_HOLDS_OBJECT(root)) o = json_node_get_object(root);
+    }
+    if (!o && !err) {
+        g_set_error(&err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "request must be a JSON object");
+    }
+    const gchar *cmd = NULL;
+    if (o) {
+        JsonNode *id = json_object_get_member(o, "id");
+        if (id) {
+            json_builder_set_member_name(b, "id");
+            json_builder_add_value(b, json_node_copy(id));
+        }
+        cmd = control_get_string(o, "cmd");
+        json_builder_set_member_name(b, "cmd");
+        json_builder_add_string_value(b, cmd ? cmd : "");
+    }
+    gboolean ok = o && control_apply(app, cmd, o, b, &err);
+    json_builder_set_member_name(b, "ok");
+    json_builder_add_boolean_value(b, ok);
+    if (!ok) {
+        json_builder_set_member_name(b, "error");
+        json_builder_add_string_value(b, err ? err->message : "unknown error");
+    }
+    if (app->cfg->verbose) {
+        g_printerr("Control: %s -> %s\n", cmd ? cmd : "(invalid)", ok ? "ok" : (err ? err->message : "error"));
+    }
+    g_clear_error(&err);
+    control_add_state(b, app);
+    json_builder_end_object(b);
+
+    JsonGenerator *gen = json_generator_new();
+    JsonNode *resp = json_builder_get_root(b);
+    json_generator_set_root(gen, resp);
+    gchar *out = json_generator_to_data(gen, NULL);
+    json_node_unref(resp);
+    g_object_unref(gen);
+    g_object_unref(parser);
+    g_object_unref(b);
+    return out;
+}
+
+static void control_client_free(ControlClient *client) {
+    g_io_stream_close(G_IO_STREAM(client->conn), NULL, NULL);
+    g_string_free(client->in, TRUE);
+    g_object_unref(client->conn);
+    g_free(client->pending);
+    g_free(client);
+}
+
+static void control_write_cb(GObject *source, GAsyncResult *res, gpointer user_data) {
+    ControlClient *client = (ControlClient*)user_data;
+    GError *err = NULL;
+    gboolean ok = g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), res, NULL, &err);
+    g_clear_pointer(&client->pending, g_free);
+    if (!ok || client->closing) {
+        g_clear_error(&err);
+        control_client_free(client);
+        return;
+    }
+    control_read_next(client);
+}
+
+static void control_send(ControlClient *client, gchar *resp) {
+    client->pending = g_strconcat(resp, "\n", NULL);
+    g_free(resp);
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(client->conn));
+    g_output_stream_write_all_async(out, client->pending, strlen(client->pending),
+                                    G_PRIORITY_DEFAULT, NULL, control_write_cb, client);
+}
+
+static void control_read_cb(GObject *source, GAsyncResult *res, gpointer user_data) {
+    ControlClient *client = (ControlClient*)user_data;
+    GError *err = NULL;
+    gssize n = g_input_stream_read_finish(G_INPUT_STREAM(source), res, &err);
+    if (n <= 0) {
+        // EOF or error: client went away
+        g_clear_error(&err);
+        control_client_free(client);
+        return;
+    }
+    g_string_append_len(client->in, client->chunk, n);
+    control_read_next(client);
+}
+
+// Answer the next complete request line, or read more of it
+static void control_read_next(ControlClient *client) {
+    for (;;) {
+        const gchar *nl = memchr(client->in->str, '\n', client->in->len);
+        gsize len = nl ? (gsize)(nl - client->in->str) : client->in->len;
+        if (len > CONTROL_LINE_MAX) {
+            // A client that keeps sending without a newline would grow the
+            // buffer without bound
+            client->closing = TRUE;
+            control_send(client, g_strdup_printf("{\"ok\":false,\"error\":\"request line longer than %d bytes\"}",
+                                                 CONTROL_LINE_MAX));
+            return;
+        }
+        if (!nl) break;
+        gchar *line = g_strndup(client->in->str, len);
+        g_string_erase(client->in, 0, (gssize)len + 1);
+        g_strstrip(line);
+        if (line[0] == '\0') {
+            g_free(line);
+            continue;
+        }
+        gchar *resp = control_handle_line(client->app, line);
+        g_free(line);
+        control_send(client, resp);
+        return;
+    }
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(client->conn));
+    g_input_stream_read_async(in, client->chunk, sizeof(client->chunk), G_PRIORITY_DEFAULT, NULL,
+                              control_read_cb, client);
+}
+
+static gboolean control_incoming_cb(GSocketService *service, GSocketConnection *conn,
+                                    GObject *source_object, gpointer user_data) {
+    ControlClient *client = g_new0(ControlClient, 1);
+    client->app = (App*)user_data;
+    client->conn = g_object_ref(conn);
+    client->in = g_string_new(NULL);
+    control_read_next(client);
+    return TRUE;
+}
+
+static gboolean control_start(App *app, const gchar *path) {
+    unlink_stale_socket(path);
+    GSocketService *svc = g_socket_service_new();
+    GSocketAddress *addr = g_unix_socket_address_new(path);
+    GError *err = NULL;
+    gboolean ok = g_socket_listener_add_address(G_SOCKET_LISTENER(svc), addr, G_SOCKET_TYPE_STREAM,
+                                                G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &err);
+    g_object_unref(addr);
+    if (!ok) {
+        g_printerr("Failed to open control socket %s: %s\n", path, err ? err->message : "unknown error");
+        g_clear_error(&err);
+        g_object_unref(svc);
+        return FALSE;
+    }
+    g_signal_connect(svc, "incoming", G_CALLBACK(control_incoming_cb), app);
+    g_socket_service_start(svc);
+    app->control = svc;
+    g_printerr("Control socket listening on %s\n", path);
+    return TRUE;
+}
+
+static void control_stop(App *app, const gchar *path) {
+    if (!app->control) return;
+    g_socket_service_stop(app->control);
+    g_socket_listener_close(G_SOCKET_LISTENER(app->control));
+    g_object_unref(app->control);
+    app->control = NULL;
+    unlink_stale_socket(path);
+}
+
+int main(int argc, char **argv) {
+#ifdef NDI2SRT_SHM_RING
+    // --encoder-process starts this binary again as each stream's encoder;
+    // it sets up GStreamer on its own
+    if (argc == 2 && g_strcmp0(argv[1], "--encoder-worker") == 0) return encoder_worker_main();
+#endif
+    gint64 t_main_us = g_get_monotonic_time();
+    // The startup benchmark passes the exec time (CLOCK_REALTIME ns)
+    gint64 exec_to_main_us = -1;
+    const gchar *exec_ns = g_getenv("NDI2SRT_EXEC_NS");
+    if (exec_ns) exec_to_main_us = g_get_real_time() - g_ascii_strtoll(exec_ns, NULL, 10) / 1000;
+
+    init_gstreamer(&argc, &argv);
+    gint64 t_init_us = g_get_monotonic_time();
+
+    AppConfig cfg;
+    if (!parse_args(argc, argv, &cfg)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+#ifndef NDI2SRT_SHM_RING
+    if (cfg.encoder_process) {
+        g_printerr("Warning: --encoder-process is not supported on this platform, ignoring\n");
+        cfg.encoder_process = FALSE;
+    }
+#endif
+
+    // Handle discover mode
+    if (cfg.discover) {
+        discover_ndi_sources(cfg.ndi_cache);
+        return 0;
+    }
+    
+    // Build the graph programmatically; every stage keeps a typed handle and
+    // outputs/renditions/backup sources attach to its tees and selectors.
+    // Each source gets its own graph, all in one pipeline.
+    App app;
+    memset(&app, 0, sizeof(app));
+    app.cfg = &cfg;
+    app.started_us = g_get_monotonic_time();
+    app.t_main_us = t_main_us;
+    app.t_init_us = t_init_us;
+    app.exec_to_main_us = exec_to_main_us;
+    app.pipeline = gst_pipeline_new("ndi2srt");
+    app.streams = g_ptr_array_new_with_free_func((GDestroyNotify)stream_free);
+    if (cfg.trace_path) {
+        app.tracer = tracer_new(cfg.trace_path, cfg.trace_seconds);
+        g_unix_signal_add(SIGUSR1, trace_signal_cb, app.tracer);
+    }
+    resource_budget_apply(&app);
+    GError *err = NULL;
+    // --srt-uri/--stdout/--output belong to --ndi-name, or to the multiplex with --mpts
+    const gchar *primary_output = NULL;
+    guint first_output = 0;
+    if (cfg.ndi_name || cfg.mpts) {
+        primary_output = cfg.stdout_mode ? "stdout" : cfg.srt_uri;
+        if (!primary_output && cfg.outputs->len > 0) primary_output = g_ptr_array_index(cfg.outputs, first_output++);
+    }
+    gboolean built = !cfg.ndi_name || app_add_stream(&app, cfg.ndi_name, primary_output, &err);
+    for (guint i = 0; built && i < cfg.streams->len; ++i) {
+        gchar **spec = g_strsplit((const gchar*)g_ptr_array_index(cfg.streams, i), "=", 2);
+        // --mpts: the first source carries the outputs of the whole multiplex
+        const gchar *uri = cfg.mpts ? (app.streams->len == 0 ? primary_output : NULL) : spec[1];
+        built = app_add_stream(&app, spec[0], uri, &err) != NULL;
+        g_strfreev(spec);
+    }
+    for (guint i = first_output; built && i < cfg.outputs->len; ++i) {
+        built = stream_attach_output((Stream*)g_ptr_array_index(app.streams, 0),
+                                     g_ptr_array_index(cfg.outputs, i), FALSE, &err) != NULL;
+    }
+    if (built && cfg.dump_ts_path) {
+        built = stream_attach_output((Stream*)g_ptr_array_index(app.streams, 0), cfg.dump_ts_path, TRUE, &err) != NULL;
+    }
+    if (!built) {
+        g_printerr("Failed to build pipeline: %s\n", err ? err->message : "unknown error");
+        g_clear_error(&err);
+        g_ptr_array_unref(app.streams);
+        gst_object_unref(app.pipeline);
+        return 1;
+    }
+    GstElement *pipeline = app.pipeline;
+    if (!clock_setup(&app, &err)) {
+        g_printerr("Failed to set up clock: %s\n", err ? err->message : "unknown error");
+        g_clear_error(&err);
+        clock_teardown(&app);
+        g_ptr_array_unref(app.streams);
+        gst_object_unref(app.pipeline);
+        return 1;
+    }
+    // A control socket that was asked for and cannot be bound is fatal:
+    // whatever drives this process through it would be left talking to nothing
+    if (cfg.control_socket && !control_start(&app, cfg.control_socket)) {
+        clock_teardown(&app);
+        g_ptr_array_unref(app.streams);
+        gst_object_unref(app.pipeline);
+        return 1;
+    }
+    if (cfg.shm_ring) {
+#ifdef NDI2SRT_SHM_RING
+        if (!shm_ring_start(&app, &err)) {
+            g_printerr("Failed to set up --shm-ring: %s\n", err ? err->message : "unknown error");
+            g_clear_error(&err);
+        }
+#else
+        g_printerr("Warning: --shm-ring is not supported on this platform, ignoring\n");
+#endif
+    }
+    if (cfg.tc_sync) aligner_start(&app);
+    if (!frame_stats_start(&app, &err)) {
+        g_printerr("Failed to set up --frame-stats: %s\n", err ? err->message : "unknown error");
+        g_clear_error(&err);
+    }
+#ifdef __linux__
+    cpu_stats_start(&app);
+#else
+    if (cfg.cpu_stats_s > 0) g_printerr("Warning: --cpu-stats is not supported on this platform, ignoring\n");
+#endif
+    governor_start(&app);
+    app.t_graph_us = g_get_monotonic_time();
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    app.loop = loop;
+    GstBus *bus = gst_element_get_bus(pipeline);
+    gst_bus_add_watch(bus, bus_msg_cb, &app);
+    gst_object_unref(bus);
+
+    // Pause first to allow negotiation and install SEI probe
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+    for (guint i = 0; i < app.streams->len; ++i) {
+        stream_install_sei((Stream*)g_ptr_array_index(app.streams, i));
+    }
+
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    for (guint i = 0; i < app.streams->len; ++i) {
+        Stream *st = (Stream*)g_ptr_array_index(app.streams, i);
+        if (cfg.mpts) {
+            g_printerr("Running... NDI: %s -> MPTS program %u (%d kbps)\n", st->ndi_name, i + 1,
+                       mpts_program_kbps(&cfg, i));
+        } else {
+            g_printerr("Running... NDI: %s -> %s\n", st->ndi_name, st->output_uri);
+        }
+    }
+    if (cfg.timeout_seconds > 0) {
+        g_timeout_add_seconds(cfg.timeout_seconds, quit_loop_cb, loop);
+    }
+    g_main_loop_run(loop);
+
+    control_stop(&app, cfg.control_socket);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+    aligner_stop(&app);
+#ifdef NDI2SRT_SHM_RING
+    shm_ring_stop(&app);
+#endif
+    frame_stats_stop(&app);
+#ifdef __linux__
+    cpu_stats_stop(&app);
+#endif
+    governor_stop(&app);
+    g_ptr_array_unref(app.streams);
+    tracer_free(app.tracer);
     gst_object_unref(pipeline);
+    clock_teardown(&app);
     g_main_loop_unref(loop);
 
     g_free(cfg.ndi_name);
     g_free(cfg.encoder);
     g_free(cfg.audio_codec);
     if (cfg.timestamp_mode) g_free(cfg.timestamp_mode);
+    g_free(cfg.ingest_format);
     if (cfg.dump_ts_path) g_free(cfg.dump_ts_path);
+    if (cfg.control_socket) g_free(cfg.control_socket);
+    g_free(cfg.clock_spec);
+    g_free(cfg.shm_ring);
+    g_free(cfg.shm_ring_mode);
+    g_free(cfg.trace_path);
+    g_free(cfg.frame_stats_path);
+    g_free(cfg.ndi_cache);
+    g_ptr_array_unref(cfg.streams);
+    g_ptr_array_unref(cfg.outputs);
+    g_array_unref(cfg.mpts_weights);
+    g_array_unref(cfg.priorities);
     return 0;
 }
@@ -0,0 +1,361 @@
+// Shared-memory output ring, see shmring.h
+//
+// Layout of the memfd: one header page, one page holding the only word
+// readers write (the futex waiter count), then a power-of-two data area of
+// records. Readers map the header and the data read-only. The producer
+// publishes with two monotonic byte counters: `reserve` is raised before a
+// record's bytes are touched, `commit` after they are complete. A reader at
+// position p knows the bytes it reads are intact as long as
+// reserve <= p + data_size (seqlock-style check after the read), so readers
+// never block or slow down the producer.
+#define _GNU_SOURCE
+#include "shmring.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+
+#define SHMRING_PAGE_SIZE   4096u
+#define SHMRING_WAIT_OFFSET SHMRING_PAGE_SIZE
+#define SHMRING_HEADER_SIZE (2 * SHMRING_PAGE_SIZE)
+
+typedef struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t mode;
+    uint32_t header_size;       // offset of the data area in the memfd
+    uint64_t data_size;         // power of two
+    _Atomic uint32_t fps_n;     // AU mode timecode rate
+    _Atomic uint32_t fps_d;
+    _Atomic uint64_t reserve;   // bytes claimed by the producer
+    _Atomic uint64_t commit;    // bytes published
+    _Atomic uint64_t last_record; // position of the newest published record
+    _Atomic uint32_t notify;    // futex word, bumped on every publish
+} ShmRingHeader;
+
+// Second page, written by readers
+typedef struct ShmRingWait {
+    _Atomic uint32_t waiters;   // readers sleeping on notify
+} ShmRingWait;
+
+_Static_assert(sizeof(ShmRingHeader) <= SHMRING_PAGE_SIZE, "ring header must fit its page");
+_Static_assert(sizeof(ShmRingRecord) % 8 == 0, "records must stay 8-byte aligned");
+
+struct ShmRingProducer {
+    int fd;
+    ShmRingHeader *hdr;
+    ShmRingWait *wait;
+    uint8_t *data;
+    uint64_t size;              // data area; never read back from the shared header
+    uint64_t mask;
+    uint64_t pos;               // == hdr->commit
+    uint64_t seq;
+};
+
+struct ShmRingReader {
+    int fd;
+    const ShmRingHeader *hdr;   // read-only
+    ShmRingWait *wait;          // read-write
+    const uint8_t *data;        // read-only
+    uint64_t size;
+    uint64_t mask;
+    uint64_t pos;               // next record to read
+    uint64_t cur;               // record handed out by next()
+    uint64_t cur_end;
+    uint64_t next_seq;          // expected sequence number
+    int have_seq;
+    ShmRingRecord rec;          // stable copy of the current record header
+};
+
+static inline uint64_t align8(uint64_t v) {
+    return (v + 7u) & ~(uint64_t)7u;
+}
+
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, (uint32_t*)addr, op, val, timeout, NULL, 0);
+}
+
+ShmRingProducer* shmring_producer_new(uint64_t data_size, ShmRingMode mode) {
+    uint64_t size = 1u << 16;
+    while (size < data_size) size <<= 1;
+
+    int fd = memfd_create("ndi2srt-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, (off_t)(SHMRING_HEADER_SIZE + size)) < 0) {
+        close(fd);
+        return NULL;
+    }
+    // Readers map the same file; make sure nobody can resize it under them
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    void *map = mmap(NULL, SHMRING_HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    ShmRingProducer *p = calloc(1, sizeof(*p));
+    p->fd = fd;
+    p->hdr = (ShmRingHeader*)map;
+    p->wait = (ShmRingWait*)((uint8_t*)map + SHMRING_WAIT_OFFSET);
+    p->data = (uint8_t*)map + SHMRING_HEADER_SIZE;
+    p->size = size;
+    p->mask = size - 1;
+    p->hdr->version = SHMRING_VERSION;
+    p->hdr->mode = (uint32_t)mode;
+    p->hdr->header_size = SHMRING_HEADER_SIZE;
+    p->hdr->data_size = size;
+    atomic_store_explicit(&p->hdr->fps_d, 1, memory_order_relaxed);
+    // Magic last: a reader never sees a half-initialised header
+    atomic_thread_fence(memory_order_release);
+    p->hdr->magic = SHMRING_MAGIC;
+    return p;
+}
+
+void shmring_producer_free(ShmRingProducer *p) {
+    if (!p) return;
+    munmap(p->hdr, SHMRING_HEADER_SIZE + p->size);
+    close(p->fd);
+    free(p);
+}
+
+int shmring_producer_fd(const ShmRingProducer *p) {
+    return p->fd;
+}
+
+void shmring_producer_set_rate(ShmRingProducer *p, uint32_t fps_n, uint32_t fps_d) {
+    atomic_store_explicit(&p->hdr->fps_n, fps_n, memory_order_relaxed);
+    atomic_store_explicit(&p->hdr->fps_d, fps_d ? fps_d : 1, memory_order_relaxed);
+}
+
+int shmring_producer_write(ShmRingProducer *p, const ShmRingRecord *meta, const void *data, size_t size) {
+    ShmRingHeader *h = p->hdr;
+    uint64_t need = align8(sizeof(ShmRingRecord) + size);
+    if (need > p->size / 2) return -1;
+
+    // Records never wrap: fill the tail of the ring and start over at 0
+    uint64_t off = p->pos & p->mask;
+    uint64_t pad = off + need > p->size ? p->size - off : 0;
+    uint64_t at = p->pos + pad;
+    atomic_store_explicit(&h->reserve, at + need, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (pad >= sizeof(ShmRingRecord)) {
+        ShmRingRecord *filler = (ShmRingRecord*)(p->data + off);
+        memset(filler, 0, sizeof(*filler));
+        filler->size = (uint32_t)(pad - sizeof(ShmRingRecord));
+        filler->flags = SHMRING_FLAG_PAD;
+    }
+    ShmRingRecord *rec = (ShmRingRecord*)(p->data + (at & p->mask));
+    *rec = *meta;
+    rec->size = (uint32_t)size;
+    rec->flags &= ~SHMRING_FLAG_PAD;
+    rec->seq = p->seq++;
+    memcpy(rec + 1, data, size);
+
+    p->pos = at + need;
+    atomic_store_explicit(&h->last_record, at, memory_order_release);
+    atomic_store_explicit(&h->commit, p->pos, memory_order_release);
+    atomic_fetch_add_explicit(&h->notify, 1, memory_order_release);
+    if (atomic_load_explicit(&p->wait->waiters, memory_order_acquire) > 0) {
+        futex(&h->notify, FUTEX_WAKE, INT_MAX, NULL);
+    }
+    return 0;
+}
+
+// Receive the memfd the producer sends right after accepting the connection
+static int recv_fd(int sock) {
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        if (n == 0) errno = ECONNRESET;
+        return -1;
+    }
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c), sizeof(fd));
+            return fd;
+        }
+    }
+    errno = EPROTO;
+    return -1;
+}
+
+ShmRingReader* shmring_reader_open(const char *socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return NULL;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int e = errno;
+        close(sock);
+        errno = e;
+        return NULL;
+    }
+    int fd = recv_fd(sock);
+    int e = errno;
+    close(sock);
+    if (fd < 0) {
+        errno = e;
+        return NULL;
+    }
+    return shmring_reader_open_fd(fd);
+}
+
+ShmRingReader* shmring_reader_open_fd(int fd) {
+    struct stat st;
+    const ShmRingHeader *hdr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > SHMRING_HEADER_SIZE) {
+        hdr = mmap(NULL, SHMRING_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    uint64_t size = hdr != MAP_FAILED ? hdr->data_size : 0;
+    if (hdr == MAP_FAILED || hdr->magic != SHMRING_MAGIC || hdr->version != SHMRING_VERSION ||
+        hdr->header_size != SHMRING_HEADER_SIZE || size < 2 || (size & (size - 1)) != 0 ||
+        (uint64_t)st.st_size != SHMRING_HEADER_SIZE + size) {
+        if (hdr != MAP_FAILED) munmap((void*)hdr, SHMRING_PAGE_SIZE);
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    ShmRingWait *wait = mmap(NULL, SHMRING_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, SHMRING_WAIT_OFFSET);
+    const uint8_t *data = wait == MAP_FAILED ? MAP_FAILED :
+        mmap(NULL, size, PROT_READ, MAP_SHARED, fd, SHMRING_HEADER_SIZE);
+    if (data == MAP_FAILED) {
+        int e = errno;
+        if (wait != MAP_FAILED) munmap(wait, SHMRING_PAGE_SIZE);
+        munmap((void*)hdr, SHMRING_PAGE_SIZE);
+        close(fd);
+        errno = e;
+        return NULL;
+    }
+
+    ShmRingReader *r = calloc(1, sizeof(*r));
+    r->fd = fd;
+    r->hdr = hdr;
+    r->wait = wait;
+    r->data = data;
+    r->size = size;
+    r->mask = size - 1;
+    // Join live: start at the newest record
+    if (atomic_load_explicit(&hdr->commit, memory_order_acquire) > 0) {
+        r->pos = atomic_load_explicit(&hdr->last_record, memory_order_acquire);
+    }
+    return r;
+}
+
+void shmring_reader_close(ShmRingReader *r) {
+    if (!r) return;
+    munmap((void*)r->data, r->size);
+    munmap(r->wait, SHMRING_PAGE_SIZE);
+    munmap((void*)r->hdr, SHMRING_PAGE_SIZE);
+    close(r->fd);
+    free(r);
+}
+
+ShmRingMode shmring_reader_mode(const ShmRingReader *r) {
+    return (ShmRingMode)r->hdr->mode;
+}
+
+void shmring_reader_rate(const ShmRingReader *r, uint32_t *fps_n, uint32_t *fps_d) {
+    *fps_n = atomic_load_explicit(&r->hdr->fps_n, memory_order_relaxed);
+    *fps_d = atomic_load_explicit(&r->hdr->fps_d, memory_order_relaxed);
+}
+
+// Have the bytes from pos on been (or being) overwritten?
+static inline int overrun(const ShmRingReader *r, uint64_t pos) {
+    return atomic_load_explicit(&r->hdr->reserve, memory_order_acquire) > pos + r->size;
+}
+
+int shmring_reader_next(ShmRingReader *r, const ShmRingRecord **rec, const uint8_t **data, uint64_t *lost) {
+    uint64_t size = r->size;
+    *lost = 0;
+    for (;;) {
+        uint64_t commit = atomic_load_explicit(&r->hdr->commit, memory_order_acquire);
+        if (r->pos >= commit) return 0;
+        if (overrun(r, r->pos)) {
+            // Too slow: jump to the newest record, the seq gap is the loss
+            r->pos = atomic_load_explicit(&r->hdr->last_record, memory_order_acquire);
+            continue;
+        }
+        uint64_t off = r->pos & r->mask;
+        uint64_t room = size - off;
+        if (room < sizeof(ShmRingRecord)) {
+            r->pos += room;
+            continue;
+        }
+        ShmRingRecord hdr;
+        memcpy(&hdr, r->data + off, sizeof(hdr));
+        atomic_thread_fence(memory_order_acquire);
+        if (overrun(r, r->pos)) continue;
+        if (hdr.flags & SHMRING_FLAG_PAD) {
+            r->pos += room;
+            continue;
+        }
+        uint64_t len = align8(sizeof(ShmRingRecord) + hdr.size);
+        if (len > room) {
+            // Cannot happen for an intact record; resynchronise
+            r->pos = atomic_load_explicit(&r->hdr->last_record, memory_order_acquire);
+            continue;
+        }
+        if (r->have_seq && hdr.seq > r->next_seq) *lost += hdr.seq - r->next_seq;
+        r->rec = hdr;
+        r->cur = r->pos;
+        r->cur_end = r->pos + len;
+        *rec = &r->rec;
+        *data = r->data + off + sizeof(ShmRingRecord);
+        return 1;
+    }
+}
+
+int shmring_reader_release(ShmRingReader *r) {
+    atomic_thread_fence(memory_order_acquire);
+    int intact = !overrun(r, r->cur);
+    // An overwritten record counts as lost on the next call
+    r->next_seq = intact ? r->rec.seq + 1 : r->rec.seq;
+    r->have_seq = 1;
+    r->pos = r->cur_end;
+    return intact;
+}
+
+void shmring_reader_wait(ShmRingReader *r, int timeout_ms) {
+    const ShmRingHeader *h = r->hdr;
+    uint32_t seen = atomic_load_explicit(&h->notify, memory_order_acquire);
+    if (atomic_load_explicit(&h->commit, memory_order_acquire) > r->pos) return;
+    struct timespec ts, *tsp = NULL;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    atomic_fetch_add_explicit(&r->wait->waiters, 1, memory_order_acq_rel);
+    futex((_Atomic uint32_t*)&h->notify, FUTEX_WAIT, seen, tsp);
+    atomic_fetch_sub_explicit(&r->wait->waiters, 1, memory_order_acq_rel);
+}
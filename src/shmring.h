@@ -0,0 +1,78 @@
+// Shared-memory output ring: one producer (ndi2srt), any number of local
+// readers. The ring lives in a memfd that readers receive over a UNIX socket
+// (SCM_RIGHTS) and map read-only; records are read in place, without copies.
+//
+// The producer never waits for readers. A reader that falls more than the
+// ring size behind is overrun: shmring_reader_release() tells it the record
+// it just used was overwritten, and the next shmring_reader_next() resumes
+// at the newest record and reports how many records were lost.
+//
+// Linux only (memfd, futex). No dependencies besides libc.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHMRING_MAGIC   0x4e445352u  // "NDSR"
+#define SHMRING_VERSION 2u
+
+typedef enum {
+    SHMRING_MODE_TS = 1,        // MPEG-TS chunks as they leave the muxer
+    SHMRING_MODE_AU = 2         // H.264 Annex B access units (with timecode SEI)
+} ShmRingMode;
+
+#define SHMRING_FLAG_PAD       (1u << 0)  // filler up to the end of the ring, skip
+#define SHMRING_FLAG_KEYFRAME  (1u << 1)  // AU mode: IDR access unit
+#define SHMRING_FLAG_DISCONT   (1u << 2)  // producer-side discontinuity
+
+#define SHMRING_TIME_NONE      UINT64_MAX
+
+// Precedes every payload; records are 8-byte aligned and never wrap
+typedef struct ShmRingRecord {
+    uint32_t size;              // payload bytes following this header
+    uint32_t flags;             // SHMRING_FLAG_*
+    uint64_t seq;               // record number, from 0
+    uint64_t pts;               // ns, SHMRING_TIME_NONE if unknown
+    uint64_t dts;
+    int64_t timecode;           // AU mode: frames since daily jam, -1 if none
+} ShmRingRecord;
+
+typedef struct ShmRingProducer ShmRingProducer;
+typedef struct ShmRingReader ShmRingReader;
+
+// Producer. data_size is rounded up to a power of two.
+ShmRingProducer* shmring_producer_new(uint64_t data_size, ShmRingMode mode);
+void shmring_producer_free(ShmRingProducer *p);
+// memfd to hand to readers (owned by the producer)
+int shmring_producer_fd(const ShmRingProducer *p);
+// Frame rate of the AU timecodes, published in the ring header
+void shmring_producer_set_rate(ShmRingProducer *p, uint32_t fps_n, uint32_t fps_d);
+// Publish one record; returns 0, or -1 if it can never fit (larger than half the ring)
+int shmring_producer_write(ShmRingProducer *p, const ShmRingRecord *meta, const void *data, size_t size);
+
+// Reader. Connects to the producer's socket, receives and maps the ring.
+// Returns NULL with errno set on failure.
+ShmRingReader* shmring_reader_open(const char *socket_path);
+// Same with a ring memfd received some other way; takes ownership of fd,
+// also on failure
+ShmRingReader* shmring_reader_open_fd(int fd);
+void shmring_reader_close(ShmRingReader *r);
+ShmRingMode shmring_reader_mode(const ShmRingReader *r);
+void shmring_reader_rate(const ShmRingReader *r, uint32_t *fps_n, uint32_t *fps_d);
+// Point *rec and *data at the next record (valid until shmring_reader_release()).
+// Returns 1 on success, 0 if nothing new was published. *lost receives the
+// number of records skipped because this reader was overrun.
+int shmring_reader_next(ShmRingReader *r, const ShmRingRecord **rec, const uint8_t **data, uint64_t *lost);
+// Done with the record from shmring_reader_next(). Returns 1 if it was intact
+// all along, 0 if the producer overwrote it meanwhile (discard what was read).
+int shmring_reader_release(ShmRingReader *r);
+// Block until something new is published or timeout_ms passes (-1 = forever)
+void shmring_reader_wait(ShmRingReader *r, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
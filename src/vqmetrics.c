@@ -0,0 +1,70 @@
+// Objective video quality metrics, see vqmetrics.h
+#include "vqmetrics.h"
+
+#include <math.h>
+
+uint64_t vq_plane_sse(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int w, int h) {
+    uint64_t sse = 0;
+    for (int y = 0; y < h; ++y) {
+        const uint8_t *restrict ra = a + (intptr_t)y * a_stride;
+        const uint8_t *restrict rb = b + (intptr_t)y * b_stride;
+        // Per-row 32-bit sum: at most 65025 * w, fits for any w < 66000
+        uint32_t row = 0;
+        for (int x = 0; x < w; ++x) {
+            int d = (int)ra[x] - (int)rb[x];
+            row += (uint32_t)(d * d);
+        }
+        sse += row;
+    }
+    return sse;
+}
+
+double vq_psnr(uint64_t sse, uint64_t samples) {
+    if (samples == 0) return 0.0;
+    if (sse == 0) return 100.0;
+    double mse = (double)sse / (double)samples;
+    double psnr = 10.0 * log10(255.0 * 255.0 / mse);
+    return psnr > 100.0 ? 100.0 : psnr;
+}
+
+// Sums over one 8x8 block: s_a, s_b, s_aa, s_bb, s_ab
+static void vq_block_sums(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, uint32_t sums[5]) {
+    uint32_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+    for (int y = 0; y < 8; ++y) {
+        const uint8_t *restrict ra = a + (intptr_t)y * a_stride;
+        const uint8_t *restrict rb = b + (intptr_t)y * b_stride;
+        for (int x = 0; x < 8; ++x) {
+            uint32_t va = ra[x], vb = rb[x];
+            sa += va;
+            sb += vb;
+            saa += va * va;
+            sbb += vb * vb;
+            sab += va * vb;
+        }
+    }
+    sums[0] = sa;
+    sums[1] = sb;
+    sums[2] = saa;
+    sums[3] = sbb;
+    sums[4] = sab;
+}
+
+double vq_plane_ssim(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int w, int h) {
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    double total = 0.0;
+    int blocks = 0;
+    for (int y = 0; y + 8 <= h; y += 8) {
+        for (int x = 0; x + 8 <= w; x += 8) {
+            uint32_t s[5];
+            vq_block_sums(a + (intptr_t)y * a_stride + x, a_stride, b + (intptr_t)y * b_stride + x, b_stride, s);
+            double ma = s[0] / 64.0, mb = s[1] / 64.0;
+            double va = s[2] / 64.0 - ma * ma;
+            double vb = s[3] / 64.0 - mb * mb;
+            double cov = s[4] / 64.0 - ma * mb;
+            total += ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+            blocks++;
+        }
+    }
+    return blocks ? total / blocks : 1.0;
+}
@@ -0,0 +1,27 @@
+// Objective video quality metrics over 8-bit planes (PSNR, SSIM).
+//
+// Plain C kernels written for auto-vectorization: fixed-width inner loops
+// over rows with integer accumulators, no branches. The build compiles this
+// file with -O3, where GCC and Clang turn them into SSE2/AVX2/NEON code.
+// No dependencies besides libc.
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sum of squared differences of a w x h plane
+uint64_t vq_plane_sse(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int w, int h);
+
+// PSNR in dB for a sum of squared differences over `samples` 8-bit values
+// (capped at 100 dB for identical planes)
+double vq_psnr(uint64_t sse, uint64_t samples);
+
+// Mean SSIM over non-overlapping 8x8 blocks (partial edge blocks ignored)
+double vq_plane_ssim(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int w, int h);
+
+#ifdef __cplusplus
+}
+#endif